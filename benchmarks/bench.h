@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bench_h__
+#define INCLUDE_bench_h__
+
+#include "common.h"
+#include "git2.h"
+
+/**
+ * Benchmarks are linked against the library sources, like the clar
+ * suite, so they can time internal functions directly.
+ *
+ * Every suite prints one tab-separated line per measurement:
+ *
+ *	suite	case	ops	bytes	seconds
+ *
+ * Lines starting with '#' are comments, so the output can be fed to
+ * any TSV-aware tool and compared between builds.
+ */
+
+typedef int (*bench_fn)(int argc, char **argv);
+
+/* Current time in seconds, from a monotonic clock */
+extern double bench_now(void);
+
+extern void bench_report(
+	const char *suite, const char *name,
+	size_t ops, size_t bytes, double seconds);
+
+/* Print the last libgit2 error and return -1 */
+extern int bench_error(const char *what);
+
+extern int bench_delta(int argc, char **argv);
+extern int bench_merge_base(int argc, char **argv);
+extern int bench_pack_lookup(int argc, char **argv);
+extern int bench_revwalk(int argc, char **argv);
+
+#endif
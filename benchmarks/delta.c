@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bench.h"
+#include "delta.h"
+#include "vector.h"
+
+/*
+ * Delta throughput on the blobs of a real repository.
+ *
+ * Blobs are sorted by size, as the packbuilder roughly does, and every
+ * blob is deltified against the WINDOW blobs preceding it. The same
+ * work is done twice: once rebuilding the source index for every pair
+ * (what `git_delta` does) and once reusing one index per source (what
+ * the packbuilder's delta window and index cache do).
+ */
+
+#define WINDOW 10
+
+struct blob {
+	void *data;
+	unsigned long size;
+};
+
+struct collect {
+	git_odb *odb;
+	git_vector blobs;
+	size_t max;
+	int error;
+};
+
+static int collect_cb(git_oid *oid, void *payload)
+{
+	struct collect *c = payload;
+	git_odb_object *obj;
+	struct blob *b;
+
+	if (c->blobs.length >= c->max)
+		return 1;
+
+	if (git_odb_read(&obj, c->odb, oid) < 0) {
+		c->error = -1;
+		return 1;
+	}
+
+	/* same limits as prepare_pack() */
+	if (git_odb_object_type(obj) != GIT_OBJ_BLOB ||
+	    git_odb_object_size(obj) < 50) {
+		git_odb_object_free(obj);
+		return 0;
+	}
+
+	b = git__malloc(sizeof(*b));
+	GITERR_CHECK_ALLOC(b);
+	b->size = (unsigned long)git_odb_object_size(obj);
+	b->data = git__malloc(b->size);
+	GITERR_CHECK_ALLOC(b->data);
+	memcpy(b->data, git_odb_object_data(obj), b->size);
+	git_odb_object_free(obj);
+
+	return git_vector_insert(&c->blobs, b);
+}
+
+static int blob_size_cmp(const void *a, const void *b)
+{
+	const struct blob *ba = a, *bb = b;
+	return (ba->size > bb->size) - (ba->size < bb->size);
+}
+
+static void run_rebuild(git_vector *blobs)
+{
+	struct blob *src, *trg;
+	unsigned long delta_size;
+	size_t i, j, ops = 0, bytes = 0;
+	double start = bench_now();
+
+	for (i = 1; i < blobs->length; ++i) {
+		trg = git_vector_get(blobs, i);
+
+		for (j = i > WINDOW ? i - WINDOW : 0; j < i; ++j) {
+			src = git_vector_get(blobs, j);
+			git__free(git_delta(src->data, src->size,
+				trg->data, trg->size, &delta_size, trg->size / 2));
+			ops++;
+			bytes += trg->size;
+		}
+	}
+
+	bench_report("delta", "rebuild_index", ops, bytes, bench_now() - start);
+}
+
+static void run_reuse(git_vector *blobs)
+{
+	struct git_delta_index *window[WINDOW];
+	struct blob *trg;
+	unsigned long delta_size;
+	size_t i, j, ops = 0, bytes = 0, indexed = 0;
+	double start, index_time = 0, delta_time = 0;
+
+	memset(window, 0, sizeof(window));
+
+	for (i = 0; i < blobs->length; ++i) {
+		trg = git_vector_get(blobs, i);
+
+		start = bench_now();
+		for (j = i > WINDOW ? i - WINDOW : 0; j < i; ++j) {
+			git__free(git_delta_create(window[j % WINDOW],
+				trg->data, trg->size, &delta_size, trg->size / 2));
+			ops++;
+			bytes += trg->size;
+		}
+		delta_time += bench_now() - start;
+
+		/* the target becomes a source for the next blobs */
+		start = bench_now();
+		git_delta_free_index(window[i % WINDOW]);
+		window[i % WINDOW] = git_delta_create_index(trg->data, trg->size);
+		index_time += bench_now() - start;
+		indexed += trg->size;
+	}
+
+	for (j = 0; j < WINDOW; ++j)
+		git_delta_free_index(window[j]);
+
+	bench_report("delta", "create_index", blobs->length, indexed, index_time);
+	bench_report("delta", "reuse_index", ops, bytes, delta_time + index_time);
+}
+
+int bench_delta(int argc, char **argv)
+{
+	git_repository *repo;
+	struct collect c;
+	struct blob *b;
+	unsigned int i;
+	int error;
+
+	memset(&c, 0, sizeof(c));
+	c.max = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 2000;
+
+	if (git_repository_open(&repo, argc > 0 ? argv[0] : ".") < 0)
+		return bench_error("open");
+
+	if (git_repository_odb(&c.odb, repo) < 0 ||
+	    git_vector_init(&c.blobs, 1024, blob_size_cmp) < 0) {
+		git_repository_free(repo);
+		return bench_error("odb");
+	}
+
+	/* the callback stops the iteration early once enough were read */
+	error = git_odb_foreach(c.odb, collect_cb, &c);
+	if (error == GIT_EUSER)
+		error = c.error;
+
+	if (!error) {
+		git_vector_sort(&c.blobs);
+		printf("# %lu blobs, window %d\n",
+			(unsigned long)c.blobs.length, WINDOW);
+
+		run_rebuild(&c.blobs);
+		run_reuse(&c.blobs);
+	} else
+		bench_error("collect");
+
+	git_vector_foreach(&c.blobs, i, b) {
+		git__free(b->data);
+		git__free(b);
+	}
+	git_vector_free(&c.blobs);
+	git_odb_free(c.odb);
+	git_repository_free(repo);
+
+	return error;
+}
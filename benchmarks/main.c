@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bench.h"
+
+#ifndef GIT_WIN32
+# include <time.h>
+# include <sys/time.h>
+#endif
+
+static const struct {
+	const char *name;
+	bench_fn fn;
+	const char *usage;
+} suites[] = {
+	{ "delta", bench_delta, "[repo] [max-blobs]" },
+	{ "merge_base", bench_merge_base, "[width] [depth]" },
+	{ "pack_lookup", bench_pack_lookup, "[objects] [lookups]" },
+	{ "revwalk", bench_revwalk, "[commits] [shape]" },
+};
+
+double bench_now(void)
+{
+#ifdef GIT_WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / (double)freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+void bench_report(
+	const char *suite, const char *name,
+	size_t ops, size_t bytes, double seconds)
+{
+	printf("%s\t%s\t%lu\t%lu\t%.6f\n", suite, name,
+		(unsigned long)ops, (unsigned long)bytes, seconds);
+	fflush(stdout);
+}
+
+int bench_error(const char *what)
+{
+	const git_error *err = giterr_last();
+
+	fprintf(stderr, "%s: %s\n", what, err ? err->message : "unknown error");
+	return -1;
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr, "usage: %s <suite> [args...]\n\nsuites:\n", prog);
+	for (i = 0; i < ARRAY_SIZE(suites); ++i)
+		fprintf(stderr, "\t%s %s\n", suites[i].name, suites[i].usage);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int error;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	git_threads_init();
+
+	for (i = 0; i < ARRAY_SIZE(suites); ++i) {
+		if (strcmp(argv[1], suites[i].name) != 0)
+			continue;
+
+		printf("# suite\tcase\tops\tbytes\tseconds\n");
+		error = suites[i].fn(argc - 2, argv + 2);
+
+		git_threads_shutdown();
+		return error < 0 ? 1 : 0;
+	}
+
+	git_threads_shutdown();
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bench.h"
+#include "commit_graph.h"
+#include "fileops.h"
+#include "git2/odb_backend.h"
+
+/*
+ * Merge base of two octopus merges over a wide history.
+ *
+ * `width` lanes of `depth` commits each grow from a single root, next
+ * to one more lane of the same length. The first tip merges the heads
+ * of every lane; the second merges the commits just below the heads of
+ * all but the extra lane. Every lane but the extra one goes STALE right
+ * away, and the walk then carries about `width` stale commits in its
+ * queue for as long as the extra lane lasts:
+ *
+ *	octopus		git_merge_base() from the objects
+ *	octopus_graph	the same, with a commit-graph written first
+ */
+
+#define DEFAULT_WIDTH 4000
+#define DEFAULT_DEPTH 50
+#define ROUNDS 3
+
+struct octopus {
+	git_odb *odb;
+	git_oid tree;
+	git_buf buf;
+	git_time_t time;
+};
+
+static int write_commit(
+	git_oid *out, struct octopus *o,
+	const git_oid *parents, size_t n, git_time_t time, size_t lane)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t i;
+
+	git_buf_clear(&o->buf);
+	git_buf_printf(&o->buf, "tree %s\n", git_oid_tostr(hex, sizeof(hex), &o->tree));
+	for (i = 0; i < n; ++i)
+		git_buf_printf(&o->buf, "parent %s\n",
+			git_oid_tostr(hex, sizeof(hex), &parents[i]));
+	git_buf_printf(&o->buf,
+		"author Bench <bench@example.com> %ld +0000\n"
+		"committer Bench <bench@example.com> %ld +0000\n\nlane %lu\n",
+		(long)time, (long)time, (unsigned long)lane);
+
+	if (git_buf_oom(&o->buf))
+		return -1;
+
+	return git_odb_write(out, o->odb, o->buf.ptr, o->buf.size, GIT_OBJ_COMMIT);
+}
+
+static int write_history(
+	git_oid *one, git_oid *two, const char *objects_dir,
+	size_t width, size_t depth)
+{
+	struct octopus o;
+	git_odb_backend *writer;
+	git_oid root, *heads = NULL, *below = NULL;
+	size_t lane, d;
+	int error = -1;
+
+	memset(&o, 0x0, sizeof(o));
+	o.time = 1234567890;
+
+	heads = git__calloc(width + 1, sizeof(git_oid));
+	below = git__calloc(width + 1, sizeof(git_oid));
+	if (!heads || !below)
+		goto done;
+
+	if (git_odb_open(&o.odb, objects_dir) < 0 ||
+		git_odb_backend_pack_writer(&writer, objects_dir) < 0 ||
+		git_odb_add_backend(o.odb, writer, 3) < 0 ||
+		git_odb_write(&o.tree, o.odb, "", 0, GIT_OBJ_TREE) < 0 ||
+		write_commit(&root, &o, NULL, 0, o.time, 0) < 0)
+		goto done;
+
+	for (lane = 0; lane <= width; ++lane)
+		git_oid_cpy(&heads[lane], &root);
+
+	/* one level at a time, so commit times and depths agree */
+	for (d = 1; d <= depth; ++d) {
+		for (lane = 0; lane <= width; ++lane) {
+			git_oid_cpy(&below[lane], &heads[lane]);
+			if (write_commit(&heads[lane], &o,
+					&below[lane], 1, o.time + d * 60, lane) < 0)
+				goto done;
+		}
+	}
+
+	if (write_commit(one, &o, heads, width + 1, o.time + (depth + 1) * 60, 0) < 0 ||
+		write_commit(two, &o, below, width, o.time + (depth + 1) * 60, 1) < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	/* flushes the pack */
+	git_odb_free(o.odb);
+	git_buf_free(&o.buf);
+	git__free(heads);
+	git__free(below);
+	return error;
+}
+
+static int run_merge_base(
+	const char *name, git_repository *repo,
+	const git_oid *one, git_commit *two)
+{
+	git_oid base;
+	double start = bench_now();
+	unsigned int i, n;
+
+	for (i = 0; i < ROUNDS; ++i)
+		if (git_merge_base(&base, repo, one, git_commit_id(two)) < 0)
+			return bench_error(name);
+
+	bench_report("merge_base", name, ROUNDS, 0, bench_now() - start);
+
+	/* any lane will do, but it has to be one of them */
+	for (n = 0; n < git_commit_parentcount(two); ++n)
+		if (git_oid_cmp(&base, git_commit_parent_oid(two, n)) == 0)
+			return 0;
+
+	fprintf(stderr, "%s: wrong merge base\n", name);
+	return -1;
+}
+
+static int create_ref(git_repository *repo, const char *name, const git_oid *id)
+{
+	git_reference *ref;
+
+	if (git_reference_create_oid(&ref, repo, name, id, 1) < 0)
+		return -1;
+
+	git_reference_free(ref);
+	return 0;
+}
+
+int bench_merge_base(int argc, char **argv)
+{
+	const char *dir = "bench-merge-base";
+	size_t width = DEFAULT_WIDTH, depth = DEFAULT_DEPTH;
+	git_repository *repo = NULL;
+	git_buf objects = GIT_BUF_INIT;
+	git_commit *two = NULL;
+	git_oid one_id, two_id;
+	int error = -1;
+
+	if (argc > 0)
+		width = strtoul(argv[0], NULL, 10);
+	if (argc > 1)
+		depth = strtoul(argv[1], NULL, 10);
+	if (width < 2 || depth < 2) {
+		fprintf(stderr, "merge_base: width and depth must be at least 2\n");
+		return -1;
+	}
+
+	printf("# %lu lanes of %lu commits\n", (unsigned long)width, (unsigned long)depth);
+
+	if (git_repository_init(&repo, dir, 1) < 0 ||
+		git_buf_joinpath(&objects, git_repository_path(repo), "objects") < 0 ||
+		write_history(&one_id, &two_id, objects.ptr, width, depth) < 0)
+		goto fail;
+
+	/* the pack was written behind the repository's back */
+	git_repository_free(repo);
+	if (git_repository_open(&repo, dir) < 0 ||
+		git_commit_lookup(&two, repo, &two_id) < 0)
+		goto fail;
+
+	if (run_merge_base("octopus", repo, &one_id, two) < 0)
+		goto done;
+
+	if (create_ref(repo, "refs/heads/one", &one_id) < 0 ||
+		create_ref(repo, "refs/heads/two", &two_id) < 0 ||
+		git_commit_graph_write(repo, 0) < 0)
+		goto fail;
+
+	if (run_merge_base("octopus_graph", repo, &one_id, two) < 0)
+		goto done;
+
+	error = 0;
+	goto done;
+
+fail:
+	error = bench_error("merge_base");
+done:
+	git_commit_free(two);
+	git_repository_free(repo);
+	git_futils_rmdir_r(dir, NULL, GIT_DIRREMOVAL_FILES_AND_DIRS);
+	git_buf_free(&objects);
+	return error;
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bench.h"
+#include "pack.h"
+#include "sha1_lookup.h"
+#include "fileops.h"
+
+/*
+ * Random lookup throughput of a pack index.
+ *
+ * A version 2 index of `nr` random object ids is written to a scratch
+ * directory, next to a pack that only has a header and a trailer
+ * (lookups never read object data). The same random ids are then
+ * looked up through:
+ *
+ *	sha1_entry_pos	the interpolating search over the mapped index
+ *			that every lookup used before the prefix mirror
+ *	find_hit	git_pack_entry_find(), ids that are present
+ *	find_miss	git_pack_entry_find(), ids that are not
+ *	find_prefix	git_pack_entry_find() with 12 hex characters
+ */
+
+#define DEFAULT_OBJECTS 4000000
+#define DEFAULT_LOOKUPS 2000000
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(void)
+{
+	/* xorshift64* */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void random_oid(git_oid *oid)
+{
+	uint64_t r[3];
+
+	r[0] = rng_next();
+	r[1] = rng_next();
+	r[2] = rng_next();
+	memcpy(oid->id, r, GIT_OID_RAWSZ);
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static int write_be32(FILE *f, uint32_t value)
+{
+	value = htonl(value);
+	return fwrite(&value, sizeof(value), 1, f) == 1 ? 0 : -1;
+}
+
+static int write_index(const char *dir, const git_oid *ids, uint32_t nr)
+{
+	git_buf path = GIT_BUF_INIT;
+	uint32_t fanout[256], i;
+	git_oid checksum;
+	FILE *f = NULL;
+	int error = -1;
+
+	memset(&checksum, 0x42, sizeof(checksum));
+	memset(fanout, 0x0, sizeof(fanout));
+	for (i = 0; i < nr; ++i)
+		fanout[ids[i].id[0]]++;
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+
+	/* header-only pack; the index trailer names its checksum */
+	if (git_buf_joinpath(&path, dir, "pack-bench.pack") < 0 ||
+		(f = fopen(path.ptr, "wb")) == NULL ||
+		write_be32(f, PACK_SIGNATURE) < 0 ||
+		write_be32(f, PACK_VERSION) < 0 ||
+		write_be32(f, nr) < 0 ||
+		fwrite(checksum.id, GIT_OID_RAWSZ, 1, f) != 1 ||
+		fclose(f) != 0)
+		goto done;
+
+	if (git_buf_joinpath(&path, dir, "pack-bench.idx") < 0 ||
+		(f = fopen(path.ptr, "wb")) == NULL)
+		goto done;
+
+	if (write_be32(f, PACK_IDX_SIGNATURE) < 0 || write_be32(f, 2) < 0)
+		goto close;
+	for (i = 0; i < 256; ++i)
+		if (write_be32(f, fanout[i]) < 0)
+			goto close;
+	if (fwrite(ids, GIT_OID_RAWSZ, nr, f) != nr)
+		goto close;
+	for (i = 0; i < nr; ++i) /* crc32 */
+		if (write_be32(f, 0) < 0)
+			goto close;
+	for (i = 0; i < nr; ++i) /* offsets */
+		if (write_be32(f, 12 + i) < 0)
+			goto close;
+	if (fwrite(checksum.id, GIT_OID_RAWSZ, 1, f) != 1 ||
+		fwrite(checksum.id, GIT_OID_RAWSZ, 1, f) != 1)
+		goto close;
+
+	error = 0;
+
+close:
+	if (fclose(f) != 0)
+		error = -1;
+done:
+	if (error < 0)
+		fprintf(stderr, "failed to write '%s'\n", path.ptr);
+	git_buf_free(&path);
+	return error;
+}
+
+static int run_sha1_entry_pos(
+	struct git_pack_file *p, const git_oid *queries, size_t nqueries)
+{
+	const uint32_t *fanout = (const uint32_t *)p->index_map.data + 2;
+	const unsigned char *index = (const unsigned char *)(fanout + 256);
+	size_t i, found = 0;
+	double start = bench_now();
+
+	for (i = 0; i < nqueries; ++i) {
+		const unsigned char *key = queries[i].id;
+		unsigned hi = ntohl(fanout[key[0]]);
+		unsigned lo = key[0] ? ntohl(fanout[key[0] - 1]) : 0;
+
+		if (sha1_entry_pos(index, GIT_OID_RAWSZ, 0, lo, hi, p->num_objects, key) >= 0)
+			found++;
+	}
+
+	bench_report("pack_lookup", "sha1_entry_pos", nqueries, 0, bench_now() - start);
+	return (found == nqueries) ? 0 : -1;
+}
+
+static int run_find(
+	const char *name, struct git_pack_file *p,
+	const git_oid *queries, size_t nqueries, size_t len, int expect)
+{
+	struct git_pack_entry e;
+	size_t i, matched = 0;
+	double start = bench_now();
+
+	for (i = 0; i < nqueries; ++i)
+		if ((git_pack_entry_find(&e, p, &queries[i], len) == 0) == expect)
+			matched++;
+
+	bench_report("pack_lookup", name, nqueries, 0, bench_now() - start);
+	giterr_clear();
+
+	if (matched != nqueries) {
+		fprintf(stderr, "%s: %lu unexpected results\n",
+			name, (unsigned long)(nqueries - matched));
+		return -1;
+	}
+
+	return 0;
+}
+
+int bench_pack_lookup(int argc, char **argv)
+{
+	const char *dir = "bench-pack-lookup";
+	uint32_t nr = DEFAULT_OBJECTS;
+	size_t nqueries = DEFAULT_LOOKUPS, i;
+	git_oid *ids = NULL, *queries = NULL, *misses = NULL, *prefixes = NULL;
+	struct git_pack_file *p = NULL;
+	git_buf path = GIT_BUF_INIT;
+	struct git_pack_entry e;
+	int error = -1;
+
+	if (argc > 0)
+		nr = (uint32_t)strtoul(argv[0], NULL, 10);
+	if (argc > 1)
+		nqueries = strtoul(argv[1], NULL, 10);
+	if (nr == 0 || nqueries == 0) {
+		fprintf(stderr, "pack_lookup: object and lookup counts must be positive\n");
+		return -1;
+	}
+
+	ids = git__malloc(nr * sizeof(git_oid));
+	queries = git__malloc(nqueries * sizeof(git_oid));
+	misses = git__malloc(nqueries * sizeof(git_oid));
+	prefixes = git__malloc(nqueries * sizeof(git_oid));
+	if (!ids || !queries || !misses || !prefixes)
+		goto done;
+
+	for (i = 0; i < nr; ++i)
+		random_oid(&ids[i]);
+	qsort(ids, nr, sizeof(git_oid), oid_cmp);
+
+	for (i = 0; i < nqueries; ++i) {
+		char hex[GIT_OID_HEXSZ];
+
+		git_oid_cpy(&queries[i], &ids[rng_next() % nr]);
+		random_oid(&misses[i]);
+
+		git_oid_fmt(hex, &queries[i]);
+		git_oid_fromstrn(&prefixes[i], hex, 12);
+	}
+
+	printf("# %lu objects, %lu lookups\n", (unsigned long)nr, (unsigned long)nqueries);
+
+	if (git_futils_mkdir_r(dir, NULL, 0777) < 0 ||
+		write_index(dir, ids, nr) < 0 ||
+		git_buf_joinpath(&path, dir, "pack-bench.idx") < 0)
+		goto done;
+
+	if (git_packfile_check(&p, path.ptr) < 0)
+		goto done;
+
+	/* maps the index */
+	if (git_pack_entry_find(&e, p, &ids[0], GIT_OID_HEXSZ) < 0) {
+		error = bench_error("pack_lookup");
+		goto done;
+	}
+
+	if (run_sha1_entry_pos(p, queries, nqueries) < 0 ||
+		run_find("find_hit", p, queries, nqueries, GIT_OID_HEXSZ, 1) < 0 ||
+		run_find("find_miss", p, misses, nqueries, GIT_OID_HEXSZ, 0) < 0 ||
+		run_find("find_prefix", p, prefixes, nqueries, 12, 1) < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	if (p)
+		packfile_free(p);
+	git_futils_rmdir_r(dir, NULL, GIT_DIRREMOVAL_FILES_AND_DIRS);
+	git_buf_free(&path);
+	git__free(ids);
+	git__free(queries);
+	git__free(misses);
+	git__free(prefixes);
+	return error;
+}
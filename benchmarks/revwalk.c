@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bench.h"
+#include "commit_graph.h"
+#include "fileops.h"
+#include "oidmap.h"
+#include "oidtable.h"
+#include "git2/odb_backend.h"
+
+GIT__USE_OIDMAP;
+
+/*
+ * Revision walks over synthetic histories.
+ *
+ * Every shape grows `lanes` lines of history side by side from a single
+ * root, `count` commits in all, written to a pack. Each lane has a
+ * branch at its head and a tag halfway down:
+ *
+ *	linear		a single lane
+ *	wide		16 lanes, the first merging one of the others in
+ *			turn every 4 commits
+ *	octopus		16 lanes, the first merging all the others at
+ *			once every 8 commits
+ *	skewed		2 lanes merging every 8 commits, where every 7th
+ *			commit is dated a day before its parents
+ *
+ * and every shape is timed with (the case names are prefixed with the
+ * shape's):
+ *
+ *	parse		a time-sorted walk of all the branches, reading
+ *			every commit from the pack
+ *	none, time, topo, topo_time, reverse
+ *			walks of all the branches with each sorting, with
+ *			the commits the repository kept from the first walk
+ *	hide_tags	a time-sorted walk of the branches, without what
+ *			the tags can reach
+ *	merge_base_many	git_merge_base_many() of the branches
+ *	time_graph, topo_graph, merge_base_many_graph
+ *			the same, with a commit-graph written first
+ *
+ * The walks count commits as their ops, the merge bases rounds. Give a
+ * shape to only run that one. Besides the shapes, the commits of the
+ * first one are looked up in a git_oidmap and a git_oidtable:
+ *
+ *	oidmap, oidtable
+ */
+
+#define DEFAULT_COUNT 50000
+#define ROUNDS 3
+
+struct shape {
+	const char *name;
+	size_t lanes;
+	/* how often the first lane merges, if ever */
+	size_t merge_every;
+	unsigned int octopus:1,
+		skew:1;
+};
+
+static const struct shape shapes[] = {
+	{ "linear", 1, 0, 0, 0 },
+	{ "wide", 16, 4, 0, 0 },
+	{ "octopus", 16, 8, 1, 0 },
+	{ "skewed", 2, 8, 0, 1 },
+};
+
+static const struct {
+	const char *name;
+	unsigned int sorting;
+} sortings[] = {
+	{ "none", GIT_SORT_NONE },
+	{ "time", GIT_SORT_TIME },
+	{ "topo", GIT_SORT_TOPOLOGICAL },
+	{ "topo_time", GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME },
+	{ "reverse", GIT_SORT_TIME | GIT_SORT_REVERSE },
+};
+
+struct history {
+	const struct shape *shape;
+	git_repository *repo;
+	git_odb *odb;
+	git_oid tree;
+	git_buf buf;
+	git_oid *ids;
+	size_t count;
+	git_oid *heads;
+	git_oid *halfway;
+};
+
+static int write_commit(
+	git_oid *out, struct history *h,
+	const git_oid *parents, size_t n, git_time_t time, size_t lane)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t i;
+
+	git_buf_clear(&h->buf);
+	git_buf_printf(&h->buf, "tree %s\n", git_oid_tostr(hex, sizeof(hex), &h->tree));
+	for (i = 0; i < n; ++i)
+		git_buf_printf(&h->buf, "parent %s\n",
+			git_oid_tostr(hex, sizeof(hex), &parents[i]));
+	git_buf_printf(&h->buf,
+		"author Bench <bench@example.com> %ld +0000\n"
+		"committer Bench <bench@example.com> %ld +0000\n\nlane %lu\n",
+		(long)time, (long)time, (unsigned long)lane);
+
+	if (git_buf_oom(&h->buf))
+		return -1;
+
+	if (git_odb_write(out, h->odb, h->buf.ptr, h->buf.size, GIT_OBJ_COMMIT) < 0)
+		return -1;
+
+	git_oid_cpy(&h->ids[h->count++], out);
+	return 0;
+}
+
+static int write_history(struct history *h, const char *objects_dir, size_t count)
+{
+	const struct shape *s = h->shape;
+	git_odb_backend *writer;
+	git_oid root, *parents = NULL;
+	git_time_t time = 1234567890;
+	size_t steps = (count - 1) / s->lanes, step, lane, n;
+	int error = -1;
+
+	h->count = 0;
+
+	parents = git__calloc(s->lanes, sizeof(git_oid));
+	if (parents == NULL ||
+		git_odb_open(&h->odb, objects_dir) < 0 ||
+		git_odb_backend_pack_writer(&writer, objects_dir) < 0 ||
+		git_odb_add_backend(h->odb, writer, 3) < 0 ||
+		git_odb_write(&h->tree, h->odb, "", 0, GIT_OBJ_TREE) < 0 ||
+		write_commit(&root, h, NULL, 0, time, 0) < 0)
+		goto done;
+
+	for (lane = 0; lane < s->lanes; ++lane)
+		git_oid_cpy(&h->heads[lane], &root);
+
+	for (step = 1; step <= steps; ++step) {
+		time += 60;
+
+		for (lane = 0; lane < s->lanes; ++lane) {
+			git_time_t when = time + lane;
+
+			git_oid_cpy(&parents[0], &h->heads[lane]);
+			n = 1;
+
+			if (lane == 0 && s->lanes > 1 &&
+				s->merge_every && step % s->merge_every == 0) {
+				if (s->octopus) {
+					for (n = 1; n < s->lanes; ++n)
+						git_oid_cpy(&parents[n], &h->heads[n]);
+				} else {
+					size_t other = 1 + (step / s->merge_every) % (s->lanes - 1);
+					git_oid_cpy(&parents[n++], &h->heads[other]);
+				}
+			}
+
+			if (s->skew && step % 7 == 0)
+				when -= 24 * 3600;
+
+			if (write_commit(&h->heads[lane], h, parents, n, when, lane) < 0)
+				goto done;
+
+			if (step == steps / 2)
+				git_oid_cpy(&h->halfway[lane], &h->heads[lane]);
+		}
+	}
+
+	error = 0;
+
+done:
+	/* flushes the pack */
+	git_odb_free(h->odb);
+	h->odb = NULL;
+	git__free(parents);
+	return error;
+}
+
+static int create_ref(
+	struct history *h, git_buf *name, const char *prefix, size_t lane,
+	const git_oid *id)
+{
+	git_reference *ref;
+
+	git_buf_clear(name);
+	if (git_buf_printf(name, "%s-%lu", prefix, (unsigned long)lane) < 0 ||
+		git_reference_create_oid(&ref, h->repo, name->ptr, id, 1) < 0)
+		return -1;
+
+	git_reference_free(ref);
+	return 0;
+}
+
+static int create_refs(struct history *h)
+{
+	git_buf name = GIT_BUF_INIT;
+	size_t lane;
+	int error = 0;
+
+	for (lane = 0; lane < h->shape->lanes && !error; ++lane)
+		if (create_ref(h, &name, "refs/heads/lane", lane, &h->heads[lane]) < 0 ||
+			create_ref(h, &name, "refs/tags/halfway", lane, &h->halfway[lane]) < 0)
+			error = -1;
+
+	git_buf_free(&name);
+	return error;
+}
+
+static void report(struct history *h, const char *name, size_t ops, double seconds)
+{
+	char label[64];
+
+	p_snprintf(label, sizeof(label), "%s_%s", h->shape->name, name);
+	bench_report("revwalk", label, ops, 0, seconds);
+}
+
+static int run_walk(
+	struct history *h, const char *name, unsigned int sorting,
+	const char *hide, unsigned int rounds)
+{
+	git_revwalk *walk;
+	git_oid id;
+	double start = bench_now();
+	size_t n = 0, per_round = 0;
+	unsigned int i;
+	int error;
+
+	if (git_revwalk_new(&walk, h->repo) < 0)
+		return bench_error(name);
+
+	git_revwalk_sorting(walk, sorting);
+
+	for (i = 0; i < rounds; ++i) {
+		if (git_revwalk_push_glob(walk, "heads") < 0 ||
+			(hide && git_revwalk_hide_glob(walk, hide) < 0)) {
+			git_revwalk_free(walk);
+			return bench_error(name);
+		}
+
+		while ((error = git_revwalk_next(&id, walk)) == 0)
+			n++;
+
+		if (error != GIT_ITEROVER) {
+			git_revwalk_free(walk);
+			return bench_error(name);
+		}
+
+		if (i == 0)
+			per_round = n;
+	}
+
+	report(h, name, n, bench_now() - start);
+	git_revwalk_free(walk);
+
+	/* every commit is on some branch */
+	if (!hide && per_round != h->count) {
+		fprintf(stderr, "%s: walked %lu commits, not %lu\n", name,
+			(unsigned long)per_round, (unsigned long)h->count);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run_merge_base_many(struct history *h, const char *name)
+{
+	const git_oid *inputs = h->heads;
+	size_t n = h->shape->lanes;
+	git_oid base, pair[2];
+	double start;
+	unsigned int i;
+
+	/* a single lane is its own base, but halfway down is not */
+	if (n < 2) {
+		git_oid_cpy(&pair[0], &h->heads[0]);
+		git_oid_cpy(&pair[1], &h->halfway[0]);
+		inputs = pair;
+		n = 2;
+	}
+
+	start = bench_now();
+	for (i = 0; i < ROUNDS; ++i)
+		if (git_merge_base_many(&base, h->repo, inputs, n) < 0)
+			return bench_error(name);
+
+	report(h, name, ROUNDS, bench_now() - start);
+	return 0;
+}
+
+static int run_shape(struct history *h, size_t count)
+{
+	const char *dir = "bench-revwalk";
+	git_buf objects = GIT_BUF_INIT;
+	size_t i;
+	int error = -1;
+
+	printf("# %s: %lu commits in %lu lanes\n", h->shape->name,
+		(unsigned long)count, (unsigned long)h->shape->lanes);
+
+	if (git_repository_init(&h->repo, dir, 1) < 0 ||
+		git_buf_joinpath(&objects, git_repository_path(h->repo), "objects") < 0 ||
+		write_history(h, objects.ptr, count) < 0)
+		goto fail;
+
+	/* the pack was written behind the repository's back */
+	git_repository_free(h->repo);
+	if (git_repository_open(&h->repo, dir) < 0 || create_refs(h) < 0)
+		goto fail;
+
+	if (run_walk(h, "parse", GIT_SORT_TIME, NULL, 1) < 0)
+		goto done;
+
+	for (i = 0; i < ARRAY_SIZE(sortings); ++i)
+		if (run_walk(h, sortings[i].name, sortings[i].sorting, NULL, ROUNDS) < 0)
+			goto done;
+
+	if (run_walk(h, "hide_tags", GIT_SORT_TIME, "tags", ROUNDS) < 0 ||
+		run_merge_base_many(h, "merge_base_many") < 0)
+		goto done;
+
+	if (git_commit_graph_write(h->repo, 0) < 0)
+		goto fail;
+
+	if (run_walk(h, "time_graph", GIT_SORT_TIME, NULL, ROUNDS) < 0 ||
+		run_walk(h, "topo_graph", GIT_SORT_TOPOLOGICAL, NULL, ROUNDS) < 0 ||
+		run_merge_base_many(h, "merge_base_many_graph") < 0)
+		goto done;
+
+	error = 0;
+	goto done;
+
+fail:
+	error = bench_error(h->shape->name);
+done:
+	git_repository_free(h->repo);
+	h->repo = NULL;
+	git_futils_rmdir_r(dir, NULL, GIT_DIRREMOVAL_FILES_AND_DIRS);
+	git_buf_free(&objects);
+	return error;
+}
+
+static int run_oidmap(const git_oid *ids, size_t count)
+{
+	git_oidmap *map = git_oidmap_alloc();
+	size_t i, found = 0;
+	unsigned int r;
+	double start;
+	khiter_t pos;
+	int ret;
+
+	if (map == NULL)
+		return bench_error("oidmap");
+
+	for (i = 0; i < count; ++i) {
+		pos = kh_put(oid, map, &ids[i], &ret);
+		kh_value(map, pos) = (void *)&ids[i];
+	}
+
+	start = bench_now();
+	for (r = 0; r < ROUNDS; ++r)
+		for (i = 0; i < count; ++i)
+			found += (kh_get(oid, map, &ids[i]) != kh_end(map));
+	bench_report("revwalk", "oidmap", found, 0, bench_now() - start);
+
+	git_oidmap_free(map);
+	return 0;
+}
+
+static int run_oidtable(const git_oid *ids, size_t count)
+{
+	git_oidtable *table;
+	size_t i, found = 0;
+	unsigned int r;
+	double start;
+
+	if (git_oidtable_new(&table, count) < 0)
+		return bench_error("oidtable");
+
+	for (i = 0; i < count; ++i)
+		if (git_oidtable_put(table, &ids[i], (void *)&ids[i]) < 0) {
+			git_oidtable_free(table);
+			return bench_error("oidtable");
+		}
+
+	start = bench_now();
+	for (r = 0; r < ROUNDS; ++r)
+		for (i = 0; i < count; ++i)
+			found += (git_oidtable_get(table, &ids[i]) != NULL);
+	bench_report("revwalk", "oidtable", found, 0, bench_now() - start);
+
+	git_oidtable_free(table);
+	return 0;
+}
+
+int bench_revwalk(int argc, char **argv)
+{
+	size_t count = DEFAULT_COUNT, i, ran = 0;
+	const char *only = NULL;
+	struct history h;
+	int error = 0;
+
+	memset(&h, 0x0, sizeof(h));
+
+	if (argc > 0)
+		count = strtoul(argv[0], NULL, 10);
+	if (argc > 1)
+		only = argv[1];
+	if (count < 64) {
+		fprintf(stderr, "revwalk: there must be at least 64 commits\n");
+		return -1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(shapes) && !error; ++i) {
+		if (only && strcmp(only, shapes[i].name) != 0)
+			continue;
+
+		h.shape = &shapes[i];
+		h.ids = git__calloc(count, sizeof(git_oid));
+		h.heads = git__calloc(h.shape->lanes, sizeof(git_oid));
+		h.halfway = git__calloc(h.shape->lanes, sizeof(git_oid));
+
+		if (!h.ids || !h.heads || !h.halfway)
+			error = bench_error("revwalk");
+		else
+			error = run_shape(&h, count);
+
+		/* the map lookups use the first history walked */
+		if (!error && ran++ == 0)
+			error = (run_oidmap(h.ids, h.count) < 0 ||
+				run_oidtable(h.ids, h.count) < 0) ? -1 : 0;
+
+		git__free(h.ids);
+		git__free(h.heads);
+		git__free(h.halfway);
+	}
+
+	git_buf_free(&h.buf);
+
+	if (!error && ran == 0) {
+		fprintf(stderr, "revwalk: unknown shape '%s'\n", only);
+		return -1;
+	}
+
+	return error;
+}
@@ -118,6 +118,69 @@ enum {
  */
 GIT_EXTERN(int) git_libgit2_capabilities(void);
 
+/**
+ * Usage of the memory windows libgit2 maps over packfiles.
+ */
+typedef struct git_mwindow_stats {
+	size_t mapped;                  /**< bytes currently mapped */
+	size_t peak_mapped;             /**< most bytes ever mapped at once */
+	unsigned int open_windows;      /**< windows currently mapped */
+	unsigned int peak_open_windows; /**< most windows ever mapped at once */
+	unsigned int mmap_calls;        /**< windows mapped so far */
+	unsigned int open_files;        /**< packfile descriptors open */
+	unsigned int peak_open_files;   /**< most descriptors ever open at once */
+} git_mwindow_stats;
+
+/**
+ * Get a snapshot of the packfile memory window statistics.
+ *
+ * The counters are shared by every repository in the process.
+ *
+ * @param stats Structure to fill with the current values
+ */
+GIT_EXTERN(void) git_libgit2_mwindow_stats(git_mwindow_stats *stats);
+
+/**
+ * Choose whether packfiles are mapped in one piece.
+ *
+ * By default, packfiles are mapped in windows of a fixed size. On
+ * 64-bit hosts, each packfile can instead be mapped whole, so reading
+ * an object never has to switch between memory windows. Packs larger
+ * than the limit on mapped memory are always windowed. Files that are
+ * already mapped keep their current windows.
+ *
+ * @param enabled non-zero to map whole packfiles, 0 to use windows
+ * @return 0 or an error code if the host cannot map whole packs
+ */
+GIT_EXTERN(int) git_libgit2_mwindow_set_whole_file(int enabled);
+
+/**
+ * Set how many packfile descriptors may be open at once.
+ *
+ * The limit is shared by every repository in the process. Once it is
+ * reached, opening a packfile closes the descriptor of the pack that
+ * was mapped from the longest time ago; its memory windows stay valid,
+ * and the pack is reopened when it needs a new one. The limit is a
+ * soft one: a pack that has not been mapped yet keeps its descriptor.
+ *
+ * @param limit the most descriptors to keep open, or 0 for no limit.
+ * The default is 128.
+ */
+GIT_EXTERN(void) git_libgit2_mwindow_set_file_limit(unsigned int limit);
+
+/**
+ * Set how much memory each repository may spend on parsed commits.
+ *
+ * Revision walks keep the parents, time and tree of the commits they
+ * parse in a cache shared by all the walks on the same repository, so
+ * that later walks do not read those commits again. A cache that grows
+ * past the limit is emptied and starts over.
+ *
+ * @param limit the most bytes for each repository's cache, or 0 to
+ * not cache commits at all. The default is 32MB.
+ */
+GIT_EXTERN(void) git_libgit2_commit_cache_set_limit(size_t limit);
+
 /** @} */
 GIT_END_DECL
 
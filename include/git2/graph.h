@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_graph_h__
+#define INCLUDE_git_graph_h__
+
+#include "common.h"
+#include "types.h"
+#include "oid.h"
+
+/**
+ * @file git2/graph.h
+ * @brief Git commit graph routines
+ * @defgroup git_graph Git commit graph routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Count the number of unique commits between two commit objects
+ *
+ * There is no need for branches containing the commits to have any
+ * upstream relationship, but it helps to think of one as a branch and
+ * the other as its upstream: the `ahead` and `behind` values are what
+ * git would report for the branches.
+ *
+ * @param ahead number of commits reachable from `local` but not `upstream`
+ * @param behind number of commits reachable from `upstream` but not `local`
+ * @param repo the repository where the commits exist
+ * @param local the commit for local
+ * @param upstream the commit for upstream
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_graph_ahead_behind(
+	size_t *ahead,
+	size_t *behind,
+	git_repository *repo,
+	const git_oid *local,
+	const git_oid *upstream);
+
+/**
+ * Count the unique commits of many pairs of commits at once
+ *
+ * The `n` pairs are `locals[i]` and `upstreams[i]`. They are walked
+ * together, so history shared by several pairs (like many branches
+ * against the same upstream) is read once: the cost is that of the
+ * union of the histories that tell the pairs apart, not of each pair.
+ *
+ * A merge base of each pair can be found on the way. With several
+ * merge bases, which one is returned is unspecified, as with
+ * `git_merge_base`; pairs without any common history get a zero oid.
+ *
+ * @param ahead array of `n` counts of the commits only in `locals[i]`
+ * @param behind array of `n` counts of the commits only in `upstreams[i]`
+ * @param merge_bases array of `n` merge bases, or NULL
+ * @param repo the repository where the commits exist
+ * @param locals array of `n` local commits
+ * @param upstreams array of `n` upstream commits
+ * @param n the number of pairs
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_graph_ahead_behind_many(
+	size_t *ahead,
+	size_t *behind,
+	git_oid *merge_bases,
+	git_repository *repo,
+	const git_oid *locals,
+	const git_oid *upstreams,
+	size_t n);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -141,6 +141,45 @@ GIT_EXTERN(int) git_odb_read(git_odb_object **out, git_odb *db, const git_oid *i
  */
 GIT_EXTERN(int) git_odb_read_prefix(git_odb_object **out, git_odb *db, const git_oid *short_id, size_t len);
 
+/**
+ * Callback for `git_odb_read_many`
+ *
+ * Called with an object that was read and the position of its id in
+ * the array given to `git_odb_read_many`. The object belongs to the
+ * callback, which must free it with `git_odb_object_free`.
+ *
+ * Return a non-zero value to stop reading.
+ */
+typedef int (*git_odb_read_many_cb)(git_odb_object *obj, size_t idx, void *payload);
+
+/**
+ * Read a batch of objects from the database
+ *
+ * This does the work of a `git_odb_read` for each of the `n` ids,
+ * but lets the backends pick the order they read the objects in:
+ * the pack backend reads them in the order they are stored in, and
+ * unpacks the delta bases they have in common only once.
+ *
+ * The objects are handed to `cb` as they are read, which usually is
+ * not the order they were asked for in. Objects already in the cache
+ * come first.
+ *
+ * @param db database to search for the objects in.
+ * @param ids the ids of the objects to read
+ * @param n the number of ids
+ * @param cb the callback to call for each object read
+ * @param payload payload for the callback
+ * @return 0 if all the objects were read; GIT_ENOTFOUND if some of
+ *	them are not in the database (the others are read anyway);
+ *	GIT_EUSER if the callback stopped the read; an error code otherwise
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb *db,
+	const git_oid *ids,
+	size_t n,
+	git_odb_read_many_cb cb,
+	void *payload);
+
 /**
  * Read the header of an object from the database, without
  * reading its full contents.
@@ -236,22 +275,66 @@ GIT_EXTERN(int) git_odb_write(git_oid *oid, git_odb *odb, const void *data, size
  */
 GIT_EXTERN(int) git_odb_open_wstream(git_odb_stream **stream, git_odb *db, size_t size, git_otype type);
 
+/**
+ * Start a bulk write into the ODB
+ *
+ * Until the bulk write is committed, the objects written with
+ * `git_odb_write` and `git_odb_open_wstream` are only staged: they
+ * can be read back through this ODB, but no other reader of the
+ * repository sees them. This lets backends skip the work they do to
+ * make every single object durable and visible, which is most of the
+ * cost of writing many small objects.
+ *
+ * Only one bulk write can be open on an ODB at a time.
+ *
+ * @param db object database to write into
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_bulk_begin(git_odb *db);
+
+/**
+ * Make the objects of a bulk write part of the ODB
+ *
+ * On success the bulk write is over. If committing fails, the bulk
+ * write is still open: it can be committed again or rolled back.
+ * The backends that did commit keep their objects either way.
+ *
+ * @param db object database with an open bulk write
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_bulk_commit(git_odb *db);
+
+/**
+ * Throw away the objects of a bulk write
+ *
+ * @param db object database with an open bulk write
+ */
+GIT_EXTERN(void) git_odb_bulk_rollback(git_odb *db);
+
 /**
  * Open a stream to read an object from the ODB
  *
- * Note that most backends do *not* support streaming reads
- * because they store their objects as compressed/delta'ed blobs.
+ * The loose and pack backends inflate the object as it is read, so
+ * an object of any size can be read with constant memory. Objects
+ * stored as deltas are the exception: they get rebuilt in memory
+ * when the stream is opened. Objects read this way do not go through
+ * the object cache. Use `git_odb_read_header` to learn the size and
+ * type of the object beforehand.
  *
- * It's recommended to use `git_odb_read` instead, which is
- * assured to work on all backends.
+ * Custom backends do not have to support streaming reads; for those,
+ * use `git_odb_read` instead, which is assured to work on all
+ * backends.
  *
  * The returned stream will be of type `GIT_STREAM_RDONLY` and
  * will have the following methods:
  *
- *		- stream->read: read `n` bytes from the stream
+ *		- stream->read: read up to `n` bytes from the stream;
+ *		  returns the number of bytes read, 0 at the end of the
+ *		  object or an error code
  *		- stream->free: free the stream
  *
- * The stream must always be free'd or will leak memory.
+ * The stream must always be free'd or will leak memory, and must
+ * be free'd before the ODB it was opened from.
  *
  * @see git_odb_stream
  *
@@ -82,6 +82,27 @@ struct git_odb_backend {
 		       );
 
 	void (* free)(struct git_odb_backend *);
+
+	/* Optional; see git_odb_read_many(). Reads the objects among
+	 * `ids` that the backend has, in any order, and hands each one
+	 * to `cb` along with its position in `ids`. The data is allocated
+	 * like read's, and belongs to the callback. */
+	int (* read_many)(
+			struct git_odb_backend *,
+			const git_oid *ids,
+			size_t n,
+			int (*cb)(size_t idx, void *data, size_t len, git_otype type, void *payload),
+			void *payload);
+
+	/* Optional; see git_odb_bulk_begin(). Between bulk_begin
+	 * and bulk_commit, the backend may stage the objects it is
+	 * given anywhere it can read them back from; they only have
+	 * to be visible to others once bulk_commit succeeds. When
+	 * another backend fails to commit, bulk_commit may be called
+	 * again after it succeeded, and must succeed again. */
+	int (* bulk_begin)(struct git_odb_backend *);
+	int (* bulk_commit)(struct git_odb_backend *);
+	void (* bulk_rollback)(struct git_odb_backend *);
 };
 
 /** Streaming mode */
@@ -106,6 +127,32 @@ GIT_EXTERN(int) git_odb_backend_pack(git_odb_backend **backend_out, const char *
 GIT_EXTERN(int) git_odb_backend_loose(git_odb_backend **backend_out, const char *objects_dir, int compression_level, int do_fsync);
 GIT_EXTERN(int) git_odb_backend_one_pack(git_odb_backend **backend_out, const char *index_file);
 
+/**
+ * Create a backend that writes new objects into a packfile
+ *
+ * Objects written through the backend are appended to a single
+ * packfile in `objects_dir/pack` instead of each getting a loose file,
+ * and can be read back from it right away. The pack is indexed and
+ * made visible to the pack backend when the writer is flushed: when a
+ * bulk write begins or is committed, and when the backend is freed.
+ * Rolling back a bulk write throws away the objects written since
+ * `git_odb_bulk_begin`, and only those.
+ *
+ * A failure to flush when the backend is freed cannot be reported, and
+ * the objects that were pending are lost. Write through
+ * `git_odb_bulk_begin` and `git_odb_bulk_commit` instead, and check
+ * what the commit returns.
+ *
+ * The backend only knows about the objects it wrote; to have writes
+ * land in it, add it to an ODB with a priority higher than the loose
+ * backend's.
+ *
+ * @param backend_out location to store the backend
+ * @param objects_dir the repository's objects directory
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_backend_pack_writer(git_odb_backend **backend_out, const char *objects_dir);
+
 GIT_EXTERN(void *) git_odb_backend_malloc(git_odb_backend *backend, size_t len);
 
 GIT_END_DECL
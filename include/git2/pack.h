@@ -41,6 +41,26 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  */
 GIT_EXTERN(void) git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n);
 
+/**
+ * Restrict deltas to bases from the same delta islands
+ *
+ * When many forks share one repository, a delta against a base only
+ * reachable from another fork forces the server to send that extra
+ * base. Delta islands group objects by the refs reaching them, and
+ * an object is only deltified against a base belonging to all of its
+ * islands.
+ *
+ * Islands are defined by the `pack.island` configuration variables,
+ * each a regular expression matched against ref names. The capture
+ * groups of the last expression matching a ref, joined with '-', name
+ * its island; e.g. `refs/virtual/([0-9]+)/heads/` gives one island
+ * per fork. Objects outside of any island may use any base.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to honour delta islands
+ */
+GIT_EXTERN(void) git_packbuilder_set_delta_islands(git_packbuilder *pb, int enabled);
+
 /**
  * Insert a single object
  *
@@ -67,6 +87,35 @@ GIT_EXTERN(int) git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
  */
 GIT_EXTERN(int) git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *oid);
 
+/**
+ * Insert a commit object
+ *
+ * This will add the commit as well as its root tree and all the
+ * trees and blobs referenced by it. Trees which have already been
+ * inserted through another commit are not walked again.
+ *
+ * @param pb The packbuilder
+ * @param oid The oid of the commit
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_insert_commit(git_packbuilder *pb, const git_oid *oid);
+
+/**
+ * Insert every commit produced by a revision walker
+ *
+ * The walker is drained: all the commits it returns are inserted
+ * first, in walk order, followed by the trees and blobs reachable
+ * from them. Use `GIT_SORT_TIME` on the walker to get the recency
+ * order recommended by `git_packbuilder_insert`.
+ *
+ * @param pb The packbuilder
+ * @param walk The revision walker to drain
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk);
+
 /**
  * Write the new pack and the corresponding index to path
  *
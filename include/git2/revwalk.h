@@ -10,6 +10,7 @@
 #include "common.h"
 #include "types.h"
 #include "oid.h"
+#include "strarray.h"
 
 /**
  * @file git2/revwalk.h
@@ -185,6 +186,28 @@ GIT_EXTERN(int) git_revwalk_push_ref(git_revwalk *walk, const char *refname);
  */
 GIT_EXTERN(int) git_revwalk_hide_ref(git_revwalk *walk, const char *refname);
 
+/**
+ * Limit the walk to the commits that change some paths
+ *
+ * Only the commits where one of `paths` differs from each of their
+ * parents are returned: a commit that has the same content there as
+ * one of its parents did not make the change itself. A root commit is
+ * returned when one of the paths exists in it. The rest of the history
+ * is still walked through, and the order of the commits is the same.
+ *
+ * The paths are relative to the root of the repository and name files
+ * or whole directories; they are not patterns. When the commit-graph
+ * has changed-path Bloom filters, most commits are ruled out without
+ * reading any of their trees.
+ *
+ * Like the sorting mode, the paths are kept when the walker is reset.
+ *
+ * @param walk the walker being used for the traversal
+ * @param paths the paths to look at, or NULL to return all commits
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_revwalk_set_paths(git_revwalk *walk, const git_strarray *paths);
+
 /**
  * Get the next commit from the revision walk.
  *
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bloom.h"
+
+#define BLOOM_SEED0 0x293ae76f
+#define BLOOM_SEED1 0x7e646e2c
+
+GIT_INLINE(uint32_t) rotl32(uint32_t value, int count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+/* 32-bit murmur3, reading bytes as unsigned */
+uint32_t git_bloom_murmur3(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *tail = p + (len & ~(size_t)3);
+	uint32_t hash = seed, k;
+
+	for (; p < tail; p += 4) {
+		k = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+			((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+
+		hash ^= k;
+		hash = rotl32(hash, 13);
+		hash = hash * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= (uint32_t)tail[2] << 16;
+		/* fall through */
+	case 2:
+		k ^= (uint32_t)tail[1] << 8;
+		/* fall through */
+	case 1:
+		k ^= (uint32_t)tail[0];
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		hash ^= k;
+	}
+
+	hash ^= (uint32_t)len;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+void git_bloom_key_init(git_bloom_key *key, const char *path, size_t len)
+{
+	key->hash0 = git_bloom_murmur3(BLOOM_SEED0, path, len);
+	key->hash1 = git_bloom_murmur3(BLOOM_SEED1, path, len);
+}
+
+void git_bloom_filter_add(
+	unsigned char *data, size_t len, uint32_t num_hashes, const git_bloom_key *key)
+{
+	uint64_t bits = (uint64_t)len * 8;
+	uint32_t i;
+
+	for (i = 0; i < num_hashes; ++i) {
+		uint64_t pos = (uint32_t)(key->hash0 + i * key->hash1) % bits;
+		data[pos / 8] |= (unsigned char)(1 << (pos & 7));
+	}
+}
+
+int git_bloom_filter_contains(
+	const git_bloom_filter *filter, const git_bloom_key *key)
+{
+	uint64_t bits = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	/* an empty filter tells nothing */
+	if (!bits)
+		return 1;
+
+	for (i = 0; i < filter->num_hashes; ++i) {
+		uint64_t pos = (uint32_t)(key->hash0 + i * key->hash1) % bits;
+
+		if (!(filter->data[pos / 8] & (1 << (pos & 7))))
+			return 0;
+	}
+
+	return 1;
+}
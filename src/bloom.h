@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bloom_h__
+#define INCLUDE_bloom_h__
+
+#include "common.h"
+
+/*
+ * Changed-path Bloom filters, as stored in a commit-graph by
+ * `git commit-graph write --changed-paths`.
+ *
+ * Each commit gets a filter of the paths that differ between its tree
+ * and the tree of its first parent: every changed file, and every
+ * directory leading to one. A filter never misses a path that was
+ * added to it, so a "no" for a path means the commit did not touch it.
+ */
+#define GIT_BLOOM_NUM_HASHES 7
+#define GIT_BLOOM_BITS_PER_ENTRY 10
+
+/* Commits changing more files than this get a filter that says "yes". */
+#define GIT_BLOOM_MAX_CHANGED_PATHS 512
+
+/*
+ * Version 1 filters were hashed with a murmur3 that sign-extends bytes
+ * above 0x7f; they can only be trusted for paths without any.
+ */
+#define GIT_BLOOM_VERSION 2
+
+/*
+ * The hashes of a path: the `i`th bit set for it is derived from
+ * `hash0 + i * hash1`, for as many hashes as the filter uses.
+ */
+typedef struct {
+	uint32_t hash0;
+	uint32_t hash1;
+} git_bloom_key;
+
+typedef struct {
+	const unsigned char *data;
+	size_t len;
+	uint32_t num_hashes;
+} git_bloom_filter;
+
+uint32_t git_bloom_murmur3(uint32_t seed, const char *data, size_t len);
+
+void git_bloom_key_init(git_bloom_key *key, const char *path, size_t len);
+
+void git_bloom_filter_add(
+	unsigned char *data, size_t len, uint32_t num_hashes, const git_bloom_key *key);
+
+/*
+ * Returns 0 if the path of `key` is definitely not in the filter, and
+ * 1 if it may be.
+ */
+int git_bloom_filter_contains(
+	const git_bloom_filter *filter, const git_bloom_key *key);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_cache.h"
+
+GIT__USE_OIDMAP;
+
+/* entries are handed out in units of this, which keeps them aligned */
+#define COMMIT_CACHE_UNIT 8
+
+/* what the map spends on each entry, besides the entry itself */
+#define COMMIT_CACHE_OVERHEAD (sizeof(git_oid *) + sizeof(void *) + 1)
+
+static size_t commit_cache_limit = GIT_COMMIT_CACHE_DEFAULT_LIMIT;
+
+void git_libgit2_commit_cache_set_limit(size_t limit)
+{
+	commit_cache_limit = limit;
+}
+
+int git_commit_cache_init(git_commit_cache *cache)
+{
+	memset(cache, 0x0, sizeof(git_commit_cache));
+
+	cache->map = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(cache->map);
+
+	if (git_pool_init(&cache->pool, COMMIT_CACHE_UNIT, 0) < 0) {
+		git_oidmap_free(cache->map);
+		return -1;
+	}
+
+	git_mutex_init(&cache->lock);
+	return 0;
+}
+
+void git_commit_cache_free(git_commit_cache *cache)
+{
+	if (cache->map == NULL)
+		return;
+
+	git_oidmap_free(cache->map);
+	git_pool_clear(&cache->pool);
+	git_mutex_free(&cache->lock);
+}
+
+const git_commit_cache_entry *git_commit_cache_get(
+	git_commit_cache *cache, const git_oid *oid)
+{
+	khiter_t pos = kh_get(oid, cache->map, oid);
+
+	if (pos == kh_end(cache->map))
+		return NULL;
+
+	return kh_value(cache->map, pos);
+}
+
+git_commit_cache_entry *git_commit_cache_add(
+	git_commit_cache *cache, const git_oid *oid, size_t parent_count)
+{
+	git_commit_cache_entry *entry;
+	size_t size, units;
+	khiter_t pos;
+	int ret;
+
+	pos = kh_get(oid, cache->map, oid);
+	if (pos != kh_end(cache->map))
+		return kh_value(cache->map, pos);
+
+	size = sizeof(git_commit_cache_entry) + parent_count * sizeof(git_oid);
+	units = (size + COMMIT_CACHE_UNIT - 1) / COMMIT_CACHE_UNIT;
+
+	if (cache->used + units * COMMIT_CACHE_UNIT + COMMIT_CACHE_OVERHEAD >
+		commit_cache_limit) {
+		kh_clear(oid, cache->map);
+		git_pool_clear(&cache->pool);
+		cache->used = 0;
+
+		/* too large to be cached at all */
+		if (units * COMMIT_CACHE_UNIT + COMMIT_CACHE_OVERHEAD > commit_cache_limit)
+			return NULL;
+	}
+
+	entry = git_pool_malloc(&cache->pool, (uint32_t)units);
+	if (entry == NULL)
+		return NULL;
+
+	git_oid_cpy(&entry->oid, oid);
+	entry->parent_count = (unsigned short)parent_count;
+
+	pos = kh_put(oid, cache->map, &entry->oid, &ret);
+	if (ret < 0)
+		return NULL;
+	kh_value(cache->map, pos) = entry;
+
+	cache->used += units * COMMIT_CACHE_UNIT + COMMIT_CACHE_OVERHEAD;
+	return entry;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_commit_cache_h__
+#define INCLUDE_commit_cache_h__
+
+#include "git2/oid.h"
+
+#include "common.h"
+#include "oidmap.h"
+#include "pool.h"
+#include "thread-utils.h"
+
+#define GIT_COMMIT_CACHE_DEFAULT_LIMIT (32 * 1024 * 1024)
+
+/*
+ * The commits the revision walks of a repository have parsed, kept for
+ * the walks that come after them: the parents, time and tree of each,
+ * and never the raw commit.
+ *
+ * Entries are only valid while the lock is held; walks copy what they
+ * need into their own commits before letting go, so walks on different
+ * threads can share the cache. Once it grows past its memory limit, the
+ * cache is emptied and starts over.
+ */
+typedef struct {
+	git_oid oid;
+	git_oid tree;
+	uint32_t time;
+	unsigned short parent_count;
+	git_oid parents[GIT_FLEX_ARRAY];
+} git_commit_cache_entry;
+
+typedef struct {
+	git_mutex lock;
+	git_oidmap *map;
+	git_pool pool;
+	size_t used;
+} git_commit_cache;
+
+int git_commit_cache_init(git_commit_cache *cache);
+void git_commit_cache_free(git_commit_cache *cache);
+
+GIT_INLINE(void) git_commit_cache_lock(git_commit_cache *cache)
+{
+	GIT_UNUSED(cache); /* git_mutex_lock is a no-op without threads */
+	git_mutex_lock(&cache->lock);
+}
+
+GIT_INLINE(void) git_commit_cache_unlock(git_commit_cache *cache)
+{
+	GIT_UNUSED(cache);
+	git_mutex_unlock(&cache->lock);
+}
+
+/* With the lock held: the entry of a commit, or NULL. */
+const git_commit_cache_entry *git_commit_cache_get(
+	git_commit_cache *cache, const git_oid *oid);
+
+/*
+ * With the lock held: an entry for a commit with `parent_count`
+ * parents, for the caller to fill in before unlocking; an existing
+ * entry is returned as it is.  May empty the cache to make room.
+ */
+git_commit_cache_entry *git_commit_cache_add(
+	git_commit_cache *cache, const git_oid *oid, size_t parent_count);
+
+#endif
@@ -0,0 +1,1065 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "git2/commit.h"
+#include "git2/refs.h"
+#include "git2/tree.h"
+
+#include "fileops.h"
+#include "filebuf.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "pool.h"
+#include "refs.h"
+#include "repository.h"
+#include "sha1_lookup.h"
+
+GIT__USE_OIDMAP;
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1 /* SHA-1 */
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+#define COMMIT_GRAPH_BLOOM_INDEX_ID 0x42494458 /* "BIDX" */
+#define COMMIT_GRAPH_BLOOM_DATA_ID 0x42444154 /* "BDAT" */
+
+#define COMMIT_GRAPH_CHUNK_ENTRY_SIZE 12
+#define COMMIT_GRAPH_FANOUT_SIZE (256 * 4)
+#define COMMIT_GRAPH_DATA_ENTRY_SIZE (GIT_OID_RAWSZ + 16)
+#define COMMIT_GRAPH_BLOOM_HEADER_SIZE 12
+
+#define COMMIT_GRAPH_PARENT_NONE 0x70000000
+#define COMMIT_GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define COMMIT_GRAPH_LAST_EDGE 0x80000000
+
+#define COMMIT_GRAPH_GENERATION_MAX 0x3fffffff
+#define COMMIT_GRAPH_TIME_MASK 0x3ffffffffULL
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+typedef struct {
+	size_t offset;
+	size_t length;
+} commit_graph_chunk;
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid commit-graph file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) commit_graph_get_be32(const unsigned char *data)
+{
+	return ntohl(*(const uint32_t *)data);
+}
+
+GIT_INLINE(uint64_t) commit_graph_get_be64(const unsigned char *data)
+{
+	return ((uint64_t)commit_graph_get_be32(data) << 32) |
+		commit_graph_get_be32(data + 4);
+}
+
+static int commit_graph_parse_oid_fanout(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	const commit_graph_chunk *chunk)
+{
+	uint32_t i, nr = 0;
+
+	if (!chunk->offset)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk->length != COMMIT_GRAPH_FANOUT_SIZE)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk->offset);
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+
+	file->num_commits = nr;
+	return 0;
+}
+
+static int commit_graph_parse_bloom(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	const commit_graph_chunk *index,
+	const commit_graph_chunk *filters)
+{
+	/* git leaves the filters out rather than write half of them */
+	if (!index->offset || !filters->offset)
+		return 0;
+
+	if (index->length != file->num_commits * (size_t)4)
+		return commit_graph_error("invalid Bloom Filter Index chunk");
+	if (filters->length < COMMIT_GRAPH_BLOOM_HEADER_SIZE)
+		return commit_graph_error("invalid Bloom Filter Data chunk");
+
+	file->bloom_version = commit_graph_get_be32(data + filters->offset);
+	file->bloom_num_hashes = commit_graph_get_be32(data + filters->offset + 4);
+
+	/* filters we cannot read only make walks slower */
+	if ((file->bloom_version != 1 && file->bloom_version != GIT_BLOOM_VERSION) ||
+		file->bloom_num_hashes == 0)
+		return 0;
+
+	file->bloom_index = data + index->offset;
+	file->bloom_data = data + filters->offset + COMMIT_GRAPH_BLOOM_HEADER_SIZE;
+	file->bloom_data_len = filters->length - COMMIT_GRAPH_BLOOM_HEADER_SIZE;
+	return 0;
+}
+
+static int commit_graph_parse(
+	git_commit_graph_file *file, const unsigned char *data, size_t size)
+{
+	const struct git_commit_graph_header *hdr =
+		(const struct git_commit_graph_header *)data;
+	const unsigned char *chunk_hdr;
+	commit_graph_chunk *last_chunk = NULL, unknown_chunk;
+	commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
+		chunk_commit_data = {0}, chunk_extra_edge_list = {0},
+		chunk_bloom_index = {0}, chunk_bloom_data = {0};
+	size_t trailer_offset, last_offset;
+	uint32_t i;
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("file is too short");
+
+	if (ntohl(hdr->signature) != COMMIT_GRAPH_SIGNATURE ||
+		hdr->version != COMMIT_GRAPH_VERSION ||
+		hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION)
+		return commit_graph_error("unsupported file header");
+
+	if (hdr->base_graph_files != 0)
+		return commit_graph_error("chained commit-graphs are not supported");
+
+	trailer_offset = size - GIT_OID_RAWSZ;
+	last_offset = sizeof(struct git_commit_graph_header) +
+		(hdr->chunks + 1) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+
+	if (trailer_offset < last_offset)
+		return commit_graph_error("wrong chunk table size");
+
+	/* The same chunk table as a multi-pack-index */
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	for (i = 0; i <= hdr->chunks; ++i, chunk_hdr += COMMIT_GRAPH_CHUNK_ENTRY_SIZE) {
+		uint64_t offset = commit_graph_get_be64(chunk_hdr + 4);
+
+		if (offset < last_offset || offset > trailer_offset)
+			return commit_graph_error("chunk offset out of range");
+
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)offset - last_chunk->offset;
+
+		if (i == hdr->chunks)
+			break;
+
+		switch (commit_graph_get_be32(chunk_hdr)) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			last_chunk = &chunk_oid_fanout;
+			break;
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			last_chunk = &chunk_oid_lookup;
+			break;
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			last_chunk = &chunk_commit_data;
+			break;
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			last_chunk = &chunk_extra_edge_list;
+			break;
+		case COMMIT_GRAPH_BLOOM_INDEX_ID:
+			last_chunk = &chunk_bloom_index;
+			break;
+		case COMMIT_GRAPH_BLOOM_DATA_ID:
+			last_chunk = &chunk_bloom_data;
+			break;
+		default:
+			/* optional chunks we do not use */
+			last_chunk = &unknown_chunk;
+			break;
+		}
+
+		last_chunk->offset = (size_t)offset;
+		last_offset = (size_t)offset;
+	}
+
+	if (commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout) < 0)
+		return -1;
+
+	if (!chunk_oid_lookup.offset ||
+		chunk_oid_lookup.length != file->num_commits * (size_t)GIT_OID_RAWSZ)
+		return commit_graph_error("missing or invalid OID Lookup chunk");
+	file->oid_lookup = (const git_oid *)(data + chunk_oid_lookup.offset);
+
+	if (!chunk_commit_data.offset ||
+		chunk_commit_data.length !=
+			file->num_commits * (size_t)COMMIT_GRAPH_DATA_ENTRY_SIZE)
+		return commit_graph_error("missing or invalid Commit Data chunk");
+	file->commit_data = data + chunk_commit_data.offset;
+
+	if (chunk_extra_edge_list.offset) {
+		if (chunk_extra_edge_list.length % 4 != 0)
+			return commit_graph_error("invalid Extra Edge List chunk");
+		file->extra_edge_list = data + chunk_extra_edge_list.offset;
+		file->num_extra_edge_list = chunk_extra_edge_list.length / 4;
+	}
+
+	if (commit_graph_parse_bloom(file, data,
+			&chunk_bloom_index, &chunk_bloom_data) < 0)
+		return -1;
+
+	git_oid_fromraw(&file->checksum, data + trailer_offset);
+	return 0;
+}
+
+static void commit_graph_free(git_commit_graph_file *file)
+{
+	git_futils_mmap_free(&file->graph_map);
+	git__free(file);
+}
+
+int git_commit_graph_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	int error;
+
+	*file_out = NULL;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+	if ((error = git_futils_mmap_ro_file(&file->graph_map, path)) < 0) {
+		git__free(file);
+		return error;
+	}
+
+	p_madvise(&file->graph_map, GIT_MADV_RANDOM);
+
+	if (commit_graph_parse(file, file->graph_map.data, file->graph_map.len) < 0) {
+		commit_graph_free(file);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(file);
+	*file_out = file;
+	return 0;
+}
+
+bool git_commit_graph_needs_refresh(
+	const git_commit_graph_file *file, const char *path)
+{
+	git_file fd;
+	struct stat st;
+	git_oid checksum;
+	int error;
+
+	if ((fd = git_futils_open_ro(path)) < 0) {
+		giterr_clear();
+		return true;
+	}
+
+	error = p_fstat(fd, &st) < 0 ||
+		!S_ISREG(st.st_mode) ||
+		(size_t)st.st_size != file->graph_map.len ||
+		p_lseek(fd, -GIT_OID_RAWSZ, SEEK_END) < 0 ||
+		p_read(fd, checksum.id, GIT_OID_RAWSZ) < 0;
+
+	p_close(fd);
+
+	return error || git_oid_cmp(&checksum, &file->checksum) != 0;
+}
+
+static int commit_graph_entry_get_byindex(
+	git_commit_graph_entry *e,
+	const git_commit_graph_file *file,
+	size_t pos)
+{
+	const unsigned char *commit_data;
+	uint32_t parent1, parent2, word;
+
+	if (pos >= file->num_commits)
+		return commit_graph_error("commit index out of range");
+
+	commit_data = file->commit_data + pos * COMMIT_GRAPH_DATA_ENTRY_SIZE;
+
+	git_oid_cpy(&e->sha1, &file->oid_lookup[pos]);
+	git_oid_fromraw(&e->tree_oid, commit_data);
+
+	parent1 = commit_graph_get_be32(commit_data + GIT_OID_RAWSZ);
+	parent2 = commit_graph_get_be32(commit_data + GIT_OID_RAWSZ + 4);
+
+	/* 30 bits of generation, then a 34-bit commit time */
+	word = commit_graph_get_be32(commit_data + GIT_OID_RAWSZ + 8);
+	e->generation = word >> 2;
+	e->commit_time = (git_time_t)(((uint64_t)(word & 0x3) << 32) |
+		commit_graph_get_be32(commit_data + GIT_OID_RAWSZ + 12));
+
+	e->parent_count = 0;
+	e->extra_parents_index = 0;
+
+	if (parent1 == COMMIT_GRAPH_PARENT_NONE)
+		return 0;
+
+	if (parent1 >= file->num_commits)
+		return commit_graph_error("parent index out of range");
+
+	e->parent_indices[0] = parent1;
+	e->parent_count = 1;
+
+	if (parent2 == COMMIT_GRAPH_PARENT_NONE)
+		return 0;
+
+	if (parent2 & COMMIT_GRAPH_EXTRA_EDGES_NEEDED) {
+		size_t edge = parent2 & ~COMMIT_GRAPH_EXTRA_EDGES_NEEDED;
+
+		/* the second parent is the first of the extra edges */
+		do {
+			if (edge >= file->num_extra_edge_list)
+				return commit_graph_error("extra edge index out of range");
+
+			word = commit_graph_get_be32(file->extra_edge_list + 4 * edge);
+			if (e->parent_count == 1) {
+				e->parent_indices[1] = word & ~COMMIT_GRAPH_LAST_EDGE;
+				e->extra_parents_index = edge;
+			}
+
+			e->parent_count++;
+			edge++;
+		} while (!(word & COMMIT_GRAPH_LAST_EDGE));
+	} else {
+		e->parent_indices[1] = parent2;
+		e->parent_count = 2;
+	}
+
+	if (e->parent_indices[1] >= file->num_commits)
+		return commit_graph_error("parent index out of range");
+
+	return 0;
+}
+
+static int commit_graph_find_pos(
+	const git_commit_graph_file *file, const git_oid *oid)
+{
+	unsigned hi, lo;
+
+	hi = ntohl(file->oid_fanout[(int)oid->id[0]]);
+	lo = ((oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)oid->id[0] - 1]));
+
+	return sha1_entry_pos(file->oid_lookup, GIT_OID_RAWSZ, 0,
+		lo, hi, file->num_commits, oid->id);
+}
+
+int git_commit_graph_entry_find(
+	git_commit_graph_entry *e,
+	const git_commit_graph_file *file,
+	const git_oid *oid)
+{
+	int pos = commit_graph_find_pos(file, oid);
+
+	if (pos < 0)
+		return GIT_ENOTFOUND;
+
+	return commit_graph_entry_get_byindex(e, file, (size_t)pos);
+}
+
+int git_commit_graph_bloom_find(
+	git_bloom_filter *filter,
+	const git_commit_graph_file *file,
+	const git_oid *oid)
+{
+	size_t start = 0, end;
+	int pos;
+
+	if (file->bloom_index == NULL ||
+		(pos = commit_graph_find_pos(file, oid)) < 0)
+		return GIT_ENOTFOUND;
+
+	if (pos > 0)
+		start = commit_graph_get_be32(file->bloom_index + 4 * (pos - 1));
+	end = commit_graph_get_be32(file->bloom_index + 4 * pos);
+
+	if (start > end || end > file->bloom_data_len)
+		return commit_graph_error("Bloom filter out of range");
+
+	filter->data = file->bloom_data + start;
+	filter->len = end - start;
+	filter->num_hashes = file->bloom_num_hashes;
+	return 0;
+}
+
+int git_commit_graph_entry_parent(
+	git_commit_graph_entry *parent,
+	const git_commit_graph_file *file,
+	const git_commit_graph_entry *entry,
+	size_t n)
+{
+	uint32_t word;
+
+	if (n >= entry->parent_count) {
+		giterr_set(GITERR_INVALID, "Parent index %u out of range", (unsigned)n);
+		return -1;
+	}
+
+	if (n < 2)
+		return commit_graph_entry_get_byindex(
+			parent, file, entry->parent_indices[n]);
+
+	/* checked by commit_graph_entry_get_byindex() for this entry */
+	word = commit_graph_get_be32(
+		file->extra_edge_list + 4 * (entry->extra_parents_index + n - 1));
+
+	return commit_graph_entry_get_byindex(
+		parent, file, word & ~COMMIT_GRAPH_LAST_EDGE);
+}
+
+void git_commit_graph_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+	GIT_REFCOUNT_DEC(file, commit_graph_free);
+}
+
+/***********************************************************
+ *
+ * COMMIT-GRAPH WRITER
+ *
+ ***********************************************************/
+
+typedef struct graph_commit {
+	git_oid id;
+	git_oid tree_id;
+	git_time_t time;
+	uint32_t generation;
+	uint32_t index;
+	/* where its Bloom filter ends in the Bloom Filter Data */
+	uint32_t bloom_end;
+	unsigned int parsed:1;
+
+	size_t parent_count;
+	struct graph_commit **parents;
+} graph_commit;
+
+struct graph_writer {
+	git_repository *repo;
+	git_oidmap *commits;
+	git_pool commit_pool;
+	git_vector sorted;
+	git_vector stack;
+	size_t num_extra_edges;
+
+	/* changed-path Bloom filters */
+	unsigned int flags;
+	git_buf bloom_data;
+	git_buf path;
+	git_bloom_key *keys;
+	size_t keys_len, keys_alloc;
+	size_t changed;
+};
+
+static graph_commit *graph_writer_get(struct graph_writer *w, const git_oid *id)
+{
+	graph_commit *commit;
+	khiter_t pos;
+	int ret;
+
+	pos = kh_get(oid, w->commits, id);
+	if (pos != kh_end(w->commits))
+		return kh_value(w->commits, pos);
+
+	commit = git_pool_malloc(&w->commit_pool, 1);
+	if (commit == NULL)
+		return NULL;
+
+	memset(commit, 0x0, sizeof(graph_commit));
+	git_oid_cpy(&commit->id, id);
+
+	pos = kh_put(oid, w->commits, &commit->id, &ret);
+	assert(ret != 0);
+	kh_value(w->commits, pos) = commit;
+
+	if (git_vector_insert(&w->sorted, commit) < 0)
+		return NULL;
+
+	return commit;
+}
+
+static int graph_writer_parse(struct graph_writer *w, graph_commit *commit)
+{
+	git_commit *c;
+	unsigned int i;
+	int error = 0;
+
+	if (git_commit_lookup(&c, w->repo, &commit->id) < 0)
+		return -1;
+
+	git_oid_cpy(&commit->tree_id, git_commit_tree_oid(c));
+	commit->time = git_commit_time(c);
+	commit->parent_count = git_commit_parentcount(c);
+
+	if (commit->parent_count > 0) {
+		commit->parents = git__calloc(commit->parent_count, sizeof(graph_commit *));
+		if (commit->parents == NULL) {
+			error = -1;
+			goto cleanup;
+		}
+	}
+
+	if (commit->parent_count > 2)
+		w->num_extra_edges += commit->parent_count - 1;
+
+	for (i = 0; i < commit->parent_count; ++i) {
+		graph_commit *parent = graph_writer_get(w, git_commit_parent_oid(c, i));
+
+		if (parent == NULL) {
+			error = -1;
+			goto cleanup;
+		}
+
+		commit->parents[i] = parent;
+		if (!parent->parsed && git_vector_insert(&w->stack, parent) < 0) {
+			error = -1;
+			goto cleanup;
+		}
+	}
+
+	commit->parsed = 1;
+
+cleanup:
+	git_commit_free(c);
+	return error;
+}
+
+static int graph_writer_add_tip(struct graph_writer *w, git_reference *ref)
+{
+	git_object *obj;
+	graph_commit *commit;
+	int error;
+
+	if ((error = git_reference_peel(&obj, ref, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	/* tags of trees and blobs add nothing to the graph */
+	if (git_object_type(obj) != GIT_OBJ_COMMIT) {
+		git_object_free(obj);
+		return 0;
+	}
+
+	commit = graph_writer_get(w, git_object_id(obj));
+	git_object_free(obj);
+	GITERR_CHECK_ALLOC(commit);
+
+	if (commit->parsed)
+		return 0;
+
+	return git_vector_insert(&w->stack, commit);
+}
+
+static int graph_writer_add_ref__cb(const char *refname, void *data)
+{
+	struct graph_writer *w = data;
+	git_reference *ref;
+	int error;
+
+	if (git_reference_lookup(&ref, w->repo, refname) < 0)
+		return -1;
+
+	error = graph_writer_add_tip(w, ref);
+	git_reference_free(ref);
+
+	return error;
+}
+
+static int graph_writer_add_head(struct graph_writer *w)
+{
+	git_reference *head;
+	int error;
+
+	if ((error = git_reference_lookup(&head, w->repo, GIT_HEAD_FILE)) < 0)
+		return error;
+
+	error = graph_writer_add_tip(w, head);
+	git_reference_free(head);
+
+	/* an orphaned HEAD has nothing to add */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static int graph_writer_collect(struct graph_writer *w)
+{
+	graph_commit *commit;
+
+	if (git_reference_foreach(w->repo, GIT_REF_LISTALL,
+			graph_writer_add_ref__cb, w) < 0 ||
+		graph_writer_add_head(w) < 0)
+		return -1;
+
+	while ((commit = git_vector_last(&w->stack)) != NULL) {
+		git_vector_pop(&w->stack);
+
+		if (!commit->parsed && graph_writer_parse(w, commit) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Give each commit one more than the largest generation of its
+ * parents, without recursing: a commit stays on the stack until all
+ * of its parents have a generation.
+ */
+static int graph_writer_generations(struct graph_writer *w)
+{
+	graph_commit *commit;
+	size_t i, j;
+
+	git_vector_foreach(&w->sorted, i, commit) {
+		if (commit->generation)
+			continue;
+
+		if (git_vector_insert(&w->stack, commit) < 0)
+			return -1;
+
+		while ((commit = git_vector_last(&w->stack)) != NULL) {
+			uint32_t generation = 0;
+			bool ready = true;
+
+			for (j = 0; j < commit->parent_count; ++j) {
+				graph_commit *parent = commit->parents[j];
+
+				if (!parent->generation) {
+					if (git_vector_insert(&w->stack, parent) < 0)
+						return -1;
+					ready = false;
+				} else if (parent->generation > generation)
+					generation = parent->generation;
+			}
+
+			if (!ready)
+				continue;
+
+			commit->generation = (generation < COMMIT_GRAPH_GENERATION_MAX) ?
+				generation + 1 : COMMIT_GRAPH_GENERATION_MAX;
+			git_vector_pop(&w->stack);
+		}
+	}
+
+	return 0;
+}
+
+static int graph_bloom_add_path(struct graph_writer *w)
+{
+	if (w->keys_len == w->keys_alloc) {
+		size_t alloc = w->keys_alloc ? w->keys_alloc * 2 : 64;
+		git_bloom_key *keys = git__realloc(w->keys, alloc * sizeof(git_bloom_key));
+
+		GITERR_CHECK_ALLOC(keys);
+		w->keys = keys;
+		w->keys_alloc = alloc;
+	}
+
+	git_bloom_key_init(&w->keys[w->keys_len++], w->path.ptr, w->path.size);
+	return 0;
+}
+
+static int graph_bloom_diff(
+	struct graph_writer *w, git_tree *old_tree, git_tree *new_tree);
+
+/*
+ * One entry that differs: a file counts as a change, a tree as the
+ * directory plus every change below it.
+ */
+static int graph_bloom_diff_entry(
+	struct graph_writer *w,
+	const git_tree_entry *old_entry,
+	const git_tree_entry *new_entry)
+{
+	const git_tree_entry *entry = new_entry ? new_entry : old_entry;
+	git_tree *trees[2] = { NULL, NULL };
+	size_t path_len = w->path.size;
+	int error = 0;
+
+	if (path_len > 0)
+		git_buf_putc(&w->path, '/');
+	git_buf_puts(&w->path, git_tree_entry_name(entry));
+	if (git_buf_oom(&w->path))
+		return -1;
+
+	if ((old_entry && git_tree_entry_type(old_entry) != GIT_OBJ_TREE) ||
+		(new_entry && git_tree_entry_type(new_entry) != GIT_OBJ_TREE)) {
+		w->changed++;
+		error = graph_bloom_add_path(w);
+	}
+
+	if (!error && old_entry && git_tree_entry_type(old_entry) == GIT_OBJ_TREE)
+		error = git_tree_lookup(&trees[0], w->repo, git_tree_entry_id(old_entry));
+	if (!error && new_entry && git_tree_entry_type(new_entry) == GIT_OBJ_TREE)
+		error = git_tree_lookup(&trees[1], w->repo, git_tree_entry_id(new_entry));
+
+	if (!error && (trees[0] || trees[1])) {
+		if ((error = graph_bloom_add_path(w)) == 0)
+			error = graph_bloom_diff(w, trees[0], trees[1]);
+	}
+
+	git_tree_free(trees[0]);
+	git_tree_free(trees[1]);
+	git_buf_truncate(&w->path, path_len);
+	return error;
+}
+
+/*
+ * Collect the keys of the paths that differ between two trees, either
+ * of which may be NULL, giving up past GIT_BLOOM_MAX_CHANGED_PATHS.
+ */
+static int graph_bloom_diff(
+	struct graph_writer *w, git_tree *old_tree, git_tree *new_tree)
+{
+	const git_tree_entry *old_entry, *new_entry;
+	unsigned int i, n;
+	int error = 0;
+
+	n = new_tree ? git_tree_entrycount(new_tree) : 0;
+	for (i = 0; i < n && !error; ++i) {
+		new_entry = git_tree_entry_byindex(new_tree, i);
+		old_entry = old_tree ?
+			git_tree_entry_byname(old_tree, git_tree_entry_name(new_entry)) : NULL;
+
+		if (old_entry &&
+			git_tree_entry_filemode(old_entry) == git_tree_entry_filemode(new_entry) &&
+			git_oid_cmp(git_tree_entry_id(old_entry), git_tree_entry_id(new_entry)) == 0)
+			continue;
+
+		error = graph_bloom_diff_entry(w, old_entry, new_entry);
+		if (w->changed > GIT_BLOOM_MAX_CHANGED_PATHS)
+			return error;
+	}
+
+	n = old_tree ? git_tree_entrycount(old_tree) : 0;
+	for (i = 0; i < n && !error; ++i) {
+		old_entry = git_tree_entry_byindex(old_tree, i);
+
+		/* the entries on both sides were looked at above */
+		if (new_tree &&
+			git_tree_entry_byname(new_tree, git_tree_entry_name(old_entry)) != NULL)
+			continue;
+
+		error = graph_bloom_diff_entry(w, old_entry, NULL);
+		if (w->changed > GIT_BLOOM_MAX_CHANGED_PATHS)
+			return error;
+	}
+
+	return error;
+}
+
+static int graph_bloom_compute(struct graph_writer *w, graph_commit *commit)
+{
+	git_tree *old_tree = NULL, *new_tree = NULL;
+	size_t start = w->bloom_data.size, len, i;
+	int error;
+
+	w->keys_len = 0;
+	w->changed = 0;
+	git_buf_clear(&w->path);
+
+	/* the filter is against the first parent, like git's */
+	if ((error = git_tree_lookup(&new_tree, w->repo, &commit->tree_id)) < 0 ||
+		(commit->parent_count > 0 &&
+		 (error = git_tree_lookup(&old_tree, w->repo,
+			&commit->parents[0]->tree_id)) < 0) ||
+		(error = graph_bloom_diff(w, old_tree, new_tree)) < 0)
+		goto cleanup;
+
+	if (w->changed > GIT_BLOOM_MAX_CHANGED_PATHS) {
+		/* a single byte with every bit set says "maybe" to anything */
+		error = git_buf_putc(&w->bloom_data, (char)0xff);
+	} else {
+		len = (w->keys_len * GIT_BLOOM_BITS_PER_ENTRY + 7) / 8;
+		if (!len)
+			len = 1;
+
+		if ((error = git_buf_grow(&w->bloom_data, start + len + 1)) < 0)
+			goto cleanup;
+
+		memset(w->bloom_data.ptr + start, 0x0, len);
+		for (i = 0; i < w->keys_len; ++i)
+			git_bloom_filter_add((unsigned char *)w->bloom_data.ptr + start,
+				len, GIT_BLOOM_NUM_HASHES, &w->keys[i]);
+
+		w->bloom_data.size = start + len;
+		w->bloom_data.ptr[w->bloom_data.size] = '\0';
+	}
+
+	commit->bloom_end = (uint32_t)w->bloom_data.size;
+
+cleanup:
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	return error;
+}
+
+static int graph_writer_bloom_filters(struct graph_writer *w)
+{
+	graph_commit *commit;
+	size_t i;
+
+	git_vector_foreach(&w->sorted, i, commit) {
+		if (graph_bloom_compute(w, commit) < 0)
+			return -1;
+	}
+
+	if (w->bloom_data.size > UINT32_MAX) {
+		giterr_set(GITERR_ODB, "Too many changed paths for a commit-graph");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int graph_commit_cmp(const void *a_, const void *b_)
+{
+	const graph_commit *a = a_, *b = b_;
+	return git_oid_cmp(&a->id, &b->id);
+}
+
+static int graph_write_be32(git_filebuf *file, uint32_t value)
+{
+	value = htonl(value);
+	return git_filebuf_write(file, &value, sizeof(value));
+}
+
+static int graph_write_be64(git_filebuf *file, uint64_t value)
+{
+	if (graph_write_be32(file, (uint32_t)(value >> 32)) < 0)
+		return -1;
+	return graph_write_be32(file, (uint32_t)value);
+}
+
+static int graph_write_chunk_entry(git_filebuf *file, uint32_t id, size_t offset)
+{
+	if (graph_write_be32(file, id) < 0)
+		return -1;
+	return graph_write_be64(file, (uint64_t)offset);
+}
+
+static int graph_write_commit_data(
+	git_filebuf *file, graph_commit *commit, size_t *extra_edges)
+{
+	uint32_t parent1 = COMMIT_GRAPH_PARENT_NONE,
+		parent2 = COMMIT_GRAPH_PARENT_NONE;
+	uint64_t time = (uint64_t)commit->time & COMMIT_GRAPH_TIME_MASK;
+
+	if (commit->parent_count > 0)
+		parent1 = commit->parents[0]->index;
+
+	if (commit->parent_count > 2) {
+		parent2 = COMMIT_GRAPH_EXTRA_EDGES_NEEDED | (uint32_t)*extra_edges;
+		*extra_edges += commit->parent_count - 1;
+	} else if (commit->parent_count == 2)
+		parent2 = commit->parents[1]->index;
+
+	if (git_filebuf_write(file, commit->tree_id.id, GIT_OID_RAWSZ) < 0 ||
+		graph_write_be32(file, parent1) < 0 ||
+		graph_write_be32(file, parent2) < 0 ||
+		graph_write_be32(file,
+			(commit->generation << 2) | (uint32_t)(time >> 32)) < 0 ||
+		graph_write_be32(file, (uint32_t)time) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int graph_write_file(struct graph_writer *w, git_filebuf *file)
+{
+	struct git_commit_graph_header hdr;
+	graph_commit *commit;
+	uint32_t fanout[256];
+	size_t i, j, offset, extra_edges = 0;
+	git_oid checksum;
+
+	memset(fanout, 0x0, sizeof(fanout));
+	git_vector_foreach(&w->sorted, i, commit)
+		fanout[commit->id.id[0]]++;
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = 3;
+	if (w->num_extra_edges)
+		hdr.chunks++;
+	if (w->flags & GIT_COMMIT_GRAPH_CHANGED_PATHS)
+		hdr.chunks += 2;
+	hdr.base_graph_files = 0;
+
+	if (git_filebuf_write(file, &hdr, sizeof(hdr)) < 0)
+		return -1;
+
+	offset = sizeof(hdr) + (hdr.chunks + 1) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+
+	if (graph_write_chunk_entry(file, COMMIT_GRAPH_OID_FANOUT_ID, offset) < 0)
+		return -1;
+	offset += COMMIT_GRAPH_FANOUT_SIZE;
+
+	if (graph_write_chunk_entry(file, COMMIT_GRAPH_OID_LOOKUP_ID, offset) < 0)
+		return -1;
+	offset += w->sorted.length * GIT_OID_RAWSZ;
+
+	if (graph_write_chunk_entry(file, COMMIT_GRAPH_COMMIT_DATA_ID, offset) < 0)
+		return -1;
+	offset += w->sorted.length * COMMIT_GRAPH_DATA_ENTRY_SIZE;
+
+	if (w->num_extra_edges) {
+		if (graph_write_chunk_entry(file, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset) < 0)
+			return -1;
+		offset += w->num_extra_edges * 4;
+	}
+
+	if (w->flags & GIT_COMMIT_GRAPH_CHANGED_PATHS) {
+		if (graph_write_chunk_entry(file, COMMIT_GRAPH_BLOOM_INDEX_ID, offset) < 0)
+			return -1;
+		offset += w->sorted.length * 4;
+
+		if (graph_write_chunk_entry(file, COMMIT_GRAPH_BLOOM_DATA_ID, offset) < 0)
+			return -1;
+		offset += COMMIT_GRAPH_BLOOM_HEADER_SIZE + w->bloom_data.size;
+	}
+
+	if (graph_write_chunk_entry(file, 0, offset) < 0)
+		return -1;
+
+	for (i = 0; i < 256; ++i)
+		if (graph_write_be32(file, fanout[i]) < 0)
+			return -1;
+
+	git_vector_foreach(&w->sorted, i, commit)
+		if (git_filebuf_write(file, commit->id.id, GIT_OID_RAWSZ) < 0)
+			return -1;
+
+	git_vector_foreach(&w->sorted, i, commit)
+		if (graph_write_commit_data(file, commit, &extra_edges) < 0)
+			return -1;
+
+	git_vector_foreach(&w->sorted, i, commit) {
+		if (commit->parent_count <= 2)
+			continue;
+
+		for (j = 1; j < commit->parent_count; ++j) {
+			uint32_t edge = commit->parents[j]->index;
+
+			if (j == commit->parent_count - 1)
+				edge |= COMMIT_GRAPH_LAST_EDGE;
+
+			if (graph_write_be32(file, edge) < 0)
+				return -1;
+		}
+	}
+
+	if (w->flags & GIT_COMMIT_GRAPH_CHANGED_PATHS) {
+		git_vector_foreach(&w->sorted, i, commit)
+			if (graph_write_be32(file, commit->bloom_end) < 0)
+				return -1;
+
+		if (graph_write_be32(file, GIT_BLOOM_VERSION) < 0 ||
+			graph_write_be32(file, GIT_BLOOM_NUM_HASHES) < 0 ||
+			graph_write_be32(file, GIT_BLOOM_BITS_PER_ENTRY) < 0 ||
+			git_filebuf_write(file, w->bloom_data.ptr, w->bloom_data.size) < 0)
+			return -1;
+	}
+
+	if (git_filebuf_hash(&checksum, file) < 0 ||
+		git_filebuf_write(file, checksum.id, GIT_OID_RAWSZ) < 0)
+		return -1;
+
+	return 0;
+}
+
+int git_commit_graph_write(git_repository *repo, unsigned int flags)
+{
+	struct graph_writer w;
+	git_buf path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	graph_commit *commit;
+	size_t i;
+	int error = -1;
+
+	memset(&w, 0x0, sizeof(w));
+	w.repo = repo;
+	w.flags = flags;
+	git_buf_init(&w.bloom_data, 0);
+	git_buf_init(&w.path, 0);
+
+	w.commits = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(w.commits);
+
+	if (git_vector_init(&w.sorted, 1024, graph_commit_cmp) < 0 ||
+		git_vector_init(&w.stack, 64, NULL) < 0 ||
+		git_pool_init(&w.commit_pool, sizeof(graph_commit), 0) < 0)
+		goto cleanup;
+
+	if (graph_writer_collect(&w) < 0 ||
+		graph_writer_generations(&w) < 0)
+		goto cleanup;
+
+	git_vector_sort(&w.sorted);
+	git_vector_foreach(&w.sorted, i, commit)
+		commit->index = (uint32_t)i;
+
+	if ((flags & GIT_COMMIT_GRAPH_CHANGED_PATHS) &&
+		graph_writer_bloom_filters(&w) < 0)
+		goto cleanup;
+
+	if (git_buf_joinpath(&path, repo->path_repository,
+			GIT_OBJECTS_DIR "info/commit-graph") < 0 ||
+		git_futils_mkpath2file(path.ptr, GIT_OBJECT_DIR_MODE) < 0 ||
+		git_filebuf_open(&file, path.ptr, GIT_FILEBUF_HASH_CONTENTS) < 0)
+		goto cleanup;
+
+	if (graph_write_file(&w, &file) < 0 ||
+		git_filebuf_commit(&file, GIT_PACK_FILE_MODE) < 0) {
+		git_filebuf_cleanup(&file);
+		goto cleanup;
+	}
+
+	error = 0;
+
+cleanup:
+	git_vector_foreach(&w.sorted, i, commit)
+		git__free(commit->parents);
+	git_vector_free(&w.sorted);
+	git_vector_free(&w.stack);
+	git_pool_clear(&w.commit_pool);
+	git_oidmap_free(w.commits);
+	git_buf_free(&w.bloom_data);
+	git_buf_free(&w.path);
+	git__free(w.keys);
+	git_buf_free(&path);
+	return error;
+}
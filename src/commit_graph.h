@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "git2/oid.h"
+#include "git2/repository.h"
+
+#include "common.h"
+#include "bloom.h"
+#include "map.h"
+
+/*
+ * The generation number of a commit that is not in a commit-graph:
+ * larger than any that can be stored in one, and so larger than the
+ * generation of any commit in the graph, ancestors included.
+ */
+#define GIT_COMMIT_GRAPH_GENERATION_INFINITY 0xffffffff
+
+/*
+ * A commit-graph file (`objects/info/commit-graph`), in the same format
+ * as the one written by `git commit-graph write`.
+ *
+ * It holds the sorted ids of a set of commits closed under ancestry,
+ * and for each the id of its tree, its parents (as positions in the
+ * table), its commit time and its generation number: 1 for a root,
+ * one more than the largest generation of its parents otherwise. A
+ * commit's generation is always larger than any of its ancestors'.
+ */
+typedef struct git_commit_graph_file {
+	git_refcount rc;
+
+	git_map graph_map;
+
+	/* The fanout table, 256 entries in network byte order. */
+	const uint32_t *oid_fanout;
+	uint32_t num_commits;
+
+	/* The OID Lookup table: `num_commits` sorted raw commit ids. */
+	const git_oid *oid_lookup;
+
+	/* The Commit Data table: tree, parents, generation and time. */
+	const unsigned char *commit_data;
+
+	/* The Extra Edge List, for the parents of octopus merges. */
+	const unsigned char *extra_edge_list;
+	size_t num_extra_edge_list;
+
+	/*
+	 * The optional changed-path Bloom filters: where each commit's
+	 * filter ends in the data, and the filters themselves.
+	 */
+	const unsigned char *bloom_index;
+	const unsigned char *bloom_data;
+	size_t bloom_data_len;
+	uint32_t bloom_version;
+	uint32_t bloom_num_hashes;
+
+	/* The trailing checksum, used to notice a rewritten file. */
+	git_oid checksum;
+} git_commit_graph_file;
+
+typedef struct git_commit_graph_entry {
+	git_oid sha1;
+	git_oid tree_oid;
+	uint32_t generation;
+	git_time_t commit_time;
+
+	size_t parent_count;
+	/* positions of the first two parents in the graph */
+	size_t parent_indices[2];
+	/* where the others start in the Extra Edge List */
+	size_t extra_parents_index;
+} git_commit_graph_entry;
+
+/*
+ * Map and validate the commit-graph at `path`.  Returns GIT_ENOTFOUND
+ * if the file does not exist.
+ */
+int git_commit_graph_open(git_commit_graph_file **file_out, const char *path);
+
+/*
+ * Returns true when the file at `path` is no longer the one `file`
+ * was read from (it was rewritten or removed).
+ */
+bool git_commit_graph_needs_refresh(
+		const git_commit_graph_file *file, const char *path);
+
+/*
+ * Find the entry of a commit.  Returns GIT_ENOTFOUND if the commit is
+ * not in the graph.
+ */
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *oid);
+
+/*
+ * Get the entry of the `n`th parent of the commit in `entry`.
+ */
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n);
+
+/*
+ * Get the changed-path Bloom filter of a commit.  Returns GIT_ENOTFOUND
+ * if the commit is not in the graph or the graph has no filters.
+ */
+int git_commit_graph_bloom_find(
+		git_bloom_filter *filter,
+		const git_commit_graph_file *file,
+		const git_oid *oid);
+
+/* Drop a reference to the file, unmapping it with the last one. */
+void git_commit_graph_free(git_commit_graph_file *file);
+
+/* Also write a changed-path Bloom filter for every commit. */
+#define GIT_COMMIT_GRAPH_CHANGED_PATHS (1u << 0)
+
+/*
+ * Write `objects/info/commit-graph` for every commit reachable from
+ * the references of `repo` and from its HEAD.
+ */
+int git_commit_graph_write(git_repository *repo, unsigned int flags);
+
+#endif
@@ -36,6 +36,23 @@ static int hdr_sz(
 	return 0;
 }
 
+int git__delta_read_header(
+	size_t *base_out,
+	size_t *result_out,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+
+	if ((hdr_sz(base_out, &delta, delta_end) < 0) ||
+		(hdr_sz(result_out, &delta, delta_end) < 0)) {
+		giterr_set(GITERR_INVALID, "Failed to read delta header");
+		return -1;
+	}
+
+	return 0;
+}
+
 int git__delta_apply(
 	git_rawobj *out,
 	const unsigned char *base,
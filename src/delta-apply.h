@@ -30,4 +30,21 @@ extern int git__delta_apply(
 	const unsigned char *delta,
 	size_t delta_len);
 
+/**
+ * Read the header of a git binary delta.
+ *
+ * @param base_out the size of the base the delta applies to.
+ * @param result_out the size of the result of applying the delta.
+ * @param delta the start of the delta; only its header is needed.
+ * @param delta_len number of bytes available at delta.
+ * @return
+ * - 0 on success;
+ * - GIT_ERROR if the header is corrupt or truncated.
+ */
+extern int git__delta_read_header(
+	size_t *base_out,
+	size_t *result_out,
+	const unsigned char *delta,
+	size_t delta_len);
+
 #endif
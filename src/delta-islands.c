@@ -0,0 +1,540 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "delta-islands.h"
+
+#include "buffer.h"
+#include "pool.h"
+#include "strmap.h"
+#include "tree.h"
+#include "vector.h"
+
+#include "git2/commit.h"
+#include "git2/config.h"
+#include "git2/refs.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+
+GIT__USE_OIDMAP;
+GIT__USE_STRMAP;
+
+#define ISLAND_MAX_GROUPS 8
+
+struct island_mark {
+	git_oid id;
+	struct git_island_bitmap *bitmap;
+};
+
+struct island_tip {
+	git_oid id;
+	unsigned int island;
+};
+
+struct git_delta_islands {
+	git_packbuilder *pb;
+
+	git_vector regexes;
+	git_strmap *names; /* island name -> index + 1 */
+	git_pool name_pool;
+	git_vector tips;
+
+	git_oidmap *marks; /* oid -> struct island_mark */
+	git_pool mark_pool;
+	unsigned int words;
+};
+
+static struct git_island_bitmap *bitmap_new(
+	struct git_delta_islands *islands, const struct git_island_bitmap *from)
+{
+	size_t size = islands->words * sizeof(uint32_t);
+	struct git_island_bitmap *b = git__malloc(sizeof(*b) + size);
+
+	if (!b)
+		return NULL;
+
+	b->refcount = 1;
+	if (from)
+		memcpy(b->bits, from->bits, size);
+	else
+		memset(b->bits, 0, size);
+
+	return b;
+}
+
+static void bitmap_decref(struct git_island_bitmap *b)
+{
+	if (b && --b->refcount == 0)
+		git__free(b);
+}
+
+static bool bitmap_is_subset(
+	struct git_delta_islands *islands,
+	const struct git_island_bitmap *self,
+	const struct git_island_bitmap *super)
+{
+	unsigned int i;
+
+	if (self == super)
+		return true;
+
+	for (i = 0; i < islands->words; ++i)
+		if (self->bits[i] & ~super->bits[i])
+			return false;
+
+	return true;
+}
+
+/* Make sure `mark` owns its bitmap before modifying it */
+static int mark_make_private(
+	struct git_delta_islands *islands, struct island_mark *mark)
+{
+	struct git_island_bitmap *copy;
+
+	if (mark->bitmap && mark->bitmap->refcount == 1)
+		return 0;
+
+	copy = bitmap_new(islands, mark->bitmap);
+	GITERR_CHECK_ALLOC(copy);
+
+	bitmap_decref(mark->bitmap);
+	mark->bitmap = copy;
+	return 0;
+}
+
+static struct island_mark *mark_lookup(
+	struct git_delta_islands *islands, const git_oid *oid)
+{
+	khiter_t pos = kh_get(oid, islands->marks, oid);
+
+	if (pos == kh_end(islands->marks))
+		return NULL;
+
+	return kh_value(islands->marks, pos);
+}
+
+static struct island_mark *mark_get(
+	struct git_delta_islands *islands, const git_oid *oid)
+{
+	struct island_mark *mark;
+	khiter_t pos;
+	int ret;
+
+	if ((mark = mark_lookup(islands, oid)) != NULL)
+		return mark;
+
+	mark = git_pool_malloc(&islands->mark_pool, 1);
+	if (!mark)
+		return NULL;
+
+	git_oid_cpy(&mark->id, oid);
+	mark->bitmap = NULL;
+
+	pos = kh_put(oid, islands->marks, &mark->id, &ret);
+	if (ret < 0) {
+		giterr_set_oom();
+		return NULL;
+	}
+	kh_value(islands->marks, pos) = mark;
+
+	return mark;
+}
+
+/*
+ * Add the islands of `from` to the object `oid`. Returns 1 when
+ * this taught the object about a new island, 0 when it already
+ * knew about all of them, and -1 on error.
+ */
+static int mark_propagate(
+	struct git_delta_islands *islands, const git_oid *oid,
+	struct git_island_bitmap *from)
+{
+	struct island_mark *mark;
+	unsigned int i;
+
+	if ((mark = mark_get(islands, oid)) == NULL)
+		return -1;
+
+	if (!mark->bitmap) {
+		mark->bitmap = from;
+		from->refcount++;
+		return 1;
+	}
+
+	if (bitmap_is_subset(islands, from, mark->bitmap))
+		return 0;
+
+	if (mark_make_private(islands, mark) < 0)
+		return -1;
+
+	for (i = 0; i < islands->words; ++i)
+		mark->bitmap->bits[i] |= from->bits[i];
+
+	return 1;
+}
+
+static bool in_pack(struct git_delta_islands *islands, const git_oid *oid)
+{
+	return git_oidtable_get(islands->pb->object_ix, oid) != NULL;
+}
+
+static int config_island_cb(const char *value, void *payload)
+{
+	struct git_delta_islands *islands = payload;
+	regex_t *regex;
+	int error;
+
+	regex = git__malloc(sizeof(*regex));
+	GITERR_CHECK_ALLOC(regex);
+
+	if ((error = regcomp(regex, value, REG_EXTENDED)) != 0) {
+		giterr_set_regex(regex, error);
+		regfree(regex);
+		git__free(regex);
+		return -1;
+	}
+
+	if (git_vector_insert(&islands->regexes, regex) < 0) {
+		regfree(regex);
+		git__free(regex);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int island_index(
+	unsigned int *out, struct git_delta_islands *islands, const char *name)
+{
+	khiter_t pos;
+	char *key;
+	int ret;
+
+	pos = git_strmap_lookup_index(islands->names, name);
+	if (git_strmap_valid_index(islands->names, pos)) {
+		*out = (unsigned int)(uintptr_t)git_strmap_value_at(islands->names, pos) - 1;
+		return 0;
+	}
+
+	key = git_pool_strdup(&islands->name_pool, name);
+	GITERR_CHECK_ALLOC(key);
+
+	*out = git_strmap_num_entries(islands->names);
+	git_strmap_insert(islands->names, key, (void *)(uintptr_t)(*out + 1), ret);
+	if (ret < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ref_island_cb(const char *refname, void *payload)
+{
+	struct git_delta_islands *islands = payload;
+	regmatch_t matches[ISLAND_MAX_GROUPS + 1];
+	git_buf name = GIT_BUF_INIT;
+	struct island_tip *tip;
+	regex_t *regex = NULL;
+	unsigned int i;
+	int error;
+
+	/* the last matching expression wins */
+	for (i = islands->regexes.length; i > 0; --i) {
+		regex = git_vector_get(&islands->regexes, i - 1);
+		if (regexec(regex, refname, ARRAY_SIZE(matches), matches, 0) == 0)
+			break;
+	}
+
+	if (i == 0)
+		return 0;
+
+	for (i = 1; i < ARRAY_SIZE(matches); ++i) {
+		if (matches[i].rm_so == -1)
+			continue;
+		if (git_buf_len(&name))
+			git_buf_putc(&name, '-');
+		git_buf_put(&name, refname + matches[i].rm_so,
+			matches[i].rm_eo - matches[i].rm_so);
+	}
+
+	/* no capture group: the whole match names the island */
+	if (!git_buf_len(&name))
+		git_buf_put(&name, refname + matches[0].rm_so,
+			matches[0].rm_eo - matches[0].rm_so);
+
+	if (git_buf_oom(&name))
+		return -1;
+
+	tip = git__malloc(sizeof(*tip));
+	if (!tip) {
+		git_buf_free(&name);
+		return -1;
+	}
+
+	error = island_index(&tip->island, islands, git_buf_cstr(&name));
+	git_buf_free(&name);
+
+	if (!error)
+		error = git_reference_name_to_oid(&tip->id, islands->pb->repo, refname);
+
+	/* dangling refs do not define an island */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		git__free(tip);
+		return 0;
+	}
+
+	if (error < 0 || (error = git_vector_insert(&islands->tips, tip)) < 0) {
+		git__free(tip);
+		return error;
+	}
+
+	return 0;
+}
+
+/* Mark a ref tip, and the commit it points to when it is a tag */
+static int mark_tip(
+	struct git_delta_islands *islands, git_revwalk *walk,
+	struct island_tip *tip)
+{
+	struct island_mark *mark;
+	git_object *obj, *peeled = NULL;
+	int error;
+
+	if ((mark = mark_get(islands, &tip->id)) == NULL ||
+	    mark_make_private(islands, mark) < 0)
+		return -1;
+
+	mark->bitmap->bits[tip->island / 32] |= 1u << (tip->island % 32);
+
+	if ((error = git_object_lookup(&obj, islands->pb->repo,
+				       &tip->id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	if (git_object_type(obj) == GIT_OBJ_TAG) {
+		if ((error = git_tag_peel(&peeled, (git_tag *)obj)) < 0)
+			goto cleanup;
+
+		if ((error = mark_propagate(islands,
+				git_object_id(peeled), mark->bitmap)) < 0)
+			goto cleanup;
+	}
+
+	if (git_object_type(peeled ? peeled : obj) == GIT_OBJ_COMMIT)
+		error = git_revwalk_push(walk, git_object_id(peeled ? peeled : obj));
+
+cleanup:
+	git_object_free(peeled);
+	git_object_free(obj);
+	return error;
+}
+
+/*
+ * Push the islands of a tree to its entries. Only objects which are
+ * going into the pack care about their islands, so the walk never
+ * leaves the pack and stops at subtrees which learned nothing new.
+ */
+static int mark_tree(
+	struct git_delta_islands *islands, const git_oid *oid,
+	struct git_island_bitmap *bitmap)
+{
+	git_tree *tree;
+	unsigned int i;
+	int error = 0;
+
+	if (git_tree_lookup(&tree, islands->pb->repo, oid) < 0)
+		return -1;
+
+	for (i = 0; i < tree->entries.length && !error; ++i) {
+		git_tree_entry *entry = tree->entries.contents[i];
+		int changed;
+
+		if (S_ISGITLINK(entry->attr) || !in_pack(islands, &entry->oid))
+			continue;
+
+		if ((changed = mark_propagate(islands, &entry->oid, bitmap)) < 0)
+			error = -1;
+		else if (changed && git_tree_entry__is_tree(entry))
+			error = mark_tree(islands, &entry->oid,
+				mark_lookup(islands, &entry->oid)->bitmap);
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+/*
+ * Walk the history from the island tips, children before parents, so
+ * the islands of a commit are complete by the time it is visited.
+ */
+static int mark_history(struct git_delta_islands *islands, git_revwalk *walk)
+{
+	struct island_mark *mark;
+	const git_oid *tree_oid;
+	git_commit *commit;
+	git_oid oid;
+	unsigned int i;
+	int error, changed;
+
+	while ((error = git_revwalk_next(&oid, walk)) == 0) {
+		if ((mark = mark_lookup(islands, &oid)) == NULL || !mark->bitmap)
+			continue;
+
+		if (git_commit_lookup(&commit, islands->pb->repo, &oid) < 0)
+			return -1;
+
+		for (i = 0; i < git_commit_parentcount(commit) && !error; ++i)
+			if (mark_propagate(islands, git_commit_parent_oid(commit, i),
+					   mark->bitmap) < 0)
+				error = -1;
+
+		tree_oid = git_commit_tree_oid(commit);
+
+		if (!error && in_pack(islands, tree_oid)) {
+			if ((changed = mark_propagate(islands, tree_oid, mark->bitmap)) < 0)
+				error = -1;
+			else if (changed)
+				error = mark_tree(islands, tree_oid,
+					mark_lookup(islands, tree_oid)->bitmap);
+		}
+
+		git_commit_free(commit);
+
+		if (error < 0)
+			return error;
+	}
+
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+static int islands_init(
+	struct git_delta_islands **out, git_packbuilder *pb)
+{
+	struct git_delta_islands *islands;
+
+	*out = NULL;
+
+	islands = git__calloc(1, sizeof(*islands));
+	GITERR_CHECK_ALLOC(islands);
+
+	islands->pb = pb;
+
+	if (git_vector_init(&islands->regexes, 4, NULL) < 0 ||
+	    git_vector_init(&islands->tips, 16, NULL) < 0 ||
+	    git_pool_init(&islands->name_pool, 1, 0) < 0 ||
+	    git_pool_init(&islands->mark_pool, sizeof(struct island_mark),
+		git_pool__suggest_items_per_page(sizeof(struct island_mark))) < 0 ||
+	    (islands->names = git_strmap_alloc()) == NULL ||
+	    (islands->marks = git_oidmap_alloc()) == NULL) {
+		git_delta_islands_free(islands);
+		return -1;
+	}
+
+	*out = islands;
+	return 0;
+}
+
+int git_delta_islands_load(git_packbuilder *pb)
+{
+	struct git_delta_islands *islands;
+	struct island_tip *tip;
+	struct island_mark *mark;
+	git_revwalk *walk = NULL;
+	git_config *config;
+	unsigned int i;
+	khiter_t pos;
+	int error;
+
+	git_delta_islands_free(pb->islands);
+	pb->islands = NULL;
+
+	for (i = 0; i < pb->nr_objects; ++i)
+		pb->object_list[i].island = NULL;
+
+	if (git_repository_config__weakptr(&config, pb->repo) < 0 ||
+	    islands_init(&islands, pb) < 0)
+		return -1;
+
+	if ((error = git_config_get_multivar(config, "pack.island", NULL,
+					     config_island_cb, islands)) < 0 ||
+	    (error = git_reference_foreach(pb->repo, GIT_REF_LISTALL,
+					   ref_island_cb, islands)) < 0)
+		goto cleanup;
+
+	/* no island is configured: every base is fine */
+	if (!islands->tips.length)
+		goto cleanup;
+
+	islands->words = (git_strmap_num_entries(islands->names) + 31) / 32;
+
+	if ((error = git_revwalk_new(&walk, pb->repo)) < 0)
+		goto cleanup;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL);
+
+	git_vector_foreach(&islands->tips, i, tip) {
+		if ((error = mark_tip(islands, walk, tip)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = mark_history(islands, walk)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = pb->object_list + i;
+
+		pos = kh_get(oid, islands->marks, &po->id);
+		if (pos == kh_end(islands->marks))
+			continue;
+
+		mark = kh_value(islands->marks, pos);
+		po->island = mark->bitmap;
+	}
+
+	pb->islands = islands;
+	pb->island_words = islands->words;
+	islands = NULL;
+
+cleanup:
+	git_revwalk_free(walk);
+	git_delta_islands_free(islands);
+	return error;
+}
+
+void git_delta_islands_free(struct git_delta_islands *islands)
+{
+	struct island_mark *mark;
+	struct island_tip *tip;
+	regex_t *regex;
+	unsigned int i;
+
+	if (!islands)
+		return;
+
+	git_vector_foreach(&islands->regexes, i, regex) {
+		regfree(regex);
+		git__free(regex);
+	}
+	git_vector_free(&islands->regexes);
+
+	git_vector_foreach(&islands->tips, i, tip)
+		git__free(tip);
+	git_vector_free(&islands->tips);
+
+	if (islands->marks) {
+		kh_foreach_value(islands->marks, mark,
+			bitmap_decref(mark->bitmap));
+		git_oidmap_free(islands->marks);
+	}
+
+	if (islands->names)
+		git_strmap_free(islands->names);
+
+	git_pool_clear(&islands->name_pool);
+	git_pool_clear(&islands->mark_pool);
+	git__free(islands);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_delta_islands_h__
+#define INCLUDE_delta_islands_h__
+
+#include "common.h"
+#include "pack-objects.h"
+
+/*
+ * Set of islands an object belongs to, one bit per island.
+ *
+ * Bitmaps are shared between objects reachable from the same refs and
+ * copied on write, so most objects of a large repository point to one
+ * of a handful of bitmaps.
+ */
+struct git_island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[GIT_FLEX_ARRAY];
+};
+
+struct git_delta_islands;
+
+/*
+ * Tag every object of the packbuilder with the islands it belongs to.
+ *
+ * Islands are named after the refs reaching an object, as selected by
+ * the `pack.island` regular expressions of the repository config: the
+ * capture groups of the last expression matching a ref name, joined
+ * with '-', give the name of its island.
+ */
+extern int git_delta_islands_load(git_packbuilder *pb);
+
+extern void git_delta_islands_free(struct git_delta_islands *islands);
+
+/*
+ * Can `trg` be stored as a delta against `src`?
+ *
+ * Only if every island the target belongs to also contains the source,
+ * so that a pack for any of those islands never needs an extra base.
+ * Objects outside of all islands may use any base.
+ */
+GIT_INLINE(bool) git_delta_islands_allowed(
+	const git_packbuilder *pb, const git_pobject *trg, const git_pobject *src)
+{
+	unsigned int i;
+
+	if (!pb->islands || !trg->island)
+		return true;
+
+	if (!src->island)
+		return false;
+
+	if (trg->island == src->island)
+		return true;
+
+	for (i = 0; i < pb->island_words; ++i)
+		if (trg->island->bits[i] & ~src->island->bits[i])
+			return false;
+
+	return true;
+}
+
+#endif
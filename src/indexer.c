@@ -90,6 +90,8 @@ static int open_pack(struct git_pack_file **out, const char *filename)
 
 	pack->mwf.fd = fd;
 	pack->mwf.size = (git_off_t)st.st_size;
+	/* we read the pack front to back */
+	pack->mwf.advice = GIT_MADV_SEQUENTIAL;
 
 	*out = pack;
 	return 0;
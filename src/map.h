@@ -23,6 +23,11 @@
 #define GIT_MAP_TYPE	0xf
 #define GIT_MAP_FIXED	0x10
 
+/* p_madvise() advice values */
+#define GIT_MADV_NORMAL		0
+#define GIT_MADV_RANDOM		1
+#define GIT_MADV_SEQUENTIAL	2
+
 #ifdef __amigaos4__
 #define MAP_FAILED 0
 #endif
@@ -43,4 +48,10 @@ typedef struct { /* memory mapped buffer	*/
 extern int p_mmap(git_map *out, size_t len, int prot, int flags, int fd, git_off_t offset);
 extern int p_munmap(git_map *map);
 
+/*
+ * Tell the system how a mapping is going to be read. This is only a
+ * hint: platforms that don't support it quietly ignore it.
+ */
+extern int p_madvise(git_map *map, int advice);
+
 #endif /* INCLUDE_map_h__ */
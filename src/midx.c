@@ -0,0 +1,641 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "midx.h"
+
+#include "fileops.h"
+#include "filebuf.h"
+#include "odb.h"
+#include "pack.h"
+#include "pool.h"
+#include "sha1_lookup.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OBJECT_ID_VERSION 1 /* SHA-1 */
+
+#define MIDX_PACKFILE_NAMES_ID 0x504e414d /* "PNAM" */
+#define MIDX_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define MIDX_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646 /* "OOFF" */
+#define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_CHUNK_ENTRY_SIZE 12
+#define MIDX_CHUNK_ALIGNMENT 4
+#define MIDX_FANOUT_SIZE (256 * 4)
+#define MIDX_OFFSET_ENTRY_SIZE 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct git_midx_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_midx_files;
+	uint32_t packfiles;
+};
+
+typedef struct {
+	size_t offset;
+	size_t length;
+} midx_chunk;
+
+static int midx_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid multi-pack-index file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) midx_get_be32(const unsigned char *data)
+{
+	return ntohl(*(const uint32_t *)data);
+}
+
+GIT_INLINE(uint64_t) midx_get_be64(const unsigned char *data)
+{
+	return ((uint64_t)midx_get_be32(data) << 32) | midx_get_be32(data + 4);
+}
+
+static int midx_parse_packfile_names(
+	git_midx_file *idx,
+	const unsigned char *data,
+	uint32_t packfiles,
+	const midx_chunk *chunk)
+{
+	const char *name = (const char *)(data + chunk->offset);
+	const char *end = name + chunk->length;
+	const char *prev = NULL;
+	uint32_t i;
+
+	if (!chunk->offset)
+		return midx_error("missing Packfile Names chunk");
+
+	if (git_vector_init(&idx->packfile_names, packfiles, NULL) < 0)
+		return -1;
+
+	for (i = 0; i < packfiles; ++i) {
+		size_t len = 0;
+
+		while (name + len < end && name[len] != '\0')
+			len++;
+
+		if (name + len == end || len == 0)
+			return midx_error("truncated Packfile Names chunk");
+
+		if (prev && strcmp(prev, name) >= 0)
+			return midx_error("Packfile Names are not sorted");
+
+		if (git_vector_insert(&idx->packfile_names, (char *)name) < 0)
+			return -1;
+
+		prev = name;
+		name += len + 1;
+	}
+
+	return 0;
+}
+
+static int midx_parse_oid_fanout(
+	git_midx_file *idx,
+	const unsigned char *data,
+	const midx_chunk *chunk)
+{
+	uint32_t i, nr = 0;
+
+	if (!chunk->offset)
+		return midx_error("missing OID Fanout chunk");
+	if (chunk->length != MIDX_FANOUT_SIZE)
+		return midx_error("OID Fanout chunk has wrong length");
+
+	idx->oid_fanout = (const uint32_t *)(data + chunk->offset);
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(idx->oid_fanout[i]);
+		if (n < nr)
+			return midx_error("index is non-monotonic");
+		nr = n;
+	}
+
+	idx->num_objects = nr;
+	return 0;
+}
+
+static int midx_parse(git_midx_file *idx, const unsigned char *data, size_t size)
+{
+	const struct git_midx_header *hdr = (const struct git_midx_header *)data;
+	const unsigned char *chunk_hdr;
+	midx_chunk *last_chunk = NULL, unknown_chunk;
+	midx_chunk chunk_packfile_names = {0}, chunk_oid_fanout = {0},
+		chunk_oid_lookup = {0}, chunk_object_offsets = {0},
+		chunk_object_large_offsets = {0};
+	size_t trailer_offset, last_offset;
+	uint32_t i;
+
+	if (size < sizeof(struct git_midx_header) + GIT_OID_RAWSZ)
+		return midx_error("file is too short");
+
+	if (ntohl(hdr->signature) != MIDX_SIGNATURE ||
+		hdr->version != MIDX_VERSION ||
+		hdr->object_id_version != MIDX_OBJECT_ID_VERSION)
+		return midx_error("unsupported file header");
+
+	if (hdr->base_midx_files != 0)
+		return midx_error("chained multi-pack-indexes are not supported");
+
+	trailer_offset = size - GIT_OID_RAWSZ;
+	last_offset = sizeof(struct git_midx_header) +
+		(hdr->chunks + 1) * MIDX_CHUNK_ENTRY_SIZE;
+
+	if (trailer_offset < last_offset)
+		return midx_error("wrong chunk table size");
+
+	/*
+	 * Each entry gives the offset where its chunk starts; the chunk
+	 * ends where the next one begins, and the table is terminated by
+	 * an entry pointing at the trailer.
+	 */
+	chunk_hdr = data + sizeof(struct git_midx_header);
+	for (i = 0; i <= hdr->chunks; ++i, chunk_hdr += MIDX_CHUNK_ENTRY_SIZE) {
+		uint64_t offset = midx_get_be64(chunk_hdr + 4);
+
+		if (offset < last_offset || offset > trailer_offset)
+			return midx_error("chunk offset out of range");
+
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)offset - last_chunk->offset;
+
+		if (i == hdr->chunks)
+			break;
+
+		switch (midx_get_be32(chunk_hdr)) {
+		case MIDX_PACKFILE_NAMES_ID:
+			last_chunk = &chunk_packfile_names;
+			break;
+		case MIDX_OID_FANOUT_ID:
+			last_chunk = &chunk_oid_fanout;
+			break;
+		case MIDX_OID_LOOKUP_ID:
+			last_chunk = &chunk_oid_lookup;
+			break;
+		case MIDX_OBJECT_OFFSETS_ID:
+			last_chunk = &chunk_object_offsets;
+			break;
+		case MIDX_OBJECT_LARGE_OFFSETS_ID:
+			last_chunk = &chunk_object_large_offsets;
+			break;
+		default:
+			/* optional chunks we do not use */
+			last_chunk = &unknown_chunk;
+			break;
+		}
+
+		last_chunk->offset = (size_t)offset;
+		last_offset = (size_t)offset;
+	}
+
+	if (midx_parse_packfile_names(
+			idx, data, ntohl(hdr->packfiles), &chunk_packfile_names) < 0 ||
+		midx_parse_oid_fanout(idx, data, &chunk_oid_fanout) < 0)
+		return -1;
+
+	if (!chunk_oid_lookup.offset ||
+		chunk_oid_lookup.length != idx->num_objects * (size_t)GIT_OID_RAWSZ)
+		return midx_error("missing or invalid OID Lookup chunk");
+	idx->oid_lookup = (const git_oid *)(data + chunk_oid_lookup.offset);
+
+	if (!chunk_object_offsets.offset ||
+		chunk_object_offsets.length != idx->num_objects * (size_t)MIDX_OFFSET_ENTRY_SIZE)
+		return midx_error("missing or invalid Object Offsets chunk");
+	idx->object_offsets = data + chunk_object_offsets.offset;
+
+	if (chunk_object_large_offsets.offset) {
+		if (chunk_object_large_offsets.length % 8 != 0)
+			return midx_error("invalid Object Large Offsets chunk");
+		idx->object_large_offsets = data + chunk_object_large_offsets.offset;
+		idx->num_object_large_offsets = chunk_object_large_offsets.length / 8;
+	}
+
+	git_oid_fromraw(&idx->checksum, data + trailer_offset);
+	return 0;
+}
+
+int git_midx_open(git_midx_file **idx_out, const char *path)
+{
+	git_midx_file *idx;
+	int error;
+
+	*idx_out = NULL;
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(idx);
+
+	if ((error = git_futils_mmap_ro_file(&idx->index_map, path)) < 0) {
+		git__free(idx);
+		return error;
+	}
+
+	p_madvise(&idx->index_map, GIT_MADV_RANDOM);
+
+	if (midx_parse(idx, idx->index_map.data, idx->index_map.len) < 0) {
+		git_midx_free(idx);
+		return -1;
+	}
+
+	*idx_out = idx;
+	return 0;
+}
+
+bool git_midx_needs_refresh(const git_midx_file *idx, const char *path)
+{
+	git_file fd;
+	struct stat st;
+	git_oid checksum;
+	int error;
+
+	if ((fd = git_futils_open_ro(path)) < 0) {
+		giterr_clear();
+		return true;
+	}
+
+	error = p_fstat(fd, &st) < 0 ||
+		!S_ISREG(st.st_mode) ||
+		(size_t)st.st_size != idx->index_map.len ||
+		p_lseek(fd, -GIT_OID_RAWSZ, SEEK_END) < 0 ||
+		p_read(fd, checksum.id, GIT_OID_RAWSZ) < 0;
+
+	p_close(fd);
+
+	return error || git_oid_cmp(&checksum, &idx->checksum) != 0;
+}
+
+int git_midx_entry_find(
+	git_midx_entry *e,
+	git_midx_file *idx,
+	const git_oid *short_oid,
+	size_t len)
+{
+	const unsigned char *object_offset;
+	const git_oid *current = NULL;
+	unsigned hi, lo;
+	int pos, found = 0;
+	uint32_t pack_index, offset32;
+
+	hi = ntohl(idx->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_entry_pos(idx->oid_lookup, GIT_OID_RAWSZ, 0,
+		lo, hi, idx->num_objects, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = idx->oid_lookup + pos;
+	} else {
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)idx->num_objects) {
+			current = idx->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)idx->num_objects) {
+		/* Check for ambiguousity */
+		if (!git_oid_ncmp(short_oid, current + 1, len))
+			found = 2;
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for multi-pack index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
+
+	object_offset = idx->object_offsets + pos * MIDX_OFFSET_ENTRY_SIZE;
+
+	pack_index = midx_get_be32(object_offset);
+	if (pack_index >= idx->packfile_names.length)
+		return midx_error("invalid index into the packfile names table");
+
+	offset32 = midx_get_be32(object_offset + 4);
+
+	if (idx->object_large_offsets && (offset32 & MIDX_LARGE_OFFSET_NEEDED)) {
+		uint32_t large_index = offset32 & ~MIDX_LARGE_OFFSET_NEEDED;
+
+		if (large_index >= idx->num_object_large_offsets)
+			return midx_error("invalid index into the object large offsets table");
+
+		e->offset = (git_off_t)midx_get_be64(
+			idx->object_large_offsets + 8 * large_index);
+	} else {
+		e->offset = offset32;
+	}
+
+	e->pack_index = pack_index;
+	git_oid_cpy(&e->sha1, current);
+	return 0;
+}
+
+int git_midx_foreach_entry(
+	git_midx_file *idx,
+	int (*cb)(git_oid *oid, void *data),
+	void *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < idx->num_objects; ++i)
+		if (cb((git_oid *)&idx->oid_lookup[i], data))
+			return GIT_EUSER;
+
+	return 0;
+}
+
+void git_midx_free(git_midx_file *idx)
+{
+	if (!idx)
+		return;
+
+	git_vector_free(&idx->packfile_names);
+	git_futils_mmap_free(&idx->index_map);
+	git__free(idx);
+}
+
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX WRITER
+ *
+ ***********************************************************/
+
+typedef struct {
+	git_oid id;
+	uint32_t pack_index;
+	git_time_t pack_mtime;
+	git_off_t offset;
+} midx_object;
+
+struct midx_writer {
+	git_vector packs;
+	git_vector objects;
+	git_pool object_pool;
+	struct git_pack_file *current_pack;
+	uint32_t current_index;
+};
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct git_pack_file *a = a_, *b = b_;
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+static int midx_object_cmp(const void *a_, const void *b_)
+{
+	const midx_object *a = a_, *b = b_;
+	int cmp;
+
+	if ((cmp = git_oid_cmp(&a->id, &b->id)) != 0)
+		return cmp;
+
+	/* Prefer the copy in the newest pack, as the pack backend does */
+	if (a->pack_mtime != b->pack_mtime)
+		return (a->pack_mtime > b->pack_mtime) ? -1 : 1;
+
+	return (a->pack_index < b->pack_index) ? -1 :
+		(a->pack_index > b->pack_index);
+}
+
+static int midx_load_pack__cb(void *data, git_buf *path)
+{
+	struct midx_writer *w = data;
+	struct git_pack_file *p;
+	int error;
+
+	if (git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0;
+
+	error = git_packfile_check(&p, path->ptr);
+	if (error == GIT_ENOTFOUND) {
+		/* ignore missing .pack file as git does */
+		giterr_clear();
+		return 0;
+	} else if (error < 0)
+		return error;
+
+	return git_vector_insert(&w->packs, p);
+}
+
+static int midx_add_object__cb(const git_oid *id, git_off_t offset, void *data)
+{
+	struct midx_writer *w = data;
+	midx_object *obj;
+
+	obj = git_pool_malloc(&w->object_pool, 1);
+	GITERR_CHECK_ALLOC(obj);
+
+	git_oid_cpy(&obj->id, id);
+	obj->pack_index = w->current_index;
+	obj->pack_mtime = w->current_pack->mtime;
+	obj->offset = offset;
+
+	return git_vector_insert(&w->objects, obj);
+}
+
+static int midx_write_be32(git_filebuf *file, uint32_t value)
+{
+	value = htonl(value);
+	return git_filebuf_write(file, &value, sizeof(value));
+}
+
+static int midx_write_be64(git_filebuf *file, uint64_t value)
+{
+	if (midx_write_be32(file, (uint32_t)(value >> 32)) < 0)
+		return -1;
+	return midx_write_be32(file, (uint32_t)value);
+}
+
+static int midx_write_chunk_entry(git_filebuf *file, uint32_t id, size_t offset)
+{
+	if (midx_write_be32(file, id) < 0)
+		return -1;
+	return midx_write_be64(file, (uint64_t)offset);
+}
+
+static int midx_write_file(struct midx_writer *w, git_filebuf *file)
+{
+	struct git_midx_header hdr;
+	git_buf names = GIT_BUF_INIT;
+	struct git_pack_file *p;
+	midx_object *obj;
+	uint32_t fanout[256];
+	size_t i, offset, num_large_offsets = 0;
+	git_oid checksum;
+	int error = -1;
+
+	/* The Packfile Names chunk: NUL-terminated .idx names, 4-byte aligned */
+	git_vector_foreach(&w->packs, i, p) {
+		const char *base = strrchr(p->pack_name, '/');
+		size_t base_len;
+
+		base = base ? base + 1 : p->pack_name;
+		base_len = strlen(base) - strlen(".pack");
+
+		git_buf_put(&names, base, base_len);
+		git_buf_put(&names, ".idx", strlen(".idx") + 1);
+	}
+	while (names.size % MIDX_CHUNK_ALIGNMENT)
+		git_buf_putc(&names, '\0');
+
+	if (git_buf_oom(&names))
+		goto done;
+
+	memset(fanout, 0x0, sizeof(fanout));
+	git_vector_foreach(&w->objects, i, obj) {
+		fanout[obj->id.id[0]]++;
+		if (obj->offset > 0x7fffffff)
+			num_large_offsets++;
+	}
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+
+	hdr.signature = htonl(MIDX_SIGNATURE);
+	hdr.version = MIDX_VERSION;
+	hdr.object_id_version = MIDX_OBJECT_ID_VERSION;
+	hdr.chunks = num_large_offsets ? 5 : 4;
+	hdr.base_midx_files = 0;
+	hdr.packfiles = htonl((uint32_t)w->packs.length);
+
+	if (git_filebuf_write(file, &hdr, sizeof(hdr)) < 0)
+		goto done;
+
+	offset = sizeof(hdr) + (hdr.chunks + 1) * MIDX_CHUNK_ENTRY_SIZE;
+
+	if (midx_write_chunk_entry(file, MIDX_PACKFILE_NAMES_ID, offset) < 0)
+		goto done;
+	offset += names.size;
+
+	if (midx_write_chunk_entry(file, MIDX_OID_FANOUT_ID, offset) < 0)
+		goto done;
+	offset += MIDX_FANOUT_SIZE;
+
+	if (midx_write_chunk_entry(file, MIDX_OID_LOOKUP_ID, offset) < 0)
+		goto done;
+	offset += w->objects.length * GIT_OID_RAWSZ;
+
+	if (midx_write_chunk_entry(file, MIDX_OBJECT_OFFSETS_ID, offset) < 0)
+		goto done;
+	offset += w->objects.length * MIDX_OFFSET_ENTRY_SIZE;
+
+	if (num_large_offsets) {
+		if (midx_write_chunk_entry(file, MIDX_OBJECT_LARGE_OFFSETS_ID, offset) < 0)
+			goto done;
+		offset += num_large_offsets * 8;
+	}
+
+	if (midx_write_chunk_entry(file, 0, offset) < 0 ||
+		git_filebuf_write(file, names.ptr, names.size) < 0)
+		goto done;
+
+	for (i = 0; i < 256; ++i)
+		if (midx_write_be32(file, fanout[i]) < 0)
+			goto done;
+
+	git_vector_foreach(&w->objects, i, obj)
+		if (git_filebuf_write(file, obj->id.id, GIT_OID_RAWSZ) < 0)
+			goto done;
+
+	num_large_offsets = 0;
+	git_vector_foreach(&w->objects, i, obj) {
+		uint32_t offset32 = (obj->offset > 0x7fffffff) ?
+			MIDX_LARGE_OFFSET_NEEDED | (uint32_t)num_large_offsets++ :
+			(uint32_t)obj->offset;
+
+		if (midx_write_be32(file, obj->pack_index) < 0 ||
+			midx_write_be32(file, offset32) < 0)
+			goto done;
+	}
+
+	if (num_large_offsets) {
+		git_vector_foreach(&w->objects, i, obj)
+			if (obj->offset > 0x7fffffff &&
+				midx_write_be64(file, (uint64_t)obj->offset) < 0)
+				goto done;
+	}
+
+	if (git_filebuf_hash(&checksum, file) < 0 ||
+		git_filebuf_write(file, checksum.id, GIT_OID_RAWSZ) < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	git_buf_free(&names);
+	return error;
+}
+
+int git_midx_write(const char *pack_dir)
+{
+	struct midx_writer w;
+	git_buf path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	struct git_pack_file *p;
+	midx_object *obj, *prev = NULL;
+	size_t i, kept = 0;
+	int error = -1;
+
+	memset(&w, 0x0, sizeof(w));
+
+	if (git_vector_init(&w.packs, 16, midx_pack_cmp) < 0 ||
+		git_vector_init(&w.objects, 1024, midx_object_cmp) < 0 ||
+		git_pool_init(&w.object_pool, sizeof(midx_object), 0) < 0 ||
+		git_buf_sets(&path, pack_dir) < 0)
+		goto cleanup;
+
+	if (git_path_direach(&path, midx_load_pack__cb, &w) < 0)
+		goto cleanup;
+
+	git_vector_sort(&w.packs);
+
+	git_vector_foreach(&w.packs, i, p) {
+		w.current_pack = p;
+		w.current_index = (uint32_t)i;
+
+		if (git_pack_foreach_entry_offset(p, midx_add_object__cb, &w) < 0)
+			goto cleanup;
+	}
+
+	/* Sort by object id and keep one copy of each object */
+	git_vector_sort(&w.objects);
+
+	git_vector_foreach(&w.objects, i, obj) {
+		if (prev && git_oid_cmp(&prev->id, &obj->id) == 0)
+			continue;
+		w.objects.contents[kept++] = obj;
+		prev = obj;
+	}
+	w.objects.length = kept;
+
+	if (git_buf_joinpath(&path, pack_dir, "multi-pack-index") < 0 ||
+		git_filebuf_open(&file, path.ptr, GIT_FILEBUF_HASH_CONTENTS) < 0)
+		goto cleanup;
+
+	if (midx_write_file(&w, &file) < 0 ||
+		git_filebuf_commit(&file, GIT_PACK_FILE_MODE) < 0) {
+		git_filebuf_cleanup(&file);
+		goto cleanup;
+	}
+
+	error = 0;
+
+cleanup:
+	git_vector_foreach(&w.packs, i, p)
+		packfile_free(p);
+	git_vector_free(&w.packs);
+	git_vector_free(&w.objects);
+	git_pool_clear(&w.object_pool);
+	git_buf_free(&path);
+	return error;
+}
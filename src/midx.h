@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "git2/oid.h"
+
+#include "common.h"
+#include "map.h"
+#include "vector.h"
+
+/*
+ * A multi-pack-index file (`objects/pack/multi-pack-index`), in the
+ * same format as the one written by `git multi-pack-index write`.
+ *
+ * It holds a single sorted table of object ids spanning a set of
+ * packfiles, together with the pack and the offset inside that pack
+ * where each object lives, so a lookup costs one binary search no
+ * matter how many packs the repository has.
+ */
+typedef struct git_midx_file {
+	git_map index_map;
+
+	/* The fanout table, 256 entries in network byte order. */
+	const uint32_t *oid_fanout;
+	uint32_t num_objects;
+
+	/* The OID Lookup table: `num_objects` sorted raw object ids. */
+	const git_oid *oid_lookup;
+
+	/* The Object Offsets table: a pack id and an offset per object. */
+	const unsigned char *object_offsets;
+
+	/* The optional Object Large Offsets table. */
+	const unsigned char *object_large_offsets;
+	size_t num_object_large_offsets;
+
+	/* The names of the indexed packs ("pack-xxx.idx"), by pack id. */
+	git_vector packfile_names;
+
+	/* The trailing checksum, used to notice a rewritten file. */
+	git_oid checksum;
+} git_midx_file;
+
+typedef struct git_midx_entry {
+	size_t pack_index;
+	git_off_t offset;
+	git_oid sha1;
+} git_midx_entry;
+
+/*
+ * Map and validate the multi-pack-index at `path`.  Returns
+ * GIT_ENOTFOUND if the file does not exist.
+ */
+int git_midx_open(git_midx_file **idx_out, const char *path);
+
+/*
+ * Returns true when the file at `path` is no longer the one `idx`
+ * was read from (it was rewritten or removed).
+ */
+bool git_midx_needs_refresh(const git_midx_file *idx, const char *path);
+
+/*
+ * Find the entry for an object id or a unique prefix of `len` hex
+ * characters.  Returns GIT_ENOTFOUND or GIT_EAMBIGUOUS on failure.
+ */
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len);
+
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		int (*cb)(git_oid *oid, void *data),
+		void *data);
+
+void git_midx_free(git_midx_file *idx);
+
+/*
+ * Write a multi-pack-index covering every pack in `pack_dir`.  When
+ * an object is stored in several packs, the copy in the newest pack
+ * is the one indexed.
+ */
+int git_midx_write(const char *pack_dir);
+
+#endif
@@ -20,6 +20,20 @@
 #define DEFAULT_MAPPED_LIMIT \
 	((1024 * 1024) * (sizeof(void*) >= 8 ? 8192ULL : 256UL))
 
+/*
+ * On 64-bit hosts, a file can be mapped in one piece instead of in
+ * windows, as long as it fits in the mapped limit: every read of the
+ * file then uses the same window and never needs to take the lock.
+ * It is opt-in, since it maps large packs all at once.
+ */
+#define DEFAULT_WHOLE_FILE 0
+
+/*
+ * A mapped window stays valid after its descriptor is closed, so we
+ * only need a descriptor while mapping. Keep at most this many open.
+ */
+#define DEFAULT_FILE_LIMIT 128
+
 /*
  * These are the global options for mmmap limits.
  * TODO: allow the user to change these
@@ -27,14 +41,186 @@
 static struct {
 	size_t window_size;
 	size_t mapped_limit;
+	int whole_file;
+	unsigned int file_limit;
 } _mw_options = {
 	DEFAULT_WINDOW_SIZE,
 	DEFAULT_MAPPED_LIMIT,
+	DEFAULT_WHOLE_FILE,
+	DEFAULT_FILE_LIMIT,
 };
 
-/* Whenever you want to read or modify this, grab git__mwindow_mutex */
+/*
+ * Whenever you want to read or modify this, grab git__mwindow_mutex.
+ *
+ * The one exception is a window's `inuse_cnt`: it only ever goes up
+ * under the lock, but a cursor can drop its reference without it. A
+ * window whose count is zero while we hold the lock has no users and
+ * cannot gain any until we let go.
+ */
 static git_mwindow_ctl mem_ctl;
 
+static int mwindow_offset_cmp(const void *a, const void *b)
+{
+	const git_mwindow *wa = a, *wb = b;
+
+	if (wa->offset < wb->offset)
+		return -1;
+	return wa->offset > wb->offset;
+}
+
+static void lru_unlink(git_mwindow_ctl *ctl, git_mwindow *w)
+{
+	if (w->lru_prev)
+		w->lru_prev->lru_next = w->lru_next;
+	else
+		ctl->lru_head = w->lru_next;
+
+	if (w->lru_next)
+		w->lru_next->lru_prev = w->lru_prev;
+	else
+		ctl->lru_tail = w->lru_prev;
+
+	w->lru_prev = w->lru_next = NULL;
+}
+
+static void lru_append(git_mwindow_ctl *ctl, git_mwindow *w)
+{
+	w->lru_prev = ctl->lru_tail;
+	w->lru_next = NULL;
+
+	if (ctl->lru_tail)
+		ctl->lru_tail->lru_next = w;
+	else
+		ctl->lru_head = w;
+
+	ctl->lru_tail = w;
+}
+
+static bool fd_lru_linked(git_mwindow_ctl *ctl, git_mwindow_file *mwf)
+{
+	return mwf->fd_prev != NULL || ctl->fd_lru_head == mwf;
+}
+
+static void fd_lru_unlink(git_mwindow_ctl *ctl, git_mwindow_file *mwf)
+{
+	if (!fd_lru_linked(ctl, mwf))
+		return;
+
+	if (mwf->fd_prev)
+		mwf->fd_prev->fd_next = mwf->fd_next;
+	else
+		ctl->fd_lru_head = mwf->fd_next;
+
+	if (mwf->fd_next)
+		mwf->fd_next->fd_prev = mwf->fd_prev;
+	else
+		ctl->fd_lru_tail = mwf->fd_prev;
+
+	mwf->fd_prev = mwf->fd_next = NULL;
+}
+
+/*
+ * Mark the descriptor of `mwf` as just used. A file only becomes a
+ * candidate for closing once it has been mapped, so nobody closes a
+ * descriptor its owner is still reading the header through.
+ */
+static void fd_lru_touch(git_mwindow_ctl *ctl, git_mwindow_file *mwf)
+{
+	if (!mwf->path)
+		return;
+
+	fd_lru_unlink(ctl, mwf);
+
+	mwf->fd_prev = ctl->fd_lru_tail;
+	if (ctl->fd_lru_tail)
+		ctl->fd_lru_tail->fd_next = mwf;
+	else
+		ctl->fd_lru_head = mwf;
+
+	ctl->fd_lru_tail = mwf;
+}
+
+/*
+ * Close the descriptor of the file that was mapped from the longest
+ * time ago. Called under lock.
+ */
+static int close_lru_file(git_mwindow_ctl *ctl)
+{
+	git_mwindow_file *mwf = ctl->fd_lru_head;
+
+	if (!mwf)
+		return -1;
+
+	fd_lru_unlink(ctl, mwf);
+
+	p_close(mwf->fd);
+	mwf->fd = -1;
+	ctl->open_files--;
+
+	return 0;
+}
+
+/*
+ * Open a descriptor within the budget of open files. Called under lock.
+ */
+static int budget_open(git_mwindow_ctl *ctl, const char *path)
+{
+	int fd;
+
+	while (_mw_options.file_limit &&
+		ctl->open_files >= _mw_options.file_limit &&
+		close_lru_file(ctl) == 0) /* nop */;
+
+	/* As with mapped_limit, this is a soft limit */
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	ctl->open_files++;
+	if (ctl->open_files > ctl->peak_open_files)
+		ctl->peak_open_files = ctl->open_files;
+
+	return fd;
+}
+
+/*
+ * Reopen a file whose descriptor was closed to stay in budget. Called
+ * under lock.
+ */
+static int file_reopen(git_mwindow_ctl *ctl, git_mwindow_file *mwf)
+{
+	struct stat st;
+	int fd;
+
+	if ((fd = budget_open(ctl, mwf->path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 || st.st_size != mwf->size) {
+		giterr_set(GITERR_OS,
+			"File '%s' changed since it was first opened", mwf->path);
+		p_close(fd);
+		ctl->open_files--;
+		return -1;
+	}
+
+	mwf->fd = fd;
+	return 0;
+}
+
+/*
+ * Unmap a window and forget about it. Called under lock.
+ */
+static void window_free(git_mwindow_ctl *ctl, git_mwindow *w)
+{
+	lru_unlink(ctl, w);
+
+	ctl->mapped -= w->window_map.len;
+	ctl->open_windows--;
+
+	git_futils_mmap_free(&w->window_map);
+	git__free(w);
+}
+
 /*
  * Free all the windows in a sequence, typically because we're done
  * with the file
@@ -42,6 +228,7 @@ static git_mwindow_ctl mem_ctl;
 void git_mwindow_free_all(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow *w;
 	unsigned int i;
 
 	git_mutex_lock(&git__mwindow_mutex);
@@ -61,19 +248,13 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
 		ctl->windowfiles.contents = NULL;
 	}
 
-	while (mwf->windows) {
-		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
-
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
-
-		git_futils_mmap_free(&w->window_map);
-
-		mwf->windows = w->next;
-		git__free(w);
+	git_vector_foreach(&mwf->windows, i, w) {
+		assert(w->inuse_cnt.val == 0);
+		window_free(ctl, w);
 	}
 
+	git_vector_free(&mwf->windows);
+
 	git_mutex_unlock(&git__mwindow_mutex);
 }
 
@@ -88,29 +269,49 @@ int git_mwindow_contains(git_mwindow *win, git_off_t offset)
 }
 
 /*
- * Find the least-recently-used window in a file
+ * Find a window of the file covering [offset, offset + extra]. Called
+ * under lock.
  */
-static void git_mwindow_scan_lru(
-	git_mwindow_file *mwf,
-	git_mwindow **lru_w,
-	git_mwindow **lru_l)
+static git_mwindow *find_window(
+	git_mwindow_file *mwf, git_off_t offset, size_t extra)
 {
-	git_mwindow *w, *w_l;
-
-	for (w_l = NULL, w = mwf->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
-			/*
-			 * If the current one is more recent than the last one,
-			 * store it in the output parameter. If lru_w is NULL,
-			 * it's the first loop, so store it as well.
-			 */
-			if (!*lru_w || w->last_used < (*lru_w)->last_used) {
-				*lru_w = w;
-				*lru_l = w_l;
-			}
-		}
-		w_l = w;
+	git_mwindow **windows = (git_mwindow **)mwf->windows.contents;
+	size_t lo = 0, hi = mwf->windows.length;
+
+	/* Skip past every window that starts at or before `offset`... */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (windows[mid]->offset <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/*
+	 * ...and walk back over them. No window is larger than the window
+	 * size, so once one ends that far before `offset` the earlier ones
+	 * cannot contain it either.
+	 */
+	while (lo > 0) {
+		git_mwindow *w = windows[--lo];
+
+		if (git_mwindow_contains(w, offset) &&
+			git_mwindow_contains(w, offset + extra))
+			return w;
+
+		if (w->offset + (git_off_t)_mw_options.window_size < offset)
+			break;
 	}
+
+	/* A whole-file window is longer than that, and always comes first */
+	if (mwf->windows.length > 0 &&
+		windows[0]->window_map.len > _mw_options.window_size &&
+		git_mwindow_contains(windows[0], offset) &&
+		git_mwindow_contains(windows[0], offset + extra))
+		return windows[0];
+
+	return NULL;
 }
 
 /*
@@ -118,40 +319,33 @@ static void git_mwindow_scan_lru(
  * the file descriptors need closing from time to time. Called under
  * lock from new_window.
  */
-static int git_mwindow_close_lru(git_mwindow_file *mwf)
+static int git_mwindow_close_lru(void)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
-	unsigned int i;
-	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
-
-	/* FIXME: Does this give us any advantage? */
-	if(mwf->windows)
-		git_mwindow_scan_lru(mwf, &lru_w, &lru_l);
-
-	for (i = 0; i < ctl->windowfiles.length; ++i) {
-		git_mwindow *last = lru_w;
-		git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
-		git_mwindow_scan_lru(cur, &lru_w, &lru_l);
-		if (lru_w != last)
-			list = &cur->windows;
-	}
+	git_mwindow *w, **windows;
+	size_t pos;
 
-	if (!lru_w) {
+	for (w = ctl->lru_head; w; w = w->lru_next)
+		if (w->inuse_cnt.val == 0)
+			break;
+
+	if (!w) {
 		giterr_set(GITERR_OS, "Failed to close memory window. Couldn't find LRU");
 		return -1;
 	}
 
-	ctl->mapped -= lru_w->window_map.len;
-	git_futils_mmap_free(&lru_w->window_map);
-
-	if (lru_l)
-		lru_l->next = lru_w->next;
-	else
-		*list = lru_w->next;
+	windows = (git_mwindow **)w->mwf->windows.contents;
+	git__bsearch(w->mwf->windows.contents, w->mwf->windows.length,
+		w, mwindow_offset_cmp, &pos);
 
-	git__free(lru_w);
-	ctl->open_windows--;
+	/* windows at the same offset sit next to each other */
+	while (pos > 0 && windows[pos - 1]->offset == w->offset)
+		pos--;
+	while (windows[pos] != w)
+		pos++;
 
+	git_vector_remove(&w->mwf->windows, (unsigned int)pos);
+	window_free(ctl, w);
 	return 0;
 }
 
@@ -173,16 +367,23 @@ static git_mwindow *new_window(
 		return NULL;
 
 	memset(w, 0x0, sizeof(*w));
-	w->offset = (offset / walign) * walign;
+	w->mwf = mwf;
+
+	if (_mw_options.whole_file && size <= (git_off_t)_mw_options.mapped_limit) {
+		w->offset = 0;
+		len = size;
+	} else {
+		w->offset = (offset / walign) * walign;
 
-	len = size - w->offset;
-	if (len > (git_off_t)_mw_options.window_size)
-		len = (git_off_t)_mw_options.window_size;
+		len = size - w->offset;
+		if (len > (git_off_t)_mw_options.window_size)
+			len = (git_off_t)_mw_options.window_size;
+	}
 
 	ctl->mapped += (size_t)len;
 
 	while (_mw_options.mapped_limit < ctl->mapped &&
-			git_mwindow_close_lru(mwf) == 0) /* nop */;
+			git_mwindow_close_lru() == 0) /* nop */;
 
 	/*
 	 * We treat _mw_options.mapped_limit as a soft limit. If we can't find a
@@ -191,10 +392,24 @@ static git_mwindow *new_window(
 	 */
 
 	if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
+		ctl->mapped -= (size_t)len;
 		git__free(w);
 		return NULL;
 	}
 
+	if (mwf->advice != GIT_MADV_NORMAL)
+		p_madvise(&w->window_map, mwf->advice);
+
+	mwf->windows._cmp = mwindow_offset_cmp;
+	if (git_vector_insert_sorted(&mwf->windows, w, NULL) < 0) {
+		ctl->mapped -= (size_t)len;
+		git_futils_mmap_free(&w->window_map);
+		git__free(w);
+		return NULL;
+	}
+
+	lru_append(ctl, w);
+
 	ctl->mmap_calls++;
 	ctl->open_windows++;
 
@@ -221,38 +436,39 @@ unsigned char *git_mwindow_open(
 	git_mwindow_ctl *ctl = &mem_ctl;
 	git_mwindow *w = *cursor;
 
-	git_mutex_lock(&git__mwindow_mutex);
+	/*
+	 * The cursor holds a reference on its window, so nobody can unmap
+	 * it under us; if it covers what we want, we don't need the lock.
+	 */
 	if (!w || !(git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))) {
-		if (w) {
-			w->inuse_cnt--;
-		}
+		git_mutex_lock(&git__mwindow_mutex);
 
-		for (w = mwf->windows; w; w = w->next) {
-			if (git_mwindow_contains(w, offset) &&
-				git_mwindow_contains(w, offset + extra))
-				break;
+		if (w) {
+			git_atomic_dec(&w->inuse_cnt);
+			*cursor = NULL;
 		}
 
 		/*
 		 * If there isn't a suitable window, we need to create a new
 		 * one.
 		 */
-		if (!w) {
-			w = new_window(mwf, mwf->fd, mwf->size, offset);
-			if (w == NULL) {
+		if ((w = find_window(mwf, offset, extra)) != NULL) {
+			lru_unlink(ctl, w);
+			lru_append(ctl, w);
+		} else {
+			if ((mwf->fd == -1 && mwf->path && file_reopen(ctl, mwf) < 0) ||
+				(w = new_window(mwf, mwf->fd, mwf->size, offset)) == NULL) {
 				git_mutex_unlock(&git__mwindow_mutex);
 				return NULL;
 			}
-			w->next = mwf->windows;
-			mwf->windows = w;
+
+			fd_lru_touch(ctl, mwf);
 		}
-	}
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
+		git_atomic_inc(&w->inuse_cnt);
 		*cursor = w;
+
+		git_mutex_unlock(&git__mwindow_mutex);
 	}
 
 	offset -= w->offset;
@@ -260,7 +476,6 @@ unsigned char *git_mwindow_open(
 	if (left)
 		*left = (unsigned int)(w->window_map.len - offset);
 
-	git_mutex_unlock(&git__mwindow_mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
@@ -302,13 +517,99 @@ int git_mwindow_file_deregister(git_mwindow_file *mwf)
 	return -1;
 }
 
+int git_mwindow_file_open(git_mwindow_file *mwf, const char *path)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+	int fd;
+
+	git_mutex_lock(&git__mwindow_mutex);
+	fd = budget_open(ctl, path);
+	git_mutex_unlock(&git__mwindow_mutex);
+
+	if (fd < 0)
+		return fd;
+
+	mwf->fd = fd;
+	mwf->path = path;
+	return 0;
+}
+
+void git_mwindow_file_close(git_mwindow_file *mwf)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+
+	if (!mwf->path) {
+		if (mwf->fd != -1)
+			p_close(mwf->fd);
+		mwf->fd = -1;
+		return;
+	}
+
+	git_mutex_lock(&git__mwindow_mutex);
+
+	fd_lru_unlink(ctl, mwf);
+
+	if (mwf->fd != -1) {
+		p_close(mwf->fd);
+		ctl->open_files--;
+	}
+
+	mwf->fd = -1;
+	mwf->path = NULL;
+
+	git_mutex_unlock(&git__mwindow_mutex);
+}
+
 void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
 	if (w) {
-		git_mutex_lock(&git__mwindow_mutex);
-		w->inuse_cnt--;
-		git_mutex_unlock(&git__mwindow_mutex);
+		git_atomic_dec(&w->inuse_cnt);
 		*window = NULL;
 	}
 }
+
+void git_libgit2_mwindow_stats(git_mwindow_stats *stats)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+
+	assert(stats);
+
+	git_mutex_lock(&git__mwindow_mutex);
+	stats->mapped = ctl->mapped;
+	stats->peak_mapped = ctl->peak_mapped;
+	stats->open_windows = ctl->open_windows;
+	stats->peak_open_windows = ctl->peak_open_windows;
+	stats->mmap_calls = ctl->mmap_calls;
+	stats->open_files = ctl->open_files;
+	stats->peak_open_files = ctl->peak_open_files;
+	git_mutex_unlock(&git__mwindow_mutex);
+}
+
+int git_libgit2_mwindow_set_whole_file(int enabled)
+{
+	if (enabled && sizeof(void*) < 8) {
+		giterr_set(GITERR_INVALID,
+			"Whole-file mapping of packs needs a 64-bit address space");
+		return -1;
+	}
+
+	git_mutex_lock(&git__mwindow_mutex);
+	_mw_options.whole_file = !!enabled;
+	git_mutex_unlock(&git__mwindow_mutex);
+
+	return 0;
+}
+
+void git_libgit2_mwindow_set_file_limit(unsigned int limit)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+
+	git_mutex_lock(&git__mwindow_mutex);
+
+	_mw_options.file_limit = limit;
+	while (limit && ctl->open_files > limit && close_lru_file(ctl) == 0)
+		/* nop */;
+
+	git_mutex_unlock(&git__mwindow_mutex);
+}
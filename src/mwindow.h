@@ -10,19 +10,35 @@
 
 #include "map.h"
 #include "vector.h"
+#include "thread-utils.h"
+
+struct git_mwindow_file;
 
 typedef struct git_mwindow {
-	struct git_mwindow *next;
+	/* The file this window maps, so the LRU can unlink it */
+	struct git_mwindow_file *mwf;
+	/* Neighbours in the global LRU list, least recently used first */
+	struct git_mwindow *lru_prev, *lru_next;
 	git_map window_map;
 	git_off_t offset;
-	size_t last_used;
-	size_t inuse_cnt;
+	git_atomic inuse_cnt;
 } git_mwindow;
 
 typedef struct git_mwindow_file {
-	git_mwindow *windows;
+	/* The open windows, sorted by offset */
+	git_vector windows;
 	int fd;
 	git_off_t size;
+	/* GIT_MADV_* hint given for every window of the file */
+	int advice;
+	/*
+	 * Set for files opened with git_mwindow_file_open(). Their
+	 * descriptor counts against the budget of open files; once idle
+	 * it may be closed, and it is reopened from `path` when a new
+	 * window is needed.
+	 */
+	const char *path;
+	struct git_mwindow_file *fd_prev, *fd_next;
 } git_mwindow_file;
 
 typedef struct git_mwindow_ctl {
@@ -31,7 +47,11 @@ typedef struct git_mwindow_ctl {
 	unsigned int mmap_calls;
 	unsigned int peak_open_windows;
 	size_t peak_mapped;
-	size_t used_ctr;
+	git_mwindow *lru_head, *lru_tail;
+	unsigned int open_files;
+	unsigned int peak_open_files;
+	/* Files with a closable descriptor, least recently mapped first */
+	git_mwindow_file *fd_lru_head, *fd_lru_tail;
 	git_vector windowfiles;
 } git_mwindow_ctl;
 
@@ -40,6 +60,18 @@ void git_mwindow_free_all(git_mwindow_file *mwf);
 unsigned char *git_mwindow_open(git_mwindow_file *mwf, git_mwindow **cursor, git_off_t offset, size_t extra, unsigned int *left);
 int git_mwindow_file_register(git_mwindow_file *mwf);
 int git_mwindow_file_deregister(git_mwindow_file *mwf);
+
+/*
+ * Open `path` read-only as the descriptor of `mwf`, closing the
+ * descriptors of other idle files if that's needed to stay within the
+ * budget of open files. `path` must outlive the file.
+ */
+int git_mwindow_file_open(git_mwindow_file *mwf, const char *path);
+
+/*
+ * Close the descriptor of `mwf`. Its windows stay mapped.
+ */
+void git_mwindow_file_close(git_mwindow_file *mwf);
 void git_mwindow_close(git_mwindow **w_cursor);
 
 #endif
@@ -316,6 +316,59 @@ static int init_fake_wstream(git_odb_stream **stream_p, git_odb_backend *backend
 	return 0;
 }
 
+typedef struct {
+	git_odb_stream stream;
+	git_rawobj obj;
+	size_t read;
+} buffer_rstream;
+
+static int buffer_rstream__read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	buffer_rstream *stream = (buffer_rstream *)_stream;
+	size_t left = stream->obj.len - stream->read;
+
+	if (len > left)
+		len = left;
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	memcpy(buffer, (char *)stream->obj.data + stream->read, len);
+	stream->read += len;
+	return (int)len;
+}
+
+static void buffer_rstream__free(git_odb_stream *_stream)
+{
+	buffer_rstream *stream = (buffer_rstream *)_stream;
+
+	git__free(stream->obj.data);
+	git__free(stream);
+}
+
+int git_odb__buffer_rstream(
+	git_odb_stream **stream_p, git_odb_backend *backend, git_rawobj *obj)
+{
+	buffer_rstream *stream;
+
+	stream = git__calloc(1, sizeof(buffer_rstream));
+	if (stream == NULL) {
+		git__free(obj->data);
+		return -1;
+	}
+
+	stream->obj = *obj;
+
+	stream->stream.backend = backend;
+	stream->stream.read = &buffer_rstream__read;
+	stream->stream.write = NULL; /* read only */
+	stream->stream.finalize_write = NULL;
+	stream->stream.free = &buffer_rstream__free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+
+	*stream_p = (git_odb_stream *)stream;
+	return 0;
+}
+
 /***********************************************************
  *
  * OBJECT DATABASE PUBLIC API
@@ -580,7 +633,8 @@ int git_odb__read_header_or_object(
 	return 0;
 }
 
-int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
+static int odb_read(
+	git_odb_object **out, git_odb *db, const git_oid *id, bool cache)
 {
 	unsigned int i;
 	int error = GIT_ENOTFOUND;
@@ -607,10 +661,169 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	if (error && error != GIT_PASSTHROUGH)
 		return error;
 
+	if (!cache) {
+		*out = new_odb_object(id, &raw);
+		git_cached_obj_incref(*out);
+		return 0;
+	}
+
 	*out = git_cache_try_store(&db->cache, new_odb_object(id, &raw));
 	return 0;
 }
 
+int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
+{
+	return odb_read(out, db, id, true);
+}
+
+int git_odb__read_nocache(git_odb_object **out, git_odb *db, const git_oid *id)
+{
+	return odb_read(out, db, id, false);
+}
+
+typedef struct {
+	git_odb *db;
+	const git_oid *ids;
+	size_t *pending; /* positions in ids of the objects not read yet */
+	size_t nr_pending;
+	unsigned char *done;
+	git_odb_read_many_cb cb;
+	void *payload;
+	bool cache;
+} read_many_state;
+
+static int read_many_deliver(read_many_state *st, size_t idx, git_rawobj *raw)
+{
+	git_odb_object *obj = new_odb_object(&st->ids[idx], raw);
+
+	st->done[idx] = 1;
+	if (st->cache)
+		obj = git_cache_try_store(&st->db->cache, obj);
+	else
+		git_cached_obj_incref(obj);
+
+	return st->cb(obj, idx, st->payload) ? GIT_EUSER : 0;
+}
+
+static int read_many_backend_cb(
+	size_t i, void *data, size_t len, git_otype type, void *payload)
+{
+	read_many_state *st = payload;
+	git_rawobj raw;
+
+	raw.data = data;
+	raw.len = len;
+	raw.type = type;
+
+	/* the backend knows the objects by their place among the pending */
+	return read_many_deliver(st, st->pending[i], &raw);
+}
+
+static int read_many_from(read_many_state *st, git_odb_backend *b)
+{
+	git_oid *ids;
+	size_t i;
+	int error = 0;
+
+	if (b->read_many != NULL) {
+		ids = git__malloc(st->nr_pending * sizeof(git_oid));
+		GITERR_CHECK_ALLOC(ids);
+
+		for (i = 0; i < st->nr_pending; ++i)
+			git_oid_cpy(&ids[i], &st->ids[st->pending[i]]);
+
+		error = b->read_many(b, ids, st->nr_pending, read_many_backend_cb, st);
+		git__free(ids);
+		return error;
+	}
+
+	if (b->read == NULL)
+		return 0;
+
+	for (i = 0; i < st->nr_pending && !error; ++i) {
+		size_t idx = st->pending[i];
+		git_rawobj raw;
+
+		error = b->read(&raw.data, &raw.len, &raw.type, b, &st->ids[idx]);
+		if (error == 0)
+			error = read_many_deliver(st, idx, &raw);
+		else if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+			giterr_clear();
+			error = 0;
+		}
+	}
+
+	return error;
+}
+
+static int odb_read_many(
+	git_odb *db, const git_oid *ids, size_t n,
+	git_odb_read_many_cb cb, void *payload, bool cache)
+{
+	read_many_state st;
+	unsigned int b;
+	size_t i, j;
+	int error = 0;
+
+	assert(db && (ids || !n) && cb);
+
+	memset(&st, 0x0, sizeof(st));
+	st.db = db;
+	st.ids = ids;
+	st.cb = cb;
+	st.payload = payload;
+	st.cache = cache;
+
+	st.pending = git__malloc(n * sizeof(size_t));
+	st.done = git__calloc(n, 1);
+	if ((n && !st.pending) || (n && !st.done)) {
+		git__free(st.pending);
+		git__free(st.done);
+		giterr_set_oom();
+		return -1;
+	}
+
+	for (i = 0; i < n && !error; ++i) {
+		git_odb_object *obj = git_cache_get(&db->cache, &ids[i]);
+
+		if (obj == NULL)
+			st.pending[st.nr_pending++] = i;
+		else if (cb(obj, i, payload))
+			error = GIT_EUSER;
+	}
+
+	for (b = 0; b < db->backends.length && st.nr_pending && !error; ++b) {
+		backend_internal *internal = git_vector_get(&db->backends, b);
+
+		error = read_many_from(&st, internal->backend);
+
+		for (i = j = 0; i < st.nr_pending; ++i)
+			if (!st.done[st.pending[i]])
+				st.pending[j++] = st.pending[i];
+		st.nr_pending = j;
+	}
+
+	if (!error && st.nr_pending)
+		error = git_odb__error_notfound(
+			"no match for some of the ids", &ids[st.pending[0]]);
+
+	git__free(st.pending);
+	git__free(st.done);
+	return error;
+}
+
+int git_odb_read_many(
+	git_odb *db, const git_oid *ids, size_t n, git_odb_read_many_cb cb, void *payload)
+{
+	return odb_read_many(db, ids, n, cb, payload, true);
+}
+
+int git_odb__read_many_nocache(
+	git_odb *db, const git_oid *ids, size_t n, git_odb_read_many_cb cb, void *payload)
+{
+	return odb_read_many(db, ids, n, cb, payload, false);
+}
+
 int git_odb_read_prefix(
 	git_odb_object **out, git_odb *db, const git_oid *short_id, size_t len)
 {
@@ -664,6 +877,76 @@ int git_odb_read_prefix(
 	return 0;
 }
 
+int git_odb_bulk_begin(git_odb *db)
+{
+	unsigned int i, j;
+	backend_internal *internal;
+
+	assert(db);
+
+	git_vector_foreach(&db->backends, i, internal) {
+		git_odb_backend *b = internal->backend;
+
+		/* we don't write in alternates! */
+		if (internal->is_alternate || b->bulk_begin == NULL)
+			continue;
+
+		if (b->bulk_begin(b) < 0)
+			goto rollback;
+	}
+
+	return 0;
+
+rollback:
+	for (j = 0; j < i; ++j) {
+		git_odb_backend *b;
+
+		internal = git_vector_get(&db->backends, j);
+		b = internal->backend;
+
+		if (!internal->is_alternate && b->bulk_rollback != NULL)
+			b->bulk_rollback(b);
+	}
+
+	return -1;
+}
+
+int git_odb_bulk_commit(git_odb *db)
+{
+	unsigned int i;
+	backend_internal *internal;
+	int error = 0;
+
+	assert(db);
+
+	git_vector_foreach(&db->backends, i, internal) {
+		git_odb_backend *b = internal->backend;
+
+		if (internal->is_alternate || b->bulk_commit == NULL)
+			continue;
+
+		if (b->bulk_commit(b) < 0)
+			error = -1;
+	}
+
+	return error;
+}
+
+void git_odb_bulk_rollback(git_odb *db)
+{
+	unsigned int i;
+	backend_internal *internal;
+
+	assert(db);
+
+	git_vector_foreach(&db->backends, i, internal) {
+		git_odb_backend *b = internal->backend;
+
+		if (!internal->is_alternate && b->bulk_rollback != NULL)
+			b->bulk_rollback(b);
+	}
+}
+
 int git_odb_foreach(git_odb *db, int (*cb)(git_oid *oid, void *data), void *data)
 {
 	unsigned int i;
@@ -74,6 +74,14 @@ int git_odb__hashfd_filtered(
  */
 int git_odb__hashlink(git_oid *out, const char *path);
 
+/*
+ * A read stream over an object that is already in memory, for the
+ * objects a backend cannot inflate as it goes (e.g. deltas). The
+ * stream takes ownership of `obj->data`, even on failure.
+ */
+int git_odb__buffer_rstream(
+	git_odb_stream **stream_p, git_odb_backend *backend, git_rawobj *obj);
+
 /*
  * Generate a GIT_ENOTFOUND error for the ODB.
  */
@@ -84,6 +92,17 @@ int git_odb__error_notfound(const char *message, const git_oid *oid);
  */
 int git_odb__error_ambiguous(const char *message);
 
+/*
+ * Read an object without keeping it in the object cache, for callers
+ * that parse it once and keep what they need elsewhere.  An object that
+ * is in the cache already is returned from there.
+ */
+int git_odb__read_nocache(git_odb_object **out, git_odb *db, const git_oid *id);
+
+/* The same for `git_odb_read_many`. */
+int git_odb__read_many_nocache(
+	git_odb *db, const git_oid *ids, size_t n, git_odb_read_many_cb cb, void *payload);
+
 /*
  * Attempt to read object header or just return whole object if it could
  * not be read.
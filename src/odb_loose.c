@@ -14,6 +14,8 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "filebuf.h"
+#include "oidmap.h"
+#include "pool.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -28,26 +30,52 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+#define LOOSE_READSTREAM_CHUNK (16 * 1024)
+
+typedef struct {
+	git_odb_stream stream;
+	git_file fd;
+	z_stream zs;
+	obj_hdr hdr;
+	size_t total_out;
+	int done;
+	/* the start of the object, inflated along with its header */
+	unsigned char head[64];
+	size_t head_pos, head_len;
+	unsigned char in[LOOSE_READSTREAM_CHUNK];
+} loose_readstream;
+
+/*
+ * The objects in one fanout directory (`objects/xx/`), sorted, as they
+ * were listed when the directory had `mtime`.
+ */
+typedef struct {
+	git_oid *ids;
+	size_t nr, alloc;
+	git_time_t mtime;
+	unsigned listed:1, racy:1;
+} loose_dir;
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
 	int object_zlib_level; /** loose object zlib compression level. */
 	int fsync_object_files; /** loose object file fsync flag. */
 	char *objects_dir;
+
+	/* readers share the listings, so they are refreshed under the lock */
+	git_mutex dirs_lock;
+	loose_dir dirs[256];
+
+	/* Set during a bulk write: the directory its objects are staged
+	 * in, laid out like `objects_dir`, and the ids staged there. */
+	char *bulk_dir;
+	git_oidmap *bulk_objects;
+	git_pool bulk_ids;
+	unsigned char bulk_fanout[256]; /* the fanout directories made */
 } loose_backend;
 
-/* State structure for exploring directories,
- * in order to locate objects matching a short oid.
- */
-typedef struct {
-	size_t dir_len;
-	unsigned char short_oid[GIT_OID_HEXSZ]; /* hex formatted oid to match */
-	size_t short_oid_len;
-	int found;				/* number of matching
-						 * objects already found */
-	unsigned char res_oid[GIT_OID_HEXSZ];	/* hex formatted oid of
-						 * the object found */
-} loose_locate_object_state;
+GIT__USE_OIDMAP;
 
 
 /***********************************************************
@@ -452,50 +480,263 @@ static int read_header_loose(git_rawobj *out, git_buf *loc)
 	return error;
 }
 
-static int locate_object(
-	git_buf *object_location,
-	loose_backend *backend,
-	const git_oid *oid)
+/***********************************************************
+ *
+ * FANOUT DIRECTORY CACHE
+ *
+ ***********************************************************/
+
+static int loose_dir_oid_cmp(const void *a, const void *b)
 {
-	int error = object_file_name(object_location, backend->objects_dir, oid);
+	return git_oid_cmp(a, b);
+}
+
+/* Position of the first cached id not smaller than `oid` */
+static size_t loose_dir_lower_bound(const loose_dir *dir, const git_oid *oid)
+{
+	size_t lo = 0, hi = dir->nr;
 
-	if (!error && !git_path_exists(object_location->ptr))
-		return GIT_ENOTFOUND;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
 
-	return error;
+		if (git_oid_cmp(&dir->ids[mid], oid) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
 }
 
-/* Explore an entry of a directory and see if it matches a short oid */
-static int fn_locate_object_short_oid(void *state, git_buf *pathbuf) {
-	loose_locate_object_state *sstate = (loose_locate_object_state *)state;
+static bool loose_dir_contains(const loose_dir *dir, const git_oid *oid)
+{
+	size_t pos = loose_dir_lower_bound(dir, oid);
+	return pos < dir->nr && git_oid_cmp(&dir->ids[pos], oid) == 0;
+}
+
+static int loose_dir_grow(loose_dir *dir)
+{
+	size_t alloc;
+	git_oid *ids;
 
-	if (git_buf_len(pathbuf) - sstate->dir_len != GIT_OID_HEXSZ - 2) {
-		/* Entry cannot be an object. Continue to next entry */
+	if (dir->nr < dir->alloc)
+		return 0;
+
+	alloc = dir->alloc ? dir->alloc * 2 : 16;
+	ids = git__realloc(dir->ids, alloc * sizeof(git_oid));
+	GITERR_CHECK_ALLOC(ids);
+
+	dir->ids = ids;
+	dir->alloc = alloc;
+	return 0;
+}
+
+static int loose_dir_add(loose_dir *dir, const git_oid *oid)
+{
+	size_t pos = loose_dir_lower_bound(dir, oid);
+
+	if (pos < dir->nr && git_oid_cmp(&dir->ids[pos], oid) == 0)
+		return 0;
+
+	if (loose_dir_grow(dir) < 0)
+		return -1;
+
+	memmove(&dir->ids[pos + 1], &dir->ids[pos], (dir->nr - pos) * sizeof(git_oid));
+	git_oid_cpy(&dir->ids[pos], oid);
+	dir->nr++;
+
+	return 0;
+}
+
+struct loose_dir_scan {
+	loose_dir *dir;
+	size_t dir_len;
+	char hex[GIT_OID_HEXSZ];
+};
+
+static int loose_dir_scan_cb(void *_state, git_buf *path)
+{
+	struct loose_dir_scan *state = _state;
+	loose_dir *dir = state->dir;
+	git_oid oid;
+
+	/* Anything that isn't named like an object is not one */
+	if (git_buf_len(path) - state->dir_len != GIT_OID_HEXSZ - 2)
+		return 0;
+
+	memcpy(state->hex + 2, path->ptr + state->dir_len, GIT_OID_HEXSZ - 2);
+	if (git_oid_fromstrn(&oid, state->hex, GIT_OID_HEXSZ) < 0) {
+		giterr_clear();
 		return 0;
 	}
 
-	if (git_path_isdir(pathbuf->ptr) == false) {
-		/* We are already in the directory matching the 2 first hex characters,
-		 * compare the first ncmp characters of the oids */
-		if (!memcmp(sstate->short_oid + 2,
-			(unsigned char *)pathbuf->ptr + sstate->dir_len,
-			sstate->short_oid_len - 2)) {
+	if (loose_dir_grow(dir) < 0)
+		return -1;
 
-			if (!sstate->found) {
-				sstate->res_oid[0] = sstate->short_oid[0];
-				sstate->res_oid[1] = sstate->short_oid[1];
-				memcpy(sstate->res_oid+2, pathbuf->ptr+sstate->dir_len, GIT_OID_HEXSZ-2);
-			}
-			sstate->found++;
-		}
+	git_oid_cpy(&dir->ids[dir->nr++], &oid);
+	return 0;
+}
+
+/*
+ * Make sure the listing of the fanout directory for `fanout` is up to
+ * date. This costs a stat() of the directory; it is only read again
+ * when its mtime changed, which adding or removing an object does.
+ */
+static int loose_dir_path(git_buf *path, loose_backend *backend, unsigned char fanout)
+{
+	git_buf_sets(path, backend->objects_dir);
+	git_path_to_dir(path);
+	return git_buf_printf(path, "%02x", fanout);
+}
+
+/* With `dirs_lock` held */
+static int loose_dir_refresh(loose_backend *backend, unsigned char fanout)
+{
+	loose_dir *dir = &backend->dirs[fanout];
+	struct loose_dir_scan state;
+	git_buf path = GIT_BUF_INIT;
+	git_time_t scan_time;
+	struct stat st;
+	int error;
+
+	if (loose_dir_path(&path, backend, fanout) < 0)
+		return -1;
+
+	memcpy(state.hex, path.ptr + path.size - 2, 2);
+
+	if (p_stat(path.ptr, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		/* No such directory, so no such objects */
+		dir->nr = 0;
+		dir->listed = 0;
+		git_buf_free(&path);
+		return 0;
+	}
+
+	/*
+	 * A listing taken during the same second as a change to the
+	 * directory may have missed it; don't trust it until the clock
+	 * moves on.
+	 */
+	if (dir->listed && !dir->racy && dir->mtime == (git_time_t)st.st_mtime) {
+		git_buf_free(&path);
+		return 0;
+	}
+
+	scan_time = (git_time_t)time(NULL);
+
+	git_path_to_dir(&path);
+	state.dir = dir;
+	state.dir_len = git_buf_len(&path);
+	dir->nr = 0;
+	dir->listed = 0;
+
+	error = git_path_direach(&path, loose_dir_scan_cb, &state);
+	git_buf_free(&path);
+
+	if (error < 0) {
+		dir->nr = 0;
+		return error;
 	}
 
-	if (sstate->found > 1)
-		return git_odb__error_ambiguous("multiple matches in loose objects");
+	qsort(dir->ids, dir->nr, sizeof(git_oid), loose_dir_oid_cmp);
+
+	dir->listed = 1;
+	dir->racy = ((git_time_t)st.st_mtime >= scan_time);
+	dir->mtime = (git_time_t)st.st_mtime;
 
 	return 0;
 }
 
+static int loose_dir_stat(struct stat *st, loose_backend *backend, unsigned char fanout)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = loose_dir_path(&path, backend, fanout)) == 0)
+		error = p_stat(path.ptr, st);
+
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * Whether the listing of the directory `oid` is written to is current,
+ * checked before writing it: if so, the listing can be kept current
+ * after the write instead of being read again.
+ */
+static bool loose_dir_is_current(loose_backend *backend, const git_oid *oid)
+{
+	loose_dir *dir = &backend->dirs[oid->id[0]];
+	struct stat st;
+	git_time_t mtime;
+	bool current;
+
+	git_mutex_lock(&backend->dirs_lock);
+	current = dir->listed && !dir->racy;
+	mtime = dir->mtime;
+	git_mutex_unlock(&backend->dirs_lock);
+
+	if (!current || loose_dir_stat(&st, backend, oid->id[0]) < 0)
+		return false;
+
+	return mtime == (git_time_t)st.st_mtime;
+}
+
+/*
+ * Remember an object we just wrote, so looking for it again doesn't
+ * have to list its directory. When nothing else changed the directory
+ * since it was listed, the new mtime is only ours and the listing stays
+ * current; a change made by someone else in the same second after this
+ * stat goes unnoticed until the directory changes again.
+ */
+static void loose_dir_wrote(loose_backend *backend, const git_oid *oid, bool was_current)
+{
+	loose_dir *dir = &backend->dirs[oid->id[0]];
+	struct stat st;
+
+	if (was_current && loose_dir_stat(&st, backend, oid->id[0]) < 0)
+		was_current = false;
+
+	git_mutex_lock(&backend->dirs_lock);
+
+	if (dir->listed) {
+		if (loose_dir_add(dir, oid) < 0)
+			giterr_clear();
+		else if (was_current)
+			dir->mtime = (git_time_t)st.st_mtime;
+	}
+
+	git_mutex_unlock(&backend->dirs_lock);
+}
+
+static int locate_object(
+	git_buf *object_location,
+	loose_backend *backend,
+	const git_oid *oid)
+{
+	loose_dir *dir = &backend->dirs[oid->id[0]];
+	int error;
+
+	if (backend->bulk_dir &&
+		kh_get(oid, backend->bulk_objects, oid) != kh_end(backend->bulk_objects))
+		return object_file_name(object_location, backend->bulk_dir, oid);
+
+	if ((error = object_file_name(object_location, backend->objects_dir, oid)) < 0)
+		return error;
+
+	/*
+	 * Answered from the listing of the directory, once it is known
+	 * to be current: objects come and go with gc and prune.
+	 */
+	git_mutex_lock(&backend->dirs_lock);
+	if ((error = loose_dir_refresh(backend, oid->id[0])) == 0 &&
+		!loose_dir_contains(dir, oid))
+		error = GIT_ENOTFOUND;
+	git_mutex_unlock(&backend->dirs_lock);
+
+	return error;
+}
+
 /* Locate an object matching a given short oid */
 static int locate_object_short_oid(
 	git_buf *object_location,
@@ -504,62 +745,70 @@ static int locate_object_short_oid(
 	const git_oid *short_oid,
 	size_t len)
 {
-	char *objects_dir = backend->objects_dir;
-	size_t dir_len = strlen(objects_dir);
-	loose_locate_object_state state;
+	loose_dir *dir = &backend->dirs[short_oid->id[0]];
+	const git_oid *found = NULL;
+	git_oid key;
+	size_t pos;
 	int error;
 
-	/* prealloc memory for OBJ_DIR/xx/ */
-	if (git_buf_grow(object_location, dir_len + 5) < 0)
-		return -1;
+	/* Matches sort right after the prefix padded with zeros */
+	memset(&key, 0x0, sizeof(key));
+	memcpy(key.id, short_oid->id, len / 2);
+	if (len % 2)
+		key.id[len / 2] = short_oid->id[len / 2] & 0xf0;
 
-	git_buf_sets(object_location, objects_dir);
-	git_path_to_dir(object_location);
+	/* The listing of OBJ_DIR/xx/, xx being the first byte of short_oid */
+	git_mutex_lock(&backend->dirs_lock);
 
-	/* save adjusted position at end of dir so it can be restored later */
-	dir_len = git_buf_len(object_location);
+	if ((error = loose_dir_refresh(backend, short_oid->id[0])) == 0) {
+		pos = loose_dir_lower_bound(dir, &key);
 
-	/* Convert raw oid to hex formatted oid */
-	git_oid_fmt((char *)state.short_oid, short_oid);
+		if (pos < dir->nr && git_oid_ncmp(&dir->ids[pos], short_oid, len) == 0) {
+			if (pos + 1 < dir->nr &&
+				git_oid_ncmp(&dir->ids[pos + 1], short_oid, len) == 0)
+				error = git_odb__error_ambiguous("multiple matches in loose objects");
 
-	/* Explore OBJ_DIR/xx/ where xx is the beginning of hex formatted short oid */
-	if (git_buf_printf(object_location, "%.2s/", state.short_oid) < 0)
-		return -1;
-
-	/* Check that directory exists */
-	if (git_path_isdir(object_location->ptr) == false)
-		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+			/* the listing may change once we let go of the lock */
+			git_oid_cpy(res_oid, &dir->ids[pos]);
+			found = res_oid;
+		}
+	}
 
-	state.dir_len = git_buf_len(object_location);
-	state.short_oid_len = len;
-	state.found = 0;
+	git_mutex_unlock(&backend->dirs_lock);
 
-	/* Explore directory to find a unique object matching short_oid */
-	error = git_path_direach(
-		object_location, fn_locate_object_short_oid, &state);
-	if (error)
+	if (error < 0)
 		return error;
 
-	if (!state.found)
-		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	/* Staged objects of a bulk write aren't sorted; look at them all */
+	if (backend->bulk_dir) {
+		git_oidmap *staged = backend->bulk_objects;
+		khiter_t i;
 
-	/* Convert obtained hex formatted oid to raw */
-	error = git_oid_fromstr(res_oid, (char *)state.res_oid);
-	if (error)
-		return error;
+		for (i = kh_begin(staged); i != kh_end(staged); ++i) {
+			const git_oid *id;
 
-	/* Update the location according to the oid obtained */
+			if (!kh_exist(staged, i))
+				continue;
 
-	git_buf_truncate(object_location, dir_len);
-	if (git_buf_grow(object_location, dir_len + GIT_OID_HEXSZ + 2) < 0)
-		return -1;
+			id = kh_key(staged, i);
+			if (git_oid_ncmp(id, short_oid, len) != 0 ||
+				(found && git_oid_cmp(id, found) == 0))
+				continue;
 
-	git_oid_pathfmt(object_location->ptr + dir_len, res_oid);
+			if (found)
+				return git_odb__error_ambiguous("multiple matches in loose objects");
 
-	object_location->size += GIT_OID_HEXSZ + 1;
-	object_location->ptr[object_location->size] = '\0';
+			found = id;
+		}
+	}
 
-	return 0;
+	if (!found)
+		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+
+	if (found != res_oid)
+		git_oid_cpy(res_oid, found);
+
+	return locate_object(object_location, backend, res_oid);
 }
 
 
@@ -761,6 +1010,444 @@ static int loose_backend__foreach(git_odb_backend *_backend, int (*cb)(git_oid *
 	return state.cb_error ? state.cb_error : error;
 }
 
+/***********************************************************
+ *
+ * BULK WRITES
+ *
+ * The objects of a bulk write are written, without a lock file
+ * or a rename each, to a staging directory inside the object
+ * directory. Committing syncs them all if asked to and moves them
+ * in place: a fanout directory the repository doesn't have yet is
+ * moved in with a single rename.
+ *
+ ***********************************************************/
+
+/*
+ * The path an object is staged at, making its fanout directory
+ * if it is the first one in there.
+ */
+static int bulk_object_path(git_buf *path, loose_backend *backend, const git_oid *oid)
+{
+	size_t dir_len;
+
+	if (object_file_name(path, backend->bulk_dir, oid) < 0)
+		return -1;
+
+	if (backend->bulk_fanout[oid->id[0]])
+		return 0;
+
+	/* cut the path right after "xx" */
+	dir_len = git_buf_len(path) - (GIT_OID_HEXSZ - 1);
+	path->ptr[dir_len] = '\0';
+
+	if (p_mkdir(path->ptr, GIT_OBJECT_DIR_MODE) < 0 && errno != EEXIST) {
+		giterr_set(GITERR_OS, "Failed to create directory '%s'", path->ptr);
+		return -1;
+	}
+
+	path->ptr[dir_len] = '/';
+	backend->bulk_fanout[oid->id[0]] = 1;
+
+	return 0;
+}
+
+static int bulk_add(loose_backend *backend, const git_oid *oid)
+{
+	git_oid *staged;
+	khiter_t pos;
+	int rval;
+
+	pos = kh_get(oid, backend->bulk_objects, oid);
+	if (pos != kh_end(backend->bulk_objects))
+		return 0;
+
+	staged = git_pool_malloc(&backend->bulk_ids, 1);
+	GITERR_CHECK_ALLOC(staged);
+	git_oid_cpy(staged, oid);
+
+	kh_put(oid, backend->bulk_objects, staged, &rval);
+	if (rval < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bulk_end(loose_backend *backend)
+{
+	if (!backend->bulk_dir)
+		return;
+
+	git_futils_rmdir_r(backend->bulk_dir, NULL, GIT_DIRREMOVAL_FILES_AND_DIRS);
+	git__free(backend->bulk_dir);
+	backend->bulk_dir = NULL;
+
+	git_oidmap_free(backend->bulk_objects);
+	git_pool_clear(&backend->bulk_ids);
+	memset(backend->bulk_fanout, 0x0, sizeof(backend->bulk_fanout));
+}
+
+static int bulk_fsync_cb(void *data, git_buf *path)
+{
+	int fd, error;
+
+	GIT_UNUSED(data);
+
+	if ((fd = p_open(path->ptr, O_RDONLY)) < 0) {
+		giterr_set(GITERR_OS, "Failed to open '%s'", path->ptr);
+		return -1;
+	}
+
+	if ((error = p_fsync(fd)) < 0)
+		giterr_set(GITERR_OS, "Failed to sync '%s'", path->ptr);
+
+	p_close(fd);
+	return error;
+}
+
+struct bulk_move {
+	size_t src_len;
+	git_buf dst;
+	size_t dst_len;
+};
+
+static int bulk_move_cb(void *data, git_buf *path)
+{
+	struct bulk_move *move = data;
+
+	git_buf_truncate(&move->dst, move->dst_len);
+	if (git_buf_puts(&move->dst, path->ptr + move->src_len) < 0)
+		return -1;
+
+	/*
+	 * An object that made it there in the meantime is the same
+	 * object; on Windows we couldn't replace it anyway.
+	 */
+	if (p_rename(path->ptr, move->dst.ptr) < 0 &&
+		git_path_exists(move->dst.ptr) == false) {
+		giterr_set(GITERR_OS, "Failed to move '%s' into place", path->ptr);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Move one staged fanout directory into the object directory */
+static int bulk_commit_fanout(loose_backend *backend, unsigned char fanout)
+{
+	git_buf src = GIT_BUF_INIT;
+	struct bulk_move move;
+	int error = -1;
+
+	memset(&move, 0x0, sizeof(move));
+
+	git_buf_sets(&src, backend->bulk_dir);
+	git_path_to_dir(&src);
+	git_buf_sets(&move.dst, backend->objects_dir);
+	git_path_to_dir(&move.dst);
+
+	if (git_buf_printf(&src, "%02x", fanout) < 0 ||
+		git_buf_printf(&move.dst, "%02x", fanout) < 0)
+		goto done;
+
+	if (backend->fsync_object_files &&
+		git_path_direach(&src, bulk_fsync_cb, NULL) < 0)
+		goto done;
+
+	/* The whole directory at once, if nothing is in the way */
+	if (git_path_isdir(move.dst.ptr) == false &&
+		p_rename(src.ptr, move.dst.ptr) == 0) {
+		error = 0;
+		goto done;
+	}
+
+	if (p_mkdir(move.dst.ptr, GIT_OBJECT_DIR_MODE) < 0 && errno != EEXIST) {
+		giterr_set(GITERR_OS, "Failed to create directory '%s'", move.dst.ptr);
+		goto done;
+	}
+
+	git_path_to_dir(&src);
+	git_path_to_dir(&move.dst);
+	move.src_len = git_buf_len(&src);
+	move.dst_len = git_buf_len(&move.dst);
+
+	error = git_path_direach(&src, bulk_move_cb, &move);
+
+done:
+	git_buf_free(&src);
+	git_buf_free(&move.dst);
+	return error;
+}
+
+static int loose_backend__bulk_begin(git_odb_backend *_backend)
+{
+	loose_backend *backend = (loose_backend *)_backend;
+	git_buf path = GIT_BUF_INIT;
+	int attempt;
+
+	if (backend->bulk_dir) {
+		giterr_set(GITERR_ODB, "A bulk write is already open");
+		return -1;
+	}
+
+	for (attempt = 0; ; ++attempt) {
+		git_buf_sets(&path, backend->objects_dir);
+		git_path_to_dir(&path);
+		if (git_buf_printf(&path, "tmp_bulk_%d", attempt) < 0)
+			return -1;
+
+		if (p_mkdir(path.ptr, GIT_OBJECT_DIR_MODE) == 0)
+			break;
+
+		if (errno != EEXIST || attempt == 1000) {
+			giterr_set(GITERR_OS, "Failed to create directory '%s'", path.ptr);
+			git_buf_free(&path);
+			return -1;
+		}
+	}
+
+	if ((backend->bulk_objects = git_oidmap_alloc()) == NULL ||
+		git_pool_init(&backend->bulk_ids, sizeof(git_oid), 0) < 0) {
+		git_oidmap_free(backend->bulk_objects);
+		git_futils_rmdir_r(path.ptr, NULL, GIT_DIRREMOVAL_FILES_AND_DIRS);
+		git_buf_free(&path);
+		giterr_set_oom();
+		return -1;
+	}
+
+	backend->bulk_dir = git_buf_detach(&path);
+	memset(backend->bulk_fanout, 0x0, sizeof(backend->bulk_fanout));
+
+	return 0;
+}
+
+static int loose_backend__bulk_commit(git_odb_backend *_backend)
+{
+	loose_backend *backend = (loose_backend *)_backend;
+	unsigned int i;
+
+	/*
+	 * Nothing staged: committed already, while another backend
+	 * failed to, and now the ODB is retrying the commit.
+	 */
+	if (!backend->bulk_dir)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(backend->bulk_fanout); ++i) {
+		if (!backend->bulk_fanout[i])
+			continue;
+
+		/* the cached listing is now out of date */
+		git_mutex_lock(&backend->dirs_lock);
+		backend->dirs[i].listed = 0;
+		git_mutex_unlock(&backend->dirs_lock);
+
+		if (bulk_commit_fanout(backend, (unsigned char)i) < 0)
+			return -1;
+
+		backend->bulk_fanout[i] = 0;
+	}
+
+	bulk_end(backend);
+	return 0;
+}
+
+static void loose_backend__bulk_rollback(git_odb_backend *_backend)
+{
+	bulk_end((loose_backend *)_backend);
+}
+
+/*
+ * Inflate from the object file into `out` until something came out or
+ * the zlib stream is over; returns the number of bytes inflated.
+ */
+static ssize_t readstream_inflate(loose_readstream *stream, void *out, size_t len)
+{
+	int status = Z_OK;
+
+	set_stream_output(&stream->zs, out, len);
+
+	while (!stream->done && stream->zs.avail_out == len) {
+		if (stream->zs.avail_in == 0) {
+			ssize_t read_bytes = p_read(stream->fd, stream->in, sizeof(stream->in));
+
+			if (read_bytes <= 0) {
+				giterr_set(GITERR_ODB, read_bytes < 0 ?
+					"Failed to read loose object" : "Loose object is truncated");
+				return -1;
+			}
+			set_stream_input(&stream->zs, stream->in, read_bytes);
+		}
+
+		status = inflate(&stream->zs, Z_SYNC_FLUSH);
+
+		if (status == Z_STREAM_END)
+			stream->done = 1;
+		else if (status != Z_OK && status != Z_BUF_ERROR) {
+			giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+			return -1;
+		}
+	}
+
+	return (ssize_t)(len - stream->zs.avail_out);
+}
+
+static int loose_backend__readstream_read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+	ssize_t n;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	if (stream->head_pos < stream->head_len) {
+		n = (ssize_t)min(len, stream->head_len - stream->head_pos);
+		memcpy(buffer, stream->head + stream->head_pos, n);
+		stream->head_pos += n;
+		return (int)n;
+	}
+
+	if ((n = readstream_inflate(stream, buffer, len)) < 0)
+		return -1;
+
+	stream->total_out += n;
+	if (stream->total_out > stream->hdr.size ||
+		(stream->done && stream->total_out != stream->hdr.size)) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate loose object. Size mismatch");
+		return -1;
+	}
+
+	return (int)n;
+}
+
+static void loose_backend__readstream_free(git_odb_stream *_stream)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+
+	inflateEnd(&stream->zs);
+	p_close(stream->fd);
+	git__free(stream);
+}
+
+static int loose_backend__readstream(
+	git_odb_stream **stream_out, git_odb_backend *_backend, const git_oid *oid)
+{
+	loose_backend *backend = (loose_backend *)_backend;
+	loose_readstream *stream = NULL;
+	git_buf object_path = GIT_BUF_INIT;
+	git_rawobj raw;
+	ssize_t head_len, n;
+	size_t used;
+	int error = -1;
+
+	if (locate_object(&object_path, backend, oid) < 0) {
+		git_buf_free(&object_path);
+		return git_odb__error_notfound("no matching loose object", oid);
+	}
+
+	stream = git__calloc(1, sizeof(loose_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if ((stream->fd = git_futils_open_ro(object_path.ptr)) < 0) {
+		git__free(stream);
+		git_buf_free(&object_path);
+		return -1;
+	}
+
+	if (p_read(stream->fd, stream->in, 2) != 2) {
+		giterr_set(GITERR_ODB, "Failed to read loose object");
+		goto fail;
+	}
+
+	/* the old pack-like format is rare enough to be read in full */
+	if (!is_zlib_compressed_data(stream->in)) {
+		p_close(stream->fd);
+		git__free(stream);
+
+		error = read_loose(&raw, &object_path);
+		git_buf_free(&object_path);
+		if (error < 0)
+			return error;
+
+		return git_odb__buffer_rstream(stream_out, _backend, &raw);
+	}
+
+	if (inflateInit(&stream->zs) < Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+		goto fail;
+	}
+	set_stream_input(&stream->zs, stream->in, 2);
+
+	/* leave room for the terminator get_object_header() relies on */
+	head_len = 0;
+	while (head_len < (ssize_t)sizeof(stream->head) - 1 && !stream->done &&
+		memchr(stream->head, '\0', head_len) == NULL) {
+		n = readstream_inflate(stream, stream->head + head_len,
+			sizeof(stream->head) - 1 - head_len);
+		if (n < 0)
+			goto fail_inflate;
+		head_len += n;
+	}
+
+	if ((used = get_object_header(&stream->hdr, stream->head)) == 0 ||
+		used > (size_t)head_len ||
+		!git_object_typeisloose(stream->hdr.type)) {
+		giterr_set(GITERR_ODB, "Failed to inflate disk object.");
+		goto fail_inflate;
+	}
+
+	stream->head_pos = used;
+	stream->head_len = (size_t)head_len;
+	stream->total_out = head_len - used;
+
+	if (stream->total_out > stream->hdr.size ||
+		(stream->done && stream->total_out != stream->hdr.size)) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate loose object. Size mismatch");
+		goto fail_inflate;
+	}
+
+	stream->stream.backend = _backend;
+	stream->stream.read = &loose_backend__readstream_read;
+	stream->stream.write = NULL; /* read only */
+	stream->stream.finalize_write = NULL;
+	stream->stream.free = &loose_backend__readstream_free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+
+	git_buf_free(&object_path);
+	*stream_out = (git_odb_stream *)stream;
+	return 0;
+
+fail_inflate:
+	inflateEnd(&stream->zs);
+fail:
+	p_close(stream->fd);
+	git__free(stream);
+	git_buf_free(&object_path);
+	return error;
+}
+
+/*
+ * Whether a written object is there already. Every write changes the
+ * directory the listing of `locate_object` is of, so a single stat()
+ * of the object's file is cheaper here than refreshing the listing.
+ */
+static bool object_is_stored(loose_backend *backend, const git_oid *oid)
+{
+	git_buf path = GIT_BUF_INIT;
+	bool stored;
+
+	if (backend->bulk_dir &&
+		kh_get(oid, backend->bulk_objects, oid) != kh_end(backend->bulk_objects))
+		return true;
+
+	stored = object_file_name(&path, backend->objects_dir, oid) == 0 &&
+		git_path_exists(path.ptr);
+
+	git_buf_free(&path);
+	return stored;
+}
+
 static int loose_backend__stream_fwrite(git_oid *oid, git_odb_stream *_stream)
 {
 	loose_writestream *stream = (loose_writestream *)_stream;
@@ -768,20 +1455,32 @@ static int loose_backend__stream_fwrite(git_oid *oid, git_odb_stream *_stream)
 	git_buf final_path = GIT_BUF_INIT;
 	int error = 0;
 
-	if (git_filebuf_hash(oid, &stream->fbuf) < 0 ||
-		object_file_name(&final_path, backend->objects_dir, oid) < 0 ||
-		git_futils_mkpath2file(final_path.ptr, GIT_OBJECT_DIR_MODE) < 0)
+	if (git_filebuf_hash(oid, &stream->fbuf) < 0)
 		error = -1;
 	/*
 	 * Don't try to add an existing object to the repository. This
 	 * is what git does and allows us to sidestep the fact that
 	 * we're not allowed to overwrite a read-only file on Windows.
 	 */
-	else if (git_path_exists(final_path.ptr) == true)
+	else if (object_is_stored(backend, oid))
 		git_filebuf_cleanup(&stream->fbuf);
-	else
-		error = git_filebuf_commit_at(
-			&stream->fbuf, final_path.ptr, GIT_OBJECT_FILE_MODE);
+	else if (backend->bulk_dir) {
+		if (bulk_object_path(&final_path, backend, oid) < 0 ||
+			git_filebuf_commit_at(
+				&stream->fbuf, final_path.ptr, GIT_OBJECT_FILE_MODE) < 0 ||
+			bulk_add(backend, oid) < 0)
+			error = -1;
+	} else {
+		bool listing_current = loose_dir_is_current(backend, oid);
+
+		if (object_file_name(&final_path, backend->objects_dir, oid) < 0 ||
+			git_futils_mkpath2file(final_path.ptr, GIT_OBJECT_DIR_MODE) < 0 ||
+			git_filebuf_commit_at(
+				&stream->fbuf, final_path.ptr, GIT_OBJECT_FILE_MODE) < 0)
+			error = -1;
+		else
+			loose_dir_wrote(backend, oid, listing_current);
+	}
 
 	git_buf_free(&final_path);
 
@@ -855,6 +1554,103 @@ static int loose_backend__stream(git_odb_stream **stream_out, git_odb_backend *_
 	return !stream ? -1 : 0;
 }
 
+static int deflate_object(
+	git_buf *out, int level,
+	const char *header, size_t header_len,
+	const void *data, size_t len)
+{
+	z_stream zs;
+	int zerror;
+
+	memset(&zs, 0x0, sizeof(zs));
+	if (deflateInit(&zs, level) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to initialize deflate");
+		return -1;
+	}
+
+	if (git_buf_grow(out, deflateBound(&zs, (uLong)(header_len + len)) + 1) < 0) {
+		deflateEnd(&zs);
+		return -1;
+	}
+
+	zs.next_out = (unsigned char *)out->ptr;
+	zs.avail_out = (uInt)out->asize - 1;
+
+	zs.next_in = (unsigned char *)header;
+	zs.avail_in = (uInt)header_len;
+	zerror = deflate(&zs, Z_NO_FLUSH);
+
+	if (zerror == Z_OK) {
+		zs.next_in = (unsigned char *)data;
+		zs.avail_in = (uInt)len;
+		zerror = deflate(&zs, Z_FINISH);
+	}
+
+	out->size = zs.total_out;
+	out->ptr[out->size] = '\0';
+	deflateEnd(&zs);
+
+	if (zerror != Z_STREAM_END) {
+		giterr_set(GITERR_ZLIB, "Failed to deflate object");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write an object of a bulk write. We hash it up front, so it can
+ * go straight to its final name in the staging directory, and an
+ * object we already have isn't written again.
+ */
+static int bulk_write(
+	git_oid *oid, loose_backend *backend,
+	const void *data, size_t len, git_otype type)
+{
+	git_buf path = GIT_BUF_INIT, deflated = GIT_BUF_INIT;
+	git_rawobj raw;
+	char header[64];
+	int header_len, fd, error = -1;
+
+	raw.data = (void *)data;
+	raw.len = len;
+	raw.type = type;
+
+	if (git_odb__hashobj(oid, &raw) < 0)
+		return -1;
+
+	if (locate_object(&path, backend, oid) == 0) {
+		git_buf_free(&path);
+		return 0;
+	}
+
+	header_len = format_object_header(header, sizeof(header), len, type);
+
+	if (deflate_object(&deflated, backend->object_zlib_level,
+			header, header_len, data, len) < 0 ||
+		bulk_object_path(&path, backend, oid) < 0)
+		goto done;
+
+	if ((fd = p_open(path.ptr, O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+			GIT_OBJECT_FILE_MODE)) < 0) {
+		giterr_set(GITERR_OS, "Failed to create '%s'", path.ptr);
+		goto done;
+	}
+
+	error = p_write(fd, deflated.ptr, deflated.size);
+	p_close(fd);
+
+	if (error < 0)
+		giterr_set(GITERR_OS, "Failed to write '%s'", path.ptr);
+	else
+		error = bulk_add(backend, oid);
+
+done:
+	git_buf_free(&path);
+	git_buf_free(&deflated);
+	return error;
+}
+
 static int loose_backend__write(git_oid *oid, git_odb_backend *_backend, const void *data, size_t len, git_otype type)
 {
 	int error = 0, header_len;
@@ -862,9 +1658,13 @@ static int loose_backend__write(git_oid *oid, git_odb_backend *_backend, const v
 	char header[64];
 	git_filebuf fbuf = GIT_FILEBUF_INIT;
 	loose_backend *backend;
+	bool listing_current;
 
 	backend = (loose_backend *)_backend;
 
+	if (backend->bulk_dir)
+		return bulk_write(oid, backend, data, len, type);
+
 	/* prepare the header for the file */
 	header_len = format_object_header(header, sizeof(header), len, type);
 
@@ -882,10 +1682,14 @@ static int loose_backend__write(git_oid *oid, git_odb_backend *_backend, const v
 	git_filebuf_write(&fbuf, data, len);
 	git_filebuf_hash(oid, &fbuf);
 
+	listing_current = loose_dir_is_current(backend, oid);
+
 	if (object_file_name(&final_path, backend->objects_dir, oid) < 0 ||
 		git_futils_mkpath2file(final_path.ptr, GIT_OBJECT_DIR_MODE) < 0 ||
 		git_filebuf_commit_at(&fbuf, final_path.ptr, GIT_OBJECT_FILE_MODE) < 0)
 		error = -1;
+	else
+		loose_dir_wrote(backend, oid, listing_current);
 
 cleanup:
 	if (error < 0)
@@ -897,9 +1701,16 @@ cleanup:
 static void loose_backend__free(git_odb_backend *_backend)
 {
 	loose_backend *backend;
+	size_t i;
 	assert(_backend);
 	backend = (loose_backend *)_backend;
 
+	bulk_end(backend);
+
+	for (i = 0; i < ARRAY_SIZE(backend->dirs); ++i)
+		git__free(backend->dirs[i].ids);
+	git_mutex_free(&backend->dirs_lock);
+
 	git__free(backend->objects_dir);
 	git__free(backend);
 }
@@ -923,14 +1734,19 @@ int git_odb_backend_loose(
 
 	backend->object_zlib_level = compression_level;
 	backend->fsync_object_files = do_fsync;
+	git_mutex_init(&backend->dirs_lock);
 
 	backend->parent.read = &loose_backend__read;
 	backend->parent.write = &loose_backend__write;
 	backend->parent.read_prefix = &loose_backend__read_prefix;
 	backend->parent.read_header = &loose_backend__read_header;
 	backend->parent.writestream = &loose_backend__stream;
+	backend->parent.readstream = &loose_backend__readstream;
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.foreach = &loose_backend__foreach;
+	backend->parent.bulk_begin = &loose_backend__bulk_begin;
+	backend->parent.bulk_commit = &loose_backend__bulk_commit;
+	backend->parent.bulk_rollback = &loose_backend__bulk_rollback;
 	backend->parent.free = &loose_backend__free;
 
 	*backend_out = (git_odb_backend *)backend;
@@ -16,14 +16,32 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "midx.h"
 
 #include "git2/odb_backend.h"
 
+/*
+ * Object ids recently looked up and not found, in a direct-mapped
+ * table. Objects only appear in the backend through a new pack, so an
+ * entry stays valid until the pack folder changes.
+ */
+#define PACK_MISSING_SLOTS 1024
+
+struct pack_missing {
+	git_oid id;
+	int used;
+};
+
 struct pack_backend {
 	git_odb_backend parent;
 	git_vector packs;
+	struct git_midx_file *midx;
+	git_vector midx_packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
+	git_time_t pack_folder_mtime;
+	unsigned pack_folder_scanned:1, pack_folder_racy:1;
+	struct pack_missing missing[PACK_MISSING_SLOTS];
 };
 
 /**
@@ -82,7 +100,10 @@ struct pack_backend {
  * |-# pack_entry_find
  *	| Iterate through all the packs that have been preloaded
  *	| (starting by the pack where the latest object was found)
- *	| to try to find the OID in one of them.
+ *	| to try to find the OID in one of them. When the pack folder
+ *	| has a `multi-pack-index`, all the packs it covers are
+ *	| searched at once with a single lookup in that index, and
+ *	| only the packs outside of it are searched one by one.
  *	|
  *	|-# pack_entry_find1
  *		| Check the index of an individual pack to see if the SHA1
@@ -134,6 +155,7 @@ static int packfile_sort__cb(const void *a_, const void *b_);
 
 static int packfile_load__cb(void *_data, git_buf *path);
 static int packfile_refresh_all(struct pack_backend *backend);
+static int midx_refresh(struct pack_backend *backend);
 
 static int pack_entry_find(struct git_pack_entry *e,
 	struct pack_backend *backend, const git_oid *oid);
@@ -232,10 +254,38 @@ static int packfile_load__cb(void *_data, git_buf *path)
 	return git_vector_insert(&backend->packs, pack);
 }
 
+GIT_INLINE(struct pack_missing *) pack_missing_slot(
+	struct pack_backend *backend, const git_oid *oid)
+{
+	uint32_t h;
+
+	memcpy(&h, oid->id, sizeof(h));
+	return &backend->missing[h % PACK_MISSING_SLOTS];
+}
+
+static bool pack_missing_contains(struct pack_backend *backend, const git_oid *oid)
+{
+	struct pack_missing *slot = pack_missing_slot(backend, oid);
+	return slot->used && git_oid_cmp(&slot->id, oid) == 0;
+}
+
+static void pack_missing_add(struct pack_backend *backend, const git_oid *oid)
+{
+	struct pack_missing *slot = pack_missing_slot(backend, oid);
+
+	git_oid_cpy(&slot->id, oid);
+	slot->used = 1;
+}
+
+/*
+ * Rescan the pack folder if it may have changed since the last scan.
+ * Returns 1 if it was rescanned, 0 if nothing changed, or an error.
+ */
 static int packfile_refresh_all(struct pack_backend *backend)
 {
 	int error;
 	struct stat st;
+	git_time_t scan_time;
 	git_buf path = GIT_BUF_INIT;
 
 	if (backend->pack_folder == NULL)
@@ -244,6 +294,17 @@ static int packfile_refresh_all(struct pack_backend *backend)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL);
 
+	/*
+	 * Adding or removing a pack changes the folder's mtime. A scan
+	 * during the same second as that change may have missed it, so
+	 * such a racy scan does not count until the clock moves on.
+	 */
+	if (backend->pack_folder_scanned && !backend->pack_folder_racy &&
+		backend->pack_folder_mtime == (git_time_t)st.st_mtime)
+		return 0;
+
+	scan_time = (git_time_t)time(NULL);
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -256,7 +317,135 @@ static int packfile_refresh_all(struct pack_backend *backend)
 
 	git_vector_sort(&backend->packs);
 
-	return 0;
+	if ((error = midx_refresh(backend)) < 0)
+		return error;
+
+	backend->pack_folder_scanned = 1;
+	backend->pack_folder_racy = ((git_time_t)st.st_mtime >= scan_time);
+	backend->pack_folder_mtime = (git_time_t)st.st_mtime;
+	memset(backend->missing, 0x0, sizeof(backend->missing));
+
+	return 1;
+}
+
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX
+ *
+ ***********************************************************/
+
+GIT_INLINE(const char *) pack_basename(const struct git_pack_file *p)
+{
+	const char *base = strrchr(p->pack_name, '/');
+	return base ? base + 1 : p->pack_name;
+}
+
+static int midx_pack_name_cmp(const void *a_, const void *b_)
+{
+	return strcmp((const char *)a_, pack_basename(b_));
+}
+
+static int midx_pack_sort_cmp(const void *a_, const void *b_)
+{
+	return strcmp(pack_basename(a_), pack_basename(b_));
+}
+
+static void midx_detach(struct pack_backend *backend)
+{
+	struct git_pack_file *p;
+	unsigned int i;
+
+	git_vector_foreach(&backend->midx_packs, i, p)
+		p->in_midx = 0;
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+}
+
+/*
+ * (Re)load the multi-pack-index of the pack folder and resolve its
+ * pack ids to our loaded packs. The multi-pack-index is only an
+ * accelerator: if it is missing, unreadable or names a pack we do
+ * not have, every pack is simply searched on its own.
+ */
+static int midx_refresh(struct pack_backend *backend)
+{
+	git_buf midx_path = GIT_BUF_INIT, pack_name = GIT_BUF_INIT;
+	git_vector by_name = GIT_VECTOR_INIT;
+	struct git_pack_file *p;
+	const char *name;
+	unsigned int i;
+	int pos, error = 0;
+
+	if (git_buf_joinpath(&midx_path, backend->pack_folder, "multi-pack-index") < 0)
+		return -1;
+
+	if (backend->midx &&
+		!git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path)))
+		goto done;
+
+	midx_detach(backend);
+
+	if (git_midx_open(&backend->midx, git_buf_cstr(&midx_path)) < 0) {
+		giterr_clear();
+		goto done;
+	}
+
+	if ((error = git_vector_dup(&by_name, &backend->packs, midx_pack_sort_cmp)) < 0)
+		goto done;
+	git_vector_sort(&by_name);
+
+	git_vector_foreach(&backend->midx->packfile_names, i, name) {
+		/* "pack-xxx.idx" names the pack we know as "pack-xxx.pack" */
+		git_buf_sets(&pack_name, name);
+		if (git__suffixcmp(pack_name.ptr, ".idx") == 0)
+			git_buf_truncate(&pack_name, pack_name.size - strlen(".idx"));
+		if ((error = git_buf_puts(&pack_name, ".pack")) < 0) {
+			midx_detach(backend);
+			goto done;
+		}
+
+		pos = git_vector_bsearch2(&by_name, midx_pack_name_cmp, pack_name.ptr);
+		if (pos < 0) {
+			midx_detach(backend);
+			goto done;
+		}
+
+		if ((error = git_vector_insert(
+				&backend->midx_packs, git_vector_get(&by_name, pos))) < 0) {
+			midx_detach(backend);
+			goto done;
+		}
+	}
+
+	git_vector_foreach(&backend->midx_packs, i, p)
+		p->in_midx = 1;
+
+	/* the packs in the index are only searched through it */
+	backend->last_found = NULL;
+
+done:
+	git_vector_free(&by_name);
+	git_buf_free(&pack_name);
+	git_buf_free(&midx_path);
+	return error;
+}
+
+static int midx_entry_find(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry m;
+	int error;
+
+	if ((error = git_midx_entry_find(&m, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	return git_pack_entry_init(
+		e, git_vector_get(&backend->midx_packs, m.pack_index), &m.sha1, m.offset);
 }
 
 static int pack_entry_find_inner(
@@ -271,11 +460,15 @@ static int pack_entry_find_inner(
 		git_pack_entry_find(e, last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (backend->midx &&
+		midx_entry_find(e, backend, oid, GIT_OID_HEXSZ) == 0)
+		return 0;
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
 		p = git_vector_get(&backend->packs, i);
-		if (p == last_found)
+		if (p == last_found || p->in_midx)
 			continue;
 
 		if (git_pack_entry_find(e, p, oid, GIT_OID_HEXSZ) == 0) {
@@ -296,13 +489,22 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	/* A known miss stays a miss until the pack folder changes */
+	if (pack_missing_contains(backend, oid)) {
+		if ((error = packfile_refresh_all(backend)) < 0)
+			return error;
+		if (!error)
+			return git_odb__error_notfound("failed to find pack entry", oid);
+	}
+
 	if (!pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 	if ((error = packfile_refresh_all(backend)) < 0)
 		return error;
-	if (!pack_entry_find_inner(e, backend, oid, last_found))
+	if (error > 0 && !pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 
+	pack_missing_add(backend, oid);
 	return git_odb__error_notfound("failed to find pack entry", oid);
 }
 
@@ -317,6 +519,10 @@ static unsigned pack_entry_find_prefix_inner(
 	unsigned int i;
 	unsigned found = 0;
 
+	/* it may have been found before the index covered it */
+	if (last_found && last_found->in_midx)
+		last_found = NULL;
+
 	if (last_found) {
 		error = git_pack_entry_find(e, last_found, short_oid, len);
 		if (error == GIT_EAMBIGUOUS)
@@ -325,11 +531,19 @@ static unsigned pack_entry_find_prefix_inner(
 			found = 1;
 	}
 
+	if (backend->midx) {
+		error = midx_entry_find(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error && ++found > 1)
+			return found;
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
 		p = git_vector_get(&backend->packs, i);
-		if (p == last_found)
+		if (p == last_found || p->in_midx)
 			continue;
 
 		error = git_pack_entry_find(e, p, short_oid, len);
@@ -359,7 +573,8 @@ static int pack_entry_find_prefix(
 		goto cleanup;
 	if ((error = packfile_refresh_all(backend)) < 0)
 		return error;
-	found = pack_entry_find_prefix_inner(e, backend, short_oid, len, last_found);
+	if (error > 0)
+		found = pack_entry_find_prefix_inner(e, backend, short_oid, len, last_found);
 
 cleanup:
 	if (!found)
@@ -379,19 +594,20 @@ cleanup:
  *
  ***********************************************************/
 
-/*
-int pack_backend__read_header(git_rawobj *obj, git_odb_backend *backend, const git_oid *oid)
+static int pack_backend__read_header(
+	size_t *len_p, git_otype *type_p,
+	struct git_odb_backend *backend, const git_oid *oid)
 {
-	pack_location location;
+	struct git_pack_entry e;
+	int error;
 
-	assert(obj && backend && oid);
+	assert(len_p && type_p && backend && oid);
 
-	if (locate_packfile(&location, (struct pack_backend *)backend, oid) < 0)
-		return GIT_ENOTFOUND;
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
 
-	return read_header_packed(obj, &location);
+	return git_packfile_resolve_header(len_p, type_p, e.p, e.offset);
 }
-*/
 
 static int pack_backend__read(void **buffer_p, size_t *len_p, git_otype *type_p, git_odb_backend *backend, const git_oid *oid)
 {
@@ -447,6 +663,147 @@ static int pack_backend__read_prefix(
 	return error;
 }
 
+struct read_many_entry {
+	struct git_pack_file *p;
+	git_off_t offset;
+	size_t idx;
+};
+
+static int read_many_entry_cmp(const void *a, const void *b)
+{
+	const struct read_many_entry *ea = a, *eb = b;
+
+	if (ea->p != eb->p)
+		return strcmp(ea->p->pack_name, eb->p->pack_name);
+
+	return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+}
+
+static int pack_backend__read_many(
+	git_odb_backend *_backend, const git_oid *ids, size_t n,
+	int (*cb)(size_t idx, void *data, size_t len, git_otype type, void *payload),
+	void *payload)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct read_many_entry *entries;
+	git_pack_base_cache *bases = NULL;
+	size_t i, nr_entries = 0;
+	int error = 0;
+
+	entries = git__malloc(n * sizeof(struct read_many_entry));
+	GITERR_CHECK_ALLOC(entries);
+
+	/* find everything first, then read the packs front to back */
+	for (i = 0; i < n; ++i) {
+		struct git_pack_entry e;
+
+		if ((error = pack_entry_find(&e, backend, &ids[i])) == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+			continue;
+		}
+		if (error < 0)
+			goto cleanup;
+
+		entries[nr_entries].p = e.p;
+		entries[nr_entries].offset = e.offset;
+		entries[nr_entries].idx = i;
+		nr_entries++;
+	}
+
+	qsort(entries, nr_entries, sizeof(struct read_many_entry), read_many_entry_cmp);
+
+	if ((bases = git__calloc(1, sizeof(git_pack_base_cache))) == NULL) {
+		error = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < nr_entries; ++i) {
+		git_off_t offset = entries[i].offset;
+		git_rawobj raw;
+
+		if ((error = git_packfile_unpack_cached(&raw, entries[i].p, &offset, bases)) < 0)
+			break;
+
+		if ((error = cb(entries[i].idx, raw.data, raw.len, raw.type, payload)) != 0)
+			break;
+	}
+
+	git_pack_base_cache_clear(bases);
+	git__free(bases);
+
+cleanup:
+	git__free(entries);
+	return error;
+}
+
+typedef struct {
+	git_odb_stream stream;
+	git_packfile_stream pack;
+} pack_readstream;
+
+static int pack_backend__readstream_read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	pack_readstream *stream = (pack_readstream *)_stream;
+	return (int)git_packfile_stream_read(&stream->pack, buffer, len);
+}
+
+static void pack_backend__readstream_free(git_odb_stream *_stream)
+{
+	pack_readstream *stream = (pack_readstream *)_stream;
+
+	git_packfile_stream_free(&stream->pack);
+	git__free(stream);
+}
+
+static int pack_backend__readstream(
+	git_odb_stream **stream_out, git_odb_backend *backend, const git_oid *oid)
+{
+	struct git_pack_entry e;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos;
+	pack_readstream *stream;
+	git_rawobj raw;
+	size_t size;
+	git_otype type;
+	int error;
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	curpos = e.offset;
+	error = git_packfile_unpack_header(&size, &type, &e.p->mwf, &w_curs, &curpos);
+	git_mwindow_close(&w_curs);
+	if (error < 0)
+		return error;
+
+	/* a delta needs its base in full anyway */
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
+		if ((error = git_packfile_unpack(&raw, e.p, &e.offset)) < 0)
+			return error;
+
+		return git_odb__buffer_rstream(stream_out, backend, &raw);
+	}
+
+	stream = git__calloc(1, sizeof(pack_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if (git_packfile_stream_open(&stream->pack, e.p, curpos, size) < 0) {
+		git__free(stream);
+		return -1;
+	}
+
+	stream->stream.backend = backend;
+	stream->stream.read = &pack_backend__readstream_read;
+	stream->stream.write = NULL; /* read only */
+	stream->stream.finalize_write = NULL;
+	stream->stream.free = &pack_backend__readstream_free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+
+	*stream_out = (git_odb_stream *)stream;
+	return 0;
+}
+
 static int pack_backend__exists(git_odb_backend *backend, const git_oid *oid)
 {
 	struct git_pack_entry e;
@@ -467,7 +824,14 @@ static int pack_backend__foreach(git_odb_backend *_backend, int (*cb)(git_oid *o
 	if ((error = packfile_refresh_all(backend)) < 0)
 		return error;
 
+	if (backend->midx &&
+		(error = git_midx_foreach_entry(backend->midx, cb, data)) < 0)
+		return error;
+
 	git_vector_foreach(&backend->packs, i, p) {
+		if (p->in_midx)
+			continue;
+
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
 			return error;
 	}
@@ -489,6 +853,8 @@ static void pack_backend__free(git_odb_backend *_backend)
 		packfile_free(p);
 	}
 
+	git_midx_free(backend->midx);
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
 	git__free(backend);
@@ -513,7 +879,9 @@ int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
-	backend->parent.read_header = NULL;
+	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
+	backend->parent.read_many = &pack_backend__read_many;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.free = &pack_backend__free;
@@ -550,7 +918,9 @@ int git_odb_backend_pack(git_odb_backend **backend_out, const char *objects_dir)
 
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
-	backend->parent.read_header = NULL;
+	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
+	backend->parent.read_many = &pack_backend__read_many;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.free = &pack_backend__free;
@@ -0,0 +1,626 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include <zlib.h>
+#include "git2/indexer.h"
+#include "git2/odb_backend.h"
+#include "fileops.h"
+#include "hash.h"
+#include "odb.h"
+#include "pack.h"
+#include "compress.h"
+#include "oidmap.h"
+#include "pool.h"
+
+GIT__USE_OIDMAP;
+
+/*
+ * A write-only pack backend.
+ *
+ * Objects are appended, whole and deflated, to a temporary packfile
+ * in `objects/pack` instead of getting a loose file each. An in-memory
+ * index of what was appended makes them readable right away. Flushing
+ * the writer seals the pack, has the indexer write its `.idx` and moves
+ * it to its final name, after which the pack backend serves it.
+ */
+
+#define PACK_WRITER_HEADER_LEN 12
+
+typedef struct {
+	git_oid id;
+	git_off_t offset;	/* of the deflated data */
+	size_t zlen;
+	size_t size;
+	git_otype type;
+} pack_writer_entry;
+
+typedef struct {
+	git_odb_backend parent;
+	char *pack_dir;
+
+	/* The pack being written; fd is -1 when there is none */
+	git_buf pack_path;
+	git_file fd;
+	git_off_t size;
+
+	git_oidmap *objects;
+	git_pool entries;
+	uint32_t nr_objects;
+} pack_writer_backend;
+
+typedef struct {
+	git_odb_stream stream;
+	git_buf data;
+	size_t size;
+	git_otype type;
+} pack_writer_stream;
+
+static void pack_writer_reset(pack_writer_backend *backend)
+{
+	if (backend->fd >= 0)
+		p_close(backend->fd);
+	backend->fd = -1;
+	backend->size = 0;
+
+	kh_clear(oid, backend->objects);
+	git_pool_clear(&backend->entries);
+	backend->nr_objects = 0;
+}
+
+static void pack_writer_discard(pack_writer_backend *backend)
+{
+	if (backend->fd >= 0)
+		p_unlink(backend->pack_path.ptr);
+
+	pack_writer_reset(backend);
+	git_buf_clear(&backend->pack_path);
+}
+
+static int pack_writer_start(pack_writer_backend *backend)
+{
+	git_buf tmpl = GIT_BUF_INIT;
+	uint32_t hdr[3];
+
+	if (git_buf_joinpath(&tmpl, backend->pack_dir, "tmp_pack_writer") < 0)
+		return -1;
+
+	backend->fd = git_futils_mktmp(&backend->pack_path, tmpl.ptr);
+	git_buf_free(&tmpl);
+	if (backend->fd < 0)
+		return -1;
+
+	/* the object count is filled in when the pack is sealed */
+	hdr[0] = htonl(PACK_SIGNATURE);
+	hdr[1] = htonl(PACK_VERSION);
+	hdr[2] = 0;
+
+	if (p_write(backend->fd, hdr, sizeof(hdr)) < 0) {
+		giterr_set(GITERR_OS, "Failed to write pack header");
+		pack_writer_discard(backend);
+		return -1;
+	}
+
+	backend->size = PACK_WRITER_HEADER_LEN;
+	return 0;
+}
+
+static size_t object_header(unsigned char *hdr, size_t size, git_otype type)
+{
+	unsigned char c = (type << 4) | (size & 15);
+	size_t n = 1;
+
+	size >>= 4;
+	while (size) {
+		*hdr++ = c | 0x80;
+		c = size & 0x7f;
+		size >>= 7;
+		n++;
+	}
+	*hdr = c;
+
+	return n;
+}
+
+static pack_writer_entry *pack_writer_lookup(
+	pack_writer_backend *backend, const git_oid *oid)
+{
+	khiter_t pos = kh_get(oid, backend->objects, oid);
+
+	if (pos == kh_end(backend->objects))
+		return NULL;
+
+	return kh_value(backend->objects, pos);
+}
+
+static int pack_writer_append(
+	pack_writer_backend *backend,
+	const git_oid *oid, const void *data, size_t len, git_otype type)
+{
+	git_buf deflated = GIT_BUF_INIT;
+	unsigned char hdr[16];
+	size_t hdrlen;
+	pack_writer_entry *entry;
+	khiter_t pos;
+	int rval;
+
+	if (backend->fd < 0 && pack_writer_start(backend) < 0)
+		return -1;
+
+	hdrlen = object_header(hdr, len, type);
+
+	if (git__compress(&deflated, data, len) < 0)
+		return -1;
+
+	/* reads move the file offset around */
+	if (p_lseek(backend->fd, backend->size, SEEK_SET) < 0 ||
+		p_write(backend->fd, hdr, hdrlen) < 0 ||
+		p_write(backend->fd, deflated.ptr, deflated.size) < 0) {
+		giterr_set(GITERR_OS, "Failed to append to '%s'", backend->pack_path.ptr);
+		goto fail;
+	}
+
+	entry = git_pool_malloc(&backend->entries, 1);
+	if (!entry)
+		goto fail;
+
+	git_oid_cpy(&entry->id, oid);
+	entry->offset = backend->size + hdrlen;
+	entry->zlen = deflated.size;
+	entry->size = len;
+	entry->type = type;
+
+	pos = kh_put(oid, backend->objects, &entry->id, &rval);
+	if (rval < 0) {
+		giterr_set_oom();
+		goto fail;
+	}
+	kh_value(backend->objects, pos) = entry;
+
+	backend->size += hdrlen + deflated.size;
+	backend->nr_objects++;
+
+	git_buf_free(&deflated);
+	return 0;
+
+fail:
+	/*
+	 * whatever made it to the file is overwritten by the next object,
+	 * or cut off when the pack is sealed
+	 */
+	git_buf_free(&deflated);
+	return -1;
+}
+
+static int pack_writer_hash(git_oid *out, pack_writer_backend *backend)
+{
+	git_hash_ctx *ctx;
+	char buf[64 * 1024];
+	git_off_t left = backend->size;
+
+	if (p_lseek(backend->fd, 0, SEEK_SET) < 0)
+		return -1;
+
+	ctx = git_hash_new_ctx();
+	GITERR_CHECK_ALLOC(ctx);
+
+	while (left > 0) {
+		size_t chunk = left < (git_off_t)sizeof(buf) ? (size_t)left : sizeof(buf);
+
+		if (p_read(backend->fd, buf, chunk) != (ssize_t)chunk) {
+			git_hash_free_ctx(ctx);
+			return -1;
+		}
+
+		git_hash_update(ctx, buf, chunk);
+		left -= chunk;
+	}
+
+	git_hash_final(out, ctx);
+	git_hash_free_ctx(ctx);
+	return 0;
+}
+
+static int pack_writer_seal(pack_writer_backend *backend)
+{
+	uint32_t count = htonl(backend->nr_objects);
+	git_oid trailer;
+
+	/* a failed append may have left part of an object past the end */
+	if (p_ftruncate(backend->fd, backend->size) < 0 ||
+		p_lseek(backend->fd, 8, SEEK_SET) < 0 ||
+		p_write(backend->fd, &count, sizeof(count)) < 0 ||
+		pack_writer_hash(&trailer, backend) < 0 ||
+		p_lseek(backend->fd, backend->size, SEEK_SET) < 0 ||
+		p_write(backend->fd, trailer.id, GIT_OID_RAWSZ) < 0 ||
+		p_fsync(backend->fd) < 0) {
+		giterr_set(GITERR_OS, "Failed to seal '%s'", backend->pack_path.ptr);
+		return -1;
+	}
+
+	/*
+	 * `size` stays where the objects end: if flushing fails past
+	 * this point, the pack can be sealed again or grown over the
+	 * trailer.
+	 */
+	return 0;
+}
+
+static int pack_writer_flush(pack_writer_backend *backend)
+{
+	git_indexer *idx = NULL;
+	git_indexer_stats stats;
+	git_buf final_path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error = -1;
+
+	if (backend->fd < 0)
+		return 0;
+
+	if (backend->nr_objects == 0) {
+		pack_writer_discard(backend);
+		return 0;
+	}
+
+	if (pack_writer_seal(backend) < 0)
+		goto cleanup;
+
+	/* the index gets written next to the pack and named after it */
+	if (git_indexer_new(&idx, backend->pack_path.ptr) < 0 ||
+		git_indexer_run(idx, &stats) < 0 ||
+		git_indexer_write(idx) < 0)
+		goto cleanup;
+
+	git_oid_tostr(hex, sizeof(hex), git_indexer_hash(idx));
+	if (git_buf_joinpath(&final_path, backend->pack_dir, "pack-") < 0 ||
+		git_buf_printf(&final_path, "%s.pack", hex) < 0)
+		goto cleanup;
+
+	p_chmod(backend->pack_path.ptr, GIT_PACK_FILE_MODE);
+	if (p_rename(backend->pack_path.ptr, final_path.ptr) < 0) {
+		giterr_set(GITERR_OS, "Failed to move '%s' into place", backend->pack_path.ptr);
+		goto cleanup;
+	}
+
+	pack_writer_reset(backend);
+	git_buf_clear(&backend->pack_path);
+	error = 0;
+
+cleanup:
+	git_indexer_free(idx);
+	git_buf_free(&final_path);
+	return error;
+}
+
+static int inflate_entry(
+	void **buffer_p, pack_writer_backend *backend, pack_writer_entry *entry)
+{
+	unsigned char *in, *out;
+	z_stream zs;
+	int status = Z_OK;
+
+	in = git__malloc(entry->zlen);
+	GITERR_CHECK_ALLOC(in);
+
+	if (p_lseek(backend->fd, entry->offset, SEEK_SET) < 0 ||
+		p_read(backend->fd, in, entry->zlen) != (ssize_t)entry->zlen) {
+		giterr_set(GITERR_OS, "Failed to read from '%s'", backend->pack_path.ptr);
+		git__free(in);
+		return -1;
+	}
+
+	out = git_odb_backend_malloc((git_odb_backend *)backend, entry->size + 1);
+	if (!out) {
+		git__free(in);
+		return -1;
+	}
+
+	memset(&zs, 0x0, sizeof(zs));
+	zs.next_in = in;
+	zs.avail_in = (uInt)entry->zlen;
+	zs.next_out = out;
+	zs.avail_out = (uInt)entry->size + 1;
+
+	if (inflateInit(&zs) < Z_OK)
+		status = Z_DATA_ERROR;
+	else {
+		while (status == Z_OK)
+			status = inflate(&zs, Z_FINISH);
+		inflateEnd(&zs);
+	}
+
+	git__free(in);
+
+	if (status != Z_STREAM_END || zs.total_out != entry->size) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packed object");
+		git__free(out);
+		return -1;
+	}
+
+	out[entry->size] = '\0';
+	*buffer_p = out;
+	return 0;
+}
+
+static int pack_writer__read(
+	void **buffer_p, size_t *len_p, git_otype *type_p,
+	git_odb_backend *_backend, const git_oid *oid)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+	pack_writer_entry *entry = pack_writer_lookup(backend, oid);
+
+	if (!entry)
+		return git_odb__error_notfound("no matching pack entry", oid);
+
+	if (inflate_entry(buffer_p, backend, entry) < 0)
+		return -1;
+
+	*len_p = entry->size;
+	*type_p = entry->type;
+	return 0;
+}
+
+static int pack_writer__read_header(
+	size_t *len_p, git_otype *type_p,
+	git_odb_backend *_backend, const git_oid *oid)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+	pack_writer_entry *entry = pack_writer_lookup(backend, oid);
+
+	if (!entry)
+		return git_odb__error_notfound("no matching pack entry", oid);
+
+	*len_p = entry->size;
+	*type_p = entry->type;
+	return 0;
+}
+
+static int pack_writer__read_prefix(
+	git_oid *out_oid, void **buffer_p, size_t *len_p, git_otype *type_p,
+	git_odb_backend *_backend, const git_oid *short_oid, size_t len)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+	pack_writer_entry *found = NULL;
+	khiter_t i;
+
+	if (len >= GIT_OID_HEXSZ) {
+		found = pack_writer_lookup(backend, short_oid);
+	} else {
+		/* only the objects since the last flush; a scan will do */
+		for (i = kh_begin(backend->objects); i != kh_end(backend->objects); ++i) {
+			pack_writer_entry *entry;
+
+			if (!kh_exist(backend->objects, i))
+				continue;
+
+			entry = kh_value(backend->objects, i);
+			if (git_oid_ncmp(short_oid, &entry->id, len) != 0)
+				continue;
+
+			if (found)
+				return git_odb__error_ambiguous("found multiple pack entries");
+			found = entry;
+		}
+	}
+
+	if (!found)
+		return git_odb__error_notfound("no matching pack entry for prefix", short_oid);
+
+	if (inflate_entry(buffer_p, backend, found) < 0)
+		return -1;
+
+	git_oid_cpy(out_oid, &found->id);
+	*len_p = found->size;
+	*type_p = found->type;
+	return 0;
+}
+
+static int pack_writer__readstream(
+	git_odb_stream **stream_out, git_odb_backend *_backend, const git_oid *oid)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+	pack_writer_entry *entry = pack_writer_lookup(backend, oid);
+	git_rawobj raw;
+
+	if (!entry)
+		return git_odb__error_notfound("no matching pack entry", oid);
+
+	/* pending objects are small, as a rule; they are read whole */
+	if (inflate_entry(&raw.data, backend, entry) < 0)
+		return -1;
+
+	raw.len = entry->size;
+	raw.type = entry->type;
+	return git_odb__buffer_rstream(stream_out, _backend, &raw);
+}
+
+static int pack_writer__exists(git_odb_backend *_backend, const git_oid *oid)
+{
+	return pack_writer_lookup((pack_writer_backend *)_backend, oid) != NULL;
+}
+
+static int pack_writer__foreach(
+	git_odb_backend *_backend, int (*cb)(git_oid *oid, void *data), void *data)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+	khiter_t i;
+
+	for (i = kh_begin(backend->objects); i != kh_end(backend->objects); ++i) {
+		pack_writer_entry *entry;
+
+		if (!kh_exist(backend->objects, i))
+			continue;
+
+		entry = kh_value(backend->objects, i);
+		if (cb(&entry->id, data))
+			return GIT_EUSER;
+	}
+
+	return 0;
+}
+
+static int pack_writer__write(
+	git_oid *oid, git_odb_backend *_backend,
+	const void *data, size_t len, git_otype type)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+	git_rawobj raw;
+
+	raw.data = (void *)data;
+	raw.len = len;
+	raw.type = type;
+
+	if (git_odb__hashobj(oid, &raw) < 0)
+		return -1;
+
+	/* don't store what the database already has */
+	if (pack_writer_lookup(backend, oid) != NULL ||
+		(_backend->odb && git_odb_exists(_backend->odb, oid)))
+		return 0;
+
+	return pack_writer_append(backend, oid, data, len, type);
+}
+
+static int pack_writer__stream_write(
+	git_odb_stream *_stream, const char *data, size_t len)
+{
+	pack_writer_stream *stream = (pack_writer_stream *)_stream;
+
+	if (stream->data.size + len > stream->size) {
+		giterr_set(GITERR_ODB, "Wrote more data than the declared object size");
+		return -1;
+	}
+
+	return git_buf_put(&stream->data, data, len);
+}
+
+static int pack_writer__stream_fwrite(git_oid *oid, git_odb_stream *_stream)
+{
+	pack_writer_stream *stream = (pack_writer_stream *)_stream;
+
+	if (stream->data.size != stream->size) {
+		giterr_set(GITERR_ODB, "Wrote less data than the declared object size");
+		return -1;
+	}
+
+	return pack_writer__write(oid, _stream->backend,
+		stream->data.ptr, stream->data.size, stream->type);
+}
+
+static void pack_writer__stream_free(git_odb_stream *_stream)
+{
+	pack_writer_stream *stream = (pack_writer_stream *)_stream;
+
+	git_buf_free(&stream->data);
+	git__free(stream);
+}
+
+static int pack_writer__writestream(
+	git_odb_stream **stream_out, git_odb_backend *_backend,
+	size_t length, git_otype type)
+{
+	pack_writer_stream *stream;
+
+	/* objects are deflated whole, so streams are buffered */
+	stream = git__calloc(1, sizeof(pack_writer_stream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if (git_buf_grow(&stream->data, length) < 0) {
+		git__free(stream);
+		return -1;
+	}
+
+	stream->size = length;
+	stream->type = type;
+
+	stream->stream.backend = _backend;
+	stream->stream.read = NULL; /* write only */
+	stream->stream.write = &pack_writer__stream_write;
+	stream->stream.finalize_write = &pack_writer__stream_fwrite;
+	stream->stream.free = &pack_writer__stream_free;
+	stream->stream.mode = GIT_STREAM_WRONLY;
+
+	*stream_out = (git_odb_stream *)stream;
+	return 0;
+}
+
+static int pack_writer__bulk_begin(git_odb_backend *_backend)
+{
+	/* a rollback must not take the earlier writes with it */
+	return pack_writer_flush((pack_writer_backend *)_backend);
+}
+
+static int pack_writer__bulk_commit(git_odb_backend *_backend)
+{
+	return pack_writer_flush((pack_writer_backend *)_backend);
+}
+
+static void pack_writer__bulk_rollback(git_odb_backend *_backend)
+{
+	pack_writer_discard((pack_writer_backend *)_backend);
+}
+
+static void pack_writer__free(git_odb_backend *_backend)
+{
+	pack_writer_backend *backend = (pack_writer_backend *)_backend;
+
+	/*
+	 * there is no one to report a failure to here; what could not be
+	 * flushed is thrown away, like on a rollback
+	 */
+	if (pack_writer_flush(backend) < 0) {
+		pack_writer_discard(backend);
+		giterr_clear();
+	}
+
+	git_oidmap_free(backend->objects);
+	git_pool_clear(&backend->entries);
+	git_buf_free(&backend->pack_path);
+	git__free(backend->pack_dir);
+	git__free(backend);
+}
+
+int git_odb_backend_pack_writer(git_odb_backend **backend_out, const char *objects_dir)
+{
+	pack_writer_backend *backend;
+	git_buf path = GIT_BUF_INIT;
+
+	backend = git__calloc(1, sizeof(pack_writer_backend));
+	GITERR_CHECK_ALLOC(backend);
+
+	backend->fd = -1;
+
+	if (git_buf_joinpath(&path, objects_dir, "pack") < 0 ||
+		git_futils_mkdir_r(path.ptr, NULL, GIT_OBJECT_DIR_MODE) < 0 ||
+		(backend->objects = git_oidmap_alloc()) == NULL ||
+		git_pool_init(&backend->entries, sizeof(pack_writer_entry), 0) < 0) {
+		if (!backend->objects)
+			giterr_set_oom();
+		git_oidmap_free(backend->objects);
+		git_buf_free(&path);
+		git__free(backend);
+		return -1;
+	}
+
+	backend->pack_dir = git_buf_detach(&path);
+
+	backend->parent.read = &pack_writer__read;
+	backend->parent.read_prefix = &pack_writer__read_prefix;
+	backend->parent.read_header = &pack_writer__read_header;
+	backend->parent.write = &pack_writer__write;
+	backend->parent.writestream = &pack_writer__writestream;
+	backend->parent.readstream = &pack_writer__readstream;
+	backend->parent.exists = &pack_writer__exists;
+	backend->parent.foreach = &pack_writer__foreach;
+	backend->parent.bulk_begin = &pack_writer__bulk_begin;
+	backend->parent.bulk_commit = &pack_writer__bulk_commit;
+	backend->parent.bulk_rollback = &pack_writer__bulk_rollback;
+	backend->parent.free = &pack_writer__free;
+
+	*backend_out = (git_odb_backend *)backend;
+	return 0;
+}
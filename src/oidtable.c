@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "oidtable.h"
+
+#define OIDTABLE_MIN_SLOTS 16
+
+/* linear probing slows down quickly past this */
+#define OIDTABLE_LOAD(slots) ((slots) / 10 * 7)
+
+static size_t slots_for(size_t count)
+{
+	size_t slots = OIDTABLE_MIN_SLOTS;
+
+	while (OIDTABLE_LOAD(slots) < count)
+		slots <<= 1;
+
+	return slots;
+}
+
+static void insert_slot(
+	git_oidtable *table, uint64_t prefix, const git_oid *key, void *value)
+{
+	size_t pos = git_oidtable__hash(prefix) & table->mask;
+
+	while (table->slots[pos].value != NULL)
+		pos = (pos + 1) & table->mask;
+
+	table->slots[pos].prefix = prefix;
+	table->slots[pos].value = value;
+	table->keys[pos] = key;
+}
+
+static int resize(git_oidtable *table, size_t slots)
+{
+	git_oidtable_slot *old_slots = table->slots;
+	const git_oid **old_keys = table->keys;
+	size_t i, old_count = old_slots ? table->mask + 1 : 0;
+
+	table->slots = git__calloc(slots, sizeof(git_oidtable_slot));
+	table->keys = git__calloc(slots, sizeof(git_oid *));
+	if (!table->slots || !table->keys) {
+		git__free(table->slots);
+		git__free(table->keys);
+		table->slots = old_slots;
+		table->keys = old_keys;
+		return -1;
+	}
+
+	table->mask = slots - 1;
+	table->grow_at = OIDTABLE_LOAD(slots);
+
+	for (i = 0; i < old_count; ++i)
+		if (old_slots[i].value != NULL)
+			insert_slot(table, old_slots[i].prefix, old_keys[i], old_slots[i].value);
+
+	git__free(old_slots);
+	git__free(old_keys);
+	return 0;
+}
+
+int git_oidtable_new(git_oidtable **out, size_t count)
+{
+	git_oidtable *table;
+
+	table = git__calloc(1, sizeof(git_oidtable));
+	GITERR_CHECK_ALLOC(table);
+
+	if (resize(table, slots_for(count)) < 0) {
+		git__free(table);
+		return -1;
+	}
+
+	*out = table;
+	return 0;
+}
+
+void git_oidtable_free(git_oidtable *table)
+{
+	if (table == NULL)
+		return;
+
+	git__free(table->slots);
+	git__free(table->keys);
+	git__free(table);
+}
+
+void git_oidtable_clear(git_oidtable *table)
+{
+	memset(table->slots, 0x0, (table->mask + 1) * sizeof(git_oidtable_slot));
+	table->size = 0;
+}
+
+int git_oidtable_reserve(git_oidtable *table, size_t count)
+{
+	if (count <= table->grow_at)
+		return 0;
+
+	return resize(table, slots_for(count));
+}
+
+int git_oidtable_put(git_oidtable *table, const git_oid *key, void *value)
+{
+	uint64_t prefix = git_oidtable__prefix(key);
+	size_t pos;
+
+	assert(value);
+
+	if (table->size >= table->grow_at &&
+		resize(table, (table->mask + 1) << 1) < 0)
+		return -1;
+
+	for (pos = git_oidtable__hash(prefix) & table->mask;
+		table->slots[pos].value != NULL;
+		pos = (pos + 1) & table->mask) {
+		if (table->slots[pos].prefix == prefix &&
+			git_oid_equal(table->keys[pos], key)) {
+			table->keys[pos] = key;
+			table->slots[pos].value = value;
+			return 0;
+		}
+	}
+
+	table->slots[pos].prefix = prefix;
+	table->slots[pos].value = value;
+	table->keys[pos] = key;
+	table->size++;
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_oidtable_h__
+#define INCLUDE_oidtable_h__
+
+#include "common.h"
+#include "git2/oid.h"
+
+/*
+ * A map from object ids to values, for the hot lookups of the revision
+ * walker and the packbuilder.
+ *
+ * Unlike a `git_oidmap`, the table keeps the first 8 bytes of every id
+ * next to its value, in one flat array probed linearly: a lookup only
+ * follows the key pointer to compare the rest of the id when those
+ * bytes match, which is almost never for any other id. The ids are
+ * uniformly distributed already, so they are their own hash.
+ *
+ * Values cannot be NULL, which marks the empty slots; the keys are not
+ * copied and must live as long as their entries. There is no deletion.
+ */
+
+typedef struct {
+	uint64_t prefix;
+	void *value;
+} git_oidtable_slot;
+
+typedef struct {
+	git_oidtable_slot *slots;
+	const git_oid **keys;
+	size_t mask;
+	size_t size;
+	size_t grow_at;
+} git_oidtable;
+
+/* Allocate a table with room for `count` entries before it grows */
+extern int git_oidtable_new(git_oidtable **out, size_t count);
+extern void git_oidtable_free(git_oidtable *table);
+
+/* Remove every entry, keeping the room for them */
+extern void git_oidtable_clear(git_oidtable *table);
+
+/* Make room for `count` entries in all */
+extern int git_oidtable_reserve(git_oidtable *table, size_t count);
+
+/* Map `key` to `value`, replacing any value it had before */
+extern int git_oidtable_put(git_oidtable *table, const git_oid *key, void *value);
+
+#define git_oidtable_size(t) ((t)->size)
+
+GIT_INLINE(uint64_t) git_oidtable__prefix(const git_oid *oid)
+{
+	uint64_t prefix;
+	memcpy(&prefix, oid->id, sizeof(prefix));
+	return prefix;
+}
+
+GIT_INLINE(size_t) git_oidtable__hash(uint64_t prefix)
+{
+	return (size_t)(prefix ^ (prefix >> 32));
+}
+
+/* The value of `oid`, or NULL */
+GIT_INLINE(void *) git_oidtable_get(const git_oidtable *table, const git_oid *oid)
+{
+	uint64_t prefix = git_oidtable__prefix(oid);
+	size_t pos = git_oidtable__hash(prefix) & table->mask;
+	const git_oidtable_slot *slot;
+
+	for (;; pos = (pos + 1) & table->mask) {
+		slot = &table->slots[pos];
+
+		if (slot->value == NULL)
+			return NULL;
+
+		if (slot->prefix == prefix &&
+			memcmp(table->keys[pos]->id + sizeof(prefix),
+				oid->id + sizeof(prefix), GIT_OID_RAWSZ - sizeof(prefix)) == 0)
+			return slot->value;
+	}
+}
+
+#define git_oidtable_foreach_value(t, vvar, code) { size_t __i; \
+	for (__i = 0; __i <= (t)->mask; ++__i) { \
+		if ((t)->slots[__i].value == NULL) continue; \
+		(vvar) = (t)->slots[__i].value; \
+		code; \
+	} }
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "compress.h"
 #include "delta.h"
+#include "delta-islands.h"
 #include "iterator.h"
 #include "netops.h"
 #include "pack.h"
@@ -17,6 +18,7 @@
 
 #include "git2/pack.h"
 #include "git2/commit.h"
+#include "git2/revwalk.h"
 #include "git2/tag.h"
 #include "git2/indexer.h"
 #include "git2/config.h"
@@ -49,17 +51,17 @@ struct unpacked {
 #define git_packbuilder__progress_lock(pb) GIT_PACKBUILDER__MUTEX_OP(pb, progress_mutex, lock)
 #define git_packbuilder__progress_unlock(pb) GIT_PACKBUILDER__MUTEX_OP(pb, progress_mutex, unlock)
 
-static unsigned name_hash(const char *name)
+static unsigned name_hash_update(unsigned hash, const char *name)
 {
-	unsigned c, hash = 0;
-
-	if (!name)
-		return 0;
+	unsigned c;
 
 	/*
 	 * This effectively just creates a sortable number from the
 	 * last sixteen non-whitespace characters. Last characters
 	 * count "most", so things that end in ".c" sort together.
+	 *
+	 * The hash of "a/b" can be computed by feeding "b" to the
+	 * hash of "a/", so tree walks never need to build the path.
 	 */
 	while ((c = *name++) != 0) {
 		if (git__isspace(c))
@@ -69,6 +71,14 @@ static unsigned name_hash(const char *name)
 	return hash;
 }
 
+static unsigned name_hash(const char *name)
+{
+	if (!name)
+		return 0;
+
+	return name_hash_update(0, name);
+}
+
 static int packbuilder_config(git_packbuilder *pb)
 {
 	git_config *config;
@@ -106,13 +116,14 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 	pb = git__calloc(sizeof(*pb), 1);
 	GITERR_CHECK_ALLOC(pb);
 
-	pb->object_ix = git_oidmap_alloc();
+	pb->index_cache = git_oidmap_alloc();
 
-	if (!pb->object_ix)
+	if (git_oidtable_new(&pb->object_ix, 0) < 0 || !pb->index_cache)
 		goto on_error;
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->max_index_cache_size = GIT_PACK_INDEX_CACHE_SIZE;
 	pb->ctx = git_hash_new_ctx();
 
 	if (!pb->ctx ||
@@ -143,61 +154,90 @@ void git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n)
 	pb->nr_threads = n;
 }
 
-static void rehash(git_packbuilder *pb)
+void git_packbuilder_set_delta_islands(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+	pb->use_delta_islands = !!enabled;
+	pb->done = false;
+}
+
+static int rehash(git_packbuilder *pb)
 {
 	git_pobject *po;
-	khiter_t pos;
 	unsigned int i;
-	int ret;
 
-	kh_clear(oid, pb->object_ix);
-	for (i = 0, po = pb->object_list; i < pb->nr_objects; i++, po++) {
-		pos = kh_put(oid, pb->object_ix, &po->id, &ret);
-		kh_value(pb->object_ix, pos) = po;
-	}
+	/* sized for all the objects the list has room for */
+	git_oidtable_clear(pb->object_ix);
+	if (git_oidtable_reserve(pb->object_ix, pb->nr_alloc) < 0)
+		return -1;
+
+	for (i = 0, po = pb->object_list; i < pb->nr_objects; i++, po++)
+		if (git_oidtable_put(pb->object_ix, &po->id, po) < 0)
+			return -1;
+
+	return 0;
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+/*
+ * Register `oid` in the packbuilder. When the caller already knows the
+ * type of the object (e.g. from a tree entry), the header read is
+ * deferred until `prepare_pack` actually needs the size.
+ */
+static int insert_object(git_pobject **out, git_packbuilder *pb,
+			 const git_oid *oid, git_otype type, unsigned int hash)
 {
 	git_pobject *po;
-	khiter_t pos;
-	int ret;
-
-	assert(pb && oid);
 
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
-	pos = kh_get(oid, pb->object_ix, oid);
-	if (pos != kh_end(pb->object_ix))
+	if ((po = git_oidtable_get(pb->object_ix, oid)) != NULL) {
+		if (out)
+			*out = po;
 		return 0;
+	}
 
 	if (pb->nr_objects >= pb->nr_alloc) {
 		pb->nr_alloc = (pb->nr_alloc + 1024) * 3 / 2;
 		pb->object_list = git__realloc(pb->object_list,
 					       pb->nr_alloc * sizeof(*po));
 		GITERR_CHECK_ALLOC(pb->object_list);
-		rehash(pb);
+		if (rehash(pb) < 0)
+			return -1;
 	}
 
 	po = pb->object_list + pb->nr_objects;
 	memset(po, 0x0, sizeof(*po));
 
-	if (git_odb_read_header(&po->size, &po->type, pb->odb, oid) < 0)
-		return -1;
+	if (type == GIT_OBJ_ANY) {
+		if (git_odb_read_header(&po->size, &po->type, pb->odb, oid) < 0)
+			return -1;
+	} else {
+		po->type = type;
+		po->header_pending = 1;
+	}
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
-	pos = kh_put(oid, pb->object_ix, &po->id, &ret);
-	assert(ret != 0);
-	kh_value(pb->object_ix, pos) = po;
+	if (git_oidtable_put(pb->object_ix, &po->id, po) < 0)
+		return -1;
 
 	pb->done = false;
+
+	if (out)
+		*out = po;
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	assert(pb && oid);
+
+	return insert_object(NULL, pb, oid, GIT_OBJ_ANY, name_hash(name));
+}
+
 /*
  * The per-object header is a pretty dense thing, which is
  *  - first byte: low four bits are "size",
@@ -232,21 +272,202 @@ static int gen_pack_object_header(
 	return hdr - hdr_base;
 }
 
-static int get_delta(void **out, git_odb *odb, git_pobject *po)
+/*
+ * Delta index cache
+ *
+ * Building the Rabin index of a delta source is the most expensive part
+ * of `git_delta`. Sources leaving a delta window (or used to recreate a
+ * delta at write time) are handed over to this cache together with
+ * their data, so the next thread or `get_delta` call needing the same
+ * base can take them back instead of re-reading and re-indexing.
+ *
+ * Entries are owned by exactly one party at a time: taking an entry
+ * removes it from the cache, which avoids any reference counting.
+ */
+static void index_cache_unlink(git_packbuilder *pb, struct git_pcached_index *ci)
 {
-	git_odb_object *src = NULL, *trg = NULL;
+	khiter_t pos;
+
+	if (ci->prev)
+		ci->prev->next = ci->next;
+	else
+		pb->index_lru_head = ci->next;
+
+	if (ci->next)
+		ci->next->prev = ci->prev;
+	else
+		pb->index_lru_tail = ci->prev;
+
+	pos = kh_get(oid, pb->index_cache, &ci->id);
+	assert(pos != kh_end(pb->index_cache));
+	kh_del(oid, pb->index_cache, pos);
+
+	pb->index_cache_size -= ci->memsize;
+}
+
+static void index_cache_free_entry(struct git_pcached_index *ci)
+{
+	git_delta_free_index(ci->index);
+	git__free(ci->data);
+	git__free(ci);
+}
+
+static int index_cache_take(git_packbuilder *pb, const git_oid *oid,
+			    void **data, struct git_delta_index **index)
+{
+	struct git_pcached_index *ci;
+	khiter_t pos;
+
+	git_packbuilder__cache_lock(pb);
+
+	pos = kh_get(oid, pb->index_cache, oid);
+	if (pos == kh_end(pb->index_cache)) {
+		git_packbuilder__cache_unlock(pb);
+		return GIT_ENOTFOUND;
+	}
+
+	ci = kh_value(pb->index_cache, pos);
+	index_cache_unlink(pb, ci);
+
+	git_packbuilder__cache_unlock(pb);
+
+	*data = ci->data;
+	*index = ci->index;
+	git__free(ci);
+	return 0;
+}
+
+/* Takes ownership of `data` and `index`, whatever happens */
+static void index_cache_put(git_packbuilder *pb, const git_oid *oid,
+			    void *data, unsigned long size,
+			    struct git_delta_index *index)
+{
+	struct git_pcached_index *ci, *evicted = NULL;
+	unsigned long memsize;
+	khiter_t pos;
+	int ret;
+
+	memsize = git_delta_sizeof_index(index) + sizeof(*ci) + size;
+
+	if (!pb->max_index_cache_size || memsize > pb->max_index_cache_size ||
+	    (ci = git__malloc(sizeof(*ci))) == NULL) {
+		git_delta_free_index(index);
+		git__free(data);
+		return;
+	}
+
+	git_oid_cpy(&ci->id, oid);
+	ci->data = data;
+	ci->index = index;
+	ci->memsize = memsize;
+	ci->prev = NULL;
+
+	git_packbuilder__cache_lock(pb);
+
+	pos = kh_put(oid, pb->index_cache, &ci->id, &ret);
+	if (ret <= 0) {
+		/* another thread was faster, or the table could not grow */
+		git_packbuilder__cache_unlock(pb);
+		index_cache_free_entry(ci);
+		return;
+	}
+	kh_value(pb->index_cache, pos) = ci;
+
+	ci->next = pb->index_lru_head;
+	if (ci->next)
+		ci->next->prev = ci;
+	else
+		pb->index_lru_tail = ci;
+	pb->index_lru_head = ci;
+
+	pb->index_cache_size += memsize;
+
+	while (pb->index_cache_size > pb->max_index_cache_size) {
+		struct git_pcached_index *victim = pb->index_lru_tail;
+
+		index_cache_unlink(pb, victim);
+		victim->next = evicted;
+		evicted = victim;
+	}
+
+	git_packbuilder__cache_unlock(pb);
+
+	while (evicted) {
+		ci = evicted->next;
+		index_cache_free_entry(evicted);
+		evicted = ci;
+	}
+}
+
+static void index_cache_clear(git_packbuilder *pb)
+{
+	struct git_pcached_index *ci, *next;
+
+	for (ci = pb->index_lru_head; ci; ci = next) {
+		next = ci->next;
+		index_cache_free_entry(ci);
+	}
+
+	pb->index_lru_head = pb->index_lru_tail = NULL;
+	pb->index_cache_size = 0;
+
+	if (pb->index_cache)
+		git_oidmap_free(pb->index_cache);
+}
+
+static int read_object_data(void **out, git_packbuilder *pb,
+			    const git_oid *oid, unsigned long expected_size)
+{
+	git_odb_object *obj;
+	unsigned long sz;
+
+	if (git_odb_read(&obj, pb->odb, oid) < 0)
+		return -1;
+
+	sz = git_odb_object_size(obj);
+	if (sz != expected_size) {
+		git_odb_object_free(obj);
+		giterr_set(GITERR_INVALID, "Inconsistent object length");
+		return -1;
+	}
+
+	*out = git__malloc(sz);
+	if (*out)
+		memcpy(*out, git_odb_object_data(obj), sz);
+
+	git_odb_object_free(obj);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
+static int get_delta(void **out, git_packbuilder *pb, git_pobject *po)
+{
+	git_odb_object *trg = NULL;
+	struct git_delta_index *index = NULL;
 	unsigned long delta_size;
-	void *delta_buf;
+	void *src_data = NULL, *delta_buf;
 
 	*out = NULL;
 
-	if (git_odb_read(&src, odb, &po->delta->id) < 0 ||
-	    git_odb_read(&trg, odb, &po->id) < 0)
+	if (index_cache_take(pb, &po->delta->id, &src_data, &index) < 0) {
+		if (read_object_data(&src_data, pb, &po->delta->id,
+				     po->delta->size) < 0)
+			goto on_error;
+
+		index = git_delta_create_index(src_data, po->delta->size);
+		if (!index) {
+			giterr_set_oom();
+			goto on_error;
+		}
+	}
+
+	if (git_odb_read(&trg, pb->odb, &po->id) < 0)
 		goto on_error;
 
-	delta_buf = git_delta(git_odb_object_data(src), git_odb_object_size(src),
-			      git_odb_object_data(trg), git_odb_object_size(trg),
-			      &delta_size, 0);
+	delta_buf = git_delta_create(index,
+				     git_odb_object_data(trg), git_odb_object_size(trg),
+				     &delta_size, 0);
 
 	if (!delta_buf || delta_size != po->delta_size) {
 		giterr_set(GITERR_INVALID, "Delta size changed");
@@ -255,12 +476,14 @@ static int get_delta(void **out, git_odb *odb, git_pobject *po)
 
 	*out = delta_buf;
 
-	git_odb_object_free(src);
+	/* siblings sharing this base are likely to be written next */
+	index_cache_put(pb, &po->delta->id, src_data, po->delta->size, index);
 	git_odb_object_free(trg);
 	return 0;
 
 on_error:
-	git_odb_object_free(src);
+	git_delta_free_index(index);
+	git__free(src_data);
 	git_odb_object_free(trg);
 	return -1;
 }
@@ -278,7 +501,7 @@ static int write_object(git_buf *buf, git_packbuilder *pb, git_pobject *po)
 	if (po->delta) {
 		if (po->delta_data)
 			data = po->delta_data;
-		else if (get_delta(&data, pb->odb, po) < 0)
+		else if (get_delta(&data, pb, po) < 0)
 				goto on_error;
 		size = po->delta_size;
 		type = GIT_OBJ_REF_DELTA;
@@ -441,15 +664,12 @@ static int cb_tag_foreach(const char *name, git_oid *oid, void *data)
 {
 	git_packbuilder *pb = data;
 	git_pobject *po;
-	khiter_t pos;
 
 	GIT_UNUSED(name);
 
-	pos = kh_get(oid, pb->object_ix, oid);
-	if (pos == kh_end(pb->object_ix))
+	if ((po = git_oidtable_get(pb->object_ix, oid)) == NULL)
 		return 0;
 
-	po = kh_value(pb->object_ix, pos);
 	po->tagged = 1;
 
 	/* TODO: peel objects */
@@ -685,9 +905,8 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 {
 	git_pobject *trg_object = trg->object;
 	git_pobject *src_object = src->object;
-	git_odb_object *obj;
 	unsigned long trg_size, src_size, delta_size,
-		      sizediff, max_size, sz;
+		      sizediff, max_size;
 	unsigned int ref_depth;
 	void *delta_buf;
 
@@ -699,6 +918,10 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	*ret = 0;
 
+	/* Don't make the target depend on a base outside of its islands */
+	if (!git_delta_islands_allowed(pb, trg_object, src_object))
+		return 0;
+
 	/* TODO: support reuse-delta */
 
 	/* Let's not bust the allowed depth. */
@@ -729,42 +952,19 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	/* Load data if not already done */
 	if (!trg->data) {
-		if (git_odb_read(&obj, pb->odb, &trg_object->id) < 0)
+		if (read_object_data(&trg->data, pb, &trg_object->id, trg_size) < 0)
 			return -1;
 
-		sz = git_odb_object_size(obj);
-		trg->data = git__malloc(sz);
-		GITERR_CHECK_ALLOC(trg->data);
-		memcpy(trg->data, git_odb_object_data(obj), sz);
-
-		git_odb_object_free(obj);
-
-		if (sz != trg_size) {
-			giterr_set(GITERR_INVALID,
-				   "Inconsistent target object length");
-			return -1;
-		}
-
-		*mem_usage += sz;
+		*mem_usage += trg_size;
 	}
+	if (!src->data && !src->index &&
+	    index_cache_take(pb, &src_object->id, &src->data, &src->index) == 0)
+		*mem_usage += src_size + git_delta_sizeof_index(src->index);
 	if (!src->data) {
-		if (git_odb_read(&obj, pb->odb, &src_object->id) < 0)
-			return -1;
-
-		sz = git_odb_object_size(obj);
-		src->data = git__malloc(sz);
-		GITERR_CHECK_ALLOC(src->data);
-		memcpy(src->data, git_odb_object_data(obj), sz);
-
-		git_odb_object_free(obj);
-
-		if (sz != src_size) {
-			giterr_set(GITERR_INVALID,
-				   "Inconsistent source object length");
+		if (read_object_data(&src->data, pb, &src_object->id, src_size) < 0)
 			return -1;
-		}
 
-		*mem_usage += sz;
+		*mem_usage += src_size;
 	}
 	if (!src->index) {
 		src->index = git_delta_create_index(src->data, src_size);
@@ -828,16 +1028,23 @@ static unsigned int check_delta_limit(git_pobject *me, unsigned int n)
 	return m;
 }
 
-static unsigned long free_unpacked(struct unpacked *n)
+static unsigned long free_unpacked(git_packbuilder *pb, struct unpacked *n)
 {
 	unsigned long freed_mem = git_delta_sizeof_index(n->index);
-	git_delta_free_index(n->index);
-	n->index = NULL;
-	if (n->data) {
+
+	if (n->data)
 		freed_mem += n->object->size;
+
+	if (n->index && n->data)
+		index_cache_put(pb, &n->object->id, n->data,
+				n->object->size, n->index);
+	else {
+		git_delta_free_index(n->index);
 		git__free(n->data);
-		n->data = NULL;
 	}
+
+	n->index = NULL;
+	n->data = NULL;
 	n->object = NULL;
 	n->depth = 0;
 	return freed_mem;
@@ -873,14 +1080,14 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		(*list_size)--;
 		git_packbuilder__progress_unlock(pb);
 
-		mem_usage -= free_unpacked(n);
+		mem_usage -= free_unpacked(pb, n);
 		n->object = po;
 
 		while (pb->window_memory_limit &&
 		       mem_usage > pb->window_memory_limit &&
 		       count > 1) {
 			uint32_t tail = (idx + window - count) % window;
-			mem_usage -= free_unpacked(array + tail);
+			mem_usage -= free_unpacked(pb, array + tail);
 			count--;
 		}
 
@@ -984,10 +1191,8 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 	error = 0;
 
 on_error:
-	for (i = 0; i < window; ++i) {
-		git__free(array[i].index);
-		git__free(array[i].data);
-	}
+	for (i = 0; i < window; ++i)
+		free_unpacked(pb, array + i);
 	git__free(array);
 	git_buf_free(&zbuf);
 
@@ -1193,6 +1398,32 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 #define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
 #endif
 
+static int fill_headers(git_packbuilder *pb)
+{
+	git_otype type;
+	unsigned int i;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = pb->object_list + i;
+
+		if (!po->header_pending)
+			continue;
+
+		if (git_odb_read_header(&po->size, &type, pb->odb, &po->id) < 0)
+			return -1;
+
+		if (type != po->type) {
+			giterr_set(GITERR_INVALID,
+				   "Object type does not match its tree entry");
+			return -1;
+		}
+
+		po->header_pending = 0;
+	}
+
+	return 0;
+}
+
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
@@ -1201,6 +1432,12 @@ static int prepare_pack(git_packbuilder *pb)
 	if (pb->nr_objects == 0 || pb->done)
 		return 0; /* nothing to do */
 
+	if (fill_headers(pb) < 0)
+		return -1;
+
+	if (pb->use_delta_islands && git_delta_islands_load(pb) < 0)
+		return -1;
+
 	delta_list = git__malloc(pb->nr_objects * sizeof(*delta_list));
 	GITERR_CHECK_ALLOC(delta_list);
 
@@ -1251,39 +1488,150 @@ int git_packbuilder_write(git_packbuilder *pb, const char *path)
 
 #undef PREPARE_PACK
 
-static int cb_tree_walk(const char *root, const git_tree_entry *entry, void *payload)
+static int insert_tree(git_packbuilder *pb, const git_oid *oid,
+		       unsigned int hash, unsigned int prefix_hash);
+
+static int insert_tree_entries(git_packbuilder *pb, git_tree *tree,
+			       unsigned int prefix_hash)
 {
-	git_packbuilder *pb = payload;
-	git_buf buf = GIT_BUF_INIT;
+	unsigned int i, hash;
 
-	git_buf_puts(&buf, root);
-	git_buf_puts(&buf, git_tree_entry_name(entry));
+	for (i = 0; i < tree->entries.length; ++i) {
+		git_tree_entry *entry = tree->entries.contents[i];
 
-	if (git_packbuilder_insert(pb, git_tree_entry_id(entry),
-				   git_buf_cstr(&buf)) < 0) {
-		git_buf_free(&buf);
-		return -1;
+		/* submodule commits live in another repository */
+		if (S_ISGITLINK(entry->attr))
+			continue;
+
+		hash = name_hash_update(prefix_hash, entry->filename);
+
+		if (git_tree_entry__is_tree(entry)) {
+			if (insert_tree(pb, &entry->oid, hash,
+					name_hash_update(hash, "/")) < 0)
+				return -1;
+		} else if (insert_object(NULL, pb, &entry->oid,
+					 GIT_OBJ_BLOB, hash) < 0)
+			return -1;
 	}
 
-	git_buf_free(&buf);
 	return 0;
 }
 
-int git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *oid)
+static int insert_tree(git_packbuilder *pb, const git_oid *oid,
+		       unsigned int hash, unsigned int prefix_hash)
 {
+	git_pobject *po;
 	git_tree *tree;
+	int error;
 
-	if (git_tree_lookup(&tree, pb->repo, oid) < 0 ||
-	    git_packbuilder_insert(pb, oid, NULL) < 0)
+	if (insert_object(&po, pb, oid, GIT_OBJ_TREE, hash) < 0)
 		return -1;
 
-	if (git_tree_walk(tree, cb_tree_walk, GIT_TREEWALK_PRE, pb) < 0) {
-		git_tree_free(tree);
+	/*
+	 * A tree reachable from several commits only needs to be
+	 * enumerated once; everything below it is already known.
+	 * `po` may move while we recurse, so flag it right away.
+	 */
+	if (po->walked)
+		return 0;
+	po->walked = 1;
+
+	if (git_tree_lookup(&tree, pb->repo, oid) < 0)
 		return -1;
-	}
+
+	error = insert_tree_entries(pb, tree, prefix_hash);
 
 	git_tree_free(tree);
-	return 0;
+	return error;
+}
+
+int git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *oid)
+{
+	assert(pb && oid);
+
+	return insert_tree(pb, oid, 0, 0);
+}
+
+static int insert_commit_tree(git_packbuilder *pb, const git_oid *oid)
+{
+	git_commit *commit;
+	int error;
+
+	if (git_commit_lookup(&commit, pb->repo, oid) < 0)
+		return -1;
+
+	error = insert_tree(pb, git_commit_tree_oid(commit), 0, 0);
+
+	git_commit_free(commit);
+	return error;
+}
+
+int git_packbuilder_insert_commit(git_packbuilder *pb, const git_oid *oid)
+{
+	git_pobject *po;
+
+	assert(pb && oid);
+
+	if (insert_object(&po, pb, oid, GIT_OBJ_COMMIT, 0) < 0)
+		return -1;
+
+	if (po->walked)
+		return 0;
+	po->walked = 1;
+
+	return insert_commit_tree(pb, oid);
+}
+
+int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
+{
+	git_oid *ids = NULL, *grown;
+	git_pobject *po;
+	size_t i, n = 0, alloc = 0;
+	int error;
+
+	assert(pb && walk);
+
+	/*
+	 * Keep the recommended recency order: all the commits
+	 * first, then the trees and blobs reachable from them.
+	 * The commits may have been inserted before, so they
+	 * are remembered as the walk returns them.
+	 */
+	for (;;) {
+		if (n == alloc) {
+			alloc = (alloc + 64) * 3 / 2;
+			grown = git__realloc(ids, alloc * sizeof(git_oid));
+			if (grown == NULL) {
+				error = -1;
+				goto cleanup;
+			}
+			ids = grown;
+		}
+
+		if ((error = git_revwalk_next(&ids[n], walk)) < 0)
+			break;
+
+		if ((error = insert_object(NULL, pb, &ids[n], GIT_OBJ_COMMIT, 0)) < 0)
+			goto cleanup;
+		n++;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto cleanup;
+
+	error = 0;
+	for (i = 0; i < n && !error; ++i) {
+		po = git_oidtable_get(pb->object_ix, &ids[i]);
+		if (po == NULL || po->walked)
+			continue;
+		po->walked = 1;
+
+		error = insert_commit_tree(pb, &ids[i]);
+	}
+
+cleanup:
+	git__free(ids);
+	return error;
 }
 
 void git_packbuilder_free(git_packbuilder *pb)
@@ -1305,8 +1653,10 @@ void git_packbuilder_free(git_packbuilder *pb)
 	if (pb->ctx)
 		git_hash_free_ctx(pb->ctx);
 
-	if (pb->object_ix)
-		git_oidmap_free(pb->object_ix);
+	git_oidtable_free(pb->object_ix);
+
+	index_cache_clear(pb);
+	git_delta_islands_free(pb->islands);
 
 	if (pb->object_list)
 		git__free(pb->object_list);
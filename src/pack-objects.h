@@ -13,6 +13,7 @@
 #include "buffer.h"
 #include "hash.h"
 #include "oidmap.h"
+#include "oidtable.h"
 
 #include "git2/oid.h"
 
@@ -21,6 +22,7 @@
 #define GIT_PACK_DELTA_CACHE_SIZE (256 * 1024 * 1024)
 #define GIT_PACK_DELTA_CACHE_LIMIT 1000
 #define GIT_PACK_BIG_FILE_THRESHOLD (512 * 1024 * 1024)
+#define GIT_PACK_INDEX_CACHE_SIZE (64 * 1024 * 1024)
 
 typedef struct git_pobject {
 	git_oid id;
@@ -31,6 +33,8 @@ typedef struct git_pobject {
 
 	unsigned int hash; /* name hint hash */
 
+	struct git_island_bitmap *island; /* see delta-islands.h */
+
 	struct git_pobject *delta; /* delta base object */
 	struct git_pobject *delta_child; /* deltified objects who bases me */
 	struct git_pobject *delta_sibling; /* other deltified objects
@@ -44,9 +48,21 @@ typedef struct git_pobject {
 	int written:1,
 	    recursing:1,
 	    tagged:1,
-	    filled:1;
+	    filled:1,
+	    walked:1, /* tree/commit contents already enumerated */
+	    header_pending:1; /* size not known yet; see fill_headers() */
 } git_pobject;
 
+/* a delta source and its index, kept around after leaving the window */
+struct git_pcached_index {
+	git_oid id;
+	void *data;
+	struct git_delta_index *index;
+	unsigned long memsize;
+
+	struct git_pcached_index *prev, *next; /* LRU, most recent first */
+};
+
 struct git_packbuilder {
 	git_repository *repo; /* associated repository */
 	git_odb *odb; /* associated object database */
@@ -60,10 +76,19 @@ struct git_packbuilder {
 
 	git_pobject *object_list;
 
-	git_oidmap *object_ix;
+	git_oidtable *object_ix;
 
 	git_oid pack_oid; /* hash of written pack */
 
+	/* restrict deltas to bases from the same islands */
+	bool use_delta_islands;
+	struct git_delta_islands *islands;
+	unsigned int island_words;
+
+	/* delta indexes of recently used sources, keyed by oid */
+	git_oidmap *index_cache;
+	struct git_pcached_index *index_lru_head, *index_lru_tail;
+
 	/* synchronization objects */
 	git_mutex cache_mutex;
 	git_mutex progress_mutex;
@@ -75,6 +100,8 @@ struct git_packbuilder {
 	unsigned long cache_max_small_delta_size;
 	unsigned long big_file_threshold;
 	unsigned long window_memory_limit;
+	unsigned long index_cache_size;
+	unsigned long max_index_cache_size;
 
 	int nr_threads; /* nr of threads to use */
 
@@ -58,6 +58,11 @@ static void pack_index_free(struct git_pack_file *p)
 		git__free(p->oids);
 		p->oids = NULL;
 	}
+	if (p->oid_prefixes) {
+		git__free(p->oid_prefixes);
+		p->oid_prefixes = NULL;
+	}
+	git_atomic_set(&p->lookups, 0);
 	if (p->index_map.data) {
 		git_futils_mmap_free(&p->index_map);
 		p->index_map.data = NULL;
@@ -94,6 +99,9 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 	if (error < 0)
 		return error;
 
+	/* lookups jump around the index; don't read ahead */
+	p_madvise(&p->index_map, GIT_MADV_RANDOM);
+
 	hdr = idx_map = p->index_map.data;
 
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
@@ -189,13 +197,22 @@ static int pack_index_open(struct git_pack_file *p)
 	return error;
 }
 
+/*
+ * The descriptor of an open pack may have been closed to stay within
+ * the budget of open files; the windows reopen it when they need to.
+ */
+GIT_INLINE(bool) packfile_is_open(struct git_pack_file *p)
+{
+	return p->mwf.fd != -1 || p->mwf.path != NULL;
+}
+
 static unsigned char *pack_window_open(
 		struct git_pack_file *p,
 		git_mwindow **w_cursor,
 		git_off_t offset,
 		unsigned int *left)
 {
-	if (p->mwf.fd == -1 && packfile_open(p) < 0)
+	if (!packfile_is_open(p) && packfile_open(p) < 0)
 		return NULL;
 
 	/* Since packfiles end in a hash of their content and it's
@@ -277,6 +294,42 @@ int git_packfile_unpack_header(
 	return 0;
 }
 
+static struct git_pack_base_slot *base_cache_slot(
+	git_pack_base_cache *bases, struct git_pack_file *p, git_off_t offset)
+{
+	return &bases->slots[(size_t)(offset + (uintptr_t)p) % GIT_PACK_BASE_CACHE_SLOTS];
+}
+
+static void base_cache_put(
+	git_pack_base_cache *bases, struct git_pack_file *p,
+	git_off_t offset, git_rawobj *obj)
+{
+	struct git_pack_base_slot *slot = base_cache_slot(bases, p, offset);
+
+	if (slot->obj.data) {
+		bases->memory -= slot->obj.len;
+		git__free(slot->obj.data);
+	}
+
+	if (bases->memory + obj->len > GIT_PACK_BASE_CACHE_LIMIT)
+		git_pack_base_cache_clear(bases);
+
+	slot->p = p;
+	slot->offset = offset;
+	slot->obj = *obj;
+	bases->memory += obj->len;
+}
+
+void git_pack_base_cache_clear(git_pack_base_cache *bases)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_BASE_CACHE_SLOTS; ++i)
+		git__free(bases->slots[i].obj.data);
+
+	memset(bases, 0x0, sizeof(git_pack_base_cache));
+}
+
 static int packfile_unpack_delta(
 		git_rawobj *obj,
 		struct git_pack_file *p,
@@ -284,10 +337,12 @@ static int packfile_unpack_delta(
 		git_off_t *curpos,
 		size_t delta_size,
 		git_otype delta_type,
-		git_off_t obj_offset)
+		git_off_t obj_offset,
+		git_pack_base_cache *bases)
 {
 	git_off_t base_offset;
 	git_rawobj base, delta;
+	struct git_pack_base_slot *slot = NULL;
 	int error;
 
 	base_offset = get_delta_base(p, w_curs, curpos, delta_type, obj_offset);
@@ -297,32 +352,44 @@ static int packfile_unpack_delta(
 	if (base_offset < 0) /* must actually be an error code */
 		return (int)base_offset;
 
-	error = git_packfile_unpack(&base, p, &base_offset);
+	if (bases) {
+		slot = base_cache_slot(bases, p, base_offset);
+		if (!slot->obj.data || slot->p != p || slot->offset != base_offset)
+			slot = NULL;
+	}
 
-	/*
-	 * TODO: git.git tries to load the base from other packfiles
-	 * or loose objects.
-	 *
-	 * We'll need to do this in order to support thin packs.
-	 */
-	if (error < 0)
-		return error;
+	if (slot)
+		base = slot->obj;
+	else {
+		git_off_t offset = base_offset;
+
+		error = git_packfile_unpack_cached(&base, p, &offset, bases);
+
+		/*
+		 * TODO: git.git tries to load the base from other packfiles
+		 * or loose objects.
+		 *
+		 * We'll need to do this in order to support thin packs.
+		 */
+		if (error < 0)
+			return error;
+	}
 
 	error = packfile_unpack_compressed(&delta, p, w_curs, curpos, delta_size, delta_type);
 	git_mwindow_close(w_curs);
-	if (error < 0) {
-		git__free(base.data);
-		return error;
-	}
+	if (error < 0)
+		goto cleanup;
 
 	obj->type = base.type;
 	error = git__delta_apply(obj, base.data, base.len, delta.data, delta.len);
-
-	git__free(base.data);
 	git__free(delta.data);
 
-	/* TODO: we might want to cache this shit. eventually */
-	//add_delta_base_cache(p, base_offset, base, base_size, *type);
+cleanup:
+	/* the cache keeps the bases it was handed */
+	if (!slot && bases && error == 0 && base.len <= GIT_PACK_BASE_CACHE_LIMIT)
+		base_cache_put(bases, p, base_offset, &base);
+	else if (!slot)
+		git__free(base.data);
 
 	return error; /* error set by git__delta_apply */
 }
@@ -331,6 +398,15 @@ int git_packfile_unpack(
 	git_rawobj *obj,
 	struct git_pack_file *p,
 	git_off_t *obj_offset)
+{
+	return git_packfile_unpack_cached(obj, p, obj_offset, NULL);
+}
+
+int git_packfile_unpack_cached(
+	git_rawobj *obj,
+	struct git_pack_file *p,
+	git_off_t *obj_offset,
+	git_pack_base_cache *bases)
 {
 	git_mwindow *w_curs = NULL;
 	git_off_t curpos = *obj_offset;
@@ -358,7 +434,7 @@ int git_packfile_unpack(
 	case GIT_OBJ_REF_DELTA:
 		error = packfile_unpack_delta(
 				obj, p, &w_curs, &curpos,
-				size, type, *obj_offset);
+				size, type, *obj_offset, bases);
 		break;
 
 	case GIT_OBJ_COMMIT:
@@ -391,6 +467,118 @@ static void use_git_free(void *opaq, void *ptr)
 	git__free(ptr);
 }
 
+/* Two varints of at most 10 bytes each for a 64-bit size */
+#define DELTA_HEADER_MAX_SIZE 20
+
+/*
+ * Inflate only the first bytes of the delta data at curpos, enough to
+ * read the size of the object the delta produces.
+ */
+static int packfile_delta_result_size(
+	size_t *size_p,
+	struct git_pack_file *p,
+	git_mwindow **w_curs,
+	git_off_t curpos)
+{
+	unsigned char buffer[DELTA_HEADER_MAX_SIZE], *in;
+	size_t base_size;
+	z_stream stream;
+	int st;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.next_out = buffer;
+	stream.avail_out = sizeof(buffer);
+	stream.zalloc = use_git_alloc;
+	stream.zfree = use_git_free;
+
+	if (inflateInit(&stream) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
+	do {
+		in = pack_window_open(p, w_curs, curpos, &stream.avail_in);
+		stream.next_in = in;
+		st = inflate(&stream, Z_SYNC_FLUSH);
+		git_mwindow_close(w_curs);
+
+		if (st == Z_BUF_ERROR && in == NULL) {
+			inflateEnd(&stream);
+			return GIT_EBUFS;
+		}
+
+		curpos += stream.next_in - in;
+	} while (st == Z_OK && stream.avail_out);
+
+	inflateEnd(&stream);
+
+	if (st != Z_OK && st != Z_STREAM_END) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
+	return git__delta_read_header(
+		&base_size, size_p, buffer, sizeof(buffer) - stream.avail_out);
+}
+
+int git_packfile_resolve_header(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = offset, delta_offset = offset, base_offset;
+	size_t size;
+	git_otype type;
+	int error;
+
+	error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
+	git_mwindow_close(&w_curs);
+	if (error < 0)
+		return error;
+
+	/*
+	 * The size of a delta's result is at the head of its data; its
+	 * type is the type of the object at the end of its chain, so only
+	 * the entry headers along the chain need to be read.
+	 */
+	while (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
+		size_t base_size;
+
+		base_offset = get_delta_base(p, &w_curs, &curpos, type, delta_offset);
+		git_mwindow_close(&w_curs);
+		if (base_offset == 0)
+			return packfile_error("delta offset is zero");
+		if (base_offset < 0) /* must actually be an error code */
+			return (int)base_offset;
+
+		if (delta_offset == offset &&
+			(error = packfile_delta_result_size(&size, p, &w_curs, curpos)) < 0)
+			return error;
+
+		delta_offset = curpos = base_offset;
+		error = git_packfile_unpack_header(&base_size, &type, &p->mwf, &w_curs, &curpos);
+		git_mwindow_close(&w_curs);
+		if (error < 0)
+			return error;
+	}
+
+	switch (type) {
+	case GIT_OBJ_COMMIT:
+	case GIT_OBJ_TREE:
+	case GIT_OBJ_BLOB:
+	case GIT_OBJ_TAG:
+		break;
+	default:
+		return packfile_error("invalid packfile type in header");
+	}
+
+	*size_p = size;
+	*type_p = type;
+	return 0;
+}
+
 int packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -452,6 +640,82 @@ int packfile_unpack_compressed(
 	return 0;
 }
 
+int git_packfile_stream_open(
+	git_packfile_stream *obj,
+	struct git_pack_file *p,
+	git_off_t curpos,
+	size_t size)
+{
+	memset(obj, 0, sizeof(git_packfile_stream));
+	obj->p = p;
+	obj->curpos = curpos;
+	obj->size = size;
+	obj->zstream.zalloc = use_git_alloc;
+	obj->zstream.zfree = use_git_free;
+
+	if (inflateInit(&obj->zstream) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
+	return 0;
+}
+
+ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len)
+{
+	unsigned char *in;
+	size_t written;
+	int st;
+
+	/* an empty read would never make progress */
+	if (obj->done || len == 0)
+		return 0;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	obj->zstream.next_out = buffer;
+	obj->zstream.avail_out = (uInt)len;
+
+	/* the deflated data may run across several windows */
+	do {
+		in = pack_window_open(obj->p, &obj->mw, obj->curpos, &obj->zstream.avail_in);
+		if (in == NULL) {
+			giterr_set(GITERR_ODB, "Failed to read packfile. Object is truncated");
+			return -1;
+		}
+
+		obj->zstream.next_in = in;
+		st = inflate(&obj->zstream, Z_SYNC_FLUSH);
+		git_mwindow_close(&obj->mw);
+
+		obj->curpos += obj->zstream.next_in - in;
+	} while ((st == Z_OK || st == Z_BUF_ERROR) && obj->zstream.avail_out == len);
+
+	written = len - obj->zstream.avail_out;
+
+	if (st == Z_STREAM_END)
+		obj->done = 1;
+	else if (st != Z_OK && st != Z_BUF_ERROR) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
+	if (obj->zstream.total_out > obj->size ||
+		(obj->done && obj->zstream.total_out != obj->size)) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile. Size mismatch");
+		return -1;
+	}
+
+	return (ssize_t)written;
+}
+
+void git_packfile_stream_free(git_packfile_stream *obj)
+{
+	git_mwindow_close(&obj->mw);
+	inflateEnd(&obj->zstream);
+}
+
 /*
  * curpos is where the data starts, delta_obj_offset is the where the
  * header starts
@@ -541,8 +805,7 @@ void packfile_free(struct git_pack_file *p)
 	git_mwindow_free_all(&p->mwf);
 	git_mwindow_file_deregister(&p->mwf);
 
-	if (p->mwf.fd != -1)
-		p_close(p->mwf.fd);
+	git_mwindow_file_close(&p->mwf);
 
 	pack_index_free(p);
 
@@ -556,16 +819,14 @@ static int packfile_open(struct git_pack_file *p)
 	struct git_pack_header hdr;
 	git_oid sha1;
 	unsigned char *idx_sha1;
-
-	assert(p->index_map.data);
+	int error;
 
 	if (!p->index_map.data && pack_index_open(p) < 0)
 		return git_odb__error_notfound("failed to open packfile", NULL);
 
 	/* TODO: open with noatime */
-	p->mwf.fd = git_futils_open_ro(p->pack_name);
-	if (p->mwf.fd < 0)
-		return p->mwf.fd;
+	if ((error = git_mwindow_file_open(&p->mwf, p->pack_name)) < 0)
+		return error;
 
 	if (p_fstat(p->mwf.fd, &st) < 0 ||
 		git_mwindow_file_register(&p->mwf) < 0)
@@ -611,8 +872,7 @@ static int packfile_open(struct git_pack_file *p)
 
 cleanup:
 	giterr_set(GITERR_OS, "Invalid packfile '%s'", p->pack_name);
-	p_close(p->mwf.fd);
-	p->mwf.fd = -1;
+	git_mwindow_file_close(&p->mwf);
 	return -1;
 }
 
@@ -754,6 +1014,131 @@ int git_pack_foreach_entry(
 	return 0;
 }
 
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	int (*cb)(const git_oid *oid, git_off_t offset, void *data),
+	void *data)
+{
+	const unsigned char *index;
+	size_t stride;
+	uint32_t i;
+
+	if (p->index_map.data == NULL) {
+		int error;
+
+		if ((error = pack_index_open(p)) < 0)
+			return error;
+
+		assert(p->index_map.data);
+	}
+
+	index = p->index_map.data;
+	index += 4 * 256;
+
+	if (p->index_version > 1) {
+		index += 8;
+		stride = 20;
+	} else {
+		index += 4;
+		stride = 24;
+	}
+
+	for (i = 0; i < p->num_objects; i++)
+		if (cb((const git_oid *)(index + stride * i),
+				nth_packed_object_offset(p, i), data))
+			return GIT_EUSER;
+
+	return 0;
+}
+
+GIT_INLINE(uint64_t) oid_prefix(const unsigned char *id)
+{
+	return ((uint64_t)ntohl(*(const uint32_t *)id) << 32) |
+		ntohl(*(const uint32_t *)(id + 4));
+}
+
+/*
+ * Mirror the first 8 bytes of every object id into a dense array of
+ * integers. A search over it touches 8 bytes per probe instead of a
+ * 20 or 24 byte stride through the map, and compares with a single
+ * integer comparison instead of memcmp().
+ */
+static void pack_build_oid_prefixes(
+	struct git_pack_file *p, const unsigned char *index, unsigned stride)
+{
+	uint64_t *prefixes;
+	uint32_t i;
+
+	/* This is only an accelerator; on failure keep searching the map */
+	if ((prefixes = git__malloc(p->num_objects * sizeof(uint64_t))) == NULL) {
+		giterr_clear();
+		return;
+	}
+
+	for (i = 0; i < p->num_objects; ++i)
+		prefixes[i] = oid_prefix(index + i * stride);
+
+	/* another lookup may have built it meanwhile */
+	if (git__compare_and_swap(
+			(void * volatile *)&p->oid_prefixes, NULL, prefixes) != NULL)
+		git__free(prefixes);
+}
+
+/*
+ * Same contract as sha1_entry_pos(), over the prefix mirror: returns
+ * the position of `key` in [lo, hi), or -1 - the position where it
+ * would be inserted.
+ *
+ * Object ids are uniformly distributed, so the first probes are
+ * interpolated from the prefixes at both ends of the range; a run of
+ * bad guesses degrades to plain bisection so the worst case stays
+ * logarithmic.
+ */
+static int pack_prefix_pos(
+	const struct git_pack_file *p,
+	const unsigned char *index, unsigned stride,
+	unsigned lo, unsigned hi,
+	const unsigned char *key)
+{
+	const uint64_t *prefixes = p->oid_prefixes;
+	uint64_t k = oid_prefix(key);
+	int guesses = 4;
+	int cmp = 1;
+
+	/* Find the first entry whose prefix is >= k */
+	while (lo < hi) {
+		unsigned mi;
+
+		if (guesses > 0 && hi - lo > 8) {
+			uint64_t lov = prefixes[lo], hiv = prefixes[hi - 1];
+
+			if (k <= lov)
+				break;
+			if (k > hiv) {
+				lo = hi;
+				break;
+			}
+
+			mi = lo + (unsigned)((double)(k - lov) / (double)(hiv - lov) * (hi - 1 - lo));
+			guesses--;
+		} else {
+			mi = lo + (hi - lo) / 2;
+		}
+
+		if (prefixes[mi] < k)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+
+	/* Entries sharing the 8-byte prefix are ordered by the rest of the id */
+	while (lo < p->num_objects && prefixes[lo] == k &&
+		(cmp = memcmp(index + lo * stride, key, GIT_OID_RAWSZ)) < 0)
+		lo++;
+
+	return (cmp == 0) ? (int)lo : -1 - (int)lo;
+}
+
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
 	git_oid *found_oid,
@@ -802,8 +1187,20 @@ static int pack_entry_find_offset(
 		short_oid->id[0], short_oid->id[1], short_oid->id[2], lo, hi, p->num_objects);
 #endif
 
-	/* Use git.git lookup code */
-	pos = sha1_entry_pos(index, stride, 0, lo, hi, p->num_objects, short_oid->id);
+	/*
+	 * Every lookup on a pack without the prefix mirror pays a few
+	 * scattered reads of the map; once the pack has served about one
+	 * lookup per 256 objects, reading the whole table once is cheaper.
+	 */
+	if (p->oid_prefixes == NULL &&
+		git_atomic_inc(&p->lookups) > (int)(p->num_objects >> 8))
+		pack_build_oid_prefixes(p, index, stride);
+
+	if (p->oid_prefixes != NULL)
+		pos = pack_prefix_pos(p, index, stride, lo, hi, short_oid->id);
+	else
+		/* Use git.git lookup code */
+		pos = sha1_entry_pos(index, stride, 0, lo, hi, p->num_objects, short_oid->id);
 
 	if (pos >= 0) {
 		/* An object matching exactly the oid was found */
@@ -860,26 +1257,37 @@ int git_pack_entry_find(
 
 	assert(p);
 
-	if (len == GIT_OID_HEXSZ && p->num_bad_objects) {
+	error = pack_entry_find_offset(&offset, &found_oid, p, short_oid, len);
+	if (error < 0)
+		return error;
+
+	return git_pack_entry_init(e, p, &found_oid, offset);
+}
+
+int git_pack_entry_init(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	int error;
+
+	if (p->num_bad_objects) {
 		unsigned i;
 		for (i = 0; i < p->num_bad_objects; i++)
-			if (git_oid_cmp(short_oid, &p->bad_object_sha1[i]) == 0)
+			if (git_oid_cmp(oid, &p->bad_object_sha1[i]) == 0)
 				return packfile_error("bad object found in packfile");
 	}
 
-	error = pack_entry_find_offset(&offset, &found_oid, p, short_oid, len);
-	if (error < 0)
-		return error;
-
 	/* we found a unique entry in the index;
 	 * make sure the packfile backing the index
 	 * still exists on disk */
-	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+	if (!packfile_is_open(p) && (error = packfile_open(p)) < 0)
 		return error;
 
 	e->offset = offset;
 	e->p = p;
 
-	git_oid_cpy(&e->sha1, &found_oid);
+	git_oid_cpy(&e->sha1, oid);
 	return 0;
 }
@@ -8,6 +8,8 @@
 #ifndef INCLUDE_pack_h__
 #define INCLUDE_pack_h__
 
+#include <zlib.h>
+
 #include "git2/oid.h"
 
 #include "common.h"
@@ -61,11 +63,21 @@ struct git_pack_file {
 
 	int index_version;
 	git_time_t mtime;
-	unsigned pack_local:1, pack_keep:1, has_cache:1;
+	unsigned pack_local:1, pack_keep:1, has_cache:1, in_midx:1;
 	git_oid sha1;
 	git_vector cache;
 	git_oid **oids;
 
+	/*
+	 * The first 8 bytes of every object id in the index, in index
+	 * order, as host integers. Built once the pack has served enough
+	 * lookups to pay for it; see pack_entry_find_offset(). Lookups
+	 * from several threads may build it at once: the first copy to
+	 * be published is kept, and it never changes after that.
+	 */
+	uint64_t *oid_prefixes;
+	git_atomic lookups;
+
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[GIT_FLEX_ARRAY]; /* more */
 };
@@ -83,7 +95,66 @@ int git_packfile_unpack_header(
 		git_mwindow **w_curs,
 		git_off_t *curpos);
 
+/*
+ * Incremental inflation of an undeltified entry, for objects too big
+ * to hold in memory at once. `curpos` is where the entry's data
+ * starts, right after its header.
+ */
+typedef struct git_packfile_stream {
+	struct git_pack_file *p;
+	git_mwindow *mw;
+	git_off_t curpos;
+	size_t size;
+	z_stream zstream;
+	int done;
+} git_packfile_stream;
+
+int git_packfile_stream_open(
+		git_packfile_stream *obj,
+		struct git_pack_file *p,
+		git_off_t curpos,
+		size_t size);
+
+/*
+ * Inflate up to `len` bytes of the object into `buffer`. Returns the
+ * number of bytes inflated, 0 once the whole object was read or -1 on
+ * error (including data that does not match the entry's size).
+ */
+ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
+
+void git_packfile_stream_free(git_packfile_stream *obj);
+
+int git_packfile_resolve_header(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset);
 int git_packfile_unpack(git_rawobj *obj, struct git_pack_file *p, git_off_t *obj_offset);
+
+/*
+ * Delta bases kept around while unpacking a batch of entries, so the
+ * objects that share a base only have it unpacked once. Slots are
+ * picked by the base's offset; the cache is emptied when the bases it
+ * holds would take more than GIT_PACK_BASE_CACHE_LIMIT bytes.
+ */
+#define GIT_PACK_BASE_CACHE_SLOTS 256
+#define GIT_PACK_BASE_CACHE_LIMIT (16 * 1024 * 1024)
+
+typedef struct git_pack_base_cache {
+	struct git_pack_base_slot {
+		struct git_pack_file *p;
+		git_off_t offset;
+		git_rawobj obj;
+	} slots[GIT_PACK_BASE_CACHE_SLOTS];
+	size_t memory;
+} git_pack_base_cache;
+
+int git_packfile_unpack_cached(
+		git_rawobj *obj,
+		struct git_pack_file *p,
+		git_off_t *obj_offset,
+		git_pack_base_cache *bases);
+void git_pack_base_cache_clear(git_pack_base_cache *bases);
 int packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -103,9 +174,18 @@ int git_pack_entry_find(
 		struct git_pack_file *p,
 		const git_oid *short_oid,
 		size_t len);
+int git_pack_entry_init(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		int (*cb)(git_oid *oid, void *data),
 		void *data);
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		int (*cb)(const git_oid *oid, git_off_t offset, void *data),
+		void *data);
 
 #endif
@@ -58,12 +58,22 @@ static void drop_index(git_repository *repo)
 	}
 }
 
+static void drop_commit_graph(git_repository *repo)
+{
+	if (repo->_commit_graph != NULL) {
+		GIT_REFCOUNT_OWN(repo->_commit_graph, NULL);
+		git_commit_graph_free(repo->_commit_graph);
+		repo->_commit_graph = NULL;
+	}
+}
+
 void git_repository_free(git_repository *repo)
 {
 	if (repo == NULL)
 		return;
 
 	git_cache_free(&repo->objects);
+	git_commit_cache_free(&repo->commits);
 	git_repository__refcache_free(&repo->references);
 	git_attr_cache_flush(repo);
 	git_submodule_config_free(repo);
@@ -74,6 +84,8 @@ void git_repository_free(git_repository *repo)
 	drop_config(repo);
 	drop_index(repo);
 	drop_odb(repo);
+	drop_commit_graph(repo);
+	git_mutex_free(&repo->commit_graph_lock);
 
 	git__free(repo);
 }
@@ -112,6 +124,14 @@ static git_repository *repository_alloc(void)
 		return NULL;
 	}
 
+	if (git_commit_cache_init(&repo->commits) < 0) {
+		git_cache_free(&repo->objects);
+		git__free(repo);
+		return NULL;
+	}
+
+	git_mutex_init(&repo->commit_graph_lock);
+
 	/* set all the entries in the cvar cache to `unset` */
 	git_repository__cvar_cache_clear(repo);
 
@@ -589,6 +609,58 @@ void git_repository_set_odb(git_repository *repo, git_odb *odb)
 	GIT_REFCOUNT_INC(odb);
 }
 
+/*
+ * Walks in other threads share the graph: the refcount is only touched
+ * under `commit_graph_lock`, as is the swap for a newer graph.
+ */
+int git_repository__commit_graph(git_commit_graph_file **out, git_repository *repo)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error = 0;
+
+	assert(repo && out);
+
+	*out = NULL;
+
+	if (git_buf_joinpath(&path, repo->path_repository,
+			GIT_OBJECTS_DIR "info/commit-graph") < 0)
+		return -1;
+
+	git_mutex_lock(&repo->commit_graph_lock);
+
+	/* walks still using the old graph keep it until they are done */
+	if (repo->_commit_graph != NULL &&
+		git_commit_graph_needs_refresh(repo->_commit_graph, path.ptr))
+		drop_commit_graph(repo);
+
+	if (repo->_commit_graph == NULL) {
+		error = git_commit_graph_open(&repo->_commit_graph, path.ptr);
+		if (!error)
+			GIT_REFCOUNT_OWN(repo->_commit_graph, repo);
+	}
+
+	if (!error) {
+		GIT_REFCOUNT_INC(repo->_commit_graph);
+		*out = repo->_commit_graph;
+	}
+
+	git_mutex_unlock(&repo->commit_graph_lock);
+
+	git_buf_free(&path);
+	return error;
+}
+
+void git_repository__commit_graph_release(
+	git_repository *repo, git_commit_graph_file *graph)
+{
+	if (graph == NULL)
+		return;
+
+	git_mutex_lock(&repo->commit_graph_lock);
+	git_commit_graph_free(graph);
+	git_mutex_unlock(&repo->commit_graph_lock);
+}
+
 int git_repository_index__weakptr(git_index **out, git_repository *repo)
 {
 	assert(out && repo);
@@ -15,6 +15,8 @@
 
 #include "index.h"
 #include "cache.h"
+#include "commit_cache.h"
+#include "commit_graph.h"
 #include "refs.h"
 #include "buffer.h"
 #include "odb.h"
@@ -81,8 +83,11 @@ struct git_repository {
 	git_odb *_odb;
 	git_config *_config;
 	git_index *_index;
+	git_commit_graph_file *_commit_graph;
+	git_mutex commit_graph_lock;
 
 	git_cache objects;
+	git_commit_cache commits;
 	git_refcache references;
 	git_attr_cache attrcache;
 	git_strmap *submodules;
@@ -114,6 +119,15 @@ int git_repository_config__weakptr(git_config **out, git_repository *repo);
 int git_repository_odb__weakptr(git_odb **out, git_repository *repo);
 int git_repository_index__weakptr(git_index **out, git_repository *repo);
 
+/*
+ * The commit-graph of the repository, kept open between calls and
+ * reopened when the file changes. Give it back with
+ * git_repository__commit_graph_release. Returns GIT_ENOTFOUND if the
+ * repository has none.
+ */
+int git_repository__commit_graph(git_commit_graph_file **out, git_repository *repo);
+void git_repository__commit_graph_release(git_repository *repo, git_commit_graph_file *graph);
+
 /*
  * CVAR cache
  *
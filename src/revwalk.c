@@ -7,29 +7,39 @@
 
 #include "common.h"
 #include "commit.h"
+#include "commit_graph.h"
 #include "odb.h"
 #include "pqueue.h"
 #include "pool.h"
-#include "oidmap.h"
+#include "oidtable.h"
+#include "repository.h"
 
 #include "git2/revwalk.h"
 #include "git2/merge.h"
+#include "git2/graph.h"
+#include "git2/tree.h"
 
 #include <regex.h>
 
-GIT__USE_OIDMAP;
-
 #define PARENT1  (1 << 0)
 #define PARENT2  (1 << 1)
 #define RESULT   (1 << 2)
 #define STALE    (1 << 3)
 
+/* how many commits are read from the odb at once */
+#define PREFETCH_BATCH 64
+
 typedef struct commit_object {
 	git_oid oid;
+	git_oid tree;
 	uint32_t time;
+	uint32_t generation;
+	/* the order in which the walker first heard of the commit */
+	uint32_t index;
 	unsigned int seen:1,
 			 uninteresting:1,
-			 topo_delay:1,
+			 topo_explored:1,
+			 queued:1,
 			 parsed:1,
 			 flags : 4;
 
@@ -44,12 +54,31 @@ typedef struct commit_list {
 	struct commit_list *next;
 } commit_list;
 
+typedef struct {
+	/* the path with its components split by NULs */
+	char *components;
+	size_t num_components;
+
+	/* the Bloom keys of the path and of each directory leading to it */
+	git_bloom_key *keys;
+	unsigned int ascii:1;
+} revwalk_path;
+
 struct git_revwalk {
 	git_repository *repo;
 	git_odb *odb;
 
-	git_oidmap *commits;
+	git_oidtable *commits;
 	git_pool commit_pool;
+	git_pool list_pool;
+
+	git_commit_graph_file *graph;
+
+	/* the commits heard of but not parsed yet, newest last */
+	git_vector prefetch;
+
+	/* only return the commits that change these */
+	git_vector paths;
 
 	commit_list *iterator_topo;
 	commit_list *iterator_rand;
@@ -59,9 +88,15 @@ struct git_revwalk {
 	int (*get_next)(commit_object **, git_revwalk *);
 	int (*enqueue)(git_revwalk *, commit_object *);
 
-	unsigned walking:1;
+	unsigned walking:1,
+		hiding:1;
 	unsigned int sorting;
 
+	/* incremental topological sorting */
+	git_pqueue topo_explore;
+	git_pqueue topo_indegree;
+	uint32_t topo_min_generation;
+
 	/* merge base calculation */
 	commit_object *one;
 	git_vector twos;
@@ -75,55 +110,52 @@ static int commit_time_cmp(void *a, void *b)
 	return (commit_a->time < commit_b->time);
 }
 
-static commit_list *commit_list_insert(commit_object *item, commit_list **list_p)
+static int commit_generation_cmp(void *a, void *b)
 {
-	commit_list *new_list = git__malloc(sizeof(commit_list));
-	if (new_list != NULL) {
-		new_list->item = item;
-		new_list->next = *list_p;
-	}
-	*list_p = new_list;
-	return new_list;
-}
+	commit_object *commit_a = (commit_object *)a;
+	commit_object *commit_b = (commit_object *)b;
 
-static commit_list *commit_list_insert_by_date(commit_object *item, commit_list **list_p)
-{
-	commit_list **pp = list_p;
-	commit_list *p;
+	if (commit_a->generation != commit_b->generation)
+		return (commit_a->generation < commit_b->generation);
 
-	while ((p = *pp) != NULL) {
-		if (commit_time_cmp(p->item, item) < 0)
-			break;
+	return (commit_a->time < commit_b->time);
+}
 
-		pp = &p->next;
-	}
+/* the nodes of the lists come from the pool of the walk, and go back to it */
+static commit_list *commit_list_insert(
+	git_revwalk *walk, commit_object *item, commit_list **list_p)
+{
+	commit_list *new_list = git_pool_malloc(&walk->list_pool, 1);
+	if (new_list == NULL)
+		return NULL;
 
-	return commit_list_insert(item, pp);
+	new_list->item = item;
+	new_list->next = *list_p;
+	*list_p = new_list;
+	return new_list;
 }
-static void commit_list_free(commit_list **list_p)
+
+static void commit_list_free(git_revwalk *walk, commit_list **list_p)
 {
 	commit_list *list = *list_p;
 
-	if (list == NULL)
-		return;
-
 	while (list) {
 		commit_list *temp = list;
 		list = temp->next;
-		git__free(temp);
+		git_pool_free(&walk->list_pool, temp);
 	}
 
 	*list_p = NULL;
 }
 
-static commit_object *commit_list_pop(commit_list **stack)
+static commit_object *commit_list_pop(git_revwalk *walk, commit_list **stack)
 {
 	commit_list *top = *stack;
 	commit_object *item = top ? top->item : NULL;
 
 	if (top) {
 		*stack = top->next;
-		git__free(top);
+		git_pool_free(&walk->list_pool, top);
 	}
 	return item;
 }
@@ -151,23 +183,20 @@ static commit_object **alloc_parents(
 static commit_object *commit_lookup(git_revwalk *walk, const git_oid *oid)
 {
 	commit_object *commit;
-	khiter_t pos;
-	int ret;
 
 	/* lookup and reserve space if not already present */
-	pos = kh_get(oid, walk->commits, oid);
-	if (pos != kh_end(walk->commits))
-		return kh_value(walk->commits, pos);
+	if ((commit = git_oidtable_get(walk->commits, oid)) != NULL)
+		return commit;
 
 	commit = alloc_commit(walk);
 	if (commit == NULL)
 		return NULL;
 
 	git_oid_cpy(&commit->oid, oid);
+	commit->index = (uint32_t)git_oidtable_size(walk->commits);
 
-	pos = kh_put(oid, walk->commits, &commit->oid, &ret);
-	assert(ret != 0);
-	kh_value(walk->commits, pos) = commit;
+	if (git_oidtable_put(walk->commits, &commit->oid, commit) < 0)
+		return NULL;
 
 	return commit;
 }
@@ -183,6 +212,40 @@ static int commit_error(commit_object *commit, const char *msg)
 	return -1;
 }
 
+/*
+ * Queue the parents of a commit read from the odb for commit_prefetch,
+ * unless they can be parsed without the odb. The parents of commits
+ * from the commit-graph are in it too, and those of cached commits
+ * most likely cached, so only the odb's commits queue theirs.
+ */
+static void prefetch_queue_parents(git_revwalk *walk, commit_object *commit)
+{
+	git_commit_cache *cache = &walk->repo->commits;
+	git_commit_graph_entry entry;
+	commit_object *parent;
+	unsigned short i;
+
+	git_commit_cache_lock(cache);
+	for (i = 0; i < commit->out_degree; ++i) {
+		parent = commit->parents[i];
+
+		if (parent->parsed)
+			continue;
+		if (walk->graph != NULL &&
+			git_commit_graph_entry_find(&entry, walk->graph, &parent->oid) == 0)
+			continue;
+		if (git_commit_cache_get(cache, &parent->oid) != NULL)
+			continue;
+
+		/* the walk does without it; prefetching is only a hint */
+		if (git_vector_insert(&walk->prefetch, parent) < 0) {
+			giterr_clear();
+			break;
+		}
+	}
+	git_commit_cache_unlock(cache);
+}
+
 static int commit_quick_parse(git_revwalk *walk, commit_object *commit, git_rawobj *raw)
 {
 	const size_t parent_len = strlen("parent ") + GIT_OID_HEXSZ + 1;
@@ -192,6 +255,9 @@ static int commit_quick_parse(git_revwalk *walk, commit_object *commit, git_rawo
 	int i, parents = 0;
 	int commit_time;
 
+	if (git_oid_fromstr(&commit->tree, (char *)buffer + strlen("tree ")) < 0)
+		return -1;
+
 	buffer += strlen("tree ") + GIT_OID_HEXSZ + 1;
 
 	parents_start = buffer;
@@ -218,6 +284,7 @@ static int commit_quick_parse(git_revwalk *walk, commit_object *commit, git_rawo
 	}
 
 	commit->out_degree = (unsigned short)parents;
+	prefetch_queue_parents(walk, commit);
 
 	if ((committer_start = buffer = memchr(buffer, '\n', buffer_end - buffer)) == NULL)
 		return commit_error(commit, "object is corrupted");
@@ -250,84 +317,341 @@ static int commit_quick_parse(git_revwalk *walk, commit_object *commit, git_rawo
 		return commit_error(commit, "cannot parse commit time");
 
 	commit->time = (time_t)commit_time;
+	commit->generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+	commit->parsed = 1;
+	return 0;
+}
+
+static int commit_graph_parse(
+	git_revwalk *walk, commit_object *commit, git_commit_graph_entry *entry)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+
+	commit->parents = alloc_parents(walk, commit, entry->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < entry->parent_count; ++i) {
+		if (git_commit_graph_entry_parent(&parent, walk->graph, entry, i) < 0)
+			return -1;
+
+		commit->parents[i] = commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)entry->parent_count;
+	git_oid_cpy(&commit->tree, &entry->tree_oid);
+	commit->time = (uint32_t)entry->commit_time;
+	commit->generation = entry->generation;
+	commit->parsed = 1;
+	return 0;
+}
+
+static int commit_cached_parse(
+	git_revwalk *walk, commit_object *commit, const git_commit_cache_entry *entry)
+{
+	unsigned short i;
+
+	commit->parents = alloc_parents(walk, commit, entry->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < entry->parent_count; ++i) {
+		commit->parents[i] = commit_lookup(walk, &entry->parents[i]);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = entry->parent_count;
+	git_oid_cpy(&commit->tree, &entry->tree);
+	commit->time = entry->time;
+	commit->generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
 	commit->parsed = 1;
 	return 0;
 }
 
+static void commit_cache_store(git_revwalk *walk, commit_object *commit)
+{
+	git_commit_cache *cache = &walk->repo->commits;
+	git_commit_cache_entry *entry;
+	unsigned short i;
+
+	git_commit_cache_lock(cache);
+
+	entry = git_commit_cache_add(cache, &commit->oid, commit->out_degree);
+	if (entry != NULL) {
+		git_oid_cpy(&entry->tree, &commit->tree);
+		entry->time = commit->time;
+		for (i = 0; i < commit->out_degree; ++i)
+			git_oid_cpy(&entry->parents[i], &commit->parents[i]->oid);
+	}
+
+	git_commit_cache_unlock(cache);
+
+	/* a commit that could not be cached is only read again later */
+	if (entry == NULL)
+		giterr_clear();
+}
+
+typedef struct {
+	git_revwalk *walk;
+	commit_object **commits;
+} prefetch_state;
+
+static int prefetch_parse_cb(git_odb_object *obj, size_t idx, void *payload)
+{
+	prefetch_state *st = payload;
+	commit_object *commit = st->commits[idx];
+
+	if (!commit->parsed && obj->raw.type == GIT_OBJ_COMMIT) {
+		/* a broken commit is reported if the walk ever gets to it */
+		if (commit_quick_parse(st->walk, commit, &obj->raw) < 0)
+			giterr_clear();
+		else
+			commit_cache_store(st->walk, commit);
+	}
+
+	git_odb_object_free(obj);
+	return 0;
+}
+
+/*
+ * Read `commit` together with the commits the walk has most recently
+ * heard of, which are the ones it is about to need: the odb reads a
+ * batch in pack order, inflating delta bases shared by the commits only
+ * once.
+ */
+static void commit_prefetch(git_revwalk *walk, commit_object *commit)
+{
+	commit_object *batch[PREFETCH_BATCH];
+	git_oid ids[PREFETCH_BATCH];
+	commit_object *next;
+	prefetch_state st;
+	size_t i, n = 1;
+
+	batch[0] = commit;
+
+	while (n < PREFETCH_BATCH && (next = git_vector_last(&walk->prefetch)) != NULL) {
+		git_vector_pop(&walk->prefetch);
+
+		/* parsed since it was queued, or the one we were asked for */
+		if (next->parsed || next == commit)
+			continue;
+
+		batch[n++] = next;
+	}
+
+	if (n == 1)
+		return;
+
+	for (i = 0; i < n; ++i)
+		git_oid_cpy(&ids[i], &batch[i]->oid);
+
+	st.walk = walk;
+	st.commits = batch;
+
+	/* whatever went wrong, the commit is read again on its own */
+	if (git_odb__read_many_nocache(walk->odb, ids, n, prefetch_parse_cb, &st) < 0)
+		giterr_clear();
+}
+
 static int commit_parse(git_revwalk *walk, commit_object *commit)
 {
+	const git_commit_cache_entry *cached;
 	git_odb_object *obj;
-	int error;
+	int error = 0;
+
+	if (commit->parsed)
+		return 0;
+
+	if (walk->graph != NULL) {
+		git_commit_graph_entry entry;
+
+		error = git_commit_graph_entry_find(&entry, walk->graph, &commit->oid);
+		if (!error)
+			return commit_graph_parse(walk, commit, &entry);
+		if (error != GIT_ENOTFOUND)
+			return error;
+	}
 
+	git_commit_cache_lock(&walk->repo->commits);
+	if ((cached = git_commit_cache_get(&walk->repo->commits, &commit->oid)) != NULL)
+		error = commit_cached_parse(walk, commit, cached);
+	git_commit_cache_unlock(&walk->repo->commits);
+
+	if (cached != NULL)
+		return error;
+
+	commit_prefetch(walk, commit);
 	if (commit->parsed)
 		return 0;
 
-	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
+	/* the commit is kept above, so there is no use for the raw one */
+	if ((error = git_odb__read_nocache(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 	assert(obj->raw.type == GIT_OBJ_COMMIT);
 
 	error = commit_quick_parse(walk, commit, &obj->raw);
 	git_odb_object_free(obj);
+
+	if (!error)
+		commit_cache_store(walk, commit);
+
 	return error;
 }
 
-static int interesting(git_pqueue *list)
+/*
+ * The queue of the merge base walk holds each commit at most once, and
+ * counts the commits in it that are not STALE yet: the walk is over when
+ * there are none left, and knowing that should not take a scan of the
+ * whole queue after every step. Of those, it also counts the ones that
+ * only one side has reached.
+ */
+typedef struct {
+	git_pqueue queue;
+	size_t nonstale;
+	size_t one_side[2];
+} merge_queue;
+
+static void merge_queue_count(merge_queue *q, commit_object *commit, bool add)
+{
+	int flags = commit->flags & (PARENT1 | PARENT2 | STALE);
+	size_t *side = NULL;
+
+	if (flags & STALE)
+		return;
+
+	if (flags == PARENT1)
+		side = &q->one_side[0];
+	else if (flags == PARENT2)
+		side = &q->one_side[1];
+
+	if (add) {
+		q->nonstale++;
+		if (side)
+			(*side)++;
+	} else {
+		q->nonstale--;
+		if (side)
+			(*side)--;
+	}
+}
+
+static int merge_queue_push(merge_queue *q, commit_object *commit, int flags)
 {
-	unsigned int i;
-	/* element 0 isn't used - we need to start at 1 */
-	for (i = 1; i < list->size; i++) {
-		commit_object *commit = list->d[i];
-		if ((commit->flags & STALE) == 0)
-			return 1;
+	if (commit->queued) {
+		merge_queue_count(q, commit, false);
+		commit->flags |= flags;
+		merge_queue_count(q, commit, true);
+		return 0;
 	}
 
+	if (git_pqueue_insert(&q->queue, commit) < 0)
+		return -1;
+
+	commit->flags |= flags;
+	commit->queued = 1;
+	merge_queue_count(q, commit, true);
+
 	return 0;
 }
 
+static commit_object *merge_queue_pop(merge_queue *q)
+{
+	commit_object *commit = git_pqueue_pop(&q->queue);
+
+	commit->queued = 0;
+	merge_queue_count(q, commit, false);
+
+	return commit;
+}
+
+/*
+ * Whether no more merge bases can come out of the queue.
+ *
+ * A commit only gets both PARENT1 and PARENT2 without being STALE from
+ * commits that are not STALE either, so once those in the queue all
+ * come from the same side, what is left to find are the STALE marks
+ * for the merge bases already found. When commits come out of the
+ * queue by generation, no commit below can reach them, so they are
+ * final and the walk can stop there, however much history there is
+ * left under that side. Commits outside of the commit-graph have no
+ * generation and are all walked by time first, like before.
+ */
+static int merge_queue_done(merge_queue *q)
+{
+	commit_object *top;
+
+	if (q->nonstale == 0)
+		return 1;
+
+	if (q->one_side[0] != q->nonstale && q->one_side[1] != q->nonstale)
+		return 0;
+
+	top = git_pqueue_peek(&q->queue);
+	return top->generation != GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+}
+
+static void merge_queue_free(merge_queue *q)
+{
+	commit_object *commit;
+
+	while ((commit = git_pqueue_pop(&q->queue)) != NULL)
+		commit->queued = 0;
+
+	git_pqueue_free(&q->queue);
+}
+
 static int merge_bases_many(commit_list **out, git_revwalk *walk, commit_object *one, git_vector *twos)
 {
-	int error;
+	int error = -1;
 	unsigned int i;
 	commit_object *two;
-	commit_list *result = NULL, *tmp = NULL;
-	git_pqueue list;
+	commit_list *result = NULL, *tmp, **tail;
+	merge_queue list;
+	git_pqueue bases;
 
 	/* if the commit is repeated, we have a our merge base already */
 	git_vector_foreach(twos, i, two) {
 		if (one == two)
-			return commit_list_insert(one, out) ? 0 : -1;
+			return commit_list_insert(walk, one, out) ? 0 : -1;
 	}
 
-	if (git_pqueue_init(&list, twos->length * 2, commit_time_cmp) < 0)
+	/*
+	 * Ordered by generation first, a commit comes out of the queue
+	 * after all of its descendants in there, so it is STALE by the
+	 * time it is looked at if it is ever going to be; without a
+	 * commit-graph all generations are the same and this is by time.
+	 */
+	if (git_pqueue_init(&list.queue, twos->length * 2, commit_generation_cmp) < 0)
 		return -1;
+	list.nonstale = list.one_side[0] = list.one_side[1] = 0;
 
-	if (commit_parse(walk, one) < 0)
-	    return -1;
-
-	one->flags |= PARENT1;
-	if (git_pqueue_insert(&list, one) < 0)
-		return -1;
+	if ((error = commit_parse(walk, one)) < 0 ||
+		(error = merge_queue_push(&list, one, PARENT1)) < 0)
+		goto cleanup;
 
 	git_vector_foreach(twos, i, two) {
-		commit_parse(walk, two);
-		two->flags |= PARENT2;
-		if (git_pqueue_insert(&list, two) < 0)
-			return -1;
+		if ((error = commit_parse(walk, two)) < 0 ||
+			(error = merge_queue_push(&list, two, PARENT2)) < 0)
+			goto cleanup;
 	}
 
-	/* as long as there are non-STALE commits */
-	while (interesting(&list)) {
+	/* as long as there are non-STALE commits that can still meet */
+	while (!merge_queue_done(&list)) {
 		commit_object *commit;
 		int flags;
 
-		commit = git_pqueue_pop(&list);
+		commit = merge_queue_pop(&list);
 
 		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->flags & RESULT)) {
 				commit->flags |= RESULT;
-				if (commit_list_insert(commit, &result) == NULL)
-					return -1;
+				if (commit_list_insert(walk, commit, &result) == NULL) {
+					error = -1;
+					goto cleanup;
+				}
 			}
 			/* we mark the parents of a merge stale */
 			flags |= STALE;
@@ -338,33 +662,43 @@ static int merge_bases_many(commit_list **out, git_revwalk *walk, commit_object
 			if ((p->flags & flags) == flags)
 				continue;
 
-			if ((error = commit_parse(walk, p)) < 0)
-				return error;
-
-			p->flags |= flags;
-			if (git_pqueue_insert(&list, p) < 0)
-				return -1;
+			if ((error = commit_parse(walk, p)) < 0 ||
+				(error = merge_queue_push(&list, p, flags)) < 0)
+				goto cleanup;
 		}
 	}
 
-	git_pqueue_free(&list);
+	merge_queue_free(&list);
 
-	/* filter out any stale commits in the results */
-	tmp = result;
-	result = NULL;
+	/* filter out any stale commits in the results, and sort the rest by date */
+	if (git_pqueue_init(&bases, 8, commit_time_cmp) < 0) {
+		commit_list_free(walk, &result);
+		return -1;
+	}
 
-	while (tmp) {
-		struct commit_list *next = tmp->next;
+	error = 0;
+	for (tmp = result; tmp != NULL && !error; tmp = tmp->next)
 		if (!(tmp->item->flags & STALE))
-			if (commit_list_insert_by_date(tmp->item, &result) == NULL)
-				return -1;
+			error = git_pqueue_insert(&bases, tmp->item);
 
-		git__free(tmp);
-		tmp = next;
-	}
+	commit_list_free(walk, &result);
 
-	*out = result;
-	return 0;
+	/* newest first */
+	for (tail = out; !error && (two = git_pqueue_pop(&bases)) != NULL; tail = &(*tail)->next)
+		if (commit_list_insert(walk, two, tail) == NULL)
+			error = -1;
+
+	git_pqueue_free(&bases);
+
+	if (error < 0)
+		commit_list_free(walk, out);
+
+	return error;
+
+cleanup:
+	merge_queue_free(&list);
+	commit_list_free(walk, &result);
+	return error;
 }
 
 int git_merge_base_many(git_oid *out, git_repository *repo, const git_oid input_array[], size_t length)
@@ -414,7 +748,7 @@ int git_merge_base_many(git_oid *out, git_repository *repo, const git_oid input_
 	error = 0;
 
 cleanup:
-	commit_list_free(&result);
+	commit_list_free(walk, &result);
 	git_revwalk_free(walk);
 	git_vector_free(&list);
 	return error;
@@ -455,7 +789,7 @@ int git_merge_base(git_oid *out, git_repository *repo, const git_oid *one, const
 	}
 
 	git_oid_cpy(out, &result->item->oid);
-	commit_list_free(&result);
+	commit_list_free(walk, &result);
 	git_revwalk_free(walk);
 
 	return 0;
@@ -465,88 +799,341 @@ on_error:
 	return -1;
 }
 
-static void mark_uninteresting(commit_object *commit)
-{
-	unsigned short i;
-	assert(commit);
+/*
+ * Ahead/behind counts of many pairs of commits.
+ *
+ * The pairs share one walker, so every commit is parsed at most once,
+ * and are walked GRAPH_BATCH at a time: each commit gets the set of
+ * local tips and the set of upstream tips of the batch it can be
+ * reached from, as two bitsets indexed by its `index`. A commit reached
+ * from only one side of a pair counts for that pair.
+ */
+#define GRAPH_BATCH 64
 
-	commit->uninteresting = 1;
+typedef struct {
+	uint64_t local;
+	uint64_t upstream;
+} graph_marks;
 
-	/* This means we've reached a merge base, so there's no need to walk any more */
-	if ((commit->flags & (RESULT | STALE)) == RESULT)
-		return;
+typedef struct {
+	git_revwalk *walk;
+	git_pqueue queue;
+	size_t nonfull;
 
-	for (i = 0; i < commit->out_degree; ++i)
-		if (!commit->parents[i]->uninteresting)
-			mark_uninteresting(commit->parents[i]);
+	graph_marks *marks;
+	size_t marks_alloc;
+	git_vector touched;
+
+	/* the bits of the pairs in the batch */
+	uint64_t all;
+} graph_batch;
+
+GIT_INLINE(int) graph_marks_full(graph_batch *b, const graph_marks *m)
+{
+	return (m->local & m->upstream) == b->all;
 }
 
-static int process_commit(git_revwalk *walk, commit_object *commit, int hide)
+static graph_marks *graph_marks_for(graph_batch *b, commit_object *commit)
 {
-	int error;
+	if (commit->index >= b->marks_alloc) {
+		size_t alloc = b->marks_alloc ? b->marks_alloc : 1024;
+		graph_marks *marks;
 
-	if (hide)
-		mark_uninteresting(commit);
+		while (alloc <= commit->index)
+			alloc *= 2;
 
-	if (commit->seen)
-		return 0;
+		marks = git__realloc(b->marks, alloc * sizeof(graph_marks));
+		if (marks == NULL)
+			return NULL;
 
-	commit->seen = 1;
+		memset(marks + b->marks_alloc, 0x0,
+			(alloc - b->marks_alloc) * sizeof(graph_marks));
 
-	if ((error = commit_parse(walk, commit)) < 0)
-		return error;
+		b->marks = marks;
+		b->marks_alloc = alloc;
+	}
 
-	return walk->enqueue(walk, commit);
+	return &b->marks[commit->index];
 }
 
-static int process_commit_parents(git_revwalk *walk, commit_object *commit)
+static int graph_mark(
+	graph_batch *b, commit_object *commit, uint64_t local, uint64_t upstream)
 {
-	unsigned short i;
-	int error = 0;
-
-	for (i = 0; i < commit->out_degree && !error; ++i)
-		error = process_commit(walk, commit->parents[i], commit->uninteresting);
+	graph_marks *m = graph_marks_for(b, commit);
+	int was_full;
 
-	return error;
-}
+	GITERR_CHECK_ALLOC(m);
 
-static int push_commit(git_revwalk *walk, const git_oid *oid, int uninteresting)
-{
-	git_object *obj;
-	git_otype type;
-	commit_object *commit;
+	if ((m->local | local) == m->local && (m->upstream | upstream) == m->upstream)
+		return 0;
 
-	if (git_object_lookup(&obj, walk->repo, oid, GIT_OBJ_ANY) < 0)
+	if (!m->local && !m->upstream && git_vector_insert(&b->touched, commit) < 0)
 		return -1;
 
-	type = git_object_type(obj);
-	git_object_free(obj);
+	was_full = graph_marks_full(b, m);
+	m->local |= local;
+	m->upstream |= upstream;
 
-	if (type != GIT_OBJ_COMMIT) {
-		giterr_set(GITERR_INVALID, "Object is no commit object");
-		return -1;
+	/* already queued, it will hand the new bits down */
+	if (commit->queued) {
+		if (!was_full && graph_marks_full(b, m))
+			b->nonfull--;
+		return 0;
 	}
 
-	commit = commit_lookup(walk, oid);
-	if (commit == NULL)
-		return -1; /* error already reported by failed lookup */
+	if (commit_parse(b->walk, commit) < 0 ||
+		git_pqueue_insert(&b->queue, commit) < 0)
+		return -1;
 
-	commit->uninteresting = uninteresting;
-	if (walk->one == NULL && !uninteresting) {
-		walk->one = commit;
-	} else {
-		if (git_vector_insert(&walk->twos, commit) < 0)
-			return -1;
-	}
+	commit->queued = 1;
+	if (!graph_marks_full(b, m))
+		b->nonfull++;
 
 	return 0;
 }
 
-int git_revwalk_push(git_revwalk *walk, const git_oid *oid)
+/*
+ * Whether the commits left in the queue can no longer change any count.
+ *
+ * Once every commit in the queue can be reached from every tip, so can
+ * everything under them, but that only holds if the commits which were
+ * already walked cannot get new marks anymore. Coming out of the queue
+ * by generation, no commit below can reach them; commits outside of
+ * the commit-graph are walked by time, and a commit with a skewed date
+ * may be walked before one of its descendants hands it new marks, which
+ * puts it back in the queue. Those are all above the commit-graph, so
+ * the walk only stops once they are all out of the queue.
+ */
+static int graph_batch_done(graph_batch *b)
 {
-	assert(walk && oid);
-	return push_commit(walk, oid, 0);
-}
+	commit_object *top;
+
+	if (b->nonfull > 0)
+		return 0;
+
+	top = git_pqueue_peek(&b->queue);
+	return !top || top->generation != GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+}
+
+static int graph_walk_batch(
+	graph_batch *b,
+	size_t *ahead, size_t *behind, git_oid *merge_bases,
+	const git_oid *locals, const git_oid *upstreams, size_t n)
+{
+	commit_object *commit;
+	uint64_t bases_found;
+	size_t i;
+	unsigned short p;
+	int error = 0;
+
+	b->all = (n == GRAPH_BATCH) ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1);
+	bases_found = merge_bases ? 0 : b->all;
+
+	for (i = 0; i < n && !error; ++i) {
+		uint64_t bit = (uint64_t)1 << i;
+
+		if ((commit = commit_lookup(b->walk, &locals[i])) == NULL ||
+			(error = graph_mark(b, commit, bit, 0)) < 0 ||
+			(commit = commit_lookup(b->walk, &upstreams[i])) == NULL ||
+			(error = graph_mark(b, commit, 0, bit)) < 0)
+			error = -1;
+	}
+
+	/*
+	 * Ordered by generation, the first commit to come out of the
+	 * queue that is reachable from both sides of a pair is one of
+	 * their merge bases.
+	 */
+	while (!error && (!graph_batch_done(b) ||
+		(bases_found != b->all && git_pqueue_size(&b->queue) > 0))) {
+		graph_marks m;
+		uint64_t bases;
+
+		commit = git_pqueue_pop(&b->queue);
+		commit->queued = 0;
+
+		/* a copy: marking the parents may move the marks around */
+		m = b->marks[commit->index];
+		if (!graph_marks_full(b, &m))
+			b->nonfull--;
+
+		bases = m.local & m.upstream & ~bases_found;
+		for (i = 0; bases; ++i, bases >>= 1)
+			if (bases & 1)
+				git_oid_cpy(&merge_bases[i], &commit->oid);
+		bases_found |= m.local & m.upstream;
+
+		for (p = 0; p < commit->out_degree && !error; ++p)
+			error = graph_mark(b, commit->parents[p], m.local, m.upstream);
+	}
+
+	while ((commit = git_pqueue_pop(&b->queue)) != NULL)
+		commit->queued = 0;
+
+	git_vector_foreach(&b->touched, i, commit) {
+		graph_marks *m = &b->marks[commit->index];
+		uint64_t only_local = m->local & ~m->upstream;
+		uint64_t only_upstream = m->upstream & ~m->local;
+		size_t bit;
+
+		for (bit = 0; only_local | only_upstream; ++bit) {
+			ahead[bit] += (size_t)(only_local & 1);
+			behind[bit] += (size_t)(only_upstream & 1);
+			only_local >>= 1;
+			only_upstream >>= 1;
+		}
+
+		memset(m, 0x0, sizeof(graph_marks));
+	}
+
+	git_vector_clear(&b->touched);
+	b->nonfull = 0;
+
+	return error;
+}
+
+int git_graph_ahead_behind_many(
+	size_t *ahead,
+	size_t *behind,
+	git_oid *merge_bases,
+	git_repository *repo,
+	const git_oid *locals,
+	const git_oid *upstreams,
+	size_t n)
+{
+	graph_batch b;
+	size_t i;
+	int error = -1;
+
+	assert(ahead && behind && repo && locals && upstreams);
+
+	memset(ahead, 0x0, n * sizeof(size_t));
+	memset(behind, 0x0, n * sizeof(size_t));
+	if (merge_bases)
+		memset(merge_bases, 0x0, n * sizeof(git_oid));
+
+	memset(&b, 0x0, sizeof(b));
+
+	if (git_revwalk_new(&b.walk, repo) < 0)
+		return -1;
+
+	if (git_pqueue_init(&b.queue, 64, commit_generation_cmp) < 0 ||
+		git_vector_init(&b.touched, 1024, NULL) < 0)
+		goto cleanup;
+
+	for (i = 0; i < n; i += GRAPH_BATCH) {
+		size_t batch = min(n - i, GRAPH_BATCH);
+
+		if (graph_walk_batch(&b, ahead + i, behind + i,
+				merge_bases ? merge_bases + i : NULL,
+				locals + i, upstreams + i, batch) < 0)
+			goto cleanup;
+	}
+
+	error = 0;
+
+cleanup:
+	git_pqueue_free(&b.queue);
+	git_vector_free(&b.touched);
+	git__free(b.marks);
+	git_revwalk_free(b.walk);
+	return error;
+}
+
+int git_graph_ahead_behind(
+	size_t *ahead,
+	size_t *behind,
+	git_repository *repo,
+	const git_oid *local,
+	const git_oid *upstream)
+{
+	return git_graph_ahead_behind_many(
+		ahead, behind, NULL, repo, local, upstream, 1);
+}
+
+static void mark_uninteresting(commit_object *commit)
+{
+	unsigned short i;
+	assert(commit);
+
+	commit->uninteresting = 1;
+
+	/* This means we've reached a merge base, so there's no need to walk any more */
+	if ((commit->flags & (RESULT | STALE)) == RESULT)
+		return;
+
+	for (i = 0; i < commit->out_degree; ++i)
+		if (!commit->parents[i]->uninteresting)
+			mark_uninteresting(commit->parents[i]);
+}
+
+static int process_commit(git_revwalk *walk, commit_object *commit, int hide)
+{
+	int error;
+
+	if (hide)
+		mark_uninteresting(commit);
+
+	if (commit->seen)
+		return 0;
+
+	commit->seen = 1;
+
+	if ((error = commit_parse(walk, commit)) < 0)
+		return error;
+
+	return walk->enqueue(walk, commit);
+}
+
+static int process_commit_parents(git_revwalk *walk, commit_object *commit)
+{
+	unsigned short i;
+	int error = 0;
+
+	for (i = 0; i < commit->out_degree && !error; ++i)
+		error = process_commit(walk, commit->parents[i], commit->uninteresting);
+
+	return error;
+}
+
+static int push_commit(git_revwalk *walk, const git_oid *oid, int uninteresting)
+{
+	git_otype type;
+	size_t len;
+	commit_object *commit;
+
+	/* the walk parses the commit itself */
+	if (git_odb_read_header(&len, &type, walk->odb, oid) < 0)
+		return -1;
+
+	if (type != GIT_OBJ_COMMIT) {
+		giterr_set(GITERR_INVALID, "Object is no commit object");
+		return -1;
+	}
+
+	commit = commit_lookup(walk, oid);
+	if (commit == NULL)
+		return -1; /* error already reported by failed lookup */
+
+	commit->uninteresting = uninteresting;
+	if (uninteresting)
+		walk->hiding = 1;
+
+	if (walk->one == NULL && !uninteresting) {
+		walk->one = commit;
+	} else {
+		if (git_vector_insert(&walk->twos, commit) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int git_revwalk_push(git_revwalk *walk, const git_oid *oid)
+{
+	assert(walk && oid);
+	return push_commit(walk, oid, 0);
+}
 
 
 int git_revwalk_hide(git_revwalk *walk, const git_oid *oid)
@@ -666,7 +1253,7 @@ static int revwalk_enqueue_timesort(git_revwalk *walk, commit_object *commit)
 
 static int revwalk_enqueue_unsorted(git_revwalk *walk, commit_object *commit)
 {
-	return commit_list_insert(commit, &walk->iterator_rand) ? 0 : -1;
+	return commit_list_insert(walk, commit, &walk->iterator_rand) ? 0 : -1;
 }
 
 static int revwalk_next_timesort(commit_object **object_out, git_revwalk *walk)
@@ -693,7 +1280,7 @@ static int revwalk_next_unsorted(commit_object **object_out, git_revwalk *walk)
 	int error;
 	commit_object *next;
 
-	while ((next = commit_list_pop(&walk->iterator_rand)) != NULL) {
+	while ((next = commit_list_pop(walk, &walk->iterator_rand)) != NULL) {
 		if ((error = process_commit_parents(walk, next)) < 0)
 			return error;
 
@@ -707,41 +1294,229 @@ static int revwalk_next_unsorted(commit_object **object_out, git_revwalk *walk)
 	return GIT_ITEROVER;
 }
 
-static int revwalk_next_toposort(commit_object **object_out, git_revwalk *walk)
+/*
+ * The incremental topological sort, as done by git: instead of reading
+ * the whole history up front, the walk only looks as deep as the
+ * generation numbers of the commits it is about to emit require.
+ *
+ * Three walks run at their own pace, each ordered by generation:
+ *
+ * - `topo_explore` parses commits and hands uninteresting flags down
+ *   to their parents;
+ * - `topo_indegree` counts, for every commit, its children in the walk
+ *   (`in_degree` is that count plus one, or 0 when not yet counted);
+ * - the output queue holds the commits whose children have all been
+ *   emitted, which are the ones with an `in_degree` of 1.
+ *
+ * A commit's children all have a larger generation, so once the two
+ * first walks have gone down to a commit's generation, its flags and
+ * its count are final.  Without a commit-graph every generation is
+ * infinite and the first commit still takes a full walk.
+ */
+static int topo_explore_to_depth(git_revwalk *walk, uint32_t generation)
 {
 	commit_object *next;
 	unsigned short i;
+	int error;
 
-	for (;;) {
-		next = commit_list_pop(&walk->iterator_topo);
-		if (next == NULL) {
-			giterr_clear();
-			return GIT_ITEROVER;
-		}
+	while ((next = git_pqueue_peek(&walk->topo_explore)) != NULL &&
+		next->generation >= generation) {
+		git_pqueue_pop(&walk->topo_explore);
 
-		if (next->in_degree > 0) {
-			next->topo_delay = 1;
-			continue;
+		for (i = 0; i < next->out_degree; ++i) {
+			commit_object *parent = next->parents[i];
+
+			if (next->uninteresting)
+				mark_uninteresting(parent);
+
+			if (parent->topo_explored)
+				continue;
+
+			if ((error = commit_parse(walk, parent)) < 0)
+				return error;
+
+			parent->topo_explored = 1;
+			if (git_pqueue_insert(&walk->topo_explore, parent) < 0)
+				return -1;
 		}
+	}
+
+	return 0;
+}
+
+static int topo_indegree_to_depth(git_revwalk *walk, uint32_t generation)
+{
+	commit_object *next;
+	unsigned short i;
+	int error;
+
+	while ((next = git_pqueue_peek(&walk->topo_indegree)) != NULL &&
+		next->generation >= generation) {
+		git_pqueue_pop(&walk->topo_indegree);
+
+		/* this parses the parents */
+		if ((error = topo_explore_to_depth(walk, next->generation)) < 0)
+			return error;
 
 		for (i = 0; i < next->out_degree; ++i) {
 			commit_object *parent = next->parents[i];
 
-			if (--parent->in_degree == 0 && parent->topo_delay) {
-				parent->topo_delay = 0;
-				if (commit_list_insert(parent, &walk->iterator_topo) == NULL)
-					return -1;
+			if (parent->in_degree > 0) {
+				parent->in_degree++;
+				continue;
 			}
+
+			parent->in_degree = 2;
+			if (git_pqueue_insert(&walk->topo_indegree, parent) < 0)
+				return -1;
 		}
+	}
+
+	return 0;
+}
+
+static int topo_enqueue(git_revwalk *walk, commit_object *commit)
+{
+	if (walk->sorting & GIT_SORT_TIME)
+		return git_pqueue_insert(&walk->iterator_time, commit);
+
+	return commit_list_insert(walk, commit, &walk->iterator_topo) ? 0 : -1;
+}
+
+static int topo_add_start(git_revwalk *walk, commit_object *commit)
+{
+	int error;
 
-		*object_out = next;
+	/* the same commit may have been pushed twice */
+	if (commit->seen)
 		return 0;
+
+	commit->seen = 1;
+
+	if ((error = commit_parse(walk, commit)) < 0)
+		return error;
+
+	if (commit->uninteresting)
+		mark_uninteresting(commit);
+
+	if (!commit->topo_explored) {
+		commit->topo_explored = 1;
+		if (git_pqueue_insert(&walk->topo_explore, commit) < 0)
+			return -1;
+	}
+
+	commit->in_degree = 1;
+	if (git_pqueue_insert(&walk->topo_indegree, commit) < 0)
+		return -1;
+
+	if (commit->generation < walk->topo_min_generation)
+		walk->topo_min_generation = commit->generation;
+
+	return 0;
+}
+
+static int topo_enqueue_start(git_revwalk *walk, commit_object *commit)
+{
+	/* `seen` is only used to visit each starting commit once */
+	if (!commit->seen)
+		return 0;
+
+	commit->seen = 0;
+
+	if (commit->uninteresting || commit->in_degree != 1)
+		return 0;
+
+	return topo_enqueue(walk, commit);
+}
+
+static int prepare_topo_walk(git_revwalk *walk)
+{
+	unsigned int i;
+	commit_object *two;
+	int error;
+
+	walk->topo_min_generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+
+	if ((error = topo_add_start(walk, walk->one)) < 0)
+		return error;
+
+	git_vector_foreach(&walk->twos, i, two) {
+		if ((error = topo_add_start(walk, two)) < 0)
+			return error;
+	}
+
+	if ((error = topo_indegree_to_depth(walk, walk->topo_min_generation)) < 0)
+		return error;
+
+	if ((error = topo_enqueue_start(walk, walk->one)) < 0)
+		return error;
+
+	git_vector_foreach(&walk->twos, i, two) {
+		if ((error = topo_enqueue_start(walk, two)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int topo_expand(git_revwalk *walk, commit_object *commit)
+{
+	unsigned short i;
+	int error;
+
+	for (i = 0; i < commit->out_degree; ++i) {
+		commit_object *parent = commit->parents[i];
+
+		if (parent->uninteresting)
+			continue;
+
+		if (parent->generation < walk->topo_min_generation) {
+			walk->topo_min_generation = parent->generation;
+
+			error = topo_indegree_to_depth(walk, walk->topo_min_generation);
+			if (error < 0)
+				return error;
+		}
+
+		if (--parent->in_degree == 1 &&
+			(error = topo_enqueue(walk, parent)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int revwalk_next_toposort(commit_object **object_out, git_revwalk *walk)
+{
+	commit_object *next;
+	int error;
+
+	for (;;) {
+		if (walk->sorting & GIT_SORT_TIME)
+			next = git_pqueue_pop(&walk->iterator_time);
+		else
+			next = commit_list_pop(walk, &walk->iterator_topo);
+
+		if (next == NULL) {
+			giterr_clear();
+			return GIT_ITEROVER;
+		}
+
+		next->in_degree = 0;
+
+		if ((error = topo_expand(walk, next)) < 0)
+			return error;
+
+		if (!next->uninteresting) {
+			*object_out = next;
+			return 0;
+		}
 	}
 }
 
 static int revwalk_next_reverse(commit_object **object_out, git_revwalk *walk)
 {
-	*object_out = commit_list_pop(&walk->iterator_reverse);
+	*object_out = commit_list_pop(walk, &walk->iterator_reverse);
 	return *object_out ? 0 : GIT_ITEROVER;
 }
 
@@ -762,42 +1537,37 @@ static int prepare_walk(git_revwalk *walk)
 		return GIT_ITEROVER;
 	}
 
-	/* first figure out what the merge bases are */
-	if (merge_bases_many(&bases, walk, walk->one, &walk->twos) < 0)
-		return -1;
-
-	commit_list_free(&bases);
-	if (process_commit(walk, walk->one, walk->one->uninteresting) < 0)
-		return -1;
-
-	git_vector_foreach(&walk->twos, i, two) {
-		if (process_commit(walk, two, two->uninteresting) < 0)
+	/*
+	 * First figure out what the merge bases are; they are only used
+	 * to stop marking commits as uninteresting, so without any hidden
+	 * commits there is no need to walk down to them.
+	 */
+	if (walk->hiding) {
+		if (merge_bases_many(&bases, walk, walk->one, &walk->twos) < 0)
 			return -1;
+
+		commit_list_free(walk, &bases);
 	}
 
 	if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
-		unsigned short i;
+		if ((error = prepare_topo_walk(walk)) < 0)
+			return error;
 
-		while ((error = walk->get_next(&next, walk)) == 0) {
-			for (i = 0; i < next->out_degree; ++i) {
-				commit_object *parent = next->parents[i];
-				parent->in_degree++;
-			}
+		walk->get_next = &revwalk_next_toposort;
+	} else {
+		if (process_commit(walk, walk->one, walk->one->uninteresting) < 0)
+			return -1;
 
-			if (commit_list_insert(next, &walk->iterator_topo) == NULL)
+		git_vector_foreach(&walk->twos, i, two) {
+			if (process_commit(walk, two, two->uninteresting) < 0)
 				return -1;
 		}
-
-		if (error != GIT_ITEROVER)
-			return error;
-
-		walk->get_next = &revwalk_next_toposort;
 	}
 
 	if (walk->sorting & GIT_SORT_REVERSE) {
 
 		while ((error = walk->get_next(&next, walk)) == 0)
-			if (commit_list_insert(next, &walk->iterator_reverse) == NULL)
+			if (commit_list_insert(walk, next, &walk->iterator_reverse) == NULL)
 				return -1;
 
 		if (error != GIT_ITEROVER)
@@ -814,6 +1584,240 @@ static int prepare_walk(git_revwalk *walk)
 
 
 
+/*
+ * Path limiting.  A commit is returned when the paths differ between
+ * its tree and the tree of each of its parents; when one parent has
+ * the same content, the change was made there instead.
+ *
+ * Trees are compared by id along each path, so only the trees leading
+ * to it are read, and only as deep as the two sides differ.  Before
+ * reading any, the changed-path Bloom filter of the commit, if the
+ * commit-graph has one, rules out most commits that are the same as
+ * their first parent.
+ */
+static int path_differs(
+	git_revwalk *walk,
+	const git_oid *a, const git_oid *b, const revwalk_path *path)
+{
+	const char *name = path->components;
+	git_oid ids[2];
+	unsigned int modes[2] = { 0, 0 };
+	int present[2];
+	size_t depth, side;
+
+	present[0] = (a != NULL);
+	present[1] = (b != NULL);
+	if (a)
+		git_oid_cpy(&ids[0], a);
+	if (b)
+		git_oid_cpy(&ids[1], b);
+
+	for (depth = 0; ; ++depth) {
+		if (!present[0] && !present[1])
+			return 0;
+
+		if (present[0] && present[1] && modes[0] == modes[1] &&
+			git_oid_cmp(&ids[0], &ids[1]) == 0)
+			return 0;
+
+		if (depth == path->num_components)
+			return 1;
+
+		for (side = 0; side < 2; ++side) {
+			const git_tree_entry *entry;
+			git_tree *tree;
+
+			if (!present[side])
+				continue;
+
+			/* nothing lives below a file */
+			if (depth > 0 && modes[side] != GIT_FILEMODE_TREE) {
+				present[side] = 0;
+				continue;
+			}
+
+			if (git_tree_lookup(&tree, walk->repo, &ids[side]) < 0)
+				return -1;
+
+			if ((entry = git_tree_entry_byname(tree, name)) != NULL) {
+				git_oid_cpy(&ids[side], git_tree_entry_id(entry));
+				modes[side] = git_tree_entry_filemode(entry);
+			} else
+				present[side] = 0;
+
+			git_tree_free(tree);
+		}
+
+		name += strlen(name) + 1;
+	}
+}
+
+static int paths_differ(git_revwalk *walk, const git_oid *a, const git_oid *b)
+{
+	revwalk_path *path;
+	unsigned int i;
+	int error;
+
+	git_vector_foreach(&walk->paths, i, path) {
+		if ((error = path_differs(walk, a, b, path)) != 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int bloom_may_differ(git_revwalk *walk, commit_object *commit)
+{
+	git_bloom_filter filter;
+	revwalk_path *path;
+	unsigned int i;
+	size_t j;
+
+	if (walk->graph == NULL ||
+		git_commit_graph_bloom_find(&filter, walk->graph, &commit->oid) < 0) {
+		giterr_clear();
+		return 1;
+	}
+
+	git_vector_foreach(&walk->paths, i, path) {
+		if (!path->ascii && walk->graph->bloom_version < GIT_BLOOM_VERSION)
+			return 1;
+
+		/* the leading directories are in the filter too */
+		for (j = 0; j < path->num_components; ++j)
+			if (!git_bloom_filter_contains(&filter, &path->keys[j]))
+				break;
+
+		if (j == path->num_components)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int commit_changes_paths(git_revwalk *walk, commit_object *commit)
+{
+	unsigned short i;
+	int error;
+
+	if (commit->out_degree == 0)
+		return paths_differ(walk, &commit->tree, NULL);
+
+	/* the filter is against the first parent */
+	if (!bloom_may_differ(walk, commit))
+		return 0;
+
+	for (i = 0; i < commit->out_degree; ++i) {
+		commit_object *parent = commit->parents[i];
+
+		if ((error = commit_parse(walk, parent)) < 0 ||
+			(error = paths_differ(walk, &commit->tree, &parent->tree)) <= 0)
+			return error;
+	}
+
+	return 1;
+}
+
+static int revwalk_add_path(git_revwalk *walk, const char *path)
+{
+	revwalk_path *p;
+	size_t len, i, start = 0, n = 1;
+
+	while (*path == '/')
+		path++;
+
+	len = strlen(path);
+	while (len > 0 && path[len - 1] == '/')
+		len--;
+
+	for (i = 0; i < len; ++i)
+		if (path[i] == '/')
+			n++;
+
+	p = git__calloc(1, sizeof(revwalk_path));
+	GITERR_CHECK_ALLOC(p);
+
+	p->components = git__strndup(path, len);
+	p->keys = git__calloc(n, sizeof(git_bloom_key));
+	p->ascii = 1;
+
+	if (p->components == NULL || p->keys == NULL ||
+		git_vector_insert(&walk->paths, p) < 0) {
+		git__free(p->components);
+		git__free(p->keys);
+		git__free(p);
+		return -1;
+	}
+
+	for (i = 0; i <= len; ++i) {
+		if (i < len && path[i] != '/') {
+			if ((unsigned char)path[i] >= 0x80)
+				p->ascii = 0;
+			continue;
+		}
+
+		if (i == start ||
+			(i - start == 1 && path[start] == '.') ||
+			(i - start == 2 && path[start] == '.' && path[start + 1] == '.')) {
+			giterr_set(GITERR_INVALID, "Invalid path '%s' to limit the walk", path);
+			return -1;
+		}
+
+		git_bloom_key_init(&p->keys[p->num_components++], path, i);
+		p->components[i] = '\0';
+		start = i + 1;
+	}
+
+	return 0;
+}
+
+static void revwalk_free_paths(git_revwalk *walk)
+{
+	revwalk_path *p;
+	unsigned int i;
+
+	git_vector_foreach(&walk->paths, i, p) {
+		git__free(p->components);
+		git__free(p->keys);
+		git__free(p);
+	}
+
+	git_vector_clear(&walk->paths);
+}
+
+int git_revwalk_set_paths(git_revwalk *walk, const git_strarray *paths)
+{
+	size_t i;
+
+	assert(walk);
+
+	if (walk->walking)
+		git_revwalk_reset(walk);
+
+	revwalk_free_paths(walk);
+
+	for (i = 0; paths != NULL && i < paths->count; ++i) {
+		if (revwalk_add_path(walk, paths->strings[i]) < 0) {
+			revwalk_free_paths(walk);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int revwalk_open_graph(git_revwalk *walk)
+{
+	if (walk->repo->path_repository == NULL)
+		return 0;
+
+	/* a missing or unreadable commit-graph only makes walks slower */
+	if (git_repository__commit_graph(&walk->graph, walk->repo) < 0)
+		giterr_clear();
+
+	return 0;
+}
+
 int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 {
 	git_revwalk *walk;
@@ -823,13 +1827,20 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 
 	memset(walk, 0x0, sizeof(git_revwalk));
 
-	walk->commits = git_oidmap_alloc();
-	GITERR_CHECK_ALLOC(walk->commits);
+	if (git_oidtable_new(&walk->commits, 0) < 0) {
+		git__free(walk);
+		return -1;
+	}
 
 	if (git_pqueue_init(&walk->iterator_time, 8, commit_time_cmp) < 0 ||
+		git_pqueue_init(&walk->topo_explore, 8, commit_generation_cmp) < 0 ||
+		git_pqueue_init(&walk->topo_indegree, 8, commit_generation_cmp) < 0 ||
 		git_vector_init(&walk->twos, 4, NULL) < 0 ||
+		git_vector_init(&walk->paths, 0, NULL) < 0 ||
+		git_vector_init(&walk->prefetch, 64, NULL) < 0 ||
 		git_pool_init(&walk->commit_pool, 1,
-			git_pool__suggest_items_per_page(COMMIT_ALLOC) * COMMIT_ALLOC) < 0)
+			git_pool__suggest_items_per_page(COMMIT_ALLOC) * COMMIT_ALLOC) < 0 ||
+		git_pool_init(&walk->list_pool, sizeof(commit_list), 0) < 0)
 		return -1;
 
 	walk->get_next = &revwalk_next_unsorted;
@@ -837,7 +1848,8 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 
 	walk->repo = repo;
 
-	if (git_repository_odb(&walk->odb, repo) < 0) {
+	if (git_repository_odb(&walk->odb, repo) < 0 ||
+		revwalk_open_graph(walk) < 0) {
 		git_revwalk_free(walk);
 		return -1;
 	}
@@ -854,10 +1866,17 @@ void git_revwalk_free(git_revwalk *walk)
 	git_revwalk_reset(walk);
 	git_odb_free(walk->odb);
 
-	git_oidmap_free(walk->commits);
+	git_oidtable_free(walk->commits);
 	git_pool_clear(&walk->commit_pool);
+	git_pool_clear(&walk->list_pool);
 	git_pqueue_free(&walk->iterator_time);
+	git_pqueue_free(&walk->topo_explore);
+	git_pqueue_free(&walk->topo_indegree);
 	git_vector_free(&walk->twos);
+	revwalk_free_paths(walk);
+	git_vector_free(&walk->paths);
+	git_vector_free(&walk->prefetch);
+	git_repository__commit_graph_release(walk->repo, walk->graph);
 	git__free(walk);
 }
 
@@ -897,7 +1916,13 @@ int git_revwalk_next(git_oid *oid, git_revwalk *walk)
 			return error;
 	}
 
-	error = walk->get_next(&next, walk);
+	while ((error = walk->get_next(&next, walk)) == 0 && walk->paths.length > 0) {
+		if ((error = commit_changes_paths(walk, next)) != 0)
+			break;
+	}
+
+	if (error > 0)
+		error = 0;
 
 	if (error == GIT_ITEROVER) {
 		git_revwalk_reset(walk);
@@ -917,20 +1942,28 @@ void git_revwalk_reset(git_revwalk *walk)
 
 	assert(walk);
 
-	kh_foreach_value(walk->commits, commit, {
+	git_oidtable_foreach_value(walk->commits, commit, {
 		commit->seen = 0;
 		commit->in_degree = 0;
-		commit->topo_delay = 0;
+		commit->topo_explored = 0;
 		commit->uninteresting = 0;
 		});
 
 	git_pqueue_clear(&walk->iterator_time);
-	commit_list_free(&walk->iterator_topo);
-	commit_list_free(&walk->iterator_rand);
-	commit_list_free(&walk->iterator_reverse);
+	git_pqueue_clear(&walk->topo_explore);
+	git_pqueue_clear(&walk->topo_indegree);
+	commit_list_free(walk, &walk->iterator_topo);
+	commit_list_free(walk, &walk->iterator_rand);
+	commit_list_free(walk, &walk->iterator_reverse);
 	walk->walking = 0;
+	walk->hiding = 0;
+
+	/* prepare_walk() swaps the iterator of reversed walks for the list */
+	walk->get_next = (walk->sorting & GIT_SORT_TIME) ?
+		&revwalk_next_timesort : &revwalk_next_unsorted;
 
 	walk->one = NULL;
 	git_vector_clear(&walk->twos);
+	git_vector_clear(&walk->prefetch);
 }
 
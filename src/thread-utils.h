@@ -68,6 +68,19 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 #endif
 }
 
+/* Stores `newval` if `*ptr` is still `oldval`; returns what was there */
+GIT_INLINE(void *) git__compare_and_swap(
+	void * volatile *ptr, void *oldval, void *newval)
+{
+#if defined(GIT_WIN32)
+	return InterlockedCompareExchangePointer((volatile PVOID *)ptr, newval, oldval);
+#elif defined(__GNUC__)
+	return __sync_val_compare_and_swap(ptr, oldval, newval);
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
 #else
 
 #define git_thread unsigned int
@@ -101,6 +114,15 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 	return --a->val;
 }
 
+GIT_INLINE(void *) git__compare_and_swap(
+	void * volatile *ptr, void *oldval, void *newval)
+{
+	void *found = *ptr;
+	if (found == oldval)
+		*ptr = newval;
+	return found;
+}
+
 #endif
 
 extern int git_online_cpus(void);
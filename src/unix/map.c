@@ -54,5 +54,24 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	assert(map != NULL);
+
+#ifdef MADV_RANDOM
+	/* a refused hint changes nothing about the mapping */
+	if (advice == GIT_MADV_RANDOM)
+		madvise(map->data, map->len, MADV_RANDOM);
+	else if (advice == GIT_MADV_SEQUENTIAL)
+		madvise(map->data, map->len, MADV_SEQUENTIAL);
+	else
+		madvise(map->data, map->len, MADV_NORMAL);
+#else
+	GIT_UNUSED(advice);
+#endif
+
+	return 0;
+}
+
 #endif
 
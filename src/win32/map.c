@@ -112,4 +112,11 @@ int p_munmap(git_map *map)
 	return error;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
 
+	/* the memory manager does its own read-ahead */
+	return 0;
+}
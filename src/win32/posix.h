@@ -43,6 +43,7 @@ extern int p_chmod(const char* path, mode_t mode);
 extern int p_rmdir(const char* path);
 extern int p_access(const char* path, mode_t mode);
 extern int p_fsync(int fd);
+extern int p_ftruncate(int fd, git_off_t size);
 extern int p_open(const char *path, int flags, ...);
 extern int p_creat(const char *path, mode_t mode);
 extern int p_getcwd(char *buffer_out, size_t size);
@@ -45,6 +45,22 @@ int p_fsync(int fd)
 	return 0;
 }
 
+int p_ftruncate(int fd, git_off_t size)
+{
+#ifdef _MSC_VER
+	errno_t error = _chsize_s(fd, size);
+
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+#else
+	return ftruncate64(fd, size);
+#endif
+}
+
 GIT_INLINE(time_t) filetime_to_time_t(const FILETIME *ft)
 {
 	long long winTime = ((long long)ft->dwHighDateTime << 32) + ft->dwLowDateTime;
@@ -0,0 +1,79 @@
+#include "clar_libgit2.h"
+#include "oidtable.h"
+
+#define NOIDS 5000
+
+static git_oid *make_oids(size_t n)
+{
+	git_oid *oids = git__calloc(n, sizeof(git_oid));
+	size_t i;
+
+	cl_assert(oids != NULL);
+
+	for (i = 0; i < n; ++i)
+		cl_git_pass(git_odb_hash(&oids[i], &i, sizeof(i), GIT_OBJ_BLOB));
+
+	return oids;
+}
+
+void test_core_oidtable__0(void)
+{
+	git_oidtable *table;
+	git_oid *oids = make_oids(NOIDS);
+	size_t i, count = 0;
+	void *value;
+
+	cl_git_pass(git_oidtable_new(&table, 0));
+	cl_assert_equal_i(0, git_oidtable_size(table));
+
+	/* grows from its smallest size */
+	for (i = 0; i < NOIDS; ++i)
+		cl_git_pass(git_oidtable_put(table, &oids[i], &oids[i]));
+	cl_assert_equal_i(NOIDS, git_oidtable_size(table));
+
+	for (i = 0; i < NOIDS; ++i)
+		cl_assert(git_oidtable_get(table, &oids[i]) == &oids[i]);
+
+	git_oidtable_foreach_value(table, value, {
+		cl_assert(value >= (void *)oids && value < (void *)(oids + NOIDS));
+		count++;
+	});
+	cl_assert_equal_i(NOIDS, count);
+
+	git_oidtable_free(table);
+	git__free(oids);
+}
+
+void test_core_oidtable__1(void)
+{
+	git_oidtable *table;
+	git_oid *oids = make_oids(NOIDS), other;
+	size_t i;
+
+	/* sized up front, and only half of it filled */
+	cl_git_pass(git_oidtable_new(&table, NOIDS));
+	for (i = 0; i < NOIDS; i += 2)
+		cl_git_pass(git_oidtable_put(table, &oids[i], &oids[i]));
+
+	for (i = 0; i < NOIDS; ++i)
+		cl_assert(git_oidtable_get(table, &oids[i]) == (i % 2 ? NULL : &oids[i]));
+
+	/* the same first 8 bytes are not the same id */
+	git_oid_cpy(&other, &oids[0]);
+	other.id[GIT_OID_RAWSZ - 1] ^= 1;
+	cl_assert(git_oidtable_get(table, &other) == NULL);
+
+	/* a second put replaces the value */
+	cl_git_pass(git_oidtable_put(table, &other, &other));
+	cl_git_pass(git_oidtable_put(table, &oids[0], &oids[1]));
+	cl_assert(git_oidtable_get(table, &oids[0]) == &oids[1]);
+	cl_assert(git_oidtable_get(table, &other) == &other);
+	cl_assert_equal_i(NOIDS / 2 + 1, git_oidtable_size(table));
+
+	git_oidtable_clear(table);
+	cl_assert_equal_i(0, git_oidtable_size(table));
+	cl_assert(git_oidtable_get(table, &oids[0]) == NULL);
+
+	git_oidtable_free(table);
+	git__free(oids);
+}
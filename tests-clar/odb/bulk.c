@@ -0,0 +1,112 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "posix.h"
+#include "fileops.h"
+
+static git_odb *_odb;
+
+void test_odb_bulk__initialize(void)
+{
+	cl_must_pass(p_mkdir("test-objects", GIT_OBJECT_DIR_MODE));
+	cl_git_pass(git_odb_open(&_odb, "test-objects"));
+}
+
+void test_odb_bulk__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_fixture_cleanup("test-objects");
+}
+
+static void write_blob(git_oid *id, int n)
+{
+	char data[32];
+
+	p_snprintf(data, sizeof(data), "blob number %d\n", n);
+	cl_git_pass(git_odb_write(id, _odb, data, strlen(data), GIT_OBJ_BLOB));
+}
+
+static int exists_elsewhere(const git_oid *id)
+{
+	git_odb *other;
+	int exists;
+
+	cl_git_pass(git_odb_open(&other, "test-objects"));
+	exists = git_odb_exists(other, id);
+	git_odb_free(other);
+
+	return exists;
+}
+
+void test_odb_bulk__objects_appear_on_commit(void)
+{
+	git_oid ids[600], streamed;
+	git_odb_stream *stream;
+	git_odb_object *obj;
+	int i;
+
+	/* some fanout directories already exist, others don't */
+	for (i = 0; i < 300; ++i)
+		write_blob(&ids[i], i);
+
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	cl_git_fail(git_odb_bulk_begin(_odb));
+
+	for (i = 300; i < 600; ++i)
+		write_blob(&ids[i], i);
+
+	cl_git_pass(git_odb_open_wstream(&stream, _odb, 6, GIT_OBJ_BLOB));
+	cl_git_pass(stream->write(stream, "hello\n", 6));
+	cl_git_pass(stream->finalize_write(&streamed, stream));
+	stream->free(stream);
+
+	/* readable through this ODB, but nowhere else */
+	cl_assert(git_odb_exists(_odb, &ids[400]));
+	cl_assert(git_odb_exists(_odb, &streamed));
+	cl_assert(!exists_elsewhere(&ids[400]));
+	cl_assert(!exists_elsewhere(&streamed));
+	cl_assert(exists_elsewhere(&ids[0]));
+
+	cl_git_pass(git_odb_read_prefix(&obj, _odb, &ids[400], 12));
+	cl_assert_equal_s("blob number 400\n", (const char *)git_odb_object_data(obj));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_odb_bulk_commit(_odb));
+	cl_assert(!git_path_exists("test-objects/tmp_bulk_0"));
+
+	/* retrying, as after another backend failed, is harmless */
+	cl_git_pass(git_odb_bulk_commit(_odb));
+
+	for (i = 0; i < 600; ++i)
+		cl_assert(exists_elsewhere(&ids[i]));
+	cl_assert(exists_elsewhere(&streamed));
+
+	cl_git_pass(git_odb_read(&obj, _odb, &ids[599]));
+	cl_assert_equal_s("blob number 599\n", (const char *)git_odb_object_data(obj));
+	git_odb_object_free(obj);
+}
+
+void test_odb_bulk__rollback(void)
+{
+	git_oid id, existing;
+
+	write_blob(&existing, 0);
+
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	write_blob(&id, 1);
+	/* already there; not staged again */
+	write_blob(&existing, 0);
+	cl_assert(git_odb_exists(_odb, &id));
+	git_odb_bulk_rollback(_odb);
+
+	cl_assert(!git_odb_exists(_odb, &id));
+	cl_assert(git_odb_exists(_odb, &existing));
+	cl_assert(!git_path_exists("test-objects/tmp_bulk_0"));
+
+	/* and we can start over */
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	write_blob(&id, 1);
+	cl_git_pass(git_odb_bulk_commit(_odb));
+	cl_assert(exists_elsewhere(&id));
+}
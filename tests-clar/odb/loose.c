@@ -82,3 +82,81 @@ void test_odb_loose__simple_reads(void)
 	test_read_object(&two);
 	test_read_object(&some);
 }
+
+void test_odb_loose__objects_written_behind_our_back(void)
+{
+	object_data other = one;
+	git_odb_object *obj;
+	git_odb *odb;
+	git_oid id, other_id, prefix;
+
+	write_object_files(&one);
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+
+	cl_git_pass(git_oid_fromstr(&id, one.id));
+	cl_git_pass(git_oid_fromstr(&other_id, "8b137891791fe96927ad78e64b0aad7bded08baa"));
+
+	/* lists the directory */
+	cl_assert(git_odb_exists(odb, &id));
+	cl_assert(!git_odb_exists(odb, &other_id));
+
+	cl_git_pass(git_oid_fromstrn(&prefix, one.id, 7));
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &prefix, 7));
+	cl_assert(git_oid_cmp(&id, git_odb_object_id(obj)) == 0);
+	git_odb_object_free(obj);
+
+	/* another process adds an object to the same directory */
+	other.file = "test-objects/8b/137891791fe96927ad78e64b0aad7bded08baa";
+	write_object_files(&other);
+
+	cl_assert(git_odb_exists(odb, &other_id));
+	cl_assert(git_odb_exists(odb, &id));
+
+	cl_assert_equal_i(GIT_EAMBIGUOUS, git_odb_read_prefix(&obj, odb, &prefix, 7));
+
+	cl_git_pass(git_oid_fromstrn(&prefix, one.id, 39));
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &prefix, 39));
+	cl_assert(git_oid_cmp(&id, git_odb_object_id(obj)) == 0);
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+}
+
+void test_odb_loose__objects_removed_behind_our_back(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	write_object_files(&one);
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+
+	cl_git_pass(git_oid_fromstr(&id, one.id));
+	cl_assert(git_odb_exists(odb, &id));
+
+	/* another process prunes it */
+	cl_must_pass(p_unlink(one.file));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+}
+
+void test_odb_loose__write_then_lookup(void)
+{
+	git_odb *odb;
+	git_oid id, written;
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+
+	cl_git_pass(git_oid_fromstr(&id, one.id));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_git_pass(git_odb_write(&written, odb, one.data, one.dlen, GIT_OBJ_BLOB));
+	cl_assert(git_oid_cmp(&id, &written) == 0);
+
+	cl_assert(git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &id, 10));
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+}
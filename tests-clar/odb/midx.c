@@ -0,0 +1,198 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "odb.h"
+#include "pack.h"
+#include "midx.h"
+#include "pack_data.h"
+
+static git_repository *_repo;
+static git_buf _pack_dir;
+static git_buf _midx_path;
+static int nobj;
+
+void test_odb_midx__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&_pack_dir,
+		git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_buf_joinpath(&_midx_path,
+		git_buf_cstr(&_pack_dir), "multi-pack-index"));
+
+	cl_git_pass(git_midx_write(git_buf_cstr(&_pack_dir)));
+}
+
+void test_odb_midx__cleanup(void)
+{
+	git_buf_free(&_pack_dir);
+	git_buf_free(&_midx_path);
+	cl_git_sandbox_cleanup();
+}
+
+struct pack_check {
+	git_midx_file *midx;
+	const char *pack_idx_name;
+	int count;
+};
+
+static int check_entry_cb(const git_oid *oid, git_off_t offset, void *data)
+{
+	struct pack_check *c = data;
+	git_midx_entry e;
+	const char *name;
+
+	cl_git_pass(git_midx_entry_find(&e, c->midx, oid, GIT_OID_HEXSZ));
+	cl_assert(git_oid_cmp(oid, &e.sha1) == 0);
+
+	name = git_vector_get(&c->midx->packfile_names, e.pack_index);
+	cl_assert_equal_s(c->pack_idx_name, name);
+	cl_assert(e.offset == offset);
+
+	c->count++;
+	return 0;
+}
+
+void test_odb_midx__covers_every_pack(void)
+{
+	git_midx_file *midx;
+	struct pack_check c;
+	const char *name;
+	unsigned int i;
+	int total = 0;
+
+	cl_git_pass(git_midx_open(&midx, git_buf_cstr(&_midx_path)));
+	cl_assert_equal_i(3, midx->packfile_names.length);
+	cl_assert_equal_i(1640, midx->num_objects);
+
+	git_vector_foreach(&midx->packfile_names, i, name) {
+		struct git_pack_file *p;
+		git_buf idx_path = GIT_BUF_INIT;
+
+		cl_git_pass(git_buf_joinpath(&idx_path, git_buf_cstr(&_pack_dir), name));
+		cl_git_pass(git_packfile_check(&p, git_buf_cstr(&idx_path)));
+
+		c.midx = midx;
+		c.pack_idx_name = name;
+		c.count = 0;
+		cl_git_pass(git_pack_foreach_entry_offset(p, check_entry_cb, &c));
+		cl_assert_equal_i(p->num_objects, c.count);
+		total += c.count;
+
+		packfile_free(p);
+		git_buf_free(&idx_path);
+	}
+
+	cl_assert_equal_i(1640, total);
+	cl_assert(!git_midx_needs_refresh(midx, git_buf_cstr(&_midx_path)));
+
+	git_midx_free(midx);
+}
+
+void test_odb_midx__lookup_through_the_index(void)
+{
+	git_odb *odb;
+	unsigned int i;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_oid id, found;
+		git_odb_object *obj;
+
+		cl_git_pass(git_oid_fromstr(&id, packed_objects[i]));
+		cl_assert(git_odb_exists(odb, &id) == 1);
+		cl_git_pass(git_odb_read(&obj, odb, &id));
+		git_odb_object_free(obj);
+
+		cl_git_pass(git_oid_fromstrn(&found, packed_objects[i], 10));
+		cl_git_pass(git_odb_read_prefix(&obj, odb, &found, 10));
+		cl_assert(git_oid_cmp(&id, git_odb_object_id(obj)) == 0);
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+}
+
+void test_odb_midx__index_written_while_the_odb_is_open(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid short_id, missing;
+
+	cl_git_pass(p_unlink(git_buf_cstr(&_midx_path)));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+
+	/* found in its pack, which the lookups now try first */
+	cl_git_pass(git_oid_fromstrn(&short_id, packed_objects[0], 10));
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &short_id, 10));
+	git_odb_object_free(obj);
+
+	/* a miss makes the backend see the new index */
+	cl_git_pass(git_midx_write(git_buf_cstr(&_pack_dir)));
+	cl_git_pass(git_oid_fromstrn(&missing, "dead0000be", 10));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read_prefix(&obj, odb, &missing, 10));
+
+	/* and the pack is not counted twice */
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &short_id, 10));
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+}
+
+static int foreach_cb(git_oid *oid, void *data)
+{
+	GIT_UNUSED(data);
+	GIT_UNUSED(oid);
+
+	nobj++;
+
+	return 0;
+}
+
+void test_odb_midx__foreach(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+
+	/* load the packs and the multi-pack-index with a miss */
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_assert(git_odb_exists(odb, &id) == 0);
+
+	nobj = 0;
+	cl_git_pass(git_odb_foreach(odb, foreach_cb, NULL));
+	cl_assert_equal_i(46 + 1640, nobj);
+
+	git_odb_free(odb);
+}
+
+void test_odb_midx__corrupt_index_is_ignored(void)
+{
+	git_odb *odb;
+	git_midx_file *midx;
+	unsigned int i;
+
+	cl_must_pass(p_unlink(git_buf_cstr(&_midx_path)));
+	cl_git_mkfile(git_buf_cstr(&_midx_path), "MIDX but not really");
+
+	cl_git_fail(git_midx_open(&midx, git_buf_cstr(&_midx_path)));
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_oid id;
+
+		cl_git_pass(git_oid_fromstr(&id, packed_objects[i]));
+		cl_assert(git_odb_exists(odb, &id) == 1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(loose_objects); ++i) {
+		git_oid id;
+
+		cl_git_pass(git_oid_fromstr(&id, loose_objects[i]));
+		cl_assert(git_odb_exists(odb, &id) == 1);
+	}
+
+	git_odb_free(odb);
+}
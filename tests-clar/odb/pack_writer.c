@@ -0,0 +1,265 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "posix.h"
+#include "fileops.h"
+#include "hash.h"
+#include "git2/odb_backend.h"
+
+static git_odb *_odb;
+
+void test_odb_pack_writer__initialize(void)
+{
+	git_odb_backend *writer;
+
+	cl_must_pass(p_mkdir("test-objects", GIT_OBJECT_DIR_MODE));
+	cl_git_pass(git_odb_open(&_odb, "test-objects"));
+
+	cl_git_pass(git_odb_backend_pack_writer(&writer, "test-objects"));
+	cl_git_pass(git_odb_add_backend(_odb, writer, 3));
+}
+
+void test_odb_pack_writer__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_fixture_cleanup("test-objects");
+}
+
+static void write_blob(git_oid *id, int n)
+{
+	char data[64];
+
+	/* big enough for some of the sizes to take several header bytes */
+	p_snprintf(data, sizeof(data), "blob number %d\n%*s", n, n % 40, "");
+	cl_git_pass(git_odb_write(id, _odb, data, strlen(data), GIT_OBJ_BLOB));
+}
+
+static int count_files(void *data, git_buf *path)
+{
+	GIT_UNUSED(path);
+	(*(int *)data)++;
+	return 0;
+}
+
+static int files_in(const char *dir)
+{
+	git_buf path = GIT_BUF_INIT;
+	int n = 0;
+
+	cl_git_pass(git_buf_sets(&path, dir));
+	cl_git_pass(git_path_direach(&path, count_files, &n));
+	git_buf_free(&path);
+
+	return n;
+}
+
+static void check_blob(git_odb *odb, const git_oid *id, int n)
+{
+	git_odb_object *obj;
+	char data[64];
+
+	p_snprintf(data, sizeof(data), "blob number %d\n%*s", n, n % 40, "");
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_i(GIT_OBJ_BLOB, git_odb_object_type(obj));
+	cl_assert_equal_i(strlen(data), git_odb_object_size(obj));
+	cl_assert(memcmp(data, git_odb_object_data(obj), strlen(data)) == 0);
+	git_odb_object_free(obj);
+}
+
+void test_odb_pack_writer__objects_are_readable_before_and_after_a_flush(void)
+{
+	git_oid ids[200], streamed, short_id;
+	git_odb_stream *stream;
+	git_odb_object *obj;
+	git_odb *other;
+	size_t len;
+	git_otype type;
+	int i;
+
+	cl_git_pass(git_odb_bulk_begin(_odb));
+
+	for (i = 0; i < 200; ++i)
+		write_blob(&ids[i], i);
+
+	/* writing an object twice stores it once */
+	write_blob(&ids[0], 0);
+
+	cl_git_pass(git_odb_open_wstream(&stream, _odb, 6, GIT_OBJ_BLOB));
+	cl_git_pass(stream->write(stream, "hello\n", 6));
+	cl_git_pass(stream->finalize_write(&streamed, stream));
+	stream->free(stream);
+
+	/* a pack, but no index yet */
+	cl_assert_equal_i(1, files_in("test-objects/pack"));
+
+	for (i = 0; i < 200; ++i)
+		check_blob(_odb, &ids[i], i);
+
+	cl_git_pass(git_odb_read_header(&len, &type, _odb, &streamed));
+	cl_assert_equal_i(6, len);
+	cl_assert_equal_i(GIT_OBJ_BLOB, type);
+
+	git_oid_cpy(&short_id, &ids[7]);
+	memset(short_id.id + 4, 0x0, GIT_OID_RAWSZ - 4);
+	cl_git_pass(git_odb_read_prefix(&obj, _odb, &short_id, 8));
+	cl_assert(git_oid_cmp(&ids[7], git_odb_object_id(obj)) == 0);
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_odb_open(&other, "test-objects"));
+	cl_assert(!git_odb_exists(other, &ids[0]));
+
+	cl_git_pass(git_odb_bulk_commit(_odb));
+
+	/* one pack and its index */
+	cl_assert_equal_i(2, files_in("test-objects/pack"));
+
+	for (i = 0; i < 200; ++i)
+		check_blob(other, &ids[i], i);
+	cl_assert(git_odb_exists(other, &streamed));
+
+	git_odb_free(other);
+
+	/* still readable through the writer's database */
+	check_blob(_odb, &ids[199], 199);
+}
+
+void test_odb_pack_writer__rollback(void)
+{
+	git_oid id;
+
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	write_blob(&id, 1);
+	cl_assert(git_odb_exists(_odb, &id));
+
+	git_odb_bulk_rollback(_odb);
+
+	cl_assert(!git_odb_exists(_odb, &id));
+	cl_assert_equal_i(0, files_in("test-objects/pack"));
+
+	/* an empty writer leaves nothing behind when flushed */
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	cl_git_pass(git_odb_bulk_commit(_odb));
+	cl_assert_equal_i(0, files_in("test-objects/pack"));
+}
+
+void test_odb_pack_writer__rollback_keeps_earlier_writes(void)
+{
+	git_oid before, inside;
+
+	write_blob(&before, 3);
+
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	write_blob(&inside, 4);
+	git_odb_bulk_rollback(_odb);
+
+	cl_assert(!git_odb_exists(_odb, &inside));
+
+	git_odb_free(_odb);
+	cl_git_pass(git_odb_open(&_odb, "test-objects"));
+
+	cl_assert(!git_odb_exists(_odb, &inside));
+	check_blob(_odb, &before, 3);
+}
+
+void test_odb_pack_writer__freeing_flushes(void)
+{
+	git_oid id;
+
+	/* outside of a bulk write, too */
+	write_blob(&id, 42);
+
+	git_odb_free(_odb);
+	cl_git_pass(git_odb_open(&_odb, "test-objects"));
+
+	check_blob(_odb, &id, 42);
+}
+
+static const char *_find;
+
+static int find_file(void *data, git_buf *path)
+{
+	if (strstr(path->ptr, _find) != NULL)
+		cl_git_pass(git_buf_sets((git_buf *)data, path->ptr));
+	return 0;
+}
+
+/* the file of the pack directory whose name contains `part` */
+static void pack_file(git_buf *out, const char *part)
+{
+	git_buf dir = GIT_BUF_INIT;
+
+	_find = part;
+	git_buf_clear(out);
+
+	cl_git_pass(git_buf_sets(&dir, "test-objects/pack"));
+	cl_git_pass(git_path_direach(&dir, find_file, out));
+	cl_assert(out->size > 0);
+
+	git_buf_free(&dir);
+}
+
+/* scribbles over the pack being written, from `offset` on */
+static void scribble_pending(git_off_t offset, size_t len)
+{
+	git_buf pending = GIT_BUF_INIT;
+	char junk[256];
+	int fd;
+
+	pack_file(&pending, "tmp_pack_writer");
+
+	memset(junk, 'x', sizeof(junk));
+	cl_assert(len <= sizeof(junk));
+
+	cl_assert((fd = p_open(pending.ptr, O_WRONLY)) >= 0);
+	cl_assert(p_lseek(fd, offset, SEEK_SET) == offset);
+	cl_git_pass(p_write(fd, junk, len));
+	p_close(fd);
+
+	git_buf_free(&pending);
+}
+
+void test_odb_pack_writer__sealing_cuts_off_what_is_past_the_objects(void)
+{
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	git_oid id, trailer;
+
+	cl_git_pass(git_odb_bulk_begin(_odb));
+	write_blob(&id, 7);
+
+	/* what a failed append leaves behind */
+	scribble_pending(64 * 1024, 100);
+
+	cl_git_pass(git_odb_bulk_commit(_odb));
+
+	/* the pack ends with its trailer */
+	pack_file(&path, ".pack");
+	cl_git_pass(git_futils_readbuffer(&pack, path.ptr));
+	cl_assert(pack.size > GIT_OID_RAWSZ);
+	git_hash_buf(&trailer, pack.ptr, pack.size - GIT_OID_RAWSZ);
+	cl_assert(memcmp(trailer.id, pack.ptr + pack.size - GIT_OID_RAWSZ, GIT_OID_RAWSZ) == 0);
+
+	git_buf_free(&pack);
+	git_buf_free(&path);
+
+	git_odb_free(_odb);
+	cl_git_pass(git_odb_open(&_odb, "test-objects"));
+
+	check_blob(_odb, &id, 7);
+}
+
+void test_odb_pack_writer__a_failed_flush_on_free_leaves_nothing_behind(void)
+{
+	git_oid id;
+
+	write_blob(&id, 8);
+
+	/* the object can't be inflated anymore, so indexing it fails */
+	scribble_pending(14, 16);
+
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_assert_equal_i(0, files_in("test-objects/pack"));
+}
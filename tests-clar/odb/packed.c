@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "odb.h"
+#include "pack.h"
 #include "pack_data.h"
 
 static git_odb *_odb;
@@ -76,3 +77,84 @@ void test_odb_packed__read_header_1(void)
 	}
 }
 
+
+void test_odb_packed__read_prefix(void)
+{
+	unsigned int i, j;
+	git_oid id;
+	git_odb_object *obj;
+
+	/* enough lookups to switch every pack to its hot-path search */
+	for (j = 0; j < 2; ++j) {
+		for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+			git_oid short_id;
+			size_t len = 7 + (i % (GIT_OID_HEXSZ - 7));
+
+			cl_git_pass(git_oid_fromstr(&id, packed_objects[i]));
+			cl_git_pass(git_oid_fromstrn(&short_id, packed_objects[i], len));
+			cl_git_pass(git_odb_read_prefix(&obj, _odb, &short_id, len));
+			cl_assert(git_oid_cmp(&id, git_odb_object_id(obj)) == 0);
+
+			git_odb_object_free(obj);
+		}
+	}
+
+	cl_git_pass(git_oid_fromstrn(&id, "498bc", 5));
+	cl_assert_equal_i(GIT_EAMBIGUOUS, git_odb_read_prefix(&obj, _odb, &id, 5));
+
+	cl_git_pass(git_oid_fromstrn(&id, "498bcc", 6));
+	cl_git_pass(git_odb_read_prefix(&obj, _odb, &id, 6));
+	cl_assert(git_oid_streq(git_odb_object_id(obj), "498bccdfec1fc223c27c0d84030ff419058e452d") == 0);
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_oid_fromstr(&id, "498bc0906810bd43c6fbc73385fecb7f2d04be3b"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read(&obj, _odb, &id));
+}
+
+struct header_check {
+	struct git_pack_file *p;
+	int deltas;
+};
+
+static int check_header_cb(const git_oid *oid, git_off_t offset, void *data)
+{
+	struct header_check *c = data;
+	struct git_pack_entry e;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = offset;
+	git_rawobj raw;
+	size_t size;
+	git_otype type;
+
+	cl_git_pass(git_pack_entry_find(&e, c->p, oid, GIT_OID_HEXSZ));
+	cl_assert(e.offset == offset);
+
+	cl_git_pass(git_packfile_unpack_header(&size, &type, &c->p->mwf, &w_curs, &curpos));
+	git_mwindow_close(&w_curs);
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA)
+		c->deltas++;
+
+	cl_git_pass(git_packfile_resolve_header(&size, &type, c->p, offset));
+
+	curpos = offset;
+	cl_git_pass(git_packfile_unpack(&raw, c->p, &curpos));
+	cl_assert_equal_i(raw.type, type);
+	cl_assert(raw.len == size);
+	git__free(raw.data);
+
+	return 0;
+}
+
+void test_odb_packed__resolve_delta_headers(void)
+{
+	struct header_check c;
+
+	cl_git_pass(git_packfile_check(&c.p, cl_fixture(
+		"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+	c.deltas = 0;
+
+	cl_git_pass(git_pack_foreach_entry_offset(c.p, check_header_cb, &c));
+	cl_assert(c.deltas > 0);
+
+	packfile_free(c.p);
+}
@@ -0,0 +1,99 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "pack_data.h"
+
+#define NR_IDS (ARRAY_SIZE(packed_objects) + ARRAY_SIZE(loose_objects))
+
+static git_odb *_odb;
+static git_oid _ids[NR_IDS + 1];
+static int _seen[NR_IDS + 1];
+
+void test_odb_read_many__initialize(void)
+{
+	size_t i, n = 0;
+
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+
+	/* interleaved, so the order they are asked for is no help */
+	for (i = 0; i < ARRAY_SIZE(packed_objects) || i < ARRAY_SIZE(loose_objects); ++i) {
+		if (i < ARRAY_SIZE(loose_objects))
+			cl_git_pass(git_oid_fromstr(&_ids[n++], loose_objects[i]));
+		if (i < ARRAY_SIZE(packed_objects))
+			cl_git_pass(git_oid_fromstr(&_ids[n++], packed_objects[i]));
+	}
+
+	memset(_seen, 0x0, sizeof(_seen));
+}
+
+void test_odb_read_many__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+}
+
+static int check_object(git_odb_object *obj, size_t idx, void *payload)
+{
+	git_odb_object *expected;
+
+	GIT_UNUSED(payload);
+
+	cl_assert(idx < NR_IDS + 1);
+	cl_assert(git_oid_cmp(&_ids[idx], git_odb_object_id(obj)) == 0);
+	_seen[idx]++;
+
+	cl_git_pass(git_odb_read(&expected, _odb, &_ids[idx]));
+	cl_assert_equal_i(git_odb_object_type(expected), git_odb_object_type(obj));
+	cl_assert_equal_i(git_odb_object_size(expected), git_odb_object_size(obj));
+	cl_assert(memcmp(git_odb_object_data(expected),
+		git_odb_object_data(obj), git_odb_object_size(obj)) == 0);
+	git_odb_object_free(expected);
+
+	git_odb_object_free(obj);
+	return 0;
+}
+
+void test_odb_read_many__reads_every_object_once(void)
+{
+	size_t i;
+
+	/* the second time around, they all come from the cache */
+	cl_git_pass(git_odb_read_many(_odb, _ids, NR_IDS, check_object, NULL));
+	cl_git_pass(git_odb_read_many(_odb, _ids, NR_IDS, check_object, NULL));
+
+	for (i = 0; i < NR_IDS; ++i)
+		cl_assert_equal_i(2, _seen[i]);
+}
+
+void test_odb_read_many__missing_objects(void)
+{
+	size_t i;
+
+	cl_git_pass(git_oid_fromstr(&_ids[NR_IDS], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_read_many(_odb, _ids, NR_IDS + 1, check_object, NULL));
+
+	/* everything else was read anyway */
+	for (i = 0; i < NR_IDS; ++i)
+		cl_assert_equal_i(1, _seen[i]);
+	cl_assert_equal_i(0, _seen[NR_IDS]);
+}
+
+static int stop_after_three(git_odb_object *obj, size_t idx, void *payload)
+{
+	int *count = payload;
+
+	GIT_UNUSED(idx);
+	git_odb_object_free(obj);
+
+	return ++*count == 3;
+}
+
+void test_odb_read_many__callback_can_stop_the_read(void)
+{
+	int count = 0;
+
+	cl_assert_equal_i(GIT_EUSER,
+		git_odb_read_many(_odb, _ids, NR_IDS, stop_after_three, &count));
+	cl_assert_equal_i(3, count);
+}
@@ -0,0 +1,86 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "pack-objects.h"
+#include "git2/odb_backend.h"
+
+static git_repository *_repo;
+static git_odb_backend *_backend;
+
+void test_odb_refresh__initialize(void)
+{
+	git_buf objects = GIT_BUF_INIT;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&objects, git_repository_path(_repo), "objects"));
+	cl_git_pass(git_odb_backend_pack(&_backend, git_buf_cstr(&objects)));
+	git_buf_free(&objects);
+}
+
+void test_odb_refresh__cleanup(void)
+{
+	_backend->free(_backend);
+	_backend = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static void write_pack_with(const git_oid *id)
+{
+	git_packbuilder *pb;
+	git_indexer *idx;
+	git_indexer_stats stats;
+	git_buf tmp = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_git_pass(git_buf_joinpath(&tmp, git_repository_path(_repo), "objects/pack/tmp.pack"));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+	cl_git_pass(git_packbuilder_write(pb, git_buf_cstr(&tmp)));
+
+	/* the index is named after the pack's checksum; so must the pack be */
+	cl_git_pass(git_indexer_new(&idx, git_buf_cstr(&tmp)));
+	cl_git_pass(git_indexer_run(idx, &stats));
+	cl_git_pass(git_indexer_write(idx));
+
+	git_oid_tostr(hex, sizeof(hex), git_indexer_hash(idx));
+	cl_git_pass(git_buf_joinpath(&pack, git_repository_path(_repo), "objects/pack/pack-"));
+	cl_git_pass(git_buf_printf(&pack, "%s.pack", hex));
+	cl_must_pass(p_rename(git_buf_cstr(&tmp), git_buf_cstr(&pack)));
+
+	git_indexer_free(idx);
+	git_packbuilder_free(pb);
+	git_buf_free(&tmp);
+	git_buf_free(&pack);
+}
+
+void test_odb_refresh__known_misses_are_forgotten_when_a_pack_arrives(void)
+{
+	git_oid id;
+
+	/* a loose object, so not known to the pack backend yet */
+	cl_git_pass(git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+
+	cl_assert(!_backend->exists(_backend, &id));
+	/* answered from the list of known misses */
+	cl_assert(!_backend->exists(_backend, &id));
+
+	write_pack_with(&id);
+
+	cl_assert(_backend->exists(_backend, &id));
+}
+
+void test_odb_refresh__misses(void)
+{
+	git_oid id;
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+
+	for (i = 0; i < 3; ++i)
+		cl_assert(!_backend->exists(_backend, &id));
+
+	/* known misses do not get in the way of hits */
+	cl_git_pass(git_oid_fromstr(&id, "0266163a49e280c4f5ed1e08facd36a2bd716bcf"));
+	cl_assert(_backend->exists(_backend, &id));
+}
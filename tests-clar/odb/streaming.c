@@ -0,0 +1,125 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "posix.h"
+#include "fileops.h"
+#include "git2/odb_backend.h"
+#include "pack_data.h"
+
+static git_odb *_odb;
+
+void test_odb_streaming__initialize(void)
+{
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+}
+
+void test_odb_streaming__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_fixture_cleanup("test-objects");
+}
+
+static void stream_and_compare(git_odb *odb, const git_oid *id, size_t chunk)
+{
+	git_odb_object *obj;
+	git_odb_stream *stream;
+	git_buf streamed = GIT_BUF_INIT;
+	char *buf = git__malloc(chunk);
+	int n;
+
+	cl_assert(buf);
+
+	cl_git_pass(git_odb_open_rstream(&stream, odb, id));
+	cl_assert_equal_i(GIT_STREAM_RDONLY, stream->mode);
+
+	/* an empty read reads nothing, and does not get stuck */
+	cl_assert_equal_i(0, stream->read(stream, buf, 0));
+
+	while ((n = stream->read(stream, buf, chunk)) > 0) {
+		cl_assert(n <= (int)chunk);
+		cl_git_pass(git_buf_put(&streamed, buf, n));
+	}
+	cl_git_pass(n);
+
+	/* the end stays the end */
+	cl_assert_equal_i(0, stream->read(stream, buf, chunk));
+	stream->free(stream);
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_i(git_odb_object_size(obj), streamed.size);
+	cl_assert(memcmp(git_odb_object_data(obj), streamed.ptr, streamed.size) == 0);
+	git_odb_object_free(obj);
+
+	git_buf_free(&streamed);
+	git__free(buf);
+}
+
+void test_odb_streaming__packed_objects(void)
+{
+	unsigned int i;
+
+	/* some of them are deltas */
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_oid id;
+
+		cl_git_pass(git_oid_fromstr(&id, packed_objects[i]));
+		stream_and_compare(_odb, &id, 7);
+	}
+}
+
+void test_odb_streaming__loose_objects(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(loose_objects); ++i) {
+		git_oid id;
+
+		cl_git_pass(git_oid_fromstr(&id, loose_objects[i]));
+		stream_and_compare(_odb, &id, 1);
+		stream_and_compare(_odb, &id, 4096);
+	}
+}
+
+void test_odb_streaming__missing_object(void)
+{
+	git_odb_stream *stream;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_open_rstream(&stream, _odb, &id));
+}
+
+static void write_big_blob(git_odb *odb, git_oid *id, size_t len)
+{
+	git_buf data = GIT_BUF_INIT;
+	size_t i;
+
+	for (i = 0; data.size < len; ++i)
+		cl_git_pass(git_buf_printf(&data, "line %u of a big blob\n", (unsigned)i));
+
+	cl_git_pass(git_odb_write(id, odb, data.ptr, data.size, GIT_OBJ_BLOB));
+	git_buf_free(&data);
+}
+
+void test_odb_streaming__big_blobs(void)
+{
+	git_odb *odb;
+	git_odb_backend *writer;
+	git_oid loose_id, packed_id;
+
+	cl_must_pass(p_mkdir("test-objects", GIT_OBJECT_DIR_MODE));
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+
+	write_big_blob(odb, &loose_id, 3 * 1024 * 1024);
+
+	cl_git_pass(git_odb_backend_pack_writer(&writer, "test-objects"));
+	cl_git_pass(git_odb_add_backend(odb, writer, 3));
+	write_big_blob(odb, &packed_id, 5 * 1024 * 1024);
+	git_odb_free(odb);
+
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+	stream_and_compare(odb, &loose_id, 1000);
+	stream_and_compare(odb, &packed_id, 64 * 1024);
+	git_odb_free(odb);
+}
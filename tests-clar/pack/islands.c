@@ -0,0 +1,120 @@
+#include "clar_libgit2.h"
+#include "pack-objects.h"
+#include "delta-islands.h"
+
+static git_repository *_repo;
+static git_packbuilder *_packbuilder;
+
+void test_pack_islands__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+}
+
+void test_pack_islands__cleanup(void)
+{
+	git_packbuilder_free(_packbuilder);
+	_packbuilder = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static void set_island_regex(const char *regex)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_string(cfg, "pack.island", regex));
+	git_config_free(cfg);
+}
+
+static git_pobject *find_object(const char *sha)
+{
+	git_oid oid;
+	unsigned int i;
+
+	cl_git_pass(git_oid_fromstr(&oid, sha));
+
+	for (i = 0; i < _packbuilder->nr_objects; ++i)
+		if (!git_oid_cmp(&oid, &_packbuilder->object_list[i].id))
+			return &_packbuilder->object_list[i];
+
+	return NULL;
+}
+
+static void build_pack(void)
+{
+	git_revwalk *walk;
+	git_buf buf = GIT_BUF_INIT;
+	unsigned int i;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/heads/*"));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, walk));
+	git_revwalk_free(walk);
+
+	git_packbuilder_set_delta_islands(_packbuilder, 1);
+	cl_git_pass(git_packbuilder_write_buf(&buf, _packbuilder));
+	git_buf_free(&buf);
+
+	/* no delta may cross the islands of its target */
+	for (i = 0; i < _packbuilder->nr_objects; ++i) {
+		git_pobject *po = &_packbuilder->object_list[i];
+
+		if (po->delta)
+			cl_assert(git_delta_islands_allowed(_packbuilder, po, po->delta));
+	}
+}
+
+void test_pack_islands__objects_outside_islands_are_unrestricted(void)
+{
+	git_pobject *master, *br2;
+
+	set_island_regex("refs/heads/(master)$");
+	build_pack();
+
+	cl_assert(_packbuilder->islands != NULL);
+	cl_assert_equal_i(1, _packbuilder->island_words);
+
+	/* tip of master */
+	cl_assert((master = find_object("a65fedf39aefe402d3bb6e24df4d4f5fe4547750")) != NULL);
+	cl_assert(master->island != NULL);
+	cl_assert(master->island->bits[0] == 1);
+
+	/* tip of br2, not reachable from master */
+	cl_assert((br2 = find_object("a4a7dce85cf63874e984719f4fdd239f5145052f")) != NULL);
+	cl_assert(br2->island == NULL);
+
+	cl_assert(git_delta_islands_allowed(_packbuilder, br2, master));
+	cl_assert(!git_delta_islands_allowed(_packbuilder, master, br2));
+}
+
+void test_pack_islands__one_island_per_capture(void)
+{
+	git_pobject *master, *br2, *root;
+
+	set_island_regex("refs/heads/(master|br2)$");
+	build_pack();
+
+	cl_assert((master = find_object("a65fedf39aefe402d3bb6e24df4d4f5fe4547750")) != NULL);
+	cl_assert((br2 = find_object("a4a7dce85cf63874e984719f4fdd239f5145052f")) != NULL);
+	/* first commit of the repository, reachable from both */
+	cl_assert((root = find_object("8496071c1b46c854b31185ea97743be6a8774479")) != NULL);
+
+	cl_assert(master->island && br2->island && root->island);
+	cl_assert(master->island->bits[0] != br2->island->bits[0]);
+	cl_assert_equal_i(3, root->island->bits[0]);
+
+	/* the shared history can serve as a base for both forks... */
+	cl_assert(git_delta_islands_allowed(_packbuilder, master, root));
+	cl_assert(git_delta_islands_allowed(_packbuilder, br2, root));
+	/* ...but the forks cannot depend on each other */
+	cl_assert(!git_delta_islands_allowed(_packbuilder, master, br2));
+	cl_assert(!git_delta_islands_allowed(_packbuilder, root, master));
+}
+
+void test_pack_islands__no_islands_configured(void)
+{
+	build_pack();
+	cl_assert(_packbuilder->islands == NULL);
+}
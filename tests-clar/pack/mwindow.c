@@ -0,0 +1,164 @@
+#include "clar_libgit2.h"
+#include "pack.h"
+
+static git_repository *_repo;
+
+void test_pack_mwindow__initialize(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+}
+
+void test_pack_mwindow__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	git_libgit2_mwindow_set_file_limit(128);
+	git_libgit2_mwindow_set_whole_file(0);
+}
+
+static int read_object_cb(git_oid *id, void *data)
+{
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read(&obj, data, id));
+	git_odb_object_free(obj);
+
+	return 0;
+}
+
+static void read_packed_objects(git_odb *odb)
+{
+	cl_git_pass(git_odb_foreach(odb, read_object_cb, odb));
+}
+
+void test_pack_mwindow__stats(void)
+{
+	git_mwindow_stats before, during, after;
+	git_odb *odb;
+
+	git_libgit2_mwindow_stats(&before);
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	read_packed_objects(odb);
+
+	git_libgit2_mwindow_stats(&during);
+	cl_assert(during.mmap_calls > before.mmap_calls);
+	cl_assert(during.open_windows > before.open_windows);
+	cl_assert(during.mapped > before.mapped);
+	cl_assert(during.peak_mapped >= during.mapped);
+	cl_assert(during.peak_open_windows >= during.open_windows);
+
+	/* the windows are still mapped, so reading again maps nothing new */
+	read_packed_objects(odb);
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(during.mmap_calls, after.mmap_calls);
+	cl_assert_equal_i(during.open_windows, after.open_windows);
+
+	/* closing the packs unmaps their windows */
+	git_odb_free(odb);
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(before.open_windows, after.open_windows);
+	cl_assert(before.mapped == after.mapped);
+	cl_assert(after.peak_mapped >= during.peak_mapped);
+}
+
+static int unpack_cb(const git_oid *oid, git_off_t offset, void *data)
+{
+	struct git_pack_file *p = data;
+	struct git_pack_entry e;
+	git_rawobj obj;
+
+	/* opens the pack on the first call */
+	cl_git_pass(git_pack_entry_find(&e, p, oid, GIT_OID_HEXSZ));
+	cl_assert(e.offset == offset);
+
+	cl_git_pass(git_packfile_unpack(&obj, p, &offset));
+	git__free(obj.data);
+
+	return 0;
+}
+
+void test_pack_mwindow__whole_file(void)
+{
+	git_mwindow_stats before, after;
+	struct git_pack_file *p;
+
+	if (sizeof(void *) < 8) {
+		cl_git_fail(git_libgit2_mwindow_set_whole_file(1));
+		return;
+	}
+
+	cl_git_pass(git_libgit2_mwindow_set_whole_file(1));
+	cl_git_pass(git_packfile_check(&p, cl_fixture(
+		"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+
+	git_libgit2_mwindow_stats(&before);
+	cl_git_pass(git_pack_foreach_entry_offset(p, unpack_cb, p));
+
+	/* the whole pack was read through a single window */
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(before.open_windows + 1, after.open_windows);
+	cl_assert_equal_i(before.mmap_calls + 1, after.mmap_calls);
+	cl_assert(after.mapped - before.mapped == (size_t)p->mwf.size);
+
+	packfile_free(p);
+}
+
+static void unpack_first(struct git_pack_file *p, const char *id)
+{
+	git_oid oid;
+	struct git_pack_entry e;
+	git_rawobj obj;
+
+	cl_git_pass(git_oid_fromstr(&oid, id));
+	cl_git_pass(git_pack_entry_find(&e, p, &oid, GIT_OID_HEXSZ));
+	cl_git_pass(git_packfile_unpack(&obj, p, &e.offset));
+	git__free(obj.data);
+}
+
+void test_pack_mwindow__file_limit(void)
+{
+	git_mwindow_stats before, after;
+	struct git_pack_file *a, *b;
+
+	git_libgit2_mwindow_stats(&before);
+	git_libgit2_mwindow_set_file_limit(before.open_files + 1);
+
+	cl_git_pass(git_packfile_check(&a, cl_fixture(
+		"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+	cl_git_pass(git_packfile_check(&b, cl_fixture(
+		"testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx")));
+
+	unpack_first(a, "001d938dbe69b6251f4a03cf374235c72fd0a0d2");
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(before.open_files + 1, after.open_files);
+
+	/* opening the second pack closes the first one's descriptor */
+	unpack_first(b, "418382dff1ffb8bdfba833f4d8bbcde58b1e7f47");
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(before.open_files + 1, after.open_files);
+	cl_assert(a->mwf.fd == -1);
+
+	/* the first pack's window is still mapped */
+	unpack_first(a, "001d938dbe69b6251f4a03cf374235c72fd0a0d2");
+	cl_assert(a->mwf.fd == -1);
+
+	/* without it, the pack is reopened to map a new one */
+	git_mwindow_free_all(&a->mwf);
+	unpack_first(a, "001d938dbe69b6251f4a03cf374235c72fd0a0d2");
+	cl_assert(a->mwf.fd != -1);
+	cl_assert(b->mwf.fd == -1);
+
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(before.open_files + 1, after.open_files);
+
+	packfile_free(a);
+	packfile_free(b);
+
+	git_libgit2_mwindow_stats(&after);
+	cl_assert_equal_i(before.open_files, after.open_files);
+}
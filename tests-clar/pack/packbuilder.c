@@ -1,6 +1,7 @@
 #include "clar_libgit2.h"
 #include "iterator.h"
 #include "vector.h"
+#include "pack-objects.h"
 
 static git_repository *_repo;
 static git_revwalk *_revwalker;
@@ -28,6 +29,7 @@ void test_pack_packbuilder__cleanup(void)
 	git_packbuilder_free(_packbuilder);
 	git_revwalk_free(_revwalker);
 	git_indexer_free(_indexer);
+	_indexer = NULL;
 	git_repository_free(_repo);
 }
 
@@ -65,3 +67,100 @@ void test_pack_packbuilder__create_pack(void)
 	cl_git_pass(git_indexer_run(_indexer, &stats));
 	cl_git_pass(git_indexer_write(_indexer));
 }
+
+void test_pack_packbuilder__insert_walk_matches_insert_tree(void)
+{
+	git_packbuilder *pb;
+	git_indexer_stats stats;
+	git_oid oid, *o;
+	unsigned int i;
+
+	git_revwalk_sorting(_revwalker, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_ref(_revwalker, "HEAD"));
+
+	while (git_revwalk_next(&oid, _revwalker) == 0) {
+		o = git__malloc(GIT_OID_RAWSZ);
+		cl_assert(o != NULL);
+		git_oid_cpy(o, &oid);
+		cl_git_pass(git_vector_insert(&_commits, o));
+	}
+
+	git_vector_foreach(&_commits, i, o) {
+		git_object *obj;
+		cl_git_pass(git_packbuilder_insert(_packbuilder, o, NULL));
+		cl_git_pass(git_object_lookup(&obj, _repo, o, GIT_OBJ_COMMIT));
+		cl_git_pass(git_packbuilder_insert_tree(_packbuilder,
+					git_commit_tree_oid((git_commit *)obj)));
+		git_object_free(obj);
+	}
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+
+	git_revwalk_reset(_revwalker);
+	git_revwalk_sorting(_revwalker, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_ref(_revwalker, "HEAD"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, _revwalker));
+
+	cl_assert_equal_i(_packbuilder->nr_objects, pb->nr_objects);
+
+	/* commits come first, in walk order */
+	git_vector_foreach(&_commits, i, o) {
+		cl_assert(git_oid_cmp(o, &pb->object_list[i].id) == 0);
+	}
+
+	/* inserting again is a no-op */
+	git_vector_foreach(&_commits, i, o) {
+		cl_git_pass(git_packbuilder_insert_commit(pb, o));
+	}
+	cl_assert_equal_i(_packbuilder->nr_objects, pb->nr_objects);
+
+	cl_git_pass(git_packbuilder_write(pb, "testpack_walk.pack"));
+	git_packbuilder_free(pb);
+
+	cl_git_pass(git_indexer_new(&_indexer, "testpack_walk.pack"));
+	cl_git_pass(git_indexer_run(_indexer, &stats));
+	cl_git_pass(git_indexer_write(_indexer));
+	cl_assert_equal_i(_packbuilder->nr_objects, stats.total);
+}
+
+void test_pack_packbuilder__insert_walk_after_insert(void)
+{
+	git_packbuilder *pb;
+	git_oid head;
+	size_t expected;
+
+	git_revwalk_sorting(_revwalker, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_ref(_revwalker, "HEAD"));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, _revwalker));
+	expected = _packbuilder->nr_objects;
+
+	/* a commit inserted on its own still gets its tree from the walk */
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_reference_name_to_oid(&head, _repo, "HEAD"));
+	cl_git_pass(git_packbuilder_insert(pb, &head, NULL));
+
+	cl_git_pass(git_revwalk_push_ref(_revwalker, "HEAD"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, _revwalker));
+	cl_assert_equal_i(expected, pb->nr_objects);
+
+	git_packbuilder_free(pb);
+}
+
+void test_pack_packbuilder__recreate_deltas_when_writing(void)
+{
+	git_indexer_stats stats;
+
+	/* no delta may be kept in memory: all of them are recomputed */
+	_packbuilder->max_delta_cache_size = 1;
+
+	git_revwalk_sorting(_revwalker, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_ref(_revwalker, "HEAD"));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, _revwalker));
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, "testpack_nocache.pack"));
+
+	cl_git_pass(git_indexer_new(&_indexer, "testpack_nocache.pack"));
+	cl_git_pass(git_indexer_run(_indexer, &stats));
+	cl_git_pass(git_indexer_write(_indexer));
+	cl_assert_equal_i(_packbuilder->nr_objects, stats.total);
+}
@@ -0,0 +1,162 @@
+#include "clar_libgit2.h"
+
+static git_repository *_repo;
+
+static const char *commits[] = {
+	"a4a7dce85cf63874e984719f4fdd239f5145052f",
+	"9fd738e8f7967c078dceed8190330fc8648ee56a",
+	"4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+	"c47800c7266a2be04c571c04d5a6614691ea99bd",
+	"5b5b025afb0b4c913b4c338a42934a3863bf3644",
+	"8496071c1b46c854b31185ea97743be6a8774479",
+	"be3563ae3f795b2b4353bcce3a527ad0a4f7f644",
+	"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+	"763d71aadf09a7951596c9746c024e7eece7c7af",
+	"e90810b8df3e80c413d903f631643c716887138d",
+	"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9",
+};
+
+#define NR_COMMITS ARRAY_SIZE(commits)
+#define NR_PAIRS (NR_COMMITS * NR_COMMITS)
+
+void test_revwalk_aheadbehind__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_revwalk_aheadbehind__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* the commits of `push` that are not in `hide` */
+static size_t count_unique(const git_oid *push, const git_oid *hide)
+{
+	git_revwalk *walk;
+	git_oid id;
+	size_t n = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push(walk, push));
+	cl_git_pass(git_revwalk_hide(walk, hide));
+
+	while (git_revwalk_next(&id, walk) == 0)
+		n++;
+
+	git_revwalk_free(walk);
+	return n;
+}
+
+void test_revwalk_aheadbehind__single_pair(void)
+{
+	git_oid local, upstream;
+	size_t ahead, behind;
+
+	cl_git_pass(git_oid_fromstr(&local, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_oid_fromstr(&upstream, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &local, &upstream));
+	cl_assert_equal_i(1, ahead);
+	cl_assert_equal_i(2, behind);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &local, &local));
+	cl_assert_equal_i(0, ahead);
+	cl_assert_equal_i(0, behind);
+}
+
+void test_revwalk_aheadbehind__many_pairs(void)
+{
+	git_oid locals[NR_PAIRS], upstreams[NR_PAIRS], bases[NR_PAIRS], zero;
+	size_t ahead[NR_PAIRS], behind[NR_PAIRS];
+	size_t i, j, n = 0;
+
+	/* more pairs than fit in one batch */
+	for (i = 0; i < NR_COMMITS; ++i) {
+		for (j = 0; j < NR_COMMITS; ++j, ++n) {
+			cl_git_pass(git_oid_fromstr(&locals[n], commits[i]));
+			cl_git_pass(git_oid_fromstr(&upstreams[n], commits[j]));
+		}
+	}
+
+	cl_git_pass(git_graph_ahead_behind_many(
+		ahead, behind, bases, _repo, locals, upstreams, NR_PAIRS));
+
+	memset(&zero, 0x0, sizeof(zero));
+
+	for (n = 0; n < NR_PAIRS; ++n) {
+		git_oid base;
+		int error;
+
+		cl_assert_equal_i(count_unique(&locals[n], &upstreams[n]), ahead[n]);
+		cl_assert_equal_i(count_unique(&upstreams[n], &locals[n]), behind[n]);
+
+		error = git_merge_base(&base, _repo, &locals[n], &upstreams[n]);
+		if (error == GIT_ENOTFOUND) {
+			cl_assert(git_oid_cmp(&bases[n], &zero) == 0);
+			continue;
+		}
+		cl_git_pass(error);
+
+		/*
+		 * a common ancestor, and not an older one than git_merge_base
+		 * found; criss-crosses have more than one good answer
+		 */
+		cl_assert_equal_i(0, count_unique(&bases[n], &locals[n]));
+		cl_assert_equal_i(0, count_unique(&bases[n], &upstreams[n]));
+		cl_assert(git_oid_cmp(&base, &bases[n]) == 0 ||
+			count_unique(&bases[n], &base) > 0);
+	}
+}
+
+/* a commit on top of `parent` (if any) with the given date */
+static void commit_at(git_oid *out, git_time_t time, const git_oid *parent_id)
+{
+	git_commit *parent = NULL, *base;
+	git_tree *tree;
+	git_signature *s;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_commit_lookup(&base, _repo, &id));
+	cl_git_pass(git_commit_tree(&tree, base));
+	git_commit_free(base);
+	cl_git_pass(git_signature_new(&s, "alice", "alice@example.com", time, 0));
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, _repo, parent_id));
+
+	cl_git_pass(git_commit_create(out, _repo, NULL, s, s, NULL, "skewed",
+		tree, parent ? 1 : 0, (const git_commit **)&parent));
+
+	git_commit_free(parent);
+	git_signature_free(s);
+	git_tree_free(tree);
+}
+
+void test_revwalk_aheadbehind__skewed_dates(void)
+{
+	git_oid z, y, x, l, s, u;
+	size_t ahead, behind;
+
+	/*
+	 * `s` claims to be older than its parent `x`, so it is walked
+	 * with `x` still waiting in the queue, and `x` gets the marks of
+	 * both sides while `y` and `z` are still marked from one side
+	 */
+	commit_at(&z, 10000, NULL);
+	commit_at(&y, 20000, &z);
+	commit_at(&x, 30000, &y);
+	commit_at(&l, 100000, &x);
+	commit_at(&s, 5000, &x);
+	commit_at(&u, 90000, &s);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &l, &u));
+	cl_assert_equal_i(count_unique(&l, &u), ahead);
+	cl_assert_equal_i(count_unique(&u, &l), behind);
+	cl_assert_equal_i(1, ahead);
+	cl_assert_equal_i(2, behind);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &u, &l));
+	cl_assert_equal_i(2, ahead);
+	cl_assert_equal_i(1, behind);
+}
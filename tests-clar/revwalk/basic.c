@@ -187,3 +187,22 @@ void test_revwalk_basic__disallow_non_commit(void)
 	cl_git_pass(git_oid_fromstr(&oid, "521d87c1ec3aef9824daf6d96cc0ae3710766d91"));
 	cl_git_fail(git_revwalk_push(_walk, &oid));
 }
+
+void test_revwalk_basic__reversed_walk_can_be_repeated(void)
+{
+	int i, round;
+	git_oid oid;
+
+	git_revwalk_sorting(_walk, GIT_SORT_TIME | GIT_SORT_REVERSE);
+
+	for (round = 0; round < 2; ++round) {
+		cl_git_pass(git_revwalk_push_head(_walk));
+
+		i = 0;
+		while (git_revwalk_next(&oid, _walk) == 0)
+			i++;
+
+		/* git log HEAD --oneline | wc -l => 7 */
+		cl_assert_equal_i(7, i);
+	}
+}
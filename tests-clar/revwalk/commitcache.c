@@ -0,0 +1,104 @@
+#include "clar_libgit2.h"
+#include "repository.h"
+
+static git_repository *_repo;
+
+#define MAX_WALK 64
+
+void test_revwalk_commitcache__initialize(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+}
+
+void test_revwalk_commitcache__cleanup(void)
+{
+	git_libgit2_commit_cache_set_limit(GIT_COMMIT_CACHE_DEFAULT_LIMIT);
+	git_repository_free(_repo);
+}
+
+static size_t walk_all(git_oid *out)
+{
+	git_revwalk *walk;
+	size_t n = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+
+	while (n < MAX_WALK && git_revwalk_next(&out[n], walk) == 0)
+		n++;
+
+	git_revwalk_free(walk);
+	return n;
+}
+
+void test_revwalk_commitcache__walks_share_parsed_commits(void)
+{
+	git_oid first[MAX_WALK], second[MAX_WALK];
+	git_odb *odb;
+	size_t n, i;
+
+	n = walk_all(first);
+	cl_assert(n > 0 && n < MAX_WALK);
+	cl_assert_equal_i(n, kh_size(_repo->commits.map));
+
+	cl_assert_equal_i(n, walk_all(second));
+	cl_assert(memcmp(first, second, n * sizeof(git_oid)) == 0);
+	cl_assert_equal_i(n, kh_size(_repo->commits.map));
+
+	/* and the raw commits stay out of the object cache */
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	for (i = 0; i < n; ++i)
+		cl_assert(git_cache_get(&odb->cache, &first[i]) == NULL);
+}
+
+void test_revwalk_commitcache__cache_is_emptied_past_its_limit(void)
+{
+	git_oid all[MAX_WALK], limited[MAX_WALK];
+	size_t n;
+
+	n = walk_all(all);
+
+	git_libgit2_commit_cache_set_limit(512);
+
+	/* start over with an empty cache */
+	git_repository_free(_repo);
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+
+	cl_assert_equal_i(n, walk_all(limited));
+	cl_assert(memcmp(all, limited, n * sizeof(git_oid)) == 0);
+
+	cl_assert(_repo->commits.used <= 512);
+	cl_assert(kh_size(_repo->commits.map) < n);
+
+	/* nothing at all */
+	git_libgit2_commit_cache_set_limit(0);
+
+	cl_assert_equal_i(n, walk_all(limited));
+	cl_assert(memcmp(all, limited, n * sizeof(git_oid)) == 0);
+	cl_assert_equal_i(0, kh_size(_repo->commits.map));
+}
+
+void test_revwalk_commitcache__commits_are_read_ahead(void)
+{
+	git_revwalk *walk;
+	git_oid id, tip, other;
+
+	cl_git_pass(git_oid_fromstr(&tip, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+	cl_git_pass(git_oid_fromstr(&id, "e90810b8df3e80c413d903f631643c716887138d"));
+	cl_git_pass(git_oid_fromstr(&other, "5b5b025afb0b4c913b4c338a42934a3863bf3644"));
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push(walk, &tip));
+	cl_git_pass(git_revwalk_push(walk, &id));
+
+	cl_git_pass(git_revwalk_next(&id, walk));
+	cl_assert(git_oid_cmp(&id, &tip) == 0);
+	cl_git_pass(git_revwalk_next(&id, walk));
+
+	/* the grandparent of the first tip came along with the parent of the other */
+	cl_assert(git_commit_cache_get(&_repo->commits, &other) != NULL);
+
+	git_revwalk_free(walk);
+}
@@ -0,0 +1,392 @@
+#include "clar_libgit2.h"
+#include "commit_graph.h"
+#include "repository.h"
+#include "posix.h"
+#include "fileops.h"
+
+static git_repository *_repo;
+static git_buf _graph_path;
+
+void test_revwalk_commitgraph__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&_graph_path,
+		git_repository_path(_repo), "objects/info/commit-graph"));
+}
+
+void test_revwalk_commitgraph__cleanup(void)
+{
+	git_buf_free(&_graph_path);
+	cl_git_sandbox_cleanup();
+}
+
+static void check_entry(git_commit_graph_file *graph, const git_oid *id)
+{
+	git_commit_graph_entry e, parent;
+	git_commit *commit;
+	unsigned int i;
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, id));
+	cl_git_pass(git_commit_graph_entry_find(&e, graph, id));
+
+	cl_assert(git_oid_cmp(&e.sha1, id) == 0);
+	cl_assert(git_oid_cmp(&e.tree_oid, git_commit_tree_oid(commit)) == 0);
+	cl_assert(e.commit_time == git_commit_time(commit));
+	cl_assert_equal_i(git_commit_parentcount(commit), e.parent_count);
+	cl_assert(e.generation > 0);
+
+	for (i = 0; i < e.parent_count; ++i) {
+		cl_git_pass(git_commit_graph_entry_parent(&parent, graph, &e, i));
+		cl_assert(git_oid_cmp(&parent.sha1, git_commit_parent_oid(commit, i)) == 0);
+		cl_assert(parent.generation < e.generation);
+	}
+
+	if (e.parent_count == 0)
+		cl_assert_equal_i(1, e.generation);
+
+	git_commit_free(commit);
+}
+
+void test_revwalk_commitgraph__writes_every_reachable_commit(void)
+{
+	git_commit_graph_file *graph;
+	git_revwalk *walk;
+	git_oid id;
+	int count = 0;
+
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+	cl_git_pass(git_commit_graph_open(&graph, _graph_path.ptr));
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+	cl_git_pass(git_revwalk_push_glob(walk, "remotes"));
+	cl_git_pass(git_revwalk_push_glob(walk, "notes"));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		check_entry(graph, &id);
+		count++;
+	}
+
+	/* tags of blobs or trees are left out */
+	cl_assert_equal_i(count, graph->num_commits);
+
+	cl_assert(!git_commit_graph_needs_refresh(graph, _graph_path.ptr));
+
+	git_revwalk_free(walk);
+	git_commit_graph_free(graph);
+}
+
+void test_revwalk_commitgraph__octopus_merges(void)
+{
+	static const char *parent_ids[] = {
+		"c47800c7266a2be04c571c04d5a6614691ea99bd",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a",
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9",
+		"763d71aadf09a7951596c9746c024e7eece7c7af",
+	};
+	git_commit_graph_file *graph;
+	git_commit *parents[4];
+	git_tree *tree;
+	git_signature *s;
+	git_oid id;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(parent_ids); ++i) {
+		cl_git_pass(git_oid_fromstr(&id, parent_ids[i]));
+		cl_git_pass(git_commit_lookup(&parents[i], _repo, &id));
+	}
+
+	cl_git_pass(git_commit_tree(&tree, parents[0]));
+	cl_git_pass(git_signature_now(&s, "alice", "alice@example.com"));
+
+	cl_git_pass(git_commit_create(&id, _repo, "refs/heads/octopus", s, s,
+		NULL, "octopus", tree, 4, (const git_commit **)parents));
+
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+	cl_git_pass(git_commit_graph_open(&graph, _graph_path.ptr));
+
+	check_entry(graph, &id);
+	cl_assert_equal_i(3, graph->num_extra_edge_list);
+
+	git_commit_graph_free(graph);
+	git_signature_free(s);
+	git_tree_free(tree);
+	for (i = 0; i < ARRAY_SIZE(parent_ids); ++i)
+		git_commit_free(parents[i]);
+}
+
+#define MAX_WALK 64
+
+static size_t topo_walk(git_oid *out, git_revwalk *walk)
+{
+	size_t n = 0;
+
+	while (n < MAX_WALK && git_revwalk_next(&out[n], walk) == 0)
+		n++;
+
+	return n;
+}
+
+static void check_topological(const git_oid *ids, size_t n)
+{
+	git_commit *commit;
+	size_t i, j, k;
+
+	/* every commit comes before all of its parents */
+	for (i = 0; i < n; ++i) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, &ids[i]));
+
+		for (k = 0; k < git_commit_parentcount(commit); ++k)
+			for (j = 0; j < i; ++j)
+				cl_assert(git_oid_cmp(&ids[j], git_commit_parent_oid(commit, k)) != 0);
+
+		git_commit_free(commit);
+	}
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static void check_same_walk(
+	const char *push, const char *hide, unsigned int sorting)
+{
+	git_revwalk *walk;
+	git_oid plain[MAX_WALK], with_graph[MAX_WALK];
+	size_t n_plain, n_graph;
+	git_oid id;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, sorting);
+	cl_git_pass(git_revwalk_push_glob(walk, push));
+	if (hide) {
+		cl_git_pass(git_oid_fromstr(&id, hide));
+		cl_git_pass(git_revwalk_hide(walk, &id));
+	}
+	n_plain = topo_walk(plain, walk);
+	git_revwalk_free(walk);
+
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, sorting);
+	cl_git_pass(git_revwalk_push_glob(walk, push));
+	if (hide)
+		cl_git_pass(git_revwalk_hide(walk, &id));
+	n_graph = topo_walk(with_graph, walk);
+	git_revwalk_free(walk);
+
+	cl_assert(n_plain > 0 && n_plain < MAX_WALK);
+	cl_assert_equal_i(n_plain, n_graph);
+
+	if (!(sorting & GIT_SORT_REVERSE)) {
+		check_topological(plain, n_plain);
+		check_topological(with_graph, n_graph);
+	}
+
+	qsort(plain, n_plain, sizeof(git_oid), oid_cmp);
+	qsort(with_graph, n_graph, sizeof(git_oid), oid_cmp);
+	cl_assert(memcmp(plain, with_graph, n_plain * sizeof(git_oid)) == 0);
+
+	cl_must_pass(p_unlink(_graph_path.ptr));
+}
+
+void test_revwalk_commitgraph__topological_walks(void)
+{
+	check_same_walk("heads", NULL, GIT_SORT_TOPOLOGICAL);
+	check_same_walk("heads", NULL, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+	check_same_walk("heads", NULL, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+}
+
+void test_revwalk_commitgraph__topological_walks_with_hidden_commits(void)
+{
+	check_same_walk("heads", "c47800c7266a2be04c571c04d5a6614691ea99bd",
+		GIT_SORT_TOPOLOGICAL);
+	check_same_walk("heads", "9fd738e8f7967c078dceed8190330fc8648ee56a",
+		GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+}
+
+void test_revwalk_commitgraph__stale_commits_are_walked_too(void)
+{
+	git_commit *parent;
+	git_tree *tree;
+	git_signature *s;
+	git_revwalk *walk;
+	git_oid id, tip, ids[MAX_WALK];
+	size_t n;
+
+	/* a graph that does not know about the newest commit */
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_commit_lookup(&parent, _repo, &id));
+	cl_git_pass(git_commit_tree(&tree, parent));
+	cl_git_pass(git_signature_now(&s, "alice", "alice@example.com"));
+	cl_git_pass(git_commit_create(&tip, _repo, NULL, s, s,
+		NULL, "not in the graph", tree, 1, (const git_commit **)&parent));
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL);
+	cl_git_pass(git_revwalk_push(walk, &tip));
+	n = topo_walk(ids, walk);
+	git_revwalk_free(walk);
+
+	cl_assert(git_oid_cmp(&ids[0], &tip) == 0);
+	cl_assert(git_oid_cmp(&ids[1], &id) == 0);
+	check_topological(ids, n);
+
+	git_signature_free(s);
+	git_tree_free(tree);
+	git_commit_free(parent);
+}
+
+void test_revwalk_commitgraph__walks_share_the_graph_until_it_changes(void)
+{
+	git_commit_graph_file *graph;
+	git_revwalk *one, *two;
+	git_oid id;
+	int count = 0;
+
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+
+	cl_git_pass(git_revwalk_new(&one, _repo));
+	graph = _repo->_commit_graph;
+	cl_assert(graph != NULL);
+
+	cl_git_pass(git_revwalk_new(&two, _repo));
+	cl_assert(_repo->_commit_graph == graph);
+	git_revwalk_free(two);
+
+	/* a rewritten graph is opened again, and the old one kept for `one` */
+	cl_git_pass(git_commit_graph_write(_repo, GIT_COMMIT_GRAPH_CHANGED_PATHS));
+	cl_git_pass(git_revwalk_new(&two, _repo));
+	cl_assert(_repo->_commit_graph != NULL);
+	cl_assert(_repo->_commit_graph != graph);
+	git_revwalk_free(two);
+
+	cl_git_pass(git_revwalk_push_head(one));
+	while (git_revwalk_next(&id, one) == 0)
+		count++;
+	cl_assert(count > 0);
+	git_revwalk_free(one);
+
+	p_unlink(_graph_path.ptr);
+	cl_git_pass(git_revwalk_new(&two, _repo));
+	cl_assert(_repo->_commit_graph == NULL);
+	git_revwalk_free(two);
+}
+
+void test_revwalk_commitgraph__corrupt_graphs_are_ignored(void)
+{
+	git_commit_graph_file *graph;
+	git_revwalk *walk;
+	git_oid id;
+	int count = 0;
+
+	cl_git_pass(git_futils_mkpath2file(_graph_path.ptr, 0777));
+	cl_git_mkfile(_graph_path.ptr, "CGPH this is not a commit-graph");
+
+	cl_git_fail(git_commit_graph_open(&graph, _graph_path.ptr));
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL);
+	cl_git_pass(git_revwalk_push_head(walk));
+
+	while (git_revwalk_next(&id, walk) == 0)
+		count++;
+	cl_assert(count > 0);
+
+	git_revwalk_free(walk);
+}
+
+static void merge_bases(git_oid out[][2], const char *pairs[][2], size_t n)
+{
+	git_oid one, two;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		cl_git_pass(git_oid_fromstr(&one, pairs[i][0]));
+		cl_git_pass(git_oid_fromstr(&two, pairs[i][1]));
+		cl_git_pass(git_merge_base(&out[i][0], _repo, &one, &two));
+		cl_git_pass(git_merge_base(&out[i][1], _repo, &two, &one));
+	}
+}
+
+void test_revwalk_commitgraph__merge_bases(void)
+{
+	static const char *pairs[][2] = {
+		{ "c47800c7266a2be04c571c04d5a6614691ea99bd", "9fd738e8f7967c078dceed8190330fc8648ee56a" },
+		{ "763d71aadf09a7951596c9746c024e7eece7c7af", "a65fedf39aefe402d3bb6e24df4d4f5fe4547750" },
+		{ "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", "4a202b346bb0fb0db7eff3cffeb3c70babbd2045" },
+	};
+	static const char *criss_cross[][2] = {
+		{ "a4a7dce85cf63874e984719f4fdd239f5145052f", "be3563ae3f795b2b4353bcce3a527ad0a4f7f644" },
+	};
+	git_oid plain[ARRAY_SIZE(pairs)][2], with_graph[ARRAY_SIZE(pairs)][2];
+	git_oid bases[1][2], base1, base2;
+
+	merge_bases(plain, pairs, ARRAY_SIZE(pairs));
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+	merge_bases(with_graph, pairs, ARRAY_SIZE(pairs));
+
+	cl_assert(memcmp(plain, with_graph, sizeof(plain)) == 0);
+
+	/* with two merge bases, either of them will do */
+	cl_git_pass(git_oid_fromstr(&base1, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_oid_fromstr(&base2, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+
+	merge_bases(bases, criss_cross, 1);
+	cl_assert(!git_oid_cmp(&bases[0][0], &base1) || !git_oid_cmp(&bases[0][0], &base2));
+	cl_assert(!git_oid_cmp(&bases[0][1], &base1) || !git_oid_cmp(&bases[0][1], &base2));
+}
+
+static size_t every_merge_base(int *errors, git_oid *bases, const git_oid *ids, size_t n)
+{
+	size_t i, j, k = 0;
+
+	for (i = 0; i < n; ++i)
+		for (j = 0; j < n; ++j, ++k) {
+			errors[k] = git_merge_base(&bases[k], _repo, &ids[i], &ids[j]);
+			if (errors[k] == GIT_ENOTFOUND)
+				memset(&bases[k], 0x0, sizeof(git_oid));
+			else
+				cl_git_pass(errors[k]);
+		}
+
+	return k;
+}
+
+void test_revwalk_commitgraph__merge_bases_of_every_pair(void)
+{
+	git_revwalk *walk;
+	git_oid ids[MAX_WALK];
+	git_oid *plain, *with_graph;
+	int *plain_errors, *graph_errors;
+	size_t n, pairs;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+	n = topo_walk(ids, walk);
+	git_revwalk_free(walk);
+
+	plain = git__calloc(n * n, sizeof(git_oid));
+	with_graph = git__calloc(n * n, sizeof(git_oid));
+	plain_errors = git__calloc(n * n, sizeof(int));
+	graph_errors = git__calloc(n * n, sizeof(int));
+	cl_assert(plain && with_graph && plain_errors && graph_errors);
+
+	/* the walks that stop early have to find the same bases */
+	pairs = every_merge_base(plain_errors, plain, ids, n);
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+	cl_assert_equal_i(pairs, every_merge_base(graph_errors, with_graph, ids, n));
+
+	cl_assert(memcmp(plain_errors, graph_errors, pairs * sizeof(int)) == 0);
+	cl_assert(memcmp(plain, with_graph, pairs * sizeof(git_oid)) == 0);
+
+	git__free(plain);
+	git__free(with_graph);
+	git__free(plain_errors);
+	git__free(graph_errors);
+}
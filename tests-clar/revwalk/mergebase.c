@@ -53,6 +53,22 @@ void test_revwalk_mergebase__merged_branch(void)
 	cl_assert(git_oid_cmp(&result, &expected) == 0);
 }
 
+void test_revwalk_mergebase__criss_cross_gives_the_newest_base(void)
+{
+	git_oid result, one, two, expected;
+
+	/* both c47800c and 9fd738e are merge bases, like `git merge-base --all` says */
+	cl_git_pass(git_oid_fromstr(&one, "a4a7dce85cf63874e984719f4fdd239f5145052f"));
+	cl_git_pass(git_oid_fromstr(&two, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_oid_fromstr(&expected, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+
+	cl_git_pass(git_merge_base(&result, _repo, &one, &two));
+	cl_assert(git_oid_cmp(&result, &expected) == 0);
+
+	cl_git_pass(git_merge_base(&result, _repo, &two, &one));
+	cl_assert(git_oid_cmp(&result, &expected) == 0);
+}
+
 void test_revwalk_mergebase__no_common_ancestor_returns_ENOTFOUND(void)
 {
 	git_oid result, one, two;
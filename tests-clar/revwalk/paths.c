@@ -0,0 +1,251 @@
+#include "clar_libgit2.h"
+#include "bloom.h"
+#include "buffer.h"
+#include "commit_graph.h"
+
+static git_repository *_repo;
+
+void test_revwalk_paths__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_revwalk_paths__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+#define MAX_WALK 64
+
+static const char *paths[] = {
+	"README",
+	"new.txt",
+	"branch_file.txt",
+	"readme.txt",
+	"ab",
+	"ab/de",
+	"/ab/de/fgh/1.txt",
+	"ab/c/",
+	"ab/4.txt/not_below_a_file",
+	"does_not_exist",
+};
+
+static void entry_at(git_tree_entry **entry, const git_oid *commit_id, const char *path)
+{
+	git_commit *commit;
+	git_tree *tree;
+	int error;
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, commit_id));
+	cl_git_pass(git_commit_tree(&tree, commit));
+
+	while (*path == '/')
+		path++;
+
+	error = git_tree_entry_bypath(entry, tree, path);
+	if (error == GIT_ENOTFOUND)
+		*entry = NULL;
+	else
+		cl_git_pass(error);
+
+	git_tree_free(tree);
+	git_commit_free(commit);
+}
+
+static int same_entry(const git_tree_entry *a, const git_tree_entry *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return git_tree_entry_filemode(a) == git_tree_entry_filemode(b) &&
+		git_oid_cmp(git_tree_entry_id(a), git_tree_entry_id(b)) == 0;
+}
+
+/* the slow way: look the path up in every commit and its parents */
+static int changes_path(const git_oid *id, const char *path)
+{
+	git_commit *commit;
+	git_tree_entry *entry, *parent_entry;
+	unsigned int i;
+	int changed = 1;
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, id));
+	entry_at(&entry, id, path);
+
+	if (git_commit_parentcount(commit) == 0)
+		changed = (entry != NULL);
+
+	for (i = 0; i < git_commit_parentcount(commit); ++i) {
+		entry_at(&parent_entry, git_commit_parent_oid(commit, i), path);
+		if (same_entry(entry, parent_entry))
+			changed = 0;
+		git_tree_entry_free(parent_entry);
+	}
+
+	git_tree_entry_free(entry);
+	git_commit_free(commit);
+	return changed;
+}
+
+static size_t walk_paths(git_oid *out, const char *path)
+{
+	git_revwalk *walk;
+	char *strings[1];
+	git_strarray array;
+	size_t n = 0;
+
+	strings[0] = (char *)path;
+	array.strings = strings;
+	array.count = 1;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_set_paths(walk, &array));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+
+	while (n < MAX_WALK && git_revwalk_next(&out[n], walk) == 0)
+		n++;
+
+	git_revwalk_free(walk);
+	return n;
+}
+
+static void check_paths(void)
+{
+	git_revwalk *walk;
+	git_oid all[MAX_WALK], expected[MAX_WALK], limited[MAX_WALK];
+	size_t n_all = 0, n_expected, n_limited, i, p;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+	while (n_all < MAX_WALK && git_revwalk_next(&all[n_all], walk) == 0)
+		n_all++;
+	git_revwalk_free(walk);
+
+	for (p = 0; p < ARRAY_SIZE(paths); ++p) {
+		n_expected = 0;
+		for (i = 0; i < n_all; ++i)
+			if (changes_path(&all[i], paths[p]))
+				git_oid_cpy(&expected[n_expected++], &all[i]);
+
+		n_limited = walk_paths(limited, paths[p]);
+
+		cl_assert_equal_i(n_expected, n_limited);
+		cl_assert(memcmp(expected, limited, n_expected * sizeof(git_oid)) == 0);
+	}
+}
+
+void test_revwalk_paths__only_commits_changing_the_paths(void)
+{
+	git_oid ids[MAX_WALK];
+
+	check_paths();
+
+	/* the merges took their README from one side */
+	cl_assert_equal_i(2, walk_paths(ids, "README"));
+	cl_assert_equal_i(0, walk_paths(ids, "does_not_exist"));
+}
+
+void test_revwalk_paths__with_bloom_filters(void)
+{
+	cl_git_pass(git_commit_graph_write(_repo, GIT_COMMIT_GRAPH_CHANGED_PATHS));
+	check_paths();
+}
+
+void test_revwalk_paths__several_paths(void)
+{
+	git_revwalk *walk;
+	char *strings[] = { "README", "new.txt" };
+	git_strarray array;
+	git_oid id;
+	int count = 0;
+
+	array.strings = strings;
+	array.count = 2;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_set_paths(walk, &array));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+	while (git_revwalk_next(&id, walk) == 0)
+		count++;
+
+	/* what `git log --branches -- README new.txt` shows */
+	cl_assert_equal_i(5, count);
+
+	/* and all of them again without the paths */
+	cl_git_pass(git_revwalk_set_paths(walk, NULL));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+	count = 0;
+	while (git_revwalk_next(&id, walk) == 0)
+		count++;
+	cl_assert(count > 5);
+
+	git_revwalk_free(walk);
+}
+
+void test_revwalk_paths__invalid_paths(void)
+{
+	git_revwalk *walk;
+	char *strings[1];
+	git_strarray array;
+
+	array.strings = strings;
+	array.count = 1;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	strings[0] = "";
+	cl_git_fail(git_revwalk_set_paths(walk, &array));
+	strings[0] = "ab/../README";
+	cl_git_fail(git_revwalk_set_paths(walk, &array));
+	strings[0] = "ab//de";
+	cl_git_fail(git_revwalk_set_paths(walk, &array));
+
+	git_revwalk_free(walk);
+}
+
+void test_revwalk_paths__bloom_filters_of_the_commit_graph(void)
+{
+	git_commit_graph_file *graph;
+	git_bloom_filter filter;
+	git_bloom_key key;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_commit_graph_write(_repo, GIT_COMMIT_GRAPH_CHANGED_PATHS));
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(_repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_open(&graph, path.ptr));
+
+	/* "Add some files into subdirectories" */
+	cl_git_pass(git_oid_fromstr(&id, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+	cl_git_pass(git_commit_graph_bloom_find(&filter, graph, &id));
+
+	/* 4 files and 4 directories */
+	cl_assert_equal_i((8 * GIT_BLOOM_BITS_PER_ENTRY + 7) / 8, filter.len);
+
+	git_bloom_key_init(&key, "ab/de/fgh", strlen("ab/de/fgh"));
+	cl_assert(git_bloom_filter_contains(&filter, &key));
+	git_bloom_key_init(&key, "ab/c/3.txt", strlen("ab/c/3.txt"));
+	cl_assert(git_bloom_filter_contains(&filter, &key));
+
+	git_commit_graph_free(graph);
+
+	/* a commit-graph without filters has none to give */
+	cl_git_pass(git_commit_graph_write(_repo, 0));
+	cl_git_pass(git_commit_graph_open(&graph, path.ptr));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_bloom_find(&filter, graph, &id));
+	git_commit_graph_free(graph);
+
+	git_buf_free(&path);
+}
+
+void test_revwalk_paths__murmur3(void)
+{
+	/* the values git's own tests check for */
+	cl_assert_equal_i(0x00000000, git_bloom_murmur3(0, "", 0));
+	cl_assert_equal_i(0x627b0c2c, git_bloom_murmur3(0, "Hello world!", 12));
+	cl_assert_equal_i(0x2e4ff723, git_bloom_murmur3(0,
+		"The quick brown fox jumps over the lazy dog", 43));
+}